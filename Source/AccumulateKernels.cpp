@@ -0,0 +1,846 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "AccumulateKernels.h"
+#include <algorithm>
+#include <cmath>
+
+#if JUCE_INTEL
+#include <immintrin.h>
+#elif JUCE_ARM && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TRIGGERED_AVG_NEON 1
+#if defined(__aarch64__)
+#define TRIGGERED_AVG_NEON_DOUBLE 1 // double vectors only exist on 64-bit ARM
+#endif
+#endif
+
+// Kernels for wider instruction sets than the build targets are compiled for their
+// instruction set on their own and only called once the CPU was checked
+#if JUCE_GCC || JUCE_CLANG
+#define TRIGGERED_AVG_TARGET(instructionSet) __attribute__ ((target (instructionSet)))
+#else
+#define TRIGGERED_AVG_TARGET(instructionSet)
+#endif
+
+using namespace TriggeredAverage;
+
+namespace
+{
+using AccumulateFunction = void (*) (float*, float*, const float*, int);
+using CompensatedFunction = void (*) (double*, double*, double*, double*, const float*, int);
+using WelfordFunction = void (*) (double*, double*, const float*, double, int);
+using ErrorBandFunction = void (*) (float*, float*, const float*, const float*, float, int);
+
+void accumulateScalar (float* sums, float* sumSquares, const float* data, int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+    {
+        const float sample = data[i];
+        sums[i] += sample;
+        sumSquares[i] += sample * sample;
+    }
+}
+
+void computeErrorBandScalar (float* lower,
+                             float* upper,
+                             const float* average,
+                             const float* variance,
+                             float scale,
+                             int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+    {
+        const float halfWidth = scale * std::sqrt (std::max (0.0f, variance[i]));
+        lower[i] = average[i] - halfWidth;
+        upper[i] = average[i] + halfWidth;
+    }
+}
+
+#if TRIGGERED_AVG_NEON
+void accumulateNeon (float* sums, float* sumSquares, const float* data, int numSamples)
+{
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const float32x4_t samples = vld1q_f32 (data + i);
+        vst1q_f32 (sums + i, vaddq_f32 (vld1q_f32 (sums + i), samples));
+        vst1q_f32 (sumSquares + i, vmlaq_f32 (vld1q_f32 (sumSquares + i), samples, samples));
+    }
+    accumulateScalar (sums + i, sumSquares + i, data + i, numSamples - i);
+}
+
+void computeErrorBandNeon (float* lower,
+                           float* upper,
+                           const float* average,
+                           const float* variance,
+                           float scale,
+                           int numSamples)
+{
+    const float32x4_t scales = vdupq_n_f32 (scale);
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const float32x4_t variances = vld1q_f32 (variance + i);
+
+        // The estimate has 8 bits, so it takes two steps to reach float precision
+        float32x4_t r = vrsqrteq_f32 (variances);
+        r = vmulq_f32 (r, vrsqrtsq_f32 (vmulq_f32 (variances, r), r));
+        r = vmulq_f32 (r, vrsqrtsq_f32 (vmulq_f32 (variances, r), r));
+
+        // rsqrt (0) is infinite, so the band is masked to 0 where the variance is not positive
+        const uint32x4_t positive = vcgtq_f32 (variances, vdupq_n_f32 (0.0f));
+        const float32x4_t halfWidth = vreinterpretq_f32_u32 (vandq_u32 (
+            positive, vreinterpretq_u32_f32 (vmulq_f32 (scales, vmulq_f32 (variances, r)))));
+
+        const float32x4_t averages = vld1q_f32 (average + i);
+        vst1q_f32 (lower + i, vsubq_f32 (averages, halfWidth));
+        vst1q_f32 (upper + i, vaddq_f32 (averages, halfWidth));
+    }
+    computeErrorBandScalar (
+        lower + i, upper + i, average + i, variance + i, scale, numSamples - i);
+}
+#endif
+
+void accumulateCompensatedScalar (double* sums,
+                                  double* sumCompensations,
+                                  double* sumSquares,
+                                  double* sumSquareCompensations,
+                                  const float* data,
+                                  int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+    {
+        const double sample = data[i];
+
+        const double y = sample - sumCompensations[i];
+        const double t = sums[i] + y;
+        sumCompensations[i] = (t - sums[i]) - y;
+        sums[i] = t;
+
+        // the square of a float is exact in double
+        const double ySquare = sample * sample - sumSquareCompensations[i];
+        const double tSquare = sumSquares[i] + ySquare;
+        sumSquareCompensations[i] = (tSquare - sumSquares[i]) - ySquare;
+        sumSquares[i] = tSquare;
+    }
+}
+
+void accumulateWelfordScalar (double* means,
+                              double* squaredDeviations,
+                              const float* data,
+                              double weight,
+                              int numSamples)
+{
+    const double inverseCount = 1.0 / weight;
+    for (int i = 0; i < numSamples; ++i)
+    {
+        const double sample = data[i];
+        const double delta = sample - means[i];
+        means[i] += delta * inverseCount;
+        squaredDeviations[i] += delta * (sample - means[i]);
+    }
+}
+
+#if TRIGGERED_AVG_NEON_DOUBLE
+void accumulateCompensatedNeon (double* sums,
+                                double* sumCompensations,
+                                double* sumSquares,
+                                double* sumSquareCompensations,
+                                const float* data,
+                                int numSamples)
+{
+    int i = 0;
+    for (; i + 2 <= numSamples; i += 2)
+    {
+        const float64x2_t samples = vcvt_f64_f32 (vld1_f32 (data + i));
+
+        const float64x2_t sum = vld1q_f64 (sums + i);
+        const float64x2_t y = vsubq_f64 (samples, vld1q_f64 (sumCompensations + i));
+        const float64x2_t t = vaddq_f64 (sum, y);
+        vst1q_f64 (sumCompensations + i, vsubq_f64 (vsubq_f64 (t, sum), y));
+        vst1q_f64 (sums + i, t);
+
+        const float64x2_t sumSquare = vld1q_f64 (sumSquares + i);
+        const float64x2_t ySquare =
+            vsubq_f64 (vmulq_f64 (samples, samples), vld1q_f64 (sumSquareCompensations + i));
+        const float64x2_t tSquare = vaddq_f64 (sumSquare, ySquare);
+        vst1q_f64 (sumSquareCompensations + i, vsubq_f64 (vsubq_f64 (tSquare, sumSquare), ySquare));
+        vst1q_f64 (sumSquares + i, tSquare);
+    }
+    accumulateCompensatedScalar (sums + i,
+                                 sumCompensations + i,
+                                 sumSquares + i,
+                                 sumSquareCompensations + i,
+                                 data + i,
+                                 numSamples - i);
+}
+
+void accumulateWelfordNeon (double* means,
+                            double* squaredDeviations,
+                            const float* data,
+                            double weight,
+                            int numSamples)
+{
+    const float64x2_t inverseCount = vdupq_n_f64 (1.0 / weight);
+    int i = 0;
+    for (; i + 2 <= numSamples; i += 2)
+    {
+        const float64x2_t samples = vcvt_f64_f32 (vld1_f32 (data + i));
+        const float64x2_t delta = vsubq_f64 (samples, vld1q_f64 (means + i));
+        const float64x2_t mean = vfmaq_f64 (vld1q_f64 (means + i), delta, inverseCount);
+        vst1q_f64 (means + i, mean);
+        vst1q_f64 (squaredDeviations + i,
+                   vfmaq_f64 (vld1q_f64 (squaredDeviations + i), delta, vsubq_f64 (samples, mean)));
+    }
+    accumulateWelfordScalar (
+        means + i, squaredDeviations + i, data + i, weight, numSamples - i);
+}
+#endif
+
+#if JUCE_INTEL
+TRIGGERED_AVG_TARGET ("sse2")
+void accumulateSse2 (float* sums, float* sumSquares, const float* data, int numSamples)
+{
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const __m128 samples = _mm_loadu_ps (data + i);
+        _mm_storeu_ps (sums + i, _mm_add_ps (_mm_loadu_ps (sums + i), samples));
+        _mm_storeu_ps (sumSquares + i,
+                       _mm_add_ps (_mm_loadu_ps (sumSquares + i), _mm_mul_ps (samples, samples)));
+    }
+    accumulateScalar (sums + i, sumSquares + i, data + i, numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx2,fma")
+void accumulateAvx2 (float* sums, float* sumSquares, const float* data, int numSamples)
+{
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m256 samples = _mm256_loadu_ps (data + i);
+        _mm256_storeu_ps (sums + i, _mm256_add_ps (_mm256_loadu_ps (sums + i), samples));
+        _mm256_storeu_ps (sumSquares + i,
+                          _mm256_fmadd_ps (samples, samples, _mm256_loadu_ps (sumSquares + i)));
+    }
+    accumulateScalar (sums + i, sumSquares + i, data + i, numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx512f")
+void accumulateAvx512 (float* sums, float* sumSquares, const float* data, int numSamples)
+{
+    for (int i = 0; i < numSamples; i += 16)
+    {
+        // The last block masks out the samples past the end instead of a scalar tail
+        const int remaining = numSamples - i;
+        const __mmask16 mask =
+            remaining >= 16 ? __mmask16 (0xffff) : __mmask16 ((1u << remaining) - 1u);
+
+        const __m512 samples = _mm512_maskz_loadu_ps (mask, data + i);
+        _mm512_mask_storeu_ps (
+            sums + i, mask, _mm512_add_ps (_mm512_maskz_loadu_ps (mask, sums + i), samples));
+        _mm512_mask_storeu_ps (
+            sumSquares + i,
+            mask,
+            _mm512_fmadd_ps (samples, samples, _mm512_maskz_loadu_ps (mask, sumSquares + i)));
+    }
+}
+
+TRIGGERED_AVG_TARGET ("sse2")
+void computeErrorBandSse2 (float* lower,
+                           float* upper,
+                           const float* average,
+                           const float* variance,
+                           float scale,
+                           int numSamples)
+{
+    const __m128 halfScale = _mm_set1_ps (0.5f * scale);
+    const __m128 three = _mm_set1_ps (3.0f);
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const __m128 variances = _mm_loadu_ps (variance + i);
+
+        // scale * sqrt (v) = scale * v * r, with r = rsqrt (v) refined by a Newton step:
+        // r * (3 - v * r * r) / 2
+        const __m128 r = _mm_rsqrt_ps (variances);
+        const __m128 vr = _mm_mul_ps (variances, r);
+        __m128 halfWidth =
+            _mm_mul_ps (_mm_mul_ps (halfScale, vr), _mm_sub_ps (three, _mm_mul_ps (vr, r)));
+
+        // rsqrt (0) is infinite, so the band is masked to 0 where the variance is not positive
+        halfWidth = _mm_and_ps (halfWidth, _mm_cmpgt_ps (variances, _mm_setzero_ps()));
+
+        const __m128 averages = _mm_loadu_ps (average + i);
+        _mm_storeu_ps (lower + i, _mm_sub_ps (averages, halfWidth));
+        _mm_storeu_ps (upper + i, _mm_add_ps (averages, halfWidth));
+    }
+    computeErrorBandScalar (
+        lower + i, upper + i, average + i, variance + i, scale, numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx2,fma")
+void computeErrorBandAvx2 (float* lower,
+                           float* upper,
+                           const float* average,
+                           const float* variance,
+                           float scale,
+                           int numSamples)
+{
+    const __m256 halfScale = _mm256_set1_ps (0.5f * scale);
+    const __m256 three = _mm256_set1_ps (3.0f);
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m256 variances = _mm256_loadu_ps (variance + i);
+        const __m256 r = _mm256_rsqrt_ps (variances);
+        const __m256 vr = _mm256_mul_ps (variances, r);
+        __m256 halfWidth =
+            _mm256_mul_ps (_mm256_mul_ps (halfScale, vr), _mm256_fnmadd_ps (vr, r, three));
+        halfWidth = _mm256_and_ps (
+            halfWidth, _mm256_cmp_ps (variances, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+        const __m256 averages = _mm256_loadu_ps (average + i);
+        _mm256_storeu_ps (lower + i, _mm256_sub_ps (averages, halfWidth));
+        _mm256_storeu_ps (upper + i, _mm256_add_ps (averages, halfWidth));
+    }
+    computeErrorBandScalar (
+        lower + i, upper + i, average + i, variance + i, scale, numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx512f")
+void computeErrorBandAvx512 (float* lower,
+                             float* upper,
+                             const float* average,
+                             const float* variance,
+                             float scale,
+                             int numSamples)
+{
+    const __m512 halfScale = _mm512_set1_ps (0.5f * scale);
+    const __m512 three = _mm512_set1_ps (3.0f);
+    for (int i = 0; i < numSamples; i += 16)
+    {
+        const int remaining = numSamples - i;
+        const __mmask16 mask =
+            remaining >= 16 ? __mmask16 (0xffff) : __mmask16 ((1u << remaining) - 1u);
+
+        // The estimate has 14 bits instead of 12, the Newton step brings both to float
+        // precision
+        const __m512 variances = _mm512_maskz_loadu_ps (mask, variance + i);
+        const __m512 r = _mm512_rsqrt14_ps (variances);
+        const __m512 vr = _mm512_mul_ps (variances, r);
+        const __mmask16 positive =
+            _mm512_cmp_ps_mask (variances, _mm512_setzero_ps(), _CMP_GT_OQ);
+        const __m512 halfWidth = _mm512_maskz_mul_ps (
+            positive, _mm512_mul_ps (halfScale, vr), _mm512_fnmadd_ps (vr, r, three));
+
+        const __m512 averages = _mm512_maskz_loadu_ps (mask, average + i);
+        _mm512_mask_storeu_ps (lower + i, mask, _mm512_sub_ps (averages, halfWidth));
+        _mm512_mask_storeu_ps (upper + i, mask, _mm512_add_ps (averages, halfWidth));
+    }
+}
+
+TRIGGERED_AVG_TARGET ("sse2")
+void accumulateCompensatedSse2 (double* sums,
+                                double* sumCompensations,
+                                double* sumSquares,
+                                double* sumSquareCompensations,
+                                const float* data,
+                                int numSamples)
+{
+    int i = 0;
+    for (; i + 2 <= numSamples; i += 2)
+    {
+        const __m128d samples = _mm_cvtps_pd (
+            _mm_castsi128_ps (_mm_loadl_epi64 (reinterpret_cast<const __m128i*> (data + i))));
+
+        const __m128d sum = _mm_loadu_pd (sums + i);
+        const __m128d y = _mm_sub_pd (samples, _mm_loadu_pd (sumCompensations + i));
+        const __m128d t = _mm_add_pd (sum, y);
+        _mm_storeu_pd (sumCompensations + i, _mm_sub_pd (_mm_sub_pd (t, sum), y));
+        _mm_storeu_pd (sums + i, t);
+
+        const __m128d sumSquare = _mm_loadu_pd (sumSquares + i);
+        const __m128d ySquare =
+            _mm_sub_pd (_mm_mul_pd (samples, samples), _mm_loadu_pd (sumSquareCompensations + i));
+        const __m128d tSquare = _mm_add_pd (sumSquare, ySquare);
+        _mm_storeu_pd (sumSquareCompensations + i,
+                       _mm_sub_pd (_mm_sub_pd (tSquare, sumSquare), ySquare));
+        _mm_storeu_pd (sumSquares + i, tSquare);
+    }
+    accumulateCompensatedScalar (sums + i,
+                                 sumCompensations + i,
+                                 sumSquares + i,
+                                 sumSquareCompensations + i,
+                                 data + i,
+                                 numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("sse2")
+void accumulateWelfordSse2 (double* means,
+                            double* squaredDeviations,
+                            const float* data,
+                            double weight,
+                            int numSamples)
+{
+    const __m128d inverseCount = _mm_set1_pd (1.0 / weight);
+    int i = 0;
+    for (; i + 2 <= numSamples; i += 2)
+    {
+        const __m128d samples = _mm_cvtps_pd (
+            _mm_castsi128_ps (_mm_loadl_epi64 (reinterpret_cast<const __m128i*> (data + i))));
+        const __m128d delta = _mm_sub_pd (samples, _mm_loadu_pd (means + i));
+        const __m128d mean =
+            _mm_add_pd (_mm_loadu_pd (means + i), _mm_mul_pd (delta, inverseCount));
+        _mm_storeu_pd (means + i, mean);
+        _mm_storeu_pd (squaredDeviations + i,
+                       _mm_add_pd (_mm_loadu_pd (squaredDeviations + i),
+                                   _mm_mul_pd (delta, _mm_sub_pd (samples, mean))));
+    }
+    accumulateWelfordScalar (
+        means + i, squaredDeviations + i, data + i, weight, numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx2,fma")
+void accumulateCompensatedAvx2 (double* sums,
+                                double* sumCompensations,
+                                double* sumSquares,
+                                double* sumSquareCompensations,
+                                const float* data,
+                                int numSamples)
+{
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const __m256d samples = _mm256_cvtps_pd (_mm_loadu_ps (data + i));
+
+        const __m256d sum = _mm256_loadu_pd (sums + i);
+        const __m256d y = _mm256_sub_pd (samples, _mm256_loadu_pd (sumCompensations + i));
+        const __m256d t = _mm256_add_pd (sum, y);
+        _mm256_storeu_pd (sumCompensations + i, _mm256_sub_pd (_mm256_sub_pd (t, sum), y));
+        _mm256_storeu_pd (sums + i, t);
+
+        const __m256d sumSquare = _mm256_loadu_pd (sumSquares + i);
+        const __m256d ySquare =
+            _mm256_fmsub_pd (samples, samples, _mm256_loadu_pd (sumSquareCompensations + i));
+        const __m256d tSquare = _mm256_add_pd (sumSquare, ySquare);
+        _mm256_storeu_pd (sumSquareCompensations + i,
+                          _mm256_sub_pd (_mm256_sub_pd (tSquare, sumSquare), ySquare));
+        _mm256_storeu_pd (sumSquares + i, tSquare);
+    }
+    accumulateCompensatedScalar (sums + i,
+                                 sumCompensations + i,
+                                 sumSquares + i,
+                                 sumSquareCompensations + i,
+                                 data + i,
+                                 numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx2,fma")
+void accumulateWelfordAvx2 (double* means,
+                            double* squaredDeviations,
+                            const float* data,
+                            double weight,
+                            int numSamples)
+{
+    const __m256d inverseCount = _mm256_set1_pd (1.0 / weight);
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4)
+    {
+        const __m256d samples = _mm256_cvtps_pd (_mm_loadu_ps (data + i));
+        const __m256d delta = _mm256_sub_pd (samples, _mm256_loadu_pd (means + i));
+        const __m256d mean = _mm256_fmadd_pd (delta, inverseCount, _mm256_loadu_pd (means + i));
+        _mm256_storeu_pd (means + i, mean);
+        _mm256_storeu_pd (squaredDeviations + i,
+                          _mm256_fmadd_pd (delta,
+                                           _mm256_sub_pd (samples, mean),
+                                           _mm256_loadu_pd (squaredDeviations + i)));
+    }
+    accumulateWelfordScalar (
+        means + i, squaredDeviations + i, data + i, weight, numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx512f")
+void accumulateCompensatedAvx512 (double* sums,
+                                  double* sumCompensations,
+                                  double* sumSquares,
+                                  double* sumSquareCompensations,
+                                  const float* data,
+                                  int numSamples)
+{
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m512d samples = _mm512_cvtps_pd (_mm256_loadu_ps (data + i));
+
+        const __m512d sum = _mm512_loadu_pd (sums + i);
+        const __m512d y = _mm512_sub_pd (samples, _mm512_loadu_pd (sumCompensations + i));
+        const __m512d t = _mm512_add_pd (sum, y);
+        _mm512_storeu_pd (sumCompensations + i, _mm512_sub_pd (_mm512_sub_pd (t, sum), y));
+        _mm512_storeu_pd (sums + i, t);
+
+        const __m512d sumSquare = _mm512_loadu_pd (sumSquares + i);
+        const __m512d ySquare =
+            _mm512_fmsub_pd (samples, samples, _mm512_loadu_pd (sumSquareCompensations + i));
+        const __m512d tSquare = _mm512_add_pd (sumSquare, ySquare);
+        _mm512_storeu_pd (sumSquareCompensations + i,
+                          _mm512_sub_pd (_mm512_sub_pd (tSquare, sumSquare), ySquare));
+        _mm512_storeu_pd (sumSquares + i, tSquare);
+    }
+
+    // Masked loads of fewer floats need AVX-512VL, so the tail is scalar
+    accumulateCompensatedScalar (sums + i,
+                                 sumCompensations + i,
+                                 sumSquares + i,
+                                 sumSquareCompensations + i,
+                                 data + i,
+                                 numSamples - i);
+}
+
+TRIGGERED_AVG_TARGET ("avx512f")
+void accumulateWelfordAvx512 (double* means,
+                              double* squaredDeviations,
+                              const float* data,
+                              double weight,
+                              int numSamples)
+{
+    const __m512d inverseCount = _mm512_set1_pd (1.0 / weight);
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m512d samples = _mm512_cvtps_pd (_mm256_loadu_ps (data + i));
+        const __m512d delta = _mm512_sub_pd (samples, _mm512_loadu_pd (means + i));
+        const __m512d mean = _mm512_fmadd_pd (delta, inverseCount, _mm512_loadu_pd (means + i));
+        _mm512_storeu_pd (means + i, mean);
+        _mm512_storeu_pd (squaredDeviations + i,
+                          _mm512_fmadd_pd (delta,
+                                           _mm512_sub_pd (samples, mean),
+                                           _mm512_loadu_pd (squaredDeviations + i)));
+    }
+    accumulateWelfordScalar (
+        means + i, squaredDeviations + i, data + i, weight, numSamples - i);
+}
+#endif
+
+AccumulateFunction getAccumulateFunction (SimdLevel level)
+{
+    switch (level)
+    {
+#if JUCE_INTEL
+        case SimdLevel::Avx512:
+            return accumulateAvx512;
+        case SimdLevel::Avx2:
+            return accumulateAvx2;
+        case SimdLevel::Sse2:
+            return accumulateSse2;
+#endif
+#if TRIGGERED_AVG_NEON
+        case SimdLevel::Neon:
+            return accumulateNeon;
+#endif
+        default:
+            jassert (level == SimdLevel::Scalar);
+            return accumulateScalar;
+    }
+}
+
+CompensatedFunction getCompensatedFunction (SimdLevel level)
+{
+    switch (level)
+    {
+#if JUCE_INTEL
+        case SimdLevel::Avx512:
+            return accumulateCompensatedAvx512;
+        case SimdLevel::Avx2:
+            return accumulateCompensatedAvx2;
+        case SimdLevel::Sse2:
+            return accumulateCompensatedSse2;
+#endif
+#if TRIGGERED_AVG_NEON_DOUBLE
+        case SimdLevel::Neon:
+            return accumulateCompensatedNeon;
+#endif
+        default:
+            // 32-bit NEON has no double vectors
+            jassert (level == SimdLevel::Scalar || level == SimdLevel::Neon);
+            return accumulateCompensatedScalar;
+    }
+}
+
+WelfordFunction getWelfordFunction (SimdLevel level)
+{
+    switch (level)
+    {
+#if JUCE_INTEL
+        case SimdLevel::Avx512:
+            return accumulateWelfordAvx512;
+        case SimdLevel::Avx2:
+            return accumulateWelfordAvx2;
+        case SimdLevel::Sse2:
+            return accumulateWelfordSse2;
+#endif
+#if TRIGGERED_AVG_NEON_DOUBLE
+        case SimdLevel::Neon:
+            return accumulateWelfordNeon;
+#endif
+        default:
+            jassert (level == SimdLevel::Scalar || level == SimdLevel::Neon);
+            return accumulateWelfordScalar;
+    }
+}
+
+ErrorBandFunction getErrorBandFunction (SimdLevel level)
+{
+    switch (level)
+    {
+#if JUCE_INTEL
+        case SimdLevel::Avx512:
+            return computeErrorBandAvx512;
+        case SimdLevel::Avx2:
+            return computeErrorBandAvx2;
+        case SimdLevel::Sse2:
+            return computeErrorBandSse2;
+#endif
+#if TRIGGERED_AVG_NEON
+        case SimdLevel::Neon:
+            return computeErrorBandNeon;
+#endif
+        default:
+            jassert (level == SimdLevel::Scalar);
+            return computeErrorBandScalar;
+    }
+}
+} // namespace
+
+SimdLevel TriggeredAverage::getSupportedSimdLevel()
+{
+    static const SimdLevel level = []
+    {
+#if JUCE_INTEL
+        if (SystemStats::hasAVX512F())
+            return SimdLevel::Avx512;
+        if (SystemStats::hasAVX2() && SystemStats::hasFMA3())
+            return SimdLevel::Avx2;
+        if (SystemStats::hasSSE2())
+            return SimdLevel::Sse2;
+#elif TRIGGERED_AVG_NEON
+        return SimdLevel::Neon;
+#endif
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+bool TriggeredAverage::isSimdLevelSupported (SimdLevel level)
+{
+    if (level == SimdLevel::Scalar)
+        return true;
+#if JUCE_INTEL
+    return level >= SimdLevel::Sse2 && level <= getSupportedSimdLevel();
+#else
+    return level == getSupportedSimdLevel();
+#endif
+}
+
+String TriggeredAverage::getSimdLevelName (SimdLevel level)
+{
+    switch (level)
+    {
+        case SimdLevel::Scalar:
+            return "Scalar";
+        case SimdLevel::Neon:
+            return "NEON";
+        case SimdLevel::Sse2:
+            return "SSE2";
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Avx512:
+            return "AVX-512";
+        default:
+            return "Unknown";
+    }
+}
+
+String TriggeredAverage::getAccumulatorTypeName (AccumulatorType type)
+{
+    switch (type)
+    {
+        case AccumulatorType::Float:
+            return "Float";
+        case AccumulatorType::KahanDouble:
+            return "Kahan (Double)";
+        case AccumulatorType::Welford:
+            return "Welford (Double)";
+        default:
+            return "Unknown";
+    }
+}
+
+void TriggeredAverage::accumulateSumAndSquares (float* sums,
+                                                float* sumSquares,
+                                                const float* data,
+                                                int numSamples)
+{
+    static const AccumulateFunction accumulate = getAccumulateFunction (getSupportedSimdLevel());
+    accumulate (sums, sumSquares, data, numSamples);
+}
+
+void TriggeredAverage::accumulateSumAndSquares (SimdLevel level,
+                                                float* sums,
+                                                float* sumSquares,
+                                                const float* data,
+                                                int numSamples)
+{
+    jassert (isSimdLevelSupported (level));
+    getAccumulateFunction (level) (sums, sumSquares, data, numSamples);
+}
+
+void TriggeredAverage::accumulateCompensatedSums (double* sums,
+                                                  double* sumCompensations,
+                                                  double* sumSquares,
+                                                  double* sumSquareCompensations,
+                                                  const float* data,
+                                                  int numSamples)
+{
+    static const CompensatedFunction accumulate =
+        getCompensatedFunction (getSupportedSimdLevel());
+    accumulate (sums, sumCompensations, sumSquares, sumSquareCompensations, data, numSamples);
+}
+
+void TriggeredAverage::accumulateCompensatedSums (SimdLevel level,
+                                                  double* sums,
+                                                  double* sumCompensations,
+                                                  double* sumSquares,
+                                                  double* sumSquareCompensations,
+                                                  const float* data,
+                                                  int numSamples)
+{
+    jassert (isSimdLevelSupported (level));
+    getCompensatedFunction (level) (
+        sums, sumCompensations, sumSquares, sumSquareCompensations, data, numSamples);
+}
+
+void TriggeredAverage::accumulateWelford (double* means,
+                                          double* squaredDeviations,
+                                          const float* data,
+                                          double weight,
+                                          int numSamples)
+{
+    jassert (weight > 0.0);
+    static const WelfordFunction accumulate = getWelfordFunction (getSupportedSimdLevel());
+    accumulate (means, squaredDeviations, data, weight, numSamples);
+}
+
+void TriggeredAverage::accumulateWelford (SimdLevel level,
+                                          double* means,
+                                          double* squaredDeviations,
+                                          const float* data,
+                                          double weight,
+                                          int numSamples)
+{
+    jassert (isSimdLevelSupported (level) && weight > 0.0);
+    getWelfordFunction (level) (means, squaredDeviations, data, weight, numSamples);
+}
+
+void TriggeredAverage::removeSumAndSquares (float* sums,
+                                            float* sumSquares,
+                                            const float* data,
+                                            int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+    {
+        sums[i] -= data[i];
+        sumSquares[i] -= data[i] * data[i];
+    }
+}
+
+void TriggeredAverage::removeCompensatedSums (double* sums,
+                                              double* sumCompensations,
+                                              double* sumSquares,
+                                              double* sumSquareCompensations,
+                                              const float* data,
+                                              int numSamples)
+{
+    for (int i = 0; i < numSamples; ++i)
+    {
+        const double sample = data[i];
+
+        const double y = -sample - sumCompensations[i];
+        const double t = sums[i] + y;
+        sumCompensations[i] = (t - sums[i]) - y;
+        sums[i] = t;
+
+        const double ySquare = -(sample * sample) - sumSquareCompensations[i];
+        const double tSquare = sumSquares[i] + ySquare;
+        sumSquareCompensations[i] = (tSquare - sumSquares[i]) - ySquare;
+        sumSquares[i] = tSquare;
+    }
+}
+
+void TriggeredAverage::removeWelford (double* means,
+                                      double* squaredDeviations,
+                                      const float* data,
+                                      double weight,
+                                      int numSamples)
+{
+    if (weight <= 0.0)
+    {
+        std::fill (means, means + numSamples, 0.0);
+        std::fill (squaredDeviations, squaredDeviations + numSamples, 0.0);
+        return;
+    }
+
+    // Welford's update run backwards
+    const double inverseCount = 1.0 / weight;
+    for (int i = 0; i < numSamples; ++i)
+    {
+        const double sample = data[i];
+        const double previousMean = means[i] - (sample - means[i]) * inverseCount;
+        squaredDeviations[i] -= (sample - previousMean) * (sample - means[i]);
+        means[i] = previousMean;
+    }
+}
+
+void TriggeredAverage::computeErrorBand (float* lower,
+                                         float* upper,
+                                         const float* average,
+                                         const float* variance,
+                                         float scale,
+                                         int numSamples)
+{
+    static const ErrorBandFunction compute = getErrorBandFunction (getSupportedSimdLevel());
+    compute (lower, upper, average, variance, scale, numSamples);
+}
+
+void TriggeredAverage::computeErrorBand (SimdLevel level,
+                                         float* lower,
+                                         float* upper,
+                                         const float* average,
+                                         const float* variance,
+                                         float scale,
+                                         int numSamples)
+{
+    jassert (isSimdLevelSupported (level));
+    getErrorBandFunction (level) (lower, upper, average, variance, scale, numSamples);
+}
@@ -0,0 +1,150 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#pragma once
+#include <JuceHeader.h>
+
+namespace TriggeredAverage
+{
+/** Instruction sets the accumulation kernels are written for */
+enum class SimdLevel
+{
+    Scalar,
+    Neon,
+    Sse2,
+    Avx2, // with FMA
+    Avx512
+};
+
+/** Widest instruction set of the CPU that a kernel is written for, checked once */
+SimdLevel getSupportedSimdLevel();
+
+/** True if the CPU and the build support the kernels of an instruction set */
+bool isSimdLevelSupported (SimdLevel level);
+
+String getSimdLevelName (SimdLevel level);
+
+/** How an average buffer accumulates its trials */
+enum class AccumulatorType
+{
+    // Float sums of the samples and their squares. Fastest, but after many trials with a
+    // DC offset the sums lose the low bits, the mean drifts and the variance cancels out.
+    Float,
+    // Double sums of the samples and their squares with Kahan compensation
+    KahanDouble,
+    // Welford's running mean and sum of squared deviations from it, in double
+    Welford
+};
+
+String getAccumulatorTypeName (AccumulatorType type);
+
+/** Adds a channel of a trial to the running sums of an average buffer: sums[i] += data[i]
+    and sumSquares[i] += data[i] * data[i]. Each sample is loaded once and both sums are
+    updated while it is in a register, with the widest instruction set the CPU supports. */
+void accumulateSumAndSquares (float* sums, float* sumSquares, const float* data, int numSamples);
+
+/** Like above with the given instruction set, for tests and benchmarks. The CPU must
+    support it. */
+void accumulateSumAndSquares (SimdLevel level,
+                              float* sums,
+                              float* sumSquares,
+                              const float* data,
+                              int numSamples);
+
+/** Adds a channel of a trial to Kahan-compensated double sums: sums[i] - sumCompensations[i]
+    is the sum of the samples and sumSquares[i] - sumSquareCompensations[i] the sum of their
+    squares, with the rounding error of each addition carried on to the next. */
+void accumulateCompensatedSums (double* sums,
+                                double* sumCompensations,
+                                double* sumSquares,
+                                double* sumSquareCompensations,
+                                const float* data,
+                                int numSamples);
+
+/** Like above with the given instruction set, for tests and benchmarks. The CPU must
+    support it. */
+void accumulateCompensatedSums (SimdLevel level,
+                                double* sums,
+                                double* sumCompensations,
+                                double* sumSquares,
+                                double* sumSquareCompensations,
+                                const float* data,
+                                int numSamples);
+
+/** Adds a channel of a trial to Welford's running means and sums of squared deviations
+    from them. weight is the number of trials including this one, or their total weight if
+    the older ones were scaled down. Differences to the mean stay small however large the
+    offset of the data, so the variance does not cancel out. */
+void accumulateWelford (double* means,
+                        double* squaredDeviations,
+                        const float* data,
+                        double weight,
+                        int numSamples);
+
+/** Like above with the given instruction set, for tests and benchmarks. The CPU must
+    support it. */
+void accumulateWelford (SimdLevel level,
+                        double* means,
+                        double* squaredDeviations,
+                        const float* data,
+                        double weight,
+                        int numSamples);
+
+/** Take a channel of a trial back out of the sums of the kernels above, e.g. when it leaves
+    a sliding window. Element-wise loops that the compiler vectorizes for the target. For
+    Welford's, weight is the number of trials left. */
+void removeSumAndSquares (float* sums, float* sumSquares, const float* data, int numSamples);
+void removeCompensatedSums (double* sums,
+                            double* sumCompensations,
+                            double* sumSquares,
+                            double* sumSquareCompensations,
+                            const float* data,
+                            int numSamples);
+void removeWelford (double* means,
+                    double* squaredDeviations,
+                    const float* data,
+                    double weight,
+                    int numSamples);
+
+/** Computes the band of scale standard deviations around a channel of an average:
+    lower[i] = average[i] - scale * sqrt (variance[i]) and upper[i] likewise. The square root
+    is taken as variance * rsqrt (variance) with one Newton-Raphson step, accurate to a few
+    float ulps. Variances of 0 or below give a band of width 0. */
+void computeErrorBand (float* lower,
+                       float* upper,
+                       const float* average,
+                       const float* variance,
+                       float scale,
+                       int numSamples);
+
+/** Like above with the given instruction set, for tests and benchmarks. The CPU must
+    support it. */
+void computeErrorBand (SimdLevel level,
+                       float* lower,
+                       float* upper,
+                       const float* average,
+                       const float* variance,
+                       float scale,
+                       int numSamples);
+
+} // namespace TriggeredAverage
@@ -0,0 +1,121 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#pragma once
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+namespace TriggeredAverage
+{
+/**
+ * Bounded lock-free queue for many producers and a single consumer.
+ *
+ * All slots are allocated up front, so pushing never allocates, locks or waits: it is safe
+ * from the audio thread. When the queue is full, tryPush() fails instead of blocking.
+ *
+ * Each slot carries a sequence number that tells whether it is free for the producer that
+ * claimed its position or holds an item for the consumer (D. Vyukov's bounded queue).
+ */
+template <typename T>
+class BoundedMpscQueue
+{
+public:
+    /** The capacity is rounded up to a power of two */
+    explicit BoundedMpscQueue (size_t minimumCapacity)
+        : m_capacity (std::bit_ceil (std::max<size_t> (minimumCapacity, 2))),
+          m_slots (std::make_unique<Slot[]> (m_capacity))
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+            m_slots[i].sequence.store (i, std::memory_order_relaxed);
+    }
+
+    /** Adds an item. Returns false if the queue is full. Safe to call from any thread. */
+    bool tryPush (const T& item)
+    {
+        size_t position = m_pushPosition.load (std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = m_slots[position & (m_capacity - 1)];
+            const size_t sequence = slot.sequence.load (std::memory_order_acquire);
+
+            if (sequence == position)
+            {
+                // the slot is free: claim it, or retry with the position another producer left
+                if (m_pushPosition.compare_exchange_weak (
+                        position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.item = item;
+                    slot.sequence.store (position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position)
+            {
+                // the consumer has not taken the item from one lap ago yet
+                return false;
+            }
+            else
+            {
+                position = m_pushPosition.load (std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /** Takes the oldest item. Returns false if the queue is empty, or if the next item is
+        still being written. Consumer thread only. */
+    bool tryPop (T& item)
+    {
+        Slot& slot = m_slots[m_popPosition & (m_capacity - 1)];
+        if (slot.sequence.load (std::memory_order_acquire) != m_popPosition + 1)
+            return false;
+
+        item = slot.item;
+        slot.sequence.store (m_popPosition + m_capacity, std::memory_order_release);
+        ++m_popPosition;
+        return true;
+    }
+
+    size_t getCapacity() const { return m_capacity; }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T item {};
+    };
+
+    const size_t m_capacity;
+    const std::unique_ptr<Slot[]> m_slots;
+
+    // producers and consumer touch different cache lines
+    alignas (64) std::atomic<size_t> m_pushPosition = 0;
+    alignas (64) size_t m_popPosition = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (BoundedMpscQueue)
+};
+
+} // namespace TriggeredAverage
@@ -0,0 +1,109 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "CaptureWorkerPool.h"
+#include <algorithm>
+
+using namespace TriggeredAverage;
+
+class CaptureWorkerPool::Worker : public Thread
+{
+public:
+    Worker (CaptureWorkerPool& pool, int threadIndex)
+        : Thread ("TriggeredAvg: Capture Worker " + String (threadIndex)),
+          m_pool (pool),
+          m_threadIndex (threadIndex)
+    {
+    }
+
+    ~Worker() override
+    {
+        signalThreadShouldExit();
+        m_jobStarted.signal();
+        stopThread (1000);
+    }
+
+    void startJob() { m_jobStarted.signal(); }
+
+    void run() override
+    {
+        for (;;)
+        {
+            m_jobStarted.wait (-1);
+            if (threadShouldExit())
+                return;
+
+            m_pool.processChunks (m_threadIndex);
+            if (m_pool.m_numBusyWorkers.fetch_sub (1, std::memory_order_acq_rel) == 1)
+                m_pool.m_jobDone.signal();
+        }
+    }
+
+private:
+    CaptureWorkerPool& m_pool;
+    const int m_threadIndex;
+    WaitableEvent m_jobStarted;
+};
+
+CaptureWorkerPool::CaptureWorkerPool (int numThreads)
+{
+    for (int threadIndex = 1; threadIndex < numThreads; ++threadIndex)
+    {
+        m_workers.push_back (std::make_unique<Worker> (*this, threadIndex));
+        m_workers.back()->startThread (Thread::Priority::high);
+    }
+}
+
+CaptureWorkerPool::~CaptureWorkerPool() { m_workers.clear(); }
+
+void CaptureWorkerPool::runJob (int numItems,
+                                int itemsPerChunk,
+                                ChunkFunction function,
+                                void* context)
+{
+    m_function = function;
+    m_context = context;
+    m_numItems = numItems;
+    m_itemsPerChunk = std::max (itemsPerChunk, 1);
+    m_nextItem.store (0, std::memory_order_relaxed);
+    m_numBusyWorkers.store (static_cast<int> (m_workers.size()), std::memory_order_relaxed);
+
+    // signalling publishes the job to the workers
+    for (auto& worker : m_workers)
+        worker->startJob();
+
+    processChunks (0);
+    m_jobDone.wait (-1);
+}
+
+void CaptureWorkerPool::processChunks (int threadIndex)
+{
+    for (;;)
+    {
+        const int begin = m_nextItem.fetch_add (m_itemsPerChunk, std::memory_order_relaxed);
+        if (begin >= m_numItems)
+            return;
+
+        m_function (m_context, begin, std::min (begin + m_itemsPerChunk, m_numItems), threadIndex);
+    }
+}
@@ -0,0 +1,99 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace TriggeredAverage
+{
+/**
+ * Threads that help the data collector with large captures.
+ *
+ * parallelFor() splits a range of items (e.g. the channels of a capture) into chunks that
+ * the calling thread and the worker threads take in turn, and returns once all are done.
+ * Chunks never share items, so the work on them needs no lock. With a single thread, the
+ * caller does all the work itself.
+ *
+ * parallelFor() must always be called from the same thread.
+ */
+class CaptureWorkerPool
+{
+public:
+    /** Starts numThreads - 1 worker threads; the thread calling parallelFor() is the last */
+    explicit CaptureWorkerPool (int numThreads = 1);
+    ~CaptureWorkerPool();
+
+    int getNumThreads() const { return static_cast<int> (m_workers.size()) + 1; }
+
+    /** Calls work (begin, end, threadIndex) for chunks [begin, end) of at most itemsPerChunk
+        of the items [0, numItems). threadIndex is below getNumThreads() and identifies the
+        thread, e.g. to pick its scratch memory. */
+    template <typename Work>
+    void parallelFor (int numItems, int itemsPerChunk, Work&& work)
+    {
+        if (m_workers.empty() || numItems <= itemsPerChunk)
+        {
+            if (numItems > 0)
+                work (0, numItems, 0);
+            return;
+        }
+
+        runJob (numItems,
+                itemsPerChunk,
+                [] (void* context, int begin, int end, int threadIndex)
+                {
+                    auto& chunkWork = *static_cast<std::remove_reference_t<Work>*> (context);
+                    chunkWork (begin, end, threadIndex);
+                },
+                &work);
+    }
+
+private:
+    class Worker;
+    using ChunkFunction = void (*) (void* context, int begin, int end, int threadIndex);
+
+    void runJob (int numItems, int itemsPerChunk, ChunkFunction function, void* context);
+
+    /** Works on chunks of the current job until all are taken */
+    void processChunks (int threadIndex);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    // current job, set up before the workers are woken
+    ChunkFunction m_function = nullptr;
+    void* m_context = nullptr;
+    int m_numItems = 0;
+    int m_itemsPerChunk = 1;
+    std::atomic<int> m_nextItem = 0;
+
+    std::atomic<int> m_numBusyWorkers = 0;
+    WaitableEvent m_jobDone;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CaptureWorkerPool)
+};
+
+} // namespace TriggeredAverage
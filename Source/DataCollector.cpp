@@ -22,418 +22,2012 @@
 
 */
 #include "DataCollector.h"
+#include "AccumulateKernels.h"
 #include "MultiChannelRingBuffer.h"
 #include "TriggerSource.h"
 #include "TriggeredAvgNode.h"
 #include <ProcessorHeaders.h>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <ranges>
+#include <tuple>
 
 using namespace TriggeredAverage;
 
 // DataStore implementation
+struct DataStore::SourceBuffers
+{
+    std::recursive_mutex mutex;
+    MultiChannelAverageBuffer averageBuffer;
+    SingleTrialBufferJuce trialBuffer;
+    TrialOrderStatistics orderStatistics;
+    std::vector<int> channelMap;
+
+    // Read without the lock by the lookups, which hand out the buffers only once set up
+    std::atomic<bool> isSetUp = false;
+};
+
+DataStore::DataStore() = default;
+DataStore::~DataStore() = default;
+
+DataStore::SourceBuffers& DataStore::getOrCreateSourceBuffers (TriggerSource* source,
+                                                               StreamId streamId)
+{
+    std::scoped_lock lock (m_sourcesMutex);
+    auto& buffers = m_sources[{ source, streamId }];
+    if (buffers == nullptr)
+        buffers = std::make_unique<SourceBuffers>();
+    return *buffers;
+}
+
+DataStore::SourceBuffers* DataStore::findSetUpSourceBuffers (TriggerSource* source,
+                                                             StreamId streamId)
+{
+    std::scoped_lock lock (m_sourcesMutex);
+    if (auto it = m_sources.find ({ source, streamId });
+        it != m_sources.end() && it->second->isSetUp.load (std::memory_order_acquire))
+        return it->second.get();
+    return nullptr;
+}
+
+template <typename Function>
+void DataStore::forEachSource (Function&& function)
+{
+    std::vector<std::pair<BufferKey, SourceBuffers*>> sources;
+    {
+        std::scoped_lock lock (m_sourcesMutex);
+        for (auto& [key, buffers] : m_sources)
+            sources.emplace_back (key, buffers.get());
+    }
+
+    for (auto& [key, buffers] : sources)
+    {
+        std::scoped_lock lock (buffers->mutex);
+        if (buffers->isSetUp.load (std::memory_order_relaxed))
+            function (key, *buffers);
+
+        // Changes made here reach the plots like the collector's
+        buffers->averageBuffer.publishSnapshot (&buffers->orderStatistics);
+    }
+}
+
 void DataStore::ResetAndResizeBuffersForTriggerSource (TriggerSource* source,
                                                        int nChannels,
-                                                       int nSamples)
+                                                       int nSamples,
+                                                       StreamId streamId)
 {
-    std::scoped_lock<std::recursive_mutex> lock (m_mutex);
     if (! source)
     {
-        for (auto& [key, value] : m_averageBuffers)
-        {
-            value.setSize (nChannels, nSamples);
-        }
+        forEachSource (
+            [&] (const BufferKey& key, SourceBuffers& buffers)
+            {
+                if (key.second == streamId)
+                    buffers.averageBuffer.setSize (nChannels, nSamples);
+            });
     }
     else
     {
-        m_averageBuffers[source].setSize (nChannels, nSamples);
-        m_singleTrialBuffers[source].setSize (
-            SingleTrialBufferSize { .numChannels = nChannels, .numSamples = nSamples });
+        std::vector<int> channels (static_cast<size_t> (nChannels));
+        std::iota (channels.begin(), channels.end(), 0);
+        ResetAndResizeBuffersForTriggerSource (source, channels, nSamples, streamId);
     }
 }
 
+void DataStore::ResetAndResizeBuffersForTriggerSource (TriggerSource* source,
+                                                       const std::vector<int>& channels,
+                                                       int nSamples,
+                                                       StreamId streamId)
+{
+    SourceBuffers& buffers = getOrCreateSourceBuffers (source, streamId);
+    std::scoped_lock lock (buffers.mutex);
+    const int nChannels = static_cast<int> (channels.size());
+
+    buffers.averageBuffer.setAccumulatorType (m_accumulatorType.load());
+    buffers.averageBuffer.setAverageMode (m_averageMode.load(), m_averageTimeConstant.load());
+    buffers.averageBuffer.setSize (nChannels, nSamples);
+    buffers.trialBuffer.setSize (SingleTrialBufferSize { .numChannels = nChannels,
+                                                         .numSamples = nSamples,
+                                                         .maxTrials = m_maxTrialsToStore.load() });
+    buffers.orderStatistics.setStatistic (m_averageStatistic.load(), m_trimFraction.load());
+    buffers.orderStatistics.rebuildFromTrials (buffers.trialBuffer);
+    buffers.channelMap = channels;
+    buffers.averageBuffer.publishSnapshot (&buffers.orderStatistics);
+    buffers.isSetUp.store (true, std::memory_order_release);
+}
+
+MultiChannelAverageBuffer* DataStore::getRefToAverageBufferForTriggerSource (TriggerSource* source,
+                                                                             StreamId streamId)
+{
+    if (auto* buffers = findSetUpSourceBuffers (source, streamId))
+        return &buffers->averageBuffer;
+    return nullptr;
+}
+
+SingleTrialBufferJuce* DataStore::getRefToTrialBufferForTriggerSource (TriggerSource* source,
+                                                                       StreamId streamId)
+{
+    if (auto* buffers = findSetUpSourceBuffers (source, streamId))
+        return &buffers->trialBuffer;
+    return nullptr;
+}
+
+TrialOrderStatistics* DataStore::getRefToOrderStatisticsForTriggerSource (TriggerSource* source,
+                                                                          StreamId streamId)
+{
+    if (auto* buffers = findSetUpSourceBuffers (source, streamId))
+        return &buffers->orderStatistics;
+    return nullptr;
+}
+
+const std::vector<int>* DataStore::getChannelMapForTriggerSource (TriggerSource* source,
+                                                                  StreamId streamId)
+{
+    if (auto* buffers = findSetUpSourceBuffers (source, streamId))
+        return &buffers->channelMap;
+    return nullptr;
+}
+
+std::recursive_mutex& DataStore::getMutexForTriggerSource (TriggerSource* source,
+                                                           StreamId streamId)
+{
+    return getOrCreateSourceBuffers (source, streamId).mutex;
+}
+
 void TriggeredAverage::DataStore::ResizeAllAverageBuffers (int nChannels, int nSamples, bool clear)
 {
-    auto lock = GetLock();
-    for (auto& [source, buffer] : m_averageBuffers)
-    {
-        buffer.setSize (nChannels, nSamples, clear);
-    }
+    forEachSource ([&] (const BufferKey&, SourceBuffers& buffers)
+                   { buffers.averageBuffer.setSize (nChannels, nSamples, clear); });
+}
+
+void DataStore::ResizeAverageBuffersForStream (StreamId streamId, int nSamples, bool clear)
+{
+    forEachSource (
+        [&] (const BufferKey& key, SourceBuffers& buffers)
+        {
+            if (key.second == streamId)
+                buffers.averageBuffer.setSize (
+                    buffers.averageBuffer.getNumChannels(), nSamples, clear);
+        });
 }
 
 void DataStore::setMaxTrialsToStore (int n)
 {
-    auto lock = GetLock();
-    for (auto& [source, trialBuffer] : m_singleTrialBuffers)
-    {
-        trialBuffer.setMaxTrials (n);
-    }
+    m_maxTrialsToStore.store (n);
+    forEachSource (
+        [n] (const BufferKey&, SourceBuffers& buffers)
+        {
+            // The slots of trials being written move; their windows start over
+            buffers.averageBuffer.withdrawOpenTrials (buffers.trialBuffer, 0);
+            buffers.trialBuffer.setMaxTrials (n);
+            buffers.orderStatistics.rebuildFromTrials (buffers.trialBuffer);
+
+            // A sliding window covers the trials that are left
+            if (buffers.averageBuffer.getAverageMode() == AverageMode::LastTrials)
+                buffers.averageBuffer.rebuildFromTrials (buffers.trialBuffer);
+        });
+}
+
+void DataStore::setAccumulatorType (AccumulatorType type)
+{
+    m_accumulatorType.store (type);
+    forEachSource (
+        [type] (const BufferKey&, SourceBuffers& buffers)
+        {
+            // Trials being written are added again if the new type takes partial trials
+            buffers.averageBuffer.withdrawOpenTrials (buffers.trialBuffer, 0);
+            buffers.averageBuffer.setAccumulatorType (type);
+        });
+}
+
+void DataStore::setAverageMode (AverageMode mode, double timeConstant)
+{
+    m_averageMode.store (mode);
+    m_averageTimeConstant.store (timeConstant);
+    forEachSource (
+        [mode, timeConstant] (const BufferKey&, SourceBuffers& buffers)
+        {
+            buffers.averageBuffer.setAverageMode (mode, timeConstant);
+            buffers.averageBuffer.rebuildFromTrials (buffers.trialBuffer);
+        });
+}
+
+void DataStore::setAverageStatistic (AverageStatistic statistic, float trimFraction)
+{
+    m_averageStatistic.store (statistic);
+    m_trimFraction.store (trimFraction);
+    forEachSource (
+        [statistic, trimFraction] (const BufferKey&, SourceBuffers& buffers)
+        {
+            buffers.orderStatistics.setStatistic (statistic, trimFraction);
+            buffers.orderStatistics.rebuildFromTrials (buffers.trialBuffer);
+        });
 }
 
 void DataStore::ResetAllBuffers()
 {
-    auto lock = GetLock();
-    for (auto& [source, avgBuffer] : m_averageBuffers)
+    forEachSource (
+        [] (const BufferKey&, SourceBuffers& buffers)
+        {
+            buffers.averageBuffer.resetTrials();
+            buffers.trialBuffer.clear();
+            buffers.orderStatistics.clear();
+        });
+}
+
+void DataStore::publishSnapshots()
+{
+    // Visiting a source publishes its snapshot if it changed
+    forEachSource ([] (const BufferKey&, SourceBuffers&) {});
+}
+
+void DataStore::tryPublishSnapshots()
+{
+    std::vector<SourceBuffers*> sources;
     {
-        avgBuffer.resetTrials();
+        std::scoped_lock lock (m_sourcesMutex);
+        for (auto& [key, buffers] : m_sources)
+            sources.push_back (buffers.get());
     }
-    for (auto& [source, trialBuffer] : m_singleTrialBuffers)
+
+    for (auto* buffers : sources)
     {
-        trialBuffer.clear();
+        std::unique_lock lock (buffers->mutex, std::try_to_lock);
+        if (lock.owns_lock())
+            buffers->averageBuffer.publishSnapshot (&buffers->orderStatistics);
     }
 }
 
+void DataStore::Clear()
+{
+    forEachSource (
+        [] (const BufferKey&, SourceBuffers& buffers)
+        {
+            buffers.isSetUp.store (false, std::memory_order_release);
+            buffers.averageBuffer.setSize (0, 0);
+            buffers.averageBuffer.removeChannelReaders();
+            buffers.trialBuffer.setSize (
+                SingleTrialBufferSize { .numChannels = 0, .numSamples = 0 });
+            buffers.trialBuffer.clear();
+            buffers.orderStatistics.setSize (0, 0, 0);
+            buffers.channelMap.clear();
+        });
+}
+
 DataCollector::DataCollector (TriggeredAvgNode* viewer_,
                               MultiChannelRingBuffer* buffer_,
                               DataStore* datastore_)
     : Thread ("TriggeredAvg: Data Collector"),
       m_processor (viewer_),
-      ringBuffer (buffer_),
       m_datastore (datastore_),
       newTriggerEvent (false)
 {
     //setPriority(Thread::Priority::high);
+    if (buffer_ != nullptr)
+        setRingBufferForStream (0, buffer_);
+    setNumCaptureThreads (1);
 }
 
-DataCollector::~DataCollector() { stopThread (1000); }
-
-void DataCollector::registerCaptureRequest (const CaptureRequest& request)
+DataCollector::~DataCollector()
 {
-    const ScopedLock lock (triggerQueueLock);
-    captureRequestQueue.emplace_back (request);
-    newTriggerEvent.signal();
+    stopThread (1000);
+
+    for (auto& [streamId, stream] : m_streams)
+        stream.ringBuffer->setWakeupEvent (nullptr);
 }
 
-void DataCollector::run()
+void DataCollector::setRingBufferForStream (StreamId streamId, MultiChannelRingBuffer* ringBuffer)
 {
-    constexpr double retryIntervalMs = 100.0;
-    constexpr int maximumNumberOfRetries = 500;
-    while (! threadShouldExit())
+    jassert (! isThreadRunning());
+    if (auto streamIt = m_streams.find (streamId); streamIt != m_streams.end())
     {
-        if (bool wasTriggered = newTriggerEvent.wait (100))
-        {
-            bool averageBuffersWereUpdated = false;
+        streamIt->second.ringBuffer->setWakeupEvent (nullptr);
+        m_streams.erase (streamIt);
+    }
 
-            while (! threadShouldExit())
-            {
-                // Get next request from queue (lock held briefly)
-                CaptureRequest currentRequest;
-                bool hasRequest = false;
+    if (ringBuffer == nullptr)
+        return;
 
-                {
-                    const ScopedLock lock (triggerQueueLock);
-                    if (! captureRequestQueue.empty())
-                    {
-                        currentRequest = captureRequestQueue.front();
-                        captureRequestQueue.pop_front();
-                        hasRequest = true;
-                    }
-                }
+    m_streams[streamId].ringBuffer = ringBuffer;
+    ringBuffer->setWakeupEvent (&newTriggerEvent);
+}
 
-                if (! hasRequest)
-                    break;
+void DataCollector::setNumCaptureThreads (int numThreads)
+{
+    jassert (! isThreadRunning());
+    m_workerPool.reset();
+    m_workerPool = std::make_unique<CaptureWorkerPool> (std::max (numThreads, 1));
+    m_batchChannelData.resize (static_cast<size_t> (m_workerPool->getNumThreads()));
+}
 
-                // Process request without holding the lock
-                int iRetry = 0;
-                RingBufferReadResult result = RingBufferReadResult::UnknownError;
-                SampleNumber lastKnownSampleNumber = ringBuffer->getCurrentSampleNumber();
+void DataCollector::setStreamingCapture (bool shouldStream)
+{
+    jassert (! isThreadRunning());
+    m_streamingCapture = shouldStream;
+}
 
-                do
-                {
-                    result = processCaptureRequest (currentRequest);
-                    assert (result != RingBufferReadResult::UnknownError);
+void DataCollector::setCaptureBacklog (int maxPendingRequests, BacklogPolicy policy)
+{
+    jassert (! isThreadRunning());
+    m_maxPendingRequests = static_cast<size_t> (std::max (maxPendingRequests, 1));
+    m_backlogPolicy = policy;
+}
 
-                    switch (result)
-                    {
-                        case RingBufferReadResult::Success:
-                            averageBuffersWereUpdated = true;
-                            LOGD ("[TriggeredAvg] Capture Request succesfully processed ")
-                            break;
-                        case RingBufferReadResult::DataInRingBufferTooOld:
-                            averageBuffersWereUpdated = true;
-                            LOGD ("[TriggeredAvg] Catpure Request dicarded, data too old. ")
-                            break;
-
-                        case RingBufferReadResult::NotEnoughNewData:
-                            if (iRetry < maximumNumberOfRetries)
-                            {
-                                // Check if time has jumped backwards (e.g., FileReader looping)
-                                SampleNumber currentSampleNumber =
-                                    ringBuffer->getCurrentSampleNumber();
-
-                                LOGD ("[TriggeredAvg] Capture Request retry ",
-                                      iRetry,
-                                      " - not enough data available yet (triggerSample: ",
-                                      currentRequest.triggerSample,
-                                      ", currentSample: ",
-                                      currentSampleNumber,
-                                      ", lastKnownSample: ",
-                                      lastKnownSampleNumber,
-                                      "), waiting ",
-                                      retryIntervalMs,
-                                      " ms.")
-
-                                if (currentSampleNumber < lastKnownSampleNumber)
-                                {
-                                    LOGD (
-                                        "[TriggeredAvg] Time jump detected! Aborting capture request.");
-                                    result = RingBufferReadResult::Aborted;
-                                    break;
-                                }
-
-                                wait (retryIntervalMs);
-                                iRetry++;
-                                lastKnownSampleNumber = currentSampleNumber;
-                            }
-                            else
-                            {
-                                LOGD ("TriggeredAvg: Capture request discarded after ",
-                                      maximumNumberOfRetries,
-                                      " retries - not enough data available");
-                                result = RingBufferReadResult::Aborted;
-                            }
-                            break;
-
-                        case RingBufferReadResult::InvalidParameters:
-                        case RingBufferReadResult::UnknownError:
-                            assert (false);
-                            break;
-
-                        case RingBufferReadResult::Aborted:
-                            // Valid result - happens when time jumps backwards or max retries exceeded
-                            break;
-                    }
-                } while (result == RingBufferReadResult::NotEnoughNewData
-                         && iRetry < maximumNumberOfRetries && ! threadShouldExit());
+void DataCollector::setLatencyStats (CaptureLatencyStats* stats)
+{
+    jassert (! isThreadRunning());
+    m_latencyStats = stats;
+}
 
-                assert (RingBufferReadResult::Success == result
-                        || RingBufferReadResult::DataInRingBufferTooOld == result
-                        || RingBufferReadResult::Aborted == result);
-            }
+int DataCollector::getChannelsPerChunk (int nSamples)
+{
+    return std::max (1, minimumSamplesPerChunk / std::max (nSamples, 1));
+}
+
+void DataCollector::addNewTrialsToAverage (const CaptureTarget& target,
+                                           int nTrials,
+                                           int64 triggerArrivalTicks)
+{
+    auto* trialBuffer = target.trialBuffer;
+    auto* averageBuffer = target.averageBuffer;
+    auto* orderStatistics = target.getActiveOrderStatistics();
+    const auto sums = averageBuffer->getSumWriter();
+    const int firstNewTrial = trialBuffer->getNumStoredTrials() - nTrials;
 
-            if (averageBuffersWereUpdated)
+    // Channel by channel, reading the new trials from the trial buffer, where they lie next
+    // to each other
+    m_workerPool->parallelFor (
+        averageBuffer->getNumChannels(),
+        getChannelsPerChunk (averageBuffer->getNumSamples() * nTrials),
+        [&] (int firstChannel, int endChannel, int)
+        {
+            for (int ch = firstChannel; ch < endChannel; ++ch)
             {
-                // notify the processor that the data has been updated
-                if (m_processor != nullptr)
-                    m_processor->triggerAsyncUpdate();
+                for (int t = firstNewTrial; t < trialBuffer->getNumStoredTrials(); ++t)
+                {
+                    const float* trial = trialBuffer->getTrialDataPointer (ch, t);
+                    sums.addChannel (ch, trial);
+                    if (orderStatistics != nullptr)
+                        orderStatistics->insertChannel (ch, trial);
+                }
             }
-        }
+        });
+    averageBuffer->addedTrials (nTrials, triggerArrivalTicks);
+}
+
+void DataCollector::releaseTrialSlots (const CaptureTarget& target, int nTrials)
+{
+    auto* trialBuffer = target.trialBuffer;
+    auto* averageBuffer = target.averageBuffer;
+    auto* orderStatistics = target.getActiveOrderStatistics();
+    const int nEvicted =
+        trialBuffer->getNumStoredTrials() - (trialBuffer->getMaxTrials() - nTrials);
+
+    // A sliding window loses the oldest trials as the new ones take their slots, and so do
+    // the sorted values of the stored trials
+    const bool isSlidingWindow = averageBuffer->getAverageMode() == AverageMode::LastTrials;
+    if (nEvicted > 0 && (isSlidingWindow || orderStatistics != nullptr))
+    {
+        const auto sums = averageBuffer->getSumWriter();
+        m_workerPool->parallelFor (
+            averageBuffer->getNumChannels(),
+            getChannelsPerChunk (averageBuffer->getNumSamples() * nEvicted),
+            [&] (int firstChannel, int endChannel, int)
+            {
+                for (int ch = firstChannel; ch < endChannel; ++ch)
+                {
+                    for (int t = 0; t < nEvicted; ++t)
+                    {
+                        const float* trial = trialBuffer->getTrialDataPointer (ch, t);
+                        if (isSlidingWindow)
+                            sums.removeChannel (ch, trial);
+                        if (orderStatistics != nullptr)
+                            orderStatistics->removeChannel (ch, trial);
+                    }
+                }
+            });
+        if (isSlidingWindow)
+            averageBuffer->removedTrials (nEvicted);
+    }
+    trialBuffer->reserveNextTrials (nTrials);
+
+    // Every removal leaves its rounding error in the sums
+    if (averageBuffer->getNumRemovedTrials() >= maximumRemovedTrialsBeforeRebuild)
+    {
+        averageBuffer->resetTrials();
+        if (orderStatistics != nullptr)
+            orderStatistics->clear();
+        addNewTrialsToAverage (target, trialBuffer->getNumStoredTrials(), 0);
     }
 }
 
-// process a single capture request on the ring buffer, running on the data collector thread
-RingBufferReadResult DataCollector::processCaptureRequest (const CaptureRequest& request)
+void DataCollector::recordLatency (CaptureLatencyStats::Stage stage, int64 startTicks) const
 {
-    auto result = ringBuffer->readAroundSample (
-        request.triggerSample, request.preSamples, request.postSamples, m_collectBuffer);
-    assert (result != RingBufferReadResult::UnknownError);
-    if (result != RingBufferReadResult::Success)
+    if (m_latencyStats != nullptr)
+        m_latencyStats->addSample (stage, startTicks, Time::getHighResolutionTicks());
+}
+
+bool DataCollector::registerCaptureRequest (const CaptureRequest& request)
+{
+    if (! m_captureRequestQueue.tryPush (request))
     {
-        return result;
+        m_numDroppedCaptureRequests.fetch_add (1, std::memory_order_relaxed);
+        if (request.triggerSource != nullptr)
+            request.triggerSource->captureCounters.dropped.fetch_add (1, std::memory_order_relaxed);
+        return false;
     }
 
-    // First, get buffer pointer and check size with minimal lock time
-    MultiChannelAverageBuffer* avgBuffer = nullptr;
-    SingleTrialBufferJuce* trialBuffer = nullptr;
-    bool needsResize = false;
+    // Only signalled after the request is visible, so the collector either finds it while
+    // draining or is woken up again
+    if (! m_newRequestsSignalled.exchange (true))
+        newTriggerEvent.signal();
+    return true;
+}
+
+namespace
+{
+SampleNumber getWindowEnd (const CaptureRequest& request)
+{
+    return request.triggerSample + request.postSamples;
+}
+
+/** Orders a heap of requests so the one completed first is on top */
+bool completesLater (const CaptureRequest& a, const CaptureRequest& b)
+{
+    return getWindowEnd (a) > getWindowEnd (b);
+}
 
+/** Adds numRequests to one of the capture counters of the request's source */
+void countCaptures (const CaptureRequest& request,
+                    std::atomic<uint64_t> CaptureCounters::*counter,
+                    size_t numRequests = 1)
+{
+    if (request.triggerSource != nullptr)
+        (request.triggerSource->captureCounters.*counter)
+            .fetch_add (numRequests, std::memory_order_relaxed);
+}
+
+/** Index of the backlog entry whose request a new request takes the place of: the oldest
+    trigger for DropOldest, the newest trigger of the same source for Coalesce. Returns -1 if
+    there is none. */
+template <typename Entry, typename GetRequest>
+std::ptrdiff_t findRequestToEvict (const std::vector<Entry>& backlog,
+                                   GetRequest getRequest,
+                                   BacklogPolicy policy,
+                                   const CaptureRequest& newRequest)
+{
+    std::ptrdiff_t found = -1;
+    for (size_t i = 0; i < backlog.size(); ++i)
     {
-        auto lock = m_datastore->GetLock();
-        avgBuffer = m_datastore->getRefToAverageBufferForTriggerSource (request.triggerSource);
-        trialBuffer = m_datastore->getRefToTrialBufferForTriggerSource (request.triggerSource);
+        const CaptureRequest& request = std::invoke (getRequest, backlog[i]);
+        if (policy == BacklogPolicy::Coalesce && request.triggerSource != newRequest.triggerSource)
+            continue;
 
-        if (! avgBuffer)
+        if (found >= 0)
         {
-            m_datastore->ResetAndResizeBuffersForTriggerSource (request.triggerSource,
-                                                                m_collectBuffer.getNumChannels(),
-                                                                m_collectBuffer.getNumSamples());
-            avgBuffer = m_datastore->getRefToAverageBufferForTriggerSource (request.triggerSource);
+            const SampleNumber foundTrigger =
+                std::invoke (getRequest, backlog[static_cast<size_t> (found)]).triggerSample;
+            const bool takesPlace = policy == BacklogPolicy::Coalesce
+                                        ? request.triggerSample >= foundTrigger
+                                        : request.triggerSample < foundTrigger;
+            if (! takesPlace)
+                continue;
         }
+        found = static_cast<std::ptrdiff_t> (i);
+    }
+    return found;
+}
+} // namespace
 
-        jassert (avgBuffer);
+void DataCollector::run()
+{
+    while (! threadShouldExit())
+    {
+        // Woken up by new requests and by the ring buffers as soon as the data a pending
+        // request waits for has arrived. The timeout only bounds the time to notice
+        // threadShouldExit().
+        newTriggerEvent.wait (100);
 
-        if (! trialBuffer)
+        // Take all queued requests at once. Re-arming the signal is an exchange, so that
+        // requests whose producer saw it still set are visible to the loop below.
+        m_requestBatch.clear();
+        m_newRequestsSignalled.exchange (false);
+        const int64 dequeueTicks = Time::getHighResolutionTicks();
+        for (CaptureRequest request; m_captureRequestQueue.tryPop (request);)
         {
-            m_datastore->ResetAndResizeBuffersForTriggerSource (request.triggerSource,
-                                                                m_collectBuffer.getNumChannels(),
-                                                                m_collectBuffer.getNumSamples());
-            trialBuffer = m_datastore->getRefToTrialBufferForTriggerSource (request.triggerSource);
+            request.timestamps.dequeued = dequeueTicks;
+            if (m_latencyStats != nullptr)
+                m_latencyStats->addSample (CaptureLatencyStats::TriggerToDequeue,
+                                           request.timestamps.triggerArrival,
+                                           dequeueTicks);
+            m_requestBatch.push_back (request);
         }
 
-        jassert (trialBuffer);
+        // Jumps are checked before adding the new requests, which may already belong to the
+        // samples after the jump
+        for (auto& [streamId, stream] : m_streams)
+            dropRequestsAfterTimeJump (stream);
+
+        for (const auto& request : m_requestBatch)
+            admitCaptureRequest (request);
+
+        bool averageBuffersWereUpdated = false;
+        for (auto& [streamId, stream] : m_streams)
+        {
+            if (threadShouldExit())
+                break;
+            if (processReadyRequests (stream))
+                averageBuffersWereUpdated = true;
+        }
 
-        if (m_collectBuffer.getNumChannels() != avgBuffer->getNumChannels()
-            || m_collectBuffer.getNumSamples() != avgBuffer->getNumSamples())
+        if (averageBuffersWereUpdated)
         {
-            needsResize = true;
+            // Once per wake-up rather than per trial, however many were captured
+            m_datastore->publishSnapshots();
+
+            // notify the processor that the data has been updated
+            if (m_processor != nullptr)
+                m_processor->triggerAsyncUpdate();
         }
+    }
+}
 
-    } // Lock released here
+void DataCollector::noteCaptured (const CaptureRequest& request)
+{
+    countCaptures (request, &CaptureCounters::captured);
+    recordLatency (CaptureLatencyStats::WindowCompleteToAccumulated,
+                   request.timestamps.windowComplete);
+}
 
-    // Resize outside the critical section if needed
-    if (needsResize)
+void DataCollector::admitCaptureRequest (const CaptureRequest& request)
+{
+    auto streamIt = m_streams.find (request.streamId);
+    if (streamIt == m_streams.end())
     {
-        auto lock = m_datastore->GetLock();
-        m_datastore->ResetAndResizeBuffersForTriggerSource (request.triggerSource,
-                                                            m_collectBuffer.getNumChannels(),
-                                                            m_collectBuffer.getNumSamples());
+        LOGD ("[TriggeredAvg] Capture Request discarded, no ring buffer for stream ",
+              request.streamId)
+        countCaptures (request, &CaptureCounters::aborted);
+        return;
     }
 
-    // Now add data with a separate, brief lock acquisition
+    StreamState& stream = streamIt->second;
+    if (stream.pendingRequests.size() + stream.openWindows.size() >= m_maxPendingRequests
+        && ! makeRoomInBacklog (stream, request))
     {
-        auto lock = m_datastore->GetLock();
-        avgBuffer = m_datastore->getRefToAverageBufferForTriggerSource (request.triggerSource);
-        trialBuffer = m_datastore->getRefToTrialBufferForTriggerSource (request.triggerSource);
+        countCaptures (request, &CaptureCounters::dropped);
+        return;
+    }
+
+    countCaptures (request, &CaptureCounters::accepted);
+    parkCaptureRequest (stream, request);
+}
 
-        jassert (avgBuffer);
-        jassert (trialBuffer);
-        jassert (m_collectBuffer.getNumSamples() == avgBuffer->getNumSamples());
-        jassert (m_collectBuffer.getNumChannels() == avgBuffer->getNumChannels());
+bool DataCollector::makeRoomInBacklog (StreamState& stream, const CaptureRequest& request)
+{
+    if (m_backlogPolicy == BacklogPolicy::DropNewest)
+        return false;
 
-        // Add to average buffer
-        avgBuffer->addDataToAverageFromBuffer (m_collectBuffer);
+    // Only one of the two holds requests, depending on the capture mode
+    if (m_streamingCapture)
+    {
+        const auto index =
+            findRequestToEvict (stream.openWindows, &OpenWindow::request, m_backlogPolicy, request);
+        if (index < 0)
+            return false;
 
-        // Add to trial buffer (uses template wrapper for AudioBuffer)
-        trialBuffer->addTrial (m_collectBuffer);
+        countCaptures (stream.openWindows[static_cast<size_t> (index)].request,
+                       &CaptureCounters::dropped);
+        dropOpenWindow (stream.openWindows, static_cast<size_t> (index));
+        return true;
     }
 
-    return result;
+    auto& pendingRequests = stream.pendingRequests;
+    const auto index =
+        findRequestToEvict (pendingRequests, std::identity {}, m_backlogPolicy, request);
+    if (index < 0)
+        return false;
+
+    countCaptures (pendingRequests[static_cast<size_t> (index)], &CaptureCounters::dropped);
+    pendingRequests.erase (pendingRequests.begin() + index);
+    std::ranges::make_heap (pendingRequests, completesLater);
+    return true;
 }
-MultiChannelAverageBuffer::MultiChannelAverageBuffer (int numChannels, int numSamples)
-    : m_numChannels (numChannels),
-      m_numSamples (numSamples)
+
+void DataCollector::dropOpenWindow (std::vector<OpenWindow>& openWindows, size_t index)
 {
-    m_sumBuffer.setSize (numChannels, numSamples);
-    m_sumSquaresBuffer.setSize (numChannels, numSamples);
-    m_averageBuffer.setSize (numChannels, numSamples);
-    resetTrials();
+    const CaptureRequest& dropped = openWindows[index].request;
+    int trialOffset = 0;
+    for (size_t j = 0; j < openWindows.size(); ++j)
+    {
+        const CaptureRequest& request = openWindows[j].request;
+        if (request.triggerSource != dropped.triggerSource)
+            continue;
+        if (j < index)
+            ++trialOffset;
+        else if (j > index)
+            openWindows[j].copiedUpTo = request.triggerSample - request.preSamples;
+    }
+    withdrawOpenTrials (dropped, trialOffset);
+    openWindows.erase (openWindows.begin() + static_cast<std::ptrdiff_t> (index));
 }
-MultiChannelAverageBuffer::MultiChannelAverageBuffer (MultiChannelAverageBuffer&& other) noexcept
-    : m_numChannels (other.m_numChannels),
-      m_numSamples (other.m_numSamples)
+
+void DataCollector::withdrawOpenTrials (const CaptureRequest& request, int firstTrialOffset)
 {
-    m_sumBuffer = std::move (other.m_sumBuffer);
-    m_sumSquaresBuffer = std::move (other.m_sumSquaresBuffer);
-    m_averageBuffer = std::move (other.m_averageBuffer);
-    m_numTrials = other.m_numTrials;
+    auto lock = m_datastore->GetLockForTriggerSource (request.triggerSource, request.streamId);
+    auto* averageBuffer = m_datastore->getRefToAverageBufferForTriggerSource (
+        request.triggerSource, request.streamId);
+    auto* trialBuffer =
+        m_datastore->getRefToTrialBufferForTriggerSource (request.triggerSource, request.streamId);
+    if (averageBuffer != nullptr && trialBuffer != nullptr)
+        averageBuffer->withdrawOpenTrials (*trialBuffer, firstTrialOffset);
 }
-MultiChannelAverageBuffer&
-    MultiChannelAverageBuffer::operator= (MultiChannelAverageBuffer&& other) noexcept
+
+void DataCollector::parkCaptureRequest (StreamState& stream, const CaptureRequest& request)
 {
-    if (this != &other)
+    if (m_streamingCapture)
+    {
+        // A new window size resets the buffers of the source, which drops the trials of its
+        // windows of the old size anyway
+        auto& openWindows = stream.openWindows;
+        const auto numWindowsBefore = openWindows.size();
+        std::erase_if (openWindows,
+                       [&] (const OpenWindow& window)
+                       {
+                           return window.request.triggerSource == request.triggerSource
+                                  && (window.request.preSamples != request.preSamples
+                                      || window.request.postSamples != request.postSamples);
+                       });
+        if (openWindows.size() != numWindowsBefore)
+            withdrawOpenTrials (request, 0);
+        countCaptures (request, &CaptureCounters::aborted, numWindowsBefore - openWindows.size());
+
+        openWindows.push_back (
+            { .request = request, .copiedUpTo = request.triggerSample - request.preSamples });
+        return;
+    }
+
+    auto& pendingRequests = stream.pendingRequests;
+    pendingRequests.push_back (request);
+    std::ranges::push_heap (pendingRequests, completesLater);
+}
+
+void DataCollector::dropRequestsAfterTimeJump (StreamState& stream)
+{
+    const SampleNumber currentSampleNumber = stream.ringBuffer->getCurrentSampleNumber();
+    if (currentSampleNumber < stream.lastKnownSampleNumber
+        && ! (stream.pendingRequests.empty() && stream.openWindows.empty()))
     {
-        m_sumBuffer = std::move (other.m_sumBuffer);
-        m_sumSquaresBuffer = std::move (other.m_sumSquaresBuffer);
-        m_averageBuffer = std::move (other.m_averageBuffer);
-        m_numTrials = other.m_numTrials;
-        m_numChannels = other.m_numChannels;
-        m_numSamples = other.m_numSamples;
+        LOGD ("[TriggeredAvg] Time jump detected! Aborting ",
+              stream.pendingRequests.size() + stream.openWindows.size(),
+              " pending capture requests.")
+        for (const auto& request : stream.pendingRequests)
+            countCaptures (request, &CaptureCounters::aborted);
+        for (const auto& window : stream.openWindows)
+        {
+            countCaptures (window.request, &CaptureCounters::aborted);
+            withdrawOpenTrials (window.request, 0);
+        }
+        stream.pendingRequests.clear();
+        stream.openWindows.clear();
     }
-    return *this;
+    stream.lastKnownSampleNumber = currentSampleNumber;
 }
-void MultiChannelAverageBuffer::addDataToAverageFromBuffer (const juce::AudioBuffer<float>& buffer)
+
+bool DataCollector::processReadyRequests (StreamState& stream)
 {
-    jassert (buffer.getNumChannels() == m_numChannels);
-    jassert (buffer.getNumSamples() == m_numSamples);
+    if (m_streamingCapture)
+        return processOpenWindows (stream);
 
-    // Update sum and sum-of-squares using SIMD-optimized operations
-    for (int ch = 0; ch < m_numChannels; ++ch)
-    {
-        auto* sumData = m_sumBuffer.getWritePointer (ch);
-        auto* sumSquaresData = m_sumSquaresBuffer.getWritePointer (ch);
-        auto* inputData = buffer.getReadPointer (ch);
+    MultiChannelRingBuffer* ringBuffer = stream.ringBuffer;
+    auto& pendingRequests = stream.pendingRequests;
 
-        // Use JUCE's SIMD-optimized operations
-        juce::FloatVectorOperations::add (sumData, inputData, m_numSamples);
+    const SampleNumber availableUpTo = ringBuffer->getCurrentSampleNumber();
+    m_readyRequests.clear();
+    while (! pendingRequests.empty() && getWindowEnd (pendingRequests.front()) <= availableUpTo)
+    {
+        std::ranges::pop_heap (pendingRequests, completesLater);
+        CaptureRequest& request = pendingRequests.back();
 
-        // For sum of squares, we need to square then add
-        for (int i = 0; i < m_numSamples; ++i)
+        // Requests parked again keep the time their window was first found complete
+        if (request.timestamps.windowComplete == 0)
         {
-            float sample = inputData[i];
-            sumSquaresData[i] += sample * sample;
+            request.timestamps.windowComplete = Time::getHighResolutionTicks();
+            recordLatency (CaptureLatencyStats::DequeueToWindowComplete,
+                           request.timestamps.dequeued);
         }
+        m_readyRequests.push_back (request);
+        pendingRequests.pop_back();
     }
 
-    ++m_numTrials;
+    bool averageBuffersWereUpdated = false;
+    if (! m_readyRequests.empty())
+    {
+        // Sorted by trigger sample, overlapping windows end up next to each other
+        std::ranges::stable_sort (m_readyRequests, {}, &CaptureRequest::triggerSample);
+        averageBuffersWereUpdated = processCaptureRequestsForStream (stream, m_readyRequests);
+    }
 
-    // Update the cached running average
-    updateRunningAverage();
-}
-AudioBuffer<float> MultiChannelAverageBuffer::getAverage() const
-{
-    // Simply return a copy of the cached average buffer
-    if (m_numTrials == 0)
+    // Sleep until the ring holds the window of the next pending request. If it arrived
+    // while the request was armed, the ring may have missed it, so check once more.
+    if (! pendingRequests.empty())
     {
-        AudioBuffer<float> outputBuffer;
-        outputBuffer.clear();
-        return outputBuffer;
+        const SampleNumber nextWindowEnd = getWindowEnd (pendingRequests.front());
+        ringBuffer->requestWakeup (nextWindowEnd);
+        if (ringBuffer->getCurrentSampleNumber() >= nextWindowEnd)
+            newTriggerEvent.signal();
     }
 
-    // Return a copy of the cached average
-    return AudioBuffer<float> (m_averageBuffer);
+    return averageBuffersWereUpdated;
 }
-AudioBuffer<float> MultiChannelAverageBuffer::getStandardDeviation() const
+
+bool DataCollector::processOpenWindows (StreamState& stream)
 {
-    juce::AudioBuffer<float> outputBuffer;
-    if (m_numTrials == 0)
+    MultiChannelRingBuffer* ringBuffer = stream.ringBuffer;
+    auto& openWindows = stream.openWindows;
+    if (openWindows.empty())
+        return false;
+
+    auto& sources = m_openWindowSources;
+    sources.clear();
+    for (const auto& window : openWindows)
     {
-        outputBuffer.clear();
-        return outputBuffer;
+        if (std::ranges::find (sources, window.request.triggerSource) == sources.end())
+            sources.push_back (window.request.triggerSource);
     }
 
-    outputBuffer.setSize (m_numChannels, m_numSamples, false, false, true);
-
-    for (int ch = 0; ch < m_numChannels; ++ch)
+    bool averageBuffersWereUpdated = false;
+    const StreamId streamId = openWindows.front().request.streamId;
+    for (TriggerSource* source : sources)
     {
-        auto* sumData = m_sumBuffer.getReadPointer (ch);
-        auto* sumSquaresData = m_sumSquaresBuffer.getReadPointer (ch);
-        auto* outputData = outputBuffer.getWritePointer (ch);
+        // The windows of a source take consecutive slots in their order, so one pass under
+        // one lock of the source gives every window its trial offset
+        auto lock = m_datastore->GetLockForTriggerSource (source, streamId);
+
+        // A window that cannot be read anymore gives up its slot, which moves the later
+        // windows of its source to other slots, so those start over
+        int trialOffset = 0;
+        for (size_t i = 0; i < openWindows.size();)
+        {
+            if (openWindows[i].request.triggerSource != source)
+            {
+                ++i;
+                continue;
+            }
+
+            if (advanceOpenWindow (openWindows[i], trialOffset, ringBuffer))
+            {
+                ++i;
+                ++trialOffset;
+                continue;
+            }
+
+            countCaptures (openWindows[i].request, &CaptureCounters::tooOld);
+            dropOpenWindow (openWindows, i);
+        }
 
-        for (int i = 0; i < m_numSamples; ++i)
+        // Store complete trials in slot order, i.e. while the first window of the source is
+        // complete
+        for (size_t i = 0; i < openWindows.size();)
         {
-            const float mean = sumData[i] / static_cast<float> (m_numTrials);
-            const float meanSquares = sumSquaresData[i] / static_cast<float> (m_numTrials);
-            const float variance = meanSquares - (mean * mean);
-            outputData[i] = std::sqrt (
-                std::max (0.0f, variance)); // Clamp to avoid negative due to float precision
+            if (openWindows[i].request.triggerSource != source)
+            {
+                ++i;
+                continue;
+            }
+
+            if (! storeOpenWindow (openWindows[i]))
+                break;
+
+            averageBuffersWereUpdated = true;
+            openWindows.erase (openWindows.begin() + static_cast<std::ptrdiff_t> (i));
         }
     }
-    return outputBuffer;
-}
 
-void MultiChannelAverageBuffer::resetTrials()
-{
-    m_sumBuffer.clear();
-    m_sumSquaresBuffer.clear();
-    m_averageBuffer.clear();
-    m_numTrials = 0;
-}
-int MultiChannelAverageBuffer::getNumTrials() const { return m_numTrials; }
-int MultiChannelAverageBuffer::getNumChannels() const
-{
-    assert (m_sumBuffer.getNumChannels() == m_sumSquaresBuffer.getNumChannels());
-    return m_sumBuffer.getNumChannels();
+    // Wake up once the window that completes first is complete, and in between after as
+    // many samples as are still in the cache when they are copied
+    if (! openWindows.empty())
+    {
+        const SampleNumber currentSampleNumber = ringBuffer->getCurrentSampleNumber();
+        SampleNumber nextWakeup =
+            currentSampleNumber
+            + std::max (1, minimumSamplesPerChunk / std::max (1, ringBuffer->getNumChannels()));
+        for (const auto& window : openWindows)
+        {
+            const SampleNumber windowEnd = getWindowEnd (window.request);
+            if (windowEnd > currentSampleNumber)
+                nextWakeup = std::min (nextWakeup, windowEnd);
+        }
+
+        ringBuffer->requestWakeup (nextWakeup);
+        if (ringBuffer->getCurrentSampleNumber() >= nextWakeup)
+            newTriggerEvent.signal();
+    }
+
+    return averageBuffersWereUpdated;
 }
-int MultiChannelAverageBuffer::getNumSamples() const
+
+bool DataCollector::storeOpenWindow (OpenWindow& window)
 {
-    assert (m_sumBuffer.getNumChannels() == m_sumSquaresBuffer.getNumChannels());
-    return m_sumBuffer.getNumSamples();
+    const CaptureRequest& request = window.request;
+    if (window.copiedUpTo < getWindowEnd (request))
+        return false;
+
+    const CaptureTarget target {
+        .averageBuffer = m_datastore->getRefToAverageBufferForTriggerSource (
+            request.triggerSource, request.streamId),
+        .trialBuffer = m_datastore->getRefToTrialBufferForTriggerSource (request.triggerSource,
+                                                                         request.streamId),
+        .orderStatistics = m_datastore->getRefToOrderStatisticsForTriggerSource (
+            request.triggerSource, request.streamId),
+        .channelMap =
+            m_datastore->getChannelMapForTriggerSource (request.triggerSource, request.streamId)
+    };
+
+    // The buffers were cleared or resized since the window was advanced: the next advance
+    // starts it over
+    if (target.trialBuffer == nullptr
+        || target.trialBuffer->getLayoutGeneration() != window.trialBufferGeneration)
+        return false;
+
+    auto* averageBuffer = target.averageBuffer;
+    if (averageBuffer->getOpenTrialSamples (0) != averageBuffer->getNumSamples())
+    {
+        // The trial was not added while it was written, e.g. to an exponential average
+        averageBuffer->withdrawOpenTrials (*target.trialBuffer, 0);
+        target.trialBuffer->commitTrial();
+        addNewTrialsToAverage (target, 1, request.timestamps.triggerArrival);
+        noteCaptured (request);
+        return true;
+    }
+
+    // Its samples are in the sums already; only the sorted values need the whole trial
+    target.trialBuffer->commitTrial();
+    if (auto* orderStatistics = target.getActiveOrderStatistics())
+    {
+        const int newestTrial = target.trialBuffer->getNumStoredTrials() - 1;
+        m_workerPool->parallelFor (
+            averageBuffer->getNumChannels(),
+            getChannelsPerChunk (averageBuffer->getNumSamples()),
+            [&] (int firstChannel, int endChannel, int)
+            {
+                for (int ch = firstChannel; ch < endChannel; ++ch)
+                    orderStatistics->insertChannel (
+                        ch, target.trialBuffer->getTrialDataPointer (ch, newestTrial));
+            });
+    }
+    averageBuffer->completeOpenTrial (request.timestamps.triggerArrival);
+    noteCaptured (request);
+    return true;
 }
 
-void MultiChannelAverageBuffer::updateRunningAverage()
+bool DataCollector::advanceOpenWindow (OpenWindow& window,
+                                       int trialOffset,
+                                       MultiChannelRingBuffer* ringBuffer)
 {
-    if (m_numTrials == 0)
+    const CaptureRequest& request = window.request;
+    const SampleNumber windowStart = request.triggerSample - request.preSamples;
+    const SampleNumber windowEnd = getWindowEnd (request);
+    const int nSamples = request.preSamples + request.postSamples;
+
+    const CaptureTarget target =
+        getCaptureTarget (request, nSamples, ringBuffer->getNumChannels());
+    auto* trialBuffer = target.trialBuffer;
+
+    // The slots were moved or cleared (e.g. by a resize) since the last call
+    if (trialBuffer->getLayoutGeneration() != window.trialBufferGeneration)
     {
-        m_averageBuffer.clear();
-        return;
+        window.trialBufferGeneration = trialBuffer->getLayoutGeneration();
+        window.copiedUpTo = windowStart;
+    }
+
+    // Without a free slot, the window waits for the trials before it to be stored and is
+    // then read from the ring's history
+    if (trialOffset >= trialBuffer->getMaxTrials())
+    {
+        window.copiedUpTo = windowStart;
+        return true;
+    }
+    releaseTrialSlots (target, trialOffset + 1);
+
+    // The first call also copies the pre-trigger part
+    const SampleNumber copyEnd = std::min (windowEnd, ringBuffer->getCurrentSampleNumber());
+    if (copyEnd <= window.copiedUpTo)
+        return true;
+
+    RingBufferView view;
+    const auto result = ringBuffer->getViewAroundSample (
+        window.copiedUpTo, 0, static_cast<int> (copyEnd - window.copiedUpTo), view);
+    if (result == RingBufferReadResult::NotEnoughNewData)
+        return true;
+    if (result != RingBufferReadResult::Success)
+    {
+        LOGD ("[TriggeredAvg] Streaming capture dropped, window can no longer be read.")
+        return false;
     }
 
-    const float invTrials = 1.0f / static_cast<float> (m_numTrials);
+    const int sampleOffset = static_cast<int> (window.copiedUpTo - windowStart);
+    const int copiedSamples = static_cast<int> (copyEnd - windowStart);
+
+    // Each channel goes into the sums right after it was copied, while it is in the cache,
+    // so storing the trial does not read it again. Samples that were taken back out of the
+    // sums (e.g. by a rebuild) are added again on the way.
+    auto* averageBuffer = target.averageBuffer;
+    const bool addToSums = averageBuffer->canAddOpenTrials();
+    const int firstSampleToAdd = std::min (averageBuffer->getOpenTrialSamples (trialOffset),
+                                           sampleOffset);
+    const auto sums = averageBuffer->getSumWriter();
+
+    const std::vector<int>& channelMap = *target.channelMap;
+    m_workerPool->parallelFor (
+        static_cast<int> (channelMap.size()),
+        getChannelsPerChunk (view.getNumSamples()),
+        [&] (int firstChannel, int endChannel, int)
+        {
+            for (int ch = firstChannel; ch < endChannel; ++ch)
+            {
+                float* slot = trialBuffer->getNextTrialWritePointer (ch, trialOffset);
+                view.copyTo (channelMap[ch], slot + sampleOffset);
+                if (addToSums)
+                {
+                    sums.addChannelSamples (ch,
+                                            slot + firstSampleToAdd,
+                                            firstSampleToAdd,
+                                            copiedSamples - firstSampleToAdd);
+                }
+            }
+        });
+    if (addToSums)
+        averageBuffer->addedOpenTrialSamples (trialOffset, copiedSamples);
+
+    if (! ringBuffer->isViewIntact (view))
+    {
+        LOGD ("[TriggeredAvg] Streaming capture dropped, window was overwritten while copied.")
+        return false;
+    }
 
-    // Use JUCE's SIMD-optimized multiply for each channel
-    for (int ch = 0; ch < m_numChannels; ++ch)
+    window.copiedUpTo = copyEnd;
+    if (copyEnd == windowEnd && window.request.timestamps.windowComplete == 0)
     {
-        juce::FloatVectorOperations::multiply (m_averageBuffer.getWritePointer (ch),
-                                               m_sumBuffer.getReadPointer (ch),
-                                               invTrials,
-                                               m_numSamples);
+        window.request.timestamps.windowComplete = Time::getHighResolutionTicks();
+        recordLatency (CaptureLatencyStats::DequeueToWindowComplete,
+                       window.request.timestamps.dequeued);
+    }
+    return true;
+}
+
+bool DataCollector::processCaptureRequestsForStream (StreamState& stream,
+                                                     std::span<const CaptureRequest> requests)
+{
+    MultiChannelRingBuffer* ringBuffer = stream.ringBuffer;
+
+    bool averageBuffersWereUpdated = false;
+    while (! requests.empty() && ! threadShouldExit())
+    {
+        const size_t batchSize = getBatchSize (requests, *ringBuffer);
+        if (batchSize > 1 && processCaptureBatch (requests.first (batchSize), ringBuffer))
+        {
+            for (const auto& request : requests.first (batchSize))
+                noteCaptured (request);
+            averageBuffersWereUpdated = true;
+            requests = requests.subspan (batchSize);
+            continue;
+        }
+
+        // Single requests, and batches that could not be read as a whole (e.g. because one
+        // of their windows is too old), are captured one by one
+        const CaptureRequest& request = requests.front();
+        const auto result = processCaptureRequest (request, ringBuffer);
+        assert (result != RingBufferReadResult::UnknownError);
+
+        switch (result)
+        {
+            case RingBufferReadResult::Success:
+                averageBuffersWereUpdated = true;
+                noteCaptured (request);
+                LOGD ("[TriggeredAvg] Capture Request succesfully processed ")
+                break;
+            case RingBufferReadResult::DataInRingBufferTooOld:
+                averageBuffersWereUpdated = true;
+                countCaptures (request, &CaptureCounters::tooOld);
+                LOGD ("[TriggeredAvg] Catpure Request dicarded, data too old. ")
+                break;
+
+            case RingBufferReadResult::NotEnoughNewData:
+                // The ring was reset since the request became ready; wait for the data again
+                parkCaptureRequest (stream, request);
+                break;
+
+            case RingBufferReadResult::InvalidParameters:
+            case RingBufferReadResult::UnknownError:
+                assert (false);
+                break;
+
+            case RingBufferReadResult::Aborted:
+                // Valid result - happens when the window spans a jump in the sample numbers
+                countCaptures (request, &CaptureCounters::aborted);
+                LOGD ("[TriggeredAvg] Capture Request aborted, window spans a time jump.")
+                break;
+        }
+        requests = requests.subspan (1);
+    }
+
+    return averageBuffersWereUpdated;
+}
+
+size_t DataCollector::getBatchSize (std::span<const CaptureRequest> requests,
+                                    const MultiChannelRingBuffer& ringBuffer)
+{
+    const SampleNumber availableUpTo = ringBuffer.getCurrentSampleNumber();
+    const int bufferSize = ringBuffer.getBufferSize();
+
+    // Batched requests share their window size, so sorting by trigger sample also sorts
+    // their window ends
+    const CaptureRequest& first = requests.front();
+    const SampleNumber batchStart = first.triggerSample - first.preSamples;
+    SampleNumber batchEnd = first.triggerSample + first.postSamples;
+    if (batchEnd > availableUpTo)
+        return 1;
+
+    size_t batchSize = 1;
+    while (batchSize < requests.size() && batchSize < maximumNumberOfTrialsPerBatch)
+    {
+        const CaptureRequest& request = requests[batchSize];
+        const SampleNumber windowStart = request.triggerSample - request.preSamples;
+        const SampleNumber windowEnd = request.triggerSample + request.postSamples;
+
+        if (request.preSamples != first.preSamples || request.postSamples != first.postSamples
+            || windowStart >= batchEnd || windowEnd > availableUpTo
+            || windowEnd - batchStart > bufferSize)
+            break;
+
+        batchEnd = windowEnd;
+        ++batchSize;
+    }
+
+    return batchSize;
+}
+
+bool DataCollector::processCaptureBatch (std::span<const CaptureRequest> batch,
+                                         MultiChannelRingBuffer* ringBuffer)
+{
+    const CaptureRequest& first = batch.front();
+    const int nSamples = first.preSamples + first.postSamples;
+    const SampleNumber batchStart = first.triggerSample - first.preSamples;
+    const int batchLength = static_cast<int> (batch.back().triggerSample
+                                              + batch.back().postSamples - batchStart);
+
+    RingBufferView view;
+    if (ringBuffer->getViewAroundSample (batchStart, 0, batchLength, view)
+        != RingBufferReadResult::Success)
+        return false;
+
+    const int nStreamChannels = view.getNumChannels();
+
+    // Only the sources of the batch are locked; the message thread only ever takes one
+    // source lock at a time, so this cannot deadlock
+    std::vector<std::unique_lock<std::recursive_mutex>> sourceLocks;
+    sourceLocks.reserve (batch.size());
+    for (const auto& request : batch)
+        sourceLocks.push_back (
+            m_datastore->GetLockForTriggerSource (request.triggerSource, request.streamId));
+
+    // Find the buffers of every trial. Trials of the same source go into consecutive slots
+    // of its trial buffer, in the order of their trigger samples.
+    m_batchTrials.clear();
+    m_batchTrialChannels.assign (batch.size() * static_cast<size_t> (nStreamChannels), -1);
+    for (const auto& request : batch)
+    {
+        const CaptureTarget target = getCaptureTarget (request, nSamples, nStreamChannels);
+        const auto trialOffset = static_cast<int> (
+            std::ranges::count_if (m_batchTrials,
+                                   [&] (const BatchTrial& trial)
+                                   { return trial.target.trialBuffer == target.trialBuffer; }));
+        if (trialOffset >= target.trialBuffer->getMaxTrials())
+            return false;
+
+        int* trialChannels = &m_batchTrialChannels[m_batchTrials.size() * nStreamChannels];
+        for (int ch = 0; ch < static_cast<int> (target.channelMap->size()); ++ch)
+        {
+            jassert ((*target.channelMap)[ch] < nStreamChannels);
+            trialChannels[(*target.channelMap)[ch]] = ch;
+        }
+
+        m_batchTrials.push_back (
+            { .target = target,
+              .trialOffset = trialOffset,
+              .windowOffset = static_cast<int> (request.triggerSample - request.preSamples
+                                                - batchStart) });
+    }
+
+    // Each trial buffer appears once with trial offset 0, together with its trial count
+    const auto countTrials = [this] (const BatchTrial& first)
+    {
+        return static_cast<int> (std::ranges::count_if (
+            m_batchTrials,
+            [&] (const BatchTrial& trial)
+            { return trial.target.trialBuffer == first.target.trialBuffer; }));
+    };
+
+    for (const auto& trial : m_batchTrials)
+    {
+        if (trial.trialOffset == 0)
+            releaseTrialSlots (trial.target, countTrials (trial));
+    }
+
+    // Read each channel of the batch window from the ring once and hand it out to all
+    // trials while it is still in cache. Each capture thread has its own channel scratch.
+    for (auto& channelData : m_batchChannelData)
+        channelData.resize (static_cast<size_t> (batchLength));
+
+    m_workerPool->parallelFor (
+        nStreamChannels,
+        getChannelsPerChunk (batchLength),
+        [&] (int firstChannel, int endChannel, int threadIndex)
+        {
+            float* channelData = m_batchChannelData[static_cast<size_t> (threadIndex)].data();
+            for (int streamChannel = firstChannel; streamChannel < endChannel; ++streamChannel)
+            {
+                const bool isCaptured = std::ranges::any_of (
+                    std::views::iota (size_t { 0 }, m_batchTrials.size()),
+                    [&] (size_t t)
+                    { return m_batchTrialChannels[t * nStreamChannels + streamChannel] >= 0; });
+                if (! isCaptured)
+                    continue;
+
+                view.copyTo (streamChannel, channelData);
+
+                for (size_t t = 0; t < m_batchTrials.size(); ++t)
+                {
+                    const int trialChannel =
+                        m_batchTrialChannels[t * nStreamChannels + streamChannel];
+                    if (trialChannel < 0)
+                        continue;
+
+                    const BatchTrial& trial = m_batchTrials[t];
+                    FloatVectorOperations::copy (
+                        trial.target.trialBuffer->getNextTrialWritePointer (trialChannel,
+                                                                            trial.trialOffset),
+                        channelData + trial.windowOffset,
+                        nSamples);
+                }
+            }
+        });
+
+    if (! ringBuffer->isViewIntact (view))
+    {
+        for (const auto& trial : m_batchTrials)
+        {
+            if (trial.trialOffset == 0)
+                trial.target.trialBuffer->discardTrials (countTrials (trial));
+        }
+        return false;
+    }
+
+    // The oldest trigger of the batch bounds the display latency of all its trials
+    int64 oldestTriggerArrival = 0;
+    for (const auto& request : batch)
+    {
+        const int64 arrival = request.timestamps.triggerArrival;
+        if (arrival != 0 && (oldestTriggerArrival == 0 || arrival < oldestTriggerArrival))
+            oldestTriggerArrival = arrival;
+    }
+
+    for (const auto& trial : m_batchTrials)
+    {
+        if (trial.trialOffset != 0)
+            continue;
+
+        const int nTrials = countTrials (trial);
+        trial.target.trialBuffer->commitTrials (nTrials);
+        addNewTrialsToAverage (trial.target, nTrials, oldestTriggerArrival);
+    }
+
+    LOGD ("[TriggeredAvg] ", batch.size(), " overlapping Capture Requests processed in one batch")
+    return true;
+}
+
+DataCollector::CaptureTarget DataCollector::getCaptureTarget (const CaptureRequest& request,
+                                                              int nSamples,
+                                                              int nStreamChannels)
+{
+    TriggerSource* source = request.triggerSource;
+    const StreamId streamId = request.streamId;
+
+    CaptureTarget target {
+        .averageBuffer = m_datastore->getRefToAverageBufferForTriggerSource (source, streamId),
+        .trialBuffer = m_datastore->getRefToTrialBufferForTriggerSource (source, streamId),
+        .orderStatistics = m_datastore->getRefToOrderStatisticsForTriggerSource (source, streamId),
+        .channelMap = m_datastore->getChannelMapForTriggerSource (source, streamId)
+    };
+
+    bool needsResize = true;
+    if (target.averageBuffer && target.trialBuffer && target.channelMap)
+    {
+        const int nChannels = static_cast<int> (target.channelMap->size());
+        needsResize = nChannels != target.averageBuffer->getNumChannels()
+                      || nSamples != target.averageBuffer->getNumSamples()
+                      || nChannels != target.trialBuffer->getNumChannels()
+                      || nSamples != target.trialBuffer->getNumSamples();
+    }
+
+    if (! needsResize)
+        return target;
+
+    // Sources that were not set up with a channel selection capture every channel of the
+    // stream
+    if (target.channelMap != nullptr)
+        m_datastore->ResetAndResizeBuffersForTriggerSource (
+            source, *target.channelMap, nSamples, streamId);
+    else
+        m_datastore->ResetAndResizeBuffersForTriggerSource (
+            source, nStreamChannels, nSamples, streamId);
+
+    return { .averageBuffer = m_datastore->getRefToAverageBufferForTriggerSource (source, streamId),
+             .trialBuffer = m_datastore->getRefToTrialBufferForTriggerSource (source, streamId),
+             .orderStatistics =
+                 m_datastore->getRefToOrderStatisticsForTriggerSource (source, streamId),
+             .channelMap = m_datastore->getChannelMapForTriggerSource (source, streamId) };
+}
+
+// process a single capture request on the ring buffer, running on the data collector thread
+RingBufferReadResult DataCollector::processCaptureRequest (const CaptureRequest& request,
+                                                           MultiChannelRingBuffer* ringBuffer)
+{
+    // A window overwritten while it is copied is retried, and then reported as too old
+    constexpr int maximumNumberOfAttempts = 3;
+
+    for (int attempt = 0; attempt < maximumNumberOfAttempts; ++attempt)
+    {
+        RingBufferView view;
+        auto result = ringBuffer->getViewAroundSample (
+            request.triggerSample, request.preSamples, request.postSamples, view);
+        assert (result != RingBufferReadResult::UnknownError);
+        if (result != RingBufferReadResult::Success)
+        {
+            return result;
+        }
+
+        const int nSamples = view.getNumSamples();
+
+        auto lock = m_datastore->GetLockForTriggerSource (request.triggerSource, request.streamId);
+        const CaptureTarget target = getCaptureTarget (request, nSamples, view.getNumChannels());
+        auto* trialBuffer = target.trialBuffer;
+        const std::vector<int>& channelMap = *target.channelMap;
+        const int nChannels = static_cast<int> (channelMap.size());
+        releaseTrialSlots (target, 1);
+
+        // The trial buffer slot is the only copy of the data: read the selected channels
+        // straight from ring memory into it, and only keep it if the ring was not
+        // overwritten meanwhile
+        m_workerPool->parallelFor (nChannels,
+                                   getChannelsPerChunk (nSamples),
+                                   [&] (int firstChannel, int endChannel, int)
+                                   {
+                                       for (int ch = firstChannel; ch < endChannel; ++ch)
+                                       {
+                                           jassert (channelMap[ch] < view.getNumChannels());
+                                           view.copyTo (channelMap[ch],
+                                                        trialBuffer->getNextTrialWritePointer (ch));
+                                       }
+                                   });
+
+        if (! ringBuffer->isViewIntact (view))
+        {
+            trialBuffer->discardTrial();
+            continue;
+        }
+        trialBuffer->commitTrial();
+
+        // Add to average buffer from the stored trial, which is still in cache
+        addNewTrialsToAverage (target, 1, request.timestamps.triggerArrival);
+
+        return result;
+    }
+
+    return RingBufferReadResult::DataInRingBufferTooOld;
+}
+
+MultiChannelAverageBuffer::MultiChannelAverageBuffer (int numChannels, int numSamples)
+{
+    m_sums.numChannels = numChannels;
+    m_sums.numSamples = numSamples;
+    m_sums.allocate();
+    resetTrials();
+}
+MultiChannelAverageBuffer::MultiChannelAverageBuffer (MultiChannelAverageBuffer&& other) noexcept
+{
+    *this = std::move (other);
+}
+MultiChannelAverageBuffer&
+    MultiChannelAverageBuffer::operator= (MultiChannelAverageBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        m_sums = std::move (other.m_sums);
+        m_averageMode = other.m_averageMode;
+        m_decay = other.m_decay;
+        m_numRemovedTrials = other.m_numRemovedTrials;
+        m_openTrialSamples = std::move (other.m_openTrialSamples);
+        m_snapshots = std::move (other.m_snapshots);
+        m_publishedVersion = 0;
+        m_channelReaders = std::move (other.m_channelReaders);
+        m_readersVersion = other.m_readersVersion;
+        m_version.store (other.m_version.load() + 1);
+    }
+    return *this;
+}
+void MultiChannelAverageBuffer::addDataToAverageFromBuffer (const juce::AudioBuffer<float>& buffer)
+{
+    addDataToAverage (
+        buffer.getArrayOfReadPointers(), buffer.getNumChannels(), buffer.getNumSamples());
+}
+void MultiChannelAverageBuffer::addDataToAverage (const float* const* channelData,
+                                                  int nChannels,
+                                                  int nSamples)
+{
+    jassert (nChannels == m_sums.numChannels);
+    jassert (nSamples == m_sums.numSamples);
+
+    for (int ch = 0; ch < m_sums.numChannels; ++ch)
+        addChannelToSums (ch, channelData[ch]);
+
+    addedTrials (1);
+}
+void MultiChannelAverageBuffer::addChannelToSums (int channel, const float* channelData)
+{
+    getSumWriter().addChannel (channel, channelData);
+}
+MultiChannelAverageBuffer::SumWriter MultiChannelAverageBuffer::getSumWriter()
+{
+    // Getting the write pointers marks the buffers as not clear, which is not thread-safe
+    SumWriter writer;
+    writer.m_type = m_sums.accumulatorType;
+    writer.m_decay = m_decay;
+    writer.m_sums = m_sums.sums.getArrayOfWritePointers();
+    writer.m_sumSquares = m_sums.sumSquares.getArrayOfWritePointers();
+    writer.m_doubleSums = m_sums.doubleSums.getArrayOfWritePointers();
+    writer.m_doubleSumSquares = m_sums.doubleSumSquares.getArrayOfWritePointers();
+    writer.m_sumCompensations = m_sums.sumCompensations.getArrayOfWritePointers();
+    writer.m_sumSquareCompensations = m_sums.sumSquareCompensations.getArrayOfWritePointers();
+    writer.m_means = m_sums.means.getArrayOfWritePointers();
+    writer.m_squaredDeviations = m_sums.squaredDeviations.getArrayOfWritePointers();
+    writer.m_channelWeights = m_sums.channelWeights.data();
+    writer.m_numChannels = m_sums.numChannels;
+    writer.m_numSamples = m_sums.numSamples;
+    return writer;
+}
+void MultiChannelAverageBuffer::SumWriter::addChannel (int channel, const float* channelData) const
+{
+    jassert (channel >= 0 && channel < m_numChannels);
+    const double weight = m_channelWeights[channel] * m_decay + 1.0;
+    m_channelWeights[channel] = weight;
+
+    // An exponential average scales the older trials down before adding the new one;
+    // Welford's means stay as they are
+    if (m_decay < 1.0)
+    {
+        switch (m_type)
+        {
+            case AccumulatorType::KahanDouble:
+                for (auto* state : { m_doubleSums,
+                                     m_sumCompensations,
+                                     m_doubleSumSquares,
+                                     m_sumSquareCompensations })
+                    FloatVectorOperations::multiply (state[channel], m_decay, m_numSamples);
+                break;
+            case AccumulatorType::Welford:
+                FloatVectorOperations::multiply (
+                    m_squaredDeviations[channel], m_decay, m_numSamples);
+                break;
+            default:
+                FloatVectorOperations::multiply (
+                    m_sums[channel], static_cast<float> (m_decay), m_numSamples);
+                FloatVectorOperations::multiply (
+                    m_sumSquares[channel], static_cast<float> (m_decay), m_numSamples);
+                break;
+        }
+    }
+
+    // Each kernel updates its sums in one pass over the trial
+    switch (m_type)
+    {
+        case AccumulatorType::KahanDouble:
+            accumulateCompensatedSums (m_doubleSums[channel],
+                                       m_sumCompensations[channel],
+                                       m_doubleSumSquares[channel],
+                                       m_sumSquareCompensations[channel],
+                                       channelData,
+                                       m_numSamples);
+            break;
+        case AccumulatorType::Welford:
+            accumulateWelford (m_means[channel],
+                               m_squaredDeviations[channel],
+                               channelData,
+                               weight,
+                               m_numSamples);
+            break;
+        default:
+            accumulateSumAndSquares (
+                m_sums[channel], m_sumSquares[channel], channelData, m_numSamples);
+            break;
+    }
+}
+void MultiChannelAverageBuffer::SumWriter::removeChannel (int channel,
+                                                         const float* channelData) const
+{
+    jassert (channel >= 0 && channel < m_numChannels);
+    jassert (m_decay == 1.0); // trials of an exponential average fade out instead
+    const double weight = std::max (0.0, m_channelWeights[channel] - 1.0);
+    m_channelWeights[channel] = weight;
+
+    switch (m_type)
+    {
+        case AccumulatorType::KahanDouble:
+            removeCompensatedSums (m_doubleSums[channel],
+                                   m_sumCompensations[channel],
+                                   m_doubleSumSquares[channel],
+                                   m_sumSquareCompensations[channel],
+                                   channelData,
+                                   m_numSamples);
+            break;
+        case AccumulatorType::Welford:
+            removeWelford (m_means[channel],
+                           m_squaredDeviations[channel],
+                           channelData,
+                           weight,
+                           m_numSamples);
+            break;
+        default:
+            removeSumAndSquares (m_sums[channel], m_sumSquares[channel], channelData, m_numSamples);
+            break;
+    }
+}
+void MultiChannelAverageBuffer::SumWriter::addChannelSamples (int channel,
+                                                            const float* channelData,
+                                                            int firstSample,
+                                                            int numSamples) const
+{
+    jassert (channel >= 0 && channel < m_numChannels);
+    jassert (firstSample >= 0 && firstSample + numSamples <= m_numSamples);
+    jassert (m_decay == 1.0);
+
+    switch (m_type)
+    {
+        case AccumulatorType::KahanDouble:
+            accumulateCompensatedSums (m_doubleSums[channel] + firstSample,
+                                       m_sumCompensations[channel] + firstSample,
+                                       m_doubleSumSquares[channel] + firstSample,
+                                       m_sumSquareCompensations[channel] + firstSample,
+                                       channelData,
+                                       numSamples);
+            break;
+        case AccumulatorType::Float:
+            accumulateSumAndSquares (m_sums[channel] + firstSample,
+                                     m_sumSquares[channel] + firstSample,
+                                     channelData,
+                                     numSamples);
+            break;
+        default:
+            assert (false); // Welford's means need the number of trials of every sample
+            break;
+    }
+}
+void MultiChannelAverageBuffer::SumWriter::removeChannelSamples (int channel,
+                                                               const float* channelData,
+                                                               int firstSample,
+                                                               int numSamples) const
+{
+    jassert (channel >= 0 && channel < m_numChannels);
+    jassert (firstSample >= 0 && firstSample + numSamples <= m_numSamples);
+
+    switch (m_type)
+    {
+        case AccumulatorType::KahanDouble:
+            removeCompensatedSums (m_doubleSums[channel] + firstSample,
+                                   m_sumCompensations[channel] + firstSample,
+                                   m_doubleSumSquares[channel] + firstSample,
+                                   m_sumSquareCompensations[channel] + firstSample,
+                                   channelData,
+                                   numSamples);
+            break;
+        case AccumulatorType::Float:
+            removeSumAndSquares (m_sums[channel] + firstSample,
+                                 m_sumSquares[channel] + firstSample,
+                                 channelData,
+                                 numSamples);
+            break;
+        default:
+            assert (false);
+            break;
+    }
+}
+void MultiChannelAverageBuffer::addedTrials (int numTrials, int64 triggerArrivalTicks)
+{
+    m_sums.numTrials += numTrials;
+    noteChange (triggerArrivalTicks);
+}
+void MultiChannelAverageBuffer::removedTrials (int numTrials)
+{
+    jassert (numTrials <= m_sums.numTrials);
+    m_sums.numTrials -= numTrials;
+    m_numRemovedTrials += numTrials;
+    noteChange (0);
+}
+bool MultiChannelAverageBuffer::canAddOpenTrials() const
+{
+    return m_decay == 1.0 && m_sums.accumulatorType != AccumulatorType::Welford;
+}
+int MultiChannelAverageBuffer::getOpenTrialSamples (int trialOffset) const
+{
+    return static_cast<size_t> (trialOffset) < m_openTrialSamples.size()
+               ? m_openTrialSamples[static_cast<size_t> (trialOffset)]
+               : 0;
+}
+void MultiChannelAverageBuffer::addedOpenTrialSamples (int trialOffset, int endSample)
+{
+    jassert (canAddOpenTrials());
+    const int firstSample = getOpenTrialSamples (trialOffset);
+    if (endSample <= firstSample)
+        return;
+
+    if (m_openTrialSamples.size() <= static_cast<size_t> (trialOffset))
+        m_openTrialSamples.resize (static_cast<size_t> (trialOffset) + 1, 0);
+    m_openTrialSamples[static_cast<size_t> (trialOffset)] = endSample;
+
+    auto& openTrials = m_sums.openTrials;
+    openTrials.resize (static_cast<size_t> (m_sums.numSamples), 0);
+    for (int i = firstSample; i < endSample; ++i)
+        ++openTrials[static_cast<size_t> (i)];
+    noteChange (0);
+}
+void MultiChannelAverageBuffer::completeOpenTrial (int64 triggerArrivalTicks)
+{
+    jassert (getOpenTrialSamples (0) == m_sums.numSamples);
+
+    // The trial's samples move from the count of open trials to the weight of each channel
+    for (auto& weight : m_sums.channelWeights)
+        weight += 1.0;
+    m_openTrialSamples.erase (m_openTrialSamples.begin());
+    if (std::ranges::all_of (m_openTrialSamples, [] (int samples) { return samples == 0; }))
+        forgetOpenTrials();
+    else
+        std::ranges::for_each (m_sums.openTrials, [] (int& count) { --count; });
+
+    addedTrials (1, triggerArrivalTicks);
+}
+void MultiChannelAverageBuffer::withdrawOpenTrials (SingleTrialBuffer& trials, int firstTrialOffset)
+{
+    if (static_cast<size_t> (firstTrialOffset) >= m_openTrialSamples.size())
+        return;
+
+    const auto sums = getSumWriter();
+    for (size_t t = static_cast<size_t> (firstTrialOffset); t < m_openTrialSamples.size(); ++t)
+    {
+        const int numSamples = m_openTrialSamples[t];
+        for (int ch = 0; ch < m_sums.numChannels; ++ch)
+        {
+            sums.removeChannelSamples (
+                ch, trials.getNextTrialWritePointer (ch, static_cast<int> (t)), 0, numSamples);
+        }
+        for (int i = 0; i < numSamples; ++i)
+            --m_sums.openTrials[static_cast<size_t> (i)];
+    }
+
+    m_openTrialSamples.resize (static_cast<size_t> (firstTrialOffset));
+    if (std::ranges::all_of (m_openTrialSamples, [] (int samples) { return samples == 0; }))
+        forgetOpenTrials();
+    noteChange (0);
+}
+void MultiChannelAverageBuffer::forgetOpenTrials()
+{
+    m_openTrialSamples.clear();
+    m_sums.openTrials.clear();
+}
+void MultiChannelAverageBuffer::setAverageMode (AverageMode mode, double timeConstant)
+{
+    m_averageMode = mode;
+    m_decay = mode == AverageMode::Exponential ? std::exp (-1.0 / std::max (timeConstant, 1.0))
+                                               : 1.0;
+    if (! canAddOpenTrials())
+        forgetOpenTrials();
+}
+void MultiChannelAverageBuffer::rebuildFromTrials (const SingleTrialBuffer& trials)
+{
+    resetTrials();
+
+    // Trials of another size (e.g. the average buffer was resized alone) are not averaged
+    if (trials.getNumChannels() != m_sums.numChannels
+        || trials.getNumSamples() != m_sums.numSamples)
+        return;
+
+    const auto sums = getSumWriter();
+    for (int ch = 0; ch < m_sums.numChannels; ++ch)
+    {
+        for (int t = 0; t < trials.getNumStoredTrials(); ++t)
+            sums.addChannel (ch, trials.getTrialDataPointer (ch, t));
+    }
+    addedTrials (trials.getNumStoredTrials());
+}
+AudioBuffer<float> MultiChannelAverageBuffer::getAverage() const
+{
+    if (m_sums.numTrials == 0)
+        return {};
+
+    AudioBuffer<float> average (m_sums.numChannels, m_sums.numSamples);
+    for (int ch = 0; ch < m_sums.numChannels; ++ch)
+        computeChannel (ch, average.getWritePointer (ch), nullptr);
+    return average;
+}
+AudioBuffer<float> MultiChannelAverageBuffer::getStandardDeviation() const
+{
+    if (m_sums.numTrials == 0)
+        return {};
+
+    AudioBuffer<float> average (1, m_sums.numSamples);
+    AudioBuffer<float> standardDeviation (m_sums.numChannels, m_sums.numSamples);
+    for (int ch = 0; ch < m_sums.numChannels; ++ch)
+        computeChannel (ch, average.getWritePointer (0), standardDeviation.getWritePointer (ch));
+    return standardDeviation;
+}
+uint64_t MultiChannelAverageBuffer::computeChannel (int channel,
+                                                    float* average,
+                                                    float* standardDeviation) const
+{
+    const uint64_t version = computeChannelVariance (channel, average, standardDeviation);
+    if (standardDeviation != nullptr)
+    {
+        for (int i = 0; i < m_sums.numSamples; ++i)
+            standardDeviation[i] = std::sqrt (standardDeviation[i]);
+    }
+    return version;
+}
+uint64_t MultiChannelAverageBuffer::computeChannelVariance (int channel,
+                                                            float* average,
+                                                            float* variance) const
+{
+    const uint64_t version = getVersion();
+    m_sums.computeChannelVariance (channel, average, variance);
+    return version;
+}
+void MultiChannelAverageBuffer::publishSnapshot (const TrialOrderStatistics* orderStatistics)
+{
+    const bool hasOrderStatistic = orderStatistics != nullptr && orderStatistics->isActive();
+
+    // The versions only ever increase, so their sum changes whenever any does
+    const uint64_t version = getVersion() + m_readersVersion
+                             + (orderStatistics != nullptr ? orderStatistics->getVersion() : 0);
+    if (version == m_publishedVersion)
+        return;
+
+    m_publishedChannels.assign (static_cast<size_t> (m_sums.numChannels), false);
+    for (int ch = 0; ch < m_sums.numChannels; ++ch)
+    {
+        m_publishedChannels[static_cast<size_t> (ch)] =
+            static_cast<size_t> (ch) < m_channelReaders.size()
+            && m_channelReaders[static_cast<size_t> (ch)] > 0;
+    }
+
+    AverageSnapshot& snapshot = m_snapshots.beginUpdate();
+    snapshot.sums.copyFrom (m_sums, m_publishedChannels);
+    snapshot.channels = m_publishedChannels;
+
+    // A median reads one or two rows of the sorted values, but a trimmed mean all rows it
+    // keeps, i.e. a pass over the stored trials of the channel on every publish. So it is
+    // only computed for the channels with a reader.
+    if (hasOrderStatistic)
+    {
+        const int numChannels = orderStatistics->getNumChannels();
+        const int numSamples = orderStatistics->getNumSamples();
+        snapshot.orderStatistic.setSize (numChannels, numSamples, false, false, true);
+        snapshot.orderStatisticNumTrials.resize (static_cast<size_t> (numChannels));
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            snapshot.orderStatisticNumTrials[static_cast<size_t> (ch)] =
+                orderStatistics->getNumTrials (ch);
+            if (snapshot.hasChannel (ch))
+                orderStatistics->computeChannel (ch,
+                                                 snapshot.orderStatistic.getWritePointer (ch));
+        }
+    }
+    else
+    {
+        snapshot.orderStatistic.setSize (0, 0, false, false, true);
+        snapshot.orderStatisticNumTrials.clear();
+    }
+
+    snapshot.version = version;
+    snapshot.triggerArrivalTicks = m_triggerArrivalTicks;
+    snapshot.accumulatedTicks = m_accumulatedTicks;
+    snapshot.displayed.store (false, std::memory_order_relaxed);
+    m_snapshots.publish();
+    m_publishedVersion = version;
+}
+
+void MultiChannelAverageBuffer::addChannelReader (int channel) const
+{
+    jassert (channel >= 0);
+    if (m_channelReaders.size() <= static_cast<size_t> (channel))
+        m_channelReaders.resize (static_cast<size_t> (channel) + 1, 0);
+    ++m_channelReaders[static_cast<size_t> (channel)];
+    ++m_readersVersion;
+}
+void MultiChannelAverageBuffer::removeChannelReader (int channel) const
+{
+    jassert (static_cast<size_t> (channel) < m_channelReaders.size()
+             && m_channelReaders[static_cast<size_t> (channel)] > 0);
+    --m_channelReaders[static_cast<size_t> (channel)];
+    ++m_readersVersion;
+}
+void MultiChannelAverageBuffer::removeChannelReaders()
+{
+    m_channelReaders.clear();
+    ++m_readersVersion;
+}
+
+void MultiChannelAverageBuffer::resetTrials()
+{
+    m_sums.clear();
+    m_numRemovedTrials = 0;
+    forgetOpenTrials();
+    noteChange (0);
+}
+void MultiChannelAverageBuffer::setSize (int nChannels, int nSamples, bool clearTrials)
+{
+    // Samples of trials being written only stay where they were if the layout does
+    if (nChannels != m_sums.numChannels || nSamples != m_sums.numSamples)
+        forgetOpenTrials();
+
+    m_sums.numChannels = nChannels;
+    m_sums.numSamples = nSamples;
+    m_sums.allocate();
+    if (clearTrials)
+        resetTrials();
+    else
+        noteChange (0);
+}
+int MultiChannelAverageBuffer::getNumTrials() const { return m_sums.numTrials; }
+int MultiChannelAverageBuffer::getNumChannels() const { return m_sums.numChannels; }
+int MultiChannelAverageBuffer::getNumSamples() const { return m_sums.numSamples; }
+
+void MultiChannelAverageBuffer::noteChange (int64 triggerArrivalTicks)
+{
+    m_triggerArrivalTicks = triggerArrivalTicks;
+    m_accumulatedTicks = triggerArrivalTicks != 0 ? Time::getHighResolutionTicks() : 0;
+    m_version.fetch_add (1, std::memory_order_release);
+}
+
+void MultiChannelAverageBuffer::setAccumulatorType (AccumulatorType type)
+{
+    if (type == m_sums.accumulatorType)
+        return;
+
+    // Carry the trials over through their sums in double
+    const int numChannels = m_sums.numChannels;
+    const int numSamples = m_sums.numSamples;
+    AudioBuffer<double> sums (numChannels, numSamples);
+    AudioBuffer<double> sumSquares (numChannels, numSamples);
+    for (int ch = 0; ch < numChannels; ++ch)
+        m_sums.getSums (ch, sums.getWritePointer (ch), sumSquares.getWritePointer (ch));
+
+    m_sums.accumulatorType = type;
+    m_sums.allocate();
+
+    for (int ch = 0; ch < numChannels; ++ch)
+        m_sums.setSums (ch, sums.getReadPointer (ch), sumSquares.getReadPointer (ch));
+    if (! canAddOpenTrials())
+        forgetOpenTrials();
+    noteChange (0);
+}
+
+void AverageSums::allocate()
+{
+    const auto allocate = [this] (auto& buffer, AccumulatorType type)
+    {
+        if (type == accumulatorType)
+            buffer.setSize (numChannels, numSamples);
+        else
+            buffer.setSize (0, 0);
+    };
+
+    allocate (sums, AccumulatorType::Float);
+    allocate (sumSquares, AccumulatorType::Float);
+    allocate (doubleSums, AccumulatorType::KahanDouble);
+    allocate (doubleSumSquares, AccumulatorType::KahanDouble);
+    allocate (sumCompensations, AccumulatorType::KahanDouble);
+    allocate (sumSquareCompensations, AccumulatorType::KahanDouble);
+    allocate (means, AccumulatorType::Welford);
+    allocate (squaredDeviations, AccumulatorType::Welford);
+    channelWeights.resize (static_cast<size_t> (numChannels), 0.0);
+}
+
+void AverageSums::clear()
+{
+    sums.clear();
+    sumSquares.clear();
+    doubleSums.clear();
+    doubleSumSquares.clear();
+    sumCompensations.clear();
+    sumSquareCompensations.clear();
+    means.clear();
+    squaredDeviations.clear();
+    std::fill (channelWeights.begin(), channelWeights.end(), 0.0);
+    openTrials.clear();
+    numTrials = 0;
+}
+
+void AverageSums::copyFrom (const AverageSums& other, const std::vector<bool>& channels)
+{
+    accumulatorType = other.accumulatorType;
+    numChannels = other.numChannels;
+    numSamples = other.numSamples;
+    allocate();
+
+    const auto copyChannels = [&] (auto& buffer, const auto& source)
+    {
+        for (int ch = 0; ch < source.getNumChannels(); ++ch)
+        {
+            if (static_cast<size_t> (ch) < channels.size() && channels[static_cast<size_t> (ch)])
+                buffer.copyFrom (ch, 0, source, ch, 0, numSamples);
+        }
+    };
+    copyChannels (sums, other.sums);
+    copyChannels (sumSquares, other.sumSquares);
+    copyChannels (doubleSums, other.doubleSums);
+    copyChannels (doubleSumSquares, other.doubleSumSquares);
+    copyChannels (sumCompensations, other.sumCompensations);
+    copyChannels (sumSquareCompensations, other.sumSquareCompensations);
+    copyChannels (means, other.means);
+    copyChannels (squaredDeviations, other.squaredDeviations);
+    channelWeights = other.channelWeights;
+    openTrials = other.openTrials;
+    numTrials = other.numTrials;
+}
+
+void AverageSums::computeChannelVariance (int channel, float* average, float* variance) const
+{
+    jassert (channel >= 0 && channel < numChannels);
+
+    // The number of trials, unless older ones decay, plus at each sample the trials being
+    // written that reached it
+    const double weight = channelWeights[static_cast<size_t> (channel)];
+    const int* open = openTrials.empty() ? nullptr : openTrials.data();
+    if ((numTrials == 0 || weight <= 0.0) && open == nullptr)
+    {
+        FloatVectorOperations::clear (average, numSamples);
+        if (variance != nullptr)
+            FloatVectorOperations::clear (variance, numSamples);
+        return;
+    }
+
+    if (accumulatorType == AccumulatorType::KahanDouble)
+    {
+        // E[x^2] - E[x]^2 cancels like in float, but double keeps enough digits
+        const double* channelSums = doubleSums.getReadPointer (channel);
+        const double* channelSumCompensations = sumCompensations.getReadPointer (channel);
+        const double* channelSumSquares = doubleSumSquares.getReadPointer (channel);
+        const double* channelSumSquareCompensations =
+            sumSquareCompensations.getReadPointer (channel);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const double sampleWeight = open != nullptr ? weight + open[i] : weight;
+            const double invTrials = sampleWeight > 0.0 ? 1.0 / sampleWeight : 0.0;
+            const double mean = (channelSums[i] - channelSumCompensations[i]) * invTrials;
+            average[i] = static_cast<float> (mean);
+            if (variance != nullptr)
+            {
+                const double meanSquares =
+                    (channelSumSquares[i] - channelSumSquareCompensations[i]) * invTrials;
+                variance[i] = static_cast<float> (std::max (0.0, meanSquares - mean * mean));
+            }
+        }
+        return;
+    }
+
+    if (accumulatorType == AccumulatorType::Welford)
+    {
+        const double invTrials = 1.0 / weight;
+        const double* channelMeans = means.getReadPointer (channel);
+        const double* channelSquaredDeviations = squaredDeviations.getReadPointer (channel);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            average[i] = static_cast<float> (channelMeans[i]);
+            if (variance != nullptr)
+                variance[i] =
+                    static_cast<float> (std::max (0.0, channelSquaredDeviations[i] * invTrials));
+        }
+        return;
+    }
+
+    const float* sumsData = sums.getReadPointer (channel);
+    const float* sumSquaresData = sumSquares.getReadPointer (channel);
+    if (open != nullptr)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const double sampleWeight = weight + open[i];
+            const float invTrials = sampleWeight > 0.0 ? static_cast<float> (1.0 / sampleWeight)
+                                                       : 0.0f;
+            average[i] = sumsData[i] * invTrials;
+            if (variance != nullptr)
+            {
+                const float meanSquares = sumSquaresData[i] * invTrials;
+                variance[i] = std::max (0.0f, meanSquares - (average[i] * average[i]));
+            }
+        }
+        return;
+    }
+
+    const float invTrials = static_cast<float> (1.0 / weight);
+
+    // Use JUCE's SIMD-optimized multiply for the mean
+    FloatVectorOperations::multiply (average, sumsData, invTrials, numSamples);
+
+    if (variance != nullptr)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float meanSquares = sumSquaresData[i] * invTrials;
+            variance[i] = std::max (0.0f, meanSquares - (average[i] * average[i]));
+        }
+    }
+}
+
+void AverageSums::getSums (int channel, double* channelSums, double* channelSumSquares) const
+{
+    const double weight = channelWeights[static_cast<size_t> (channel)];
+    for (int i = 0; i < numSamples; ++i)
+    {
+        switch (accumulatorType)
+        {
+            case AccumulatorType::KahanDouble:
+                channelSums[i] =
+                    doubleSums.getSample (channel, i) - sumCompensations.getSample (channel, i);
+                channelSumSquares[i] = doubleSumSquares.getSample (channel, i)
+                                       - sumSquareCompensations.getSample (channel, i);
+                break;
+            case AccumulatorType::Welford:
+            {
+                const double mean = means.getSample (channel, i);
+                channelSums[i] = mean * weight;
+                channelSumSquares[i] =
+                    squaredDeviations.getSample (channel, i) + mean * mean * weight;
+                break;
+            }
+            default:
+                channelSums[i] = sums.getSample (channel, i);
+                channelSumSquares[i] = sumSquares.getSample (channel, i);
+                break;
+        }
+    }
+}
+
+void AverageSums::setSums (int channel, const double* channelSums, const double* channelSumSquares)
+{
+    const double weight = channelWeights[static_cast<size_t> (channel)];
+    for (int i = 0; i < numSamples; ++i)
+    {
+        switch (accumulatorType)
+        {
+            case AccumulatorType::KahanDouble:
+                doubleSums.setSample (channel, i, channelSums[i]);
+                doubleSumSquares.setSample (channel, i, channelSumSquares[i]);
+                sumCompensations.setSample (channel, i, 0.0);
+                sumSquareCompensations.setSample (channel, i, 0.0);
+                break;
+            case AccumulatorType::Welford:
+            {
+                const double mean = weight > 0.0 ? channelSums[i] / weight : 0.0;
+                means.setSample (channel, i, mean);
+                squaredDeviations.setSample (
+                    channel, i, std::max (0.0, channelSumSquares[i] - channelSums[i] * mean));
+                break;
+            }
+            default:
+                sums.setSample (channel, i, static_cast<float> (channelSums[i]));
+                sumSquares.setSample (channel, i, static_cast<float> (channelSumSquares[i]));
+                break;
+        }
     }
 }
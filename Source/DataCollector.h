@@ -22,11 +22,24 @@
 
 */
 #pragma once
+#include "AccumulateKernels.h"
+#include "BoundedMpscQueue.h"
+#include "CaptureWorkerPool.h"
 #include "MultiChannelRingBuffer.h"
 #include "SingleTrialBuffer.h"
+#include "SnapshotPublisher.h"
+#include "TrialOrderStatistics.h"
+#include "Ui/PerformanceTimer.h"
 
 #include <JuceHeader.h>
 #include <ProcessorHeaders.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
 
 namespace TriggeredAverage
 {
@@ -35,12 +48,38 @@ class TriggeredAvgNode;
 class TriggerSource;
 class MultiChannelRingBuffer;
 
+/** Time::getHighResolutionTicks() at the steps of a capture, 0 where not stamped (yet) */
+struct CaptureTimestamps
+{
+    int64 triggerArrival = 0; // the TTL event was handled
+    int64 dequeued = 0; // the collector took the request from the queue
+    int64 windowComplete = 0; // the collector found the whole window in the ring
+};
+
 struct CaptureRequest
 {
     TriggerSource* triggerSource;
-    SampleNumber triggerSample;
+    SampleNumber triggerSample; // in samples of the stream given by streamId
     int preSamples;
     int postSamples;
+    StreamId streamId = 0;
+    CaptureTimestamps timestamps {};
+};
+
+/** What the collector does with a new request when its stream's backlog is full */
+enum class BacklogPolicy
+{
+    DropOldest, // evict the pending request with the oldest trigger
+    DropNewest, // reject the new request
+    Coalesce // replace the newest pending request of the same source, else reject
+};
+
+/** Which trials an average covers */
+enum class AverageMode
+{
+    AllTrials, // every trial since the last reset
+    LastTrials, // the trials held by the source's trial buffer, i.e. the last max_trials
+    Exponential // all trials, each weighted down by a factor of e per time constant of trials
 };
 
 /** JUCE-aware wrapper around SingleTrialBuffer that provides AudioBuffer convenience methods */
@@ -103,78 +142,460 @@ public:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SingleTrialBufferJuce)
 };
 
-// Thread-safe storage of average buffers
+// Thread-safe storage of average buffers, one set per trigger source and data stream.
+//
+// The buffers of each source and stream have their own lock, so capturing trials of one
+// source never waits for readers of another. Buffers are only created once and stay at the
+// same address until the DataStore is destroyed; Clear() just frees their memory.
 class DataStore
 {
 public:
-    void ResetAndResizeBuffersForTriggerSource (TriggerSource* source, int nChannels, int nSamples);
+    DataStore();
+    ~DataStore();
+
+    /** Sets up the buffers of a source to capture all nChannels channels of a stream */
+    void ResetAndResizeBuffersForTriggerSource (TriggerSource* source,
+                                                int nChannels,
+                                                int nSamples,
+                                                StreamId streamId = 0);
+
+    /** Sets up the buffers of a source to capture a subset of a stream's channels. Buffer
+        channel i holds the stream channel with local index channels[i]. */
+    void ResetAndResizeBuffersForTriggerSource (TriggerSource* source,
+                                                const std::vector<int>& channels,
+                                                int nSamples,
+                                                StreamId streamId = 0);
     void ResizeAllAverageBuffers (int nChannels, int nSamples, bool clear = true);
 
-    MultiChannelAverageBuffer* getRefToAverageBufferForTriggerSource (TriggerSource* source)
+    /** Changes the number of samples of all average buffers of a stream, keeping their
+        channels */
+    void ResizeAverageBuffersForStream (StreamId streamId, int nSamples, bool clear = true);
+
+    MultiChannelAverageBuffer* getRefToAverageBufferForTriggerSource (TriggerSource* source,
+                                                                      StreamId streamId = 0);
+    SingleTrialBufferJuce* getRefToTrialBufferForTriggerSource (TriggerSource* source,
+                                                                StreamId streamId = 0);
+
+    /** Sorted values of the stored trials of a source, kept up to date by the collector
+        while a median or trimmed mean is selected */
+    TrialOrderStatistics* getRefToOrderStatisticsForTriggerSource (TriggerSource* source,
+                                                                   StreamId streamId = 0);
+
+    /** Local indices of the stream channels held by the buffers of a source, or nullptr if
+        the buffers were not set up yet */
+    const std::vector<int>* getChannelMapForTriggerSource (TriggerSource* source,
+                                                           StreamId streamId = 0);
+
+    /** Lock of the buffers of a source on a stream. Valid, like the buffers, for the
+        lifetime of the DataStore, even before they are set up. */
+    std::recursive_mutex& getMutexForTriggerSource (TriggerSource* source,
+                                                    StreamId streamId = 0);
+
+    /** Keeps other threads from changing the buffers of a source on a stream while held */
+    std::unique_lock<std::recursive_mutex> GetLockForTriggerSource (TriggerSource* source,
+                                                                    StreamId streamId = 0)
     {
-        if (m_averageBuffers.contains (source))
-            return &m_averageBuffers.at (source);
-        return nullptr;
+        return std::unique_lock<std::recursive_mutex> (
+            getMutexForTriggerSource (source, streamId));
     }
 
-    SingleTrialBufferJuce* getRefToTrialBufferForTriggerSource (TriggerSource* source)
-    {
-        if (m_singleTrialBuffers.contains (source))
-            return &m_singleTrialBuffers.at (source);
-        return nullptr;
-    }
+    /** Publishes the snapshots of the average buffers of all sources that changed since
+        their last one, for the plots. Holds one source's lock at a time. The changes made
+        through the DataStore itself are published right away. */
+    void publishSnapshots();
 
-    std::scoped_lock<std::recursive_mutex> GetLock()
-    {
-        return std::scoped_lock<std::recursive_mutex> (m_mutex);
-    }
+    /** Like publishSnapshots(), but skips the sources whose lock is taken, for readers that
+        must not wait for a capture, e.g. plots whose channel was not published yet */
+    void tryPublishSnapshots();
 
-    void Clear()
-    {
-        auto lock = GetLock();
-        m_averageBuffers.clear();
-        m_singleTrialBuffers.clear();
-    }
+    /** Frees the buffers of all sources, one source at a time, and drops their readers */
+    void Clear();
 
     void ResetAllBuffers();
 
+    /** Sets how many trials the trial buffers of all sources, and those set up later, keep.
+        The most recent trials are kept, and a sliding window average covers those left. */
     void setMaxTrialsToStore (int n);
 
+    /** Switches how the average buffers of all sources, and those set up later, accumulate
+        their trials. The trials accumulated so far are kept. */
+    void setAccumulatorType (AccumulatorType type);
+
+    /** Sets which trials the averages of all sources, and those set up later, cover. The
+        averages start over from the stored trials, since the sums of the others do not
+        tell them apart. */
+    void setAverageMode (AverageMode mode, double timeConstant);
+
+    /** Selects the statistic the plots of all sources, and those set up later, show. The
+        median and trimmed mean are taken over the stored trials, which are sorted for them
+        from now on. */
+    void setAverageStatistic (AverageStatistic statistic, float trimFraction);
+
 private:
-    std::recursive_mutex m_mutex;
-    std::unordered_map<TriggerSource*, MultiChannelAverageBuffer> m_averageBuffers;
-    std::unordered_map<TriggerSource*, SingleTrialBufferJuce> m_singleTrialBuffers;
+    using BufferKey = std::pair<TriggerSource*, StreamId>;
+    struct SourceBuffers;
+
+    SourceBuffers& getOrCreateSourceBuffers (TriggerSource* source, StreamId streamId);
+
+    /** Buffers of a source, or nullptr if they were not set up yet */
+    SourceBuffers* findSetUpSourceBuffers (TriggerSource* source, StreamId streamId);
+
+    /** Calls function (key, buffers) for the buffers of every source, holding only the lock
+        of the source at hand, and publishes the snapshot of each that changed */
+    template <typename Function>
+    void forEachSource (Function&& function);
+
+    // Guards the map itself, not the buffers, and is never held while waiting for the lock
+    // of a source
+    std::mutex m_sourcesMutex;
+    std::map<BufferKey, std::unique_ptr<SourceBuffers>> m_sources;
+
+    std::atomic<int> m_maxTrialsToStore = SingleTrialBufferSize {}.maxTrials;
+    std::atomic<AccumulatorType> m_accumulatorType = AccumulatorType::Float;
+    std::atomic<AverageMode> m_averageMode = AverageMode::AllTrials;
+    std::atomic<double> m_averageTimeConstant = 20.0;
+    std::atomic<AverageStatistic> m_averageStatistic = AverageStatistic::Mean;
+    std::atomic<float> m_trimFraction = 0.1f;
+
+    JUCE_DECLARE_NON_COPYABLE (DataStore)
 };
 
 class DataCollector : public Thread
 {
 public:
+    /** The ring buffer passed here (if any) serves requests for stream 0 */
     DataCollector (TriggeredAvgNode*, MultiChannelRingBuffer*, DataStore*);
     ~DataCollector() override;
     void run() override;
     void registerTriggerSource (const TriggerSource*);
-    void registerCaptureRequest (const CaptureRequest&);
+
+    /** Queues a request for the collector thread. Lock- and allocation-free, so it can be
+        called from the audio thread. Returns false and counts the request as dropped if
+        the queue is full. */
+    bool registerCaptureRequest (const CaptureRequest&);
+
+    /** Number of requests dropped because the capture request queue was full */
+    uint64_t getNumDroppedCaptureRequests() const
+    {
+        return m_numDroppedCaptureRequests.load (std::memory_order_relaxed);
+    }
+
+    /** Sets the ring buffer serving requests for a stream. Must be called before the thread
+        is started. The ring buffer wakes the thread up when data that requests wait for
+        arrives, until the collector is destroyed. */
+    void setRingBufferForStream (StreamId streamId, MultiChannelRingBuffer* ringBuffer);
+
+    /** Sets the number of threads capturing trials, including the collector thread. Large
+        captures are split into blocks of channels that the threads copy and accumulate in
+        parallel. Must be called before the thread is started. */
+    void setNumCaptureThreads (int numThreads);
+    int getNumCaptureThreads() const { return m_workerPool->getNumThreads(); }
+
+    /** If enabled, the window of every request is copied into its trial buffer slot block by
+        block as the samples arrive, while they are still in cache, instead of being read
+        back from the ring once complete. The trial is added to the average when its window
+        closes. Must be called before the thread is started. */
+    void setStreamingCapture (bool shouldStream);
+
+    /** Limits the number of requests per stream waiting for their data or being streamed.
+        Requests beyond it are dropped according to the policy and counted in the
+        captureCounters of their source. Must be called before the thread is started. */
+    void setCaptureBacklog (int maxPendingRequests, BacklogPolicy policy);
+
+    /** Sets where the latencies of the capture stages are recorded, or nullptr to not record
+        them. Must be called before the thread is started. */
+    void setLatencyStats (CaptureLatencyStats* stats);
 
 private:
+    /** Request of a streaming capture whose window is copied into its trial buffer slot
+        as the samples arrive */
+    struct OpenWindow
+    {
+        CaptureRequest request;
+        SampleNumber copiedUpTo; // samples of the window before this are in the slot
+        uint64_t trialBufferGeneration = 0; // layout of the trial buffer the slot belongs to
+    };
+
+    /** Capture state of one data stream */
+    struct StreamState
+    {
+        MultiChannelRingBuffer* ringBuffer = nullptr;
+
+        // Requests waiting for the end of their window to arrive in the ring, as a min-heap
+        // on the window end
+        std::vector<CaptureRequest> pendingRequests;
+
+        // Streaming captures, in the order of their trial buffer slots per trigger source
+        std::vector<OpenWindow> openWindows;
+
+        // Newest sample number seen in the ring, to detect jumps back in time
+        SampleNumber lastKnownSampleNumber = 0;
+    };
+
+    /** Buffers a capture request is stored in. Only valid while the lock of its source is
+        held. */
+    struct CaptureTarget
+    {
+        MultiChannelAverageBuffer* averageBuffer = nullptr;
+        SingleTrialBufferJuce* trialBuffer = nullptr;
+        TrialOrderStatistics* orderStatistics = nullptr;
+        const std::vector<int>* channelMap = nullptr;
+
+        /** The order statistics if trials are sorted into them, else nullptr */
+        TrialOrderStatistics* getActiveOrderStatistics() const
+        {
+            if (orderStatistics != nullptr && orderStatistics->isActive())
+                return orderStatistics;
+            return nullptr;
+        }
+    };
+
+    /** Trial of a batch that is being written into its trial buffer */
+    struct BatchTrial
+    {
+        CaptureTarget target;
+        int trialOffset; // slot after the next trial of the trial buffer
+        int windowOffset; // first sample relative to the start of the batch window
+    };
+
+    // Requests that can be queued before the collector thread takes them
+    static constexpr size_t captureRequestQueueSize = 4096;
+
+    // Smallest share of a capture, in samples, that is worth handing to another thread
+    static constexpr int minimumSamplesPerChunk = 32768;
+
+    // Upper bound on the number of requests captured in one pass over the ring
+    static constexpr int maximumNumberOfTrialsPerBatch = 64;
+
+    // Trials taken out of a sliding-window average before its sums are rebuilt from the
+    // stored trials, which bounds their rounding errors
+    static constexpr int maximumRemovedTrialsBeforeRebuild = 1024;
+
+    bool m_streamingCapture = false;
+    size_t m_maxPendingRequests = captureRequestQueueSize;
+    BacklogPolicy m_backlogPolicy = BacklogPolicy::DropOldest;
+    CaptureLatencyStats* m_latencyStats = nullptr;
+
     // dependencies
     TriggeredAvgNode* m_processor;
-    MultiChannelRingBuffer* ringBuffer;
+    std::map<StreamId, StreamState> m_streams;
     DataStore* m_datastore;
 
     // data
-    std::deque<CaptureRequest> captureRequestQueue;
-    AudioBuffer<float> m_collectBuffer;
+    BoundedMpscQueue<CaptureRequest> m_captureRequestQueue { captureRequestQueueSize };
+    std::atomic<uint64_t> m_numDroppedCaptureRequests = 0;
 
-    // synchronization
-    CriticalSection triggerQueueLock;
-    WaitableEvent newTriggerEvent;
+    // Reused across batches so capturing does not allocate once they reached their size
+    std::vector<CaptureRequest> m_requestBatch;
+    std::vector<CaptureRequest> m_readyRequests;
+    std::vector<TriggerSource*> m_openWindowSources;
+    std::vector<BatchTrial> m_batchTrials;
+    std::vector<int> m_batchTrialChannels; // per trial and stream channel: trial channel or -1
+    std::vector<std::vector<float>> m_batchChannelData; // per capture thread: one channel
+
+    std::unique_ptr<CaptureWorkerPool> m_workerPool;
 
-    RingBufferReadResult processCaptureRequest (const CaptureRequest&);
+    // synchronization
+    WaitableEvent newTriggerEvent; // signalled by new requests and by the ring buffers
+
+    // Set by the first request queued since the collector last drained the queue, so a
+    // burst of triggers signals newTriggerEvent only once
+    std::atomic<bool> m_newRequestsSignalled = false;
+
+    /** Adds a new request to the pending requests of its stream, making room for it
+        according to the backlog policy */
+    void admitCaptureRequest (const CaptureRequest& request);
+
+    /** Removes a pending request or open window to make room for a new request. Returns
+        false if the new request has to be dropped instead. */
+    bool makeRoomInBacklog (StreamState& stream, const CaptureRequest& request);
+
+    /** Removes an open window; the later windows of its source move to other slots and
+        start over */
+    void dropOpenWindow (std::vector<OpenWindow>& openWindows, size_t index);
+
+    /** Takes the samples of the open windows of a request's source, from the window in
+        slot firstTrialOffset on, back out of its average */
+    void withdrawOpenTrials (const CaptureRequest& request, int firstTrialOffset);
+
+    /** Adds a request to the pending requests of a stream */
+    void parkCaptureRequest (StreamState& stream, const CaptureRequest& request);
+
+    /** Drops the pending requests of a stream if its sample numbers jumped back in time,
+        e.g. because a FileReader looped. Their data will never arrive. */
+    void dropRequestsAfterTimeJump (StreamState& stream);
+
+    /** Captures the pending requests of a stream whose data has arrived and asks the ring
+        buffer for a wakeup when the next one is complete. Returns true if any average
+        buffer was updated. */
+    bool processReadyRequests (StreamState& stream);
+
+    /** Copies the samples that arrived since the last call into the slots of the open
+        windows of a stream and stores the trials whose window is complete, taking the lock
+        of each source once. Returns true if any average buffer was updated. */
+    bool processOpenWindows (StreamState& stream);
+
+    /** Stores the trial of an open window whose samples have all been copied into the
+        first of the next slots of its trial buffer. Returns false if it is not complete yet,
+        or its slot moved. The lock of its source must be held. */
+    bool storeOpenWindow (OpenWindow& window);
+
+    /** Copies the next samples of an open window into its slot, trialOffset slots after the
+        next trial of its trial buffer. Returns false if the window was dropped because its
+        samples cannot be read anymore. The lock of its source must be held. */
+    bool advanceOpenWindow (OpenWindow& window,
+                            int trialOffset,
+                            MultiChannelRingBuffer* ringBuffer);
+
+    /** Captures ready requests of one stream, sorted by trigger sample. Overlapping windows
+        are captured together. Returns true if any average buffer was updated. */
+    bool processCaptureRequestsForStream (StreamState& stream,
+                                          std::span<const CaptureRequest> requests);
+
+    /** Number of requests from the start of requests that can be captured as one batch */
+    static size_t getBatchSize (std::span<const CaptureRequest> requests,
+                                const MultiChannelRingBuffer& ringBuffer);
+
+    /** Captures overlapping requests in one pass over the ring: each channel of their
+        combined window is read once and copied into every trial covering it. Returns false
+        without storing anything if the window cannot be captured as a whole. */
+    bool processCaptureBatch (std::span<const CaptureRequest> batch,
+                              MultiChannelRingBuffer* ringBuffer);
+
+    RingBufferReadResult processCaptureRequest (const CaptureRequest&, MultiChannelRingBuffer*);
+
+    /** Number of channels of nSamples each that a capture thread takes at once */
+    static int getChannelsPerChunk (int nSamples);
+
+    /** Adds the newest nTrials trials of a trial buffer to its average buffer, with the
+        channels split across the capture threads. triggerArrivalTicks is the arrival of the
+        oldest of their triggers, for measuring the latency until the average is shown. */
+    void addNewTrialsToAverage (const CaptureTarget& target,
+                                int nTrials,
+                                int64 triggerArrivalTicks);
+
+    /** Frees the slots of the next nTrials trials of a trial buffer before they are
+        written. In LastTrials mode, the stored trials in them leave the average, and they
+        always leave the sorted values. For an open window that is when the window opens,
+        not when it completes: a slot cannot hold the old trial and the new samples at
+        once. The lock of the buffers' source must be held. */
+    void releaseTrialSlots (const CaptureTarget& target, int nTrials);
+
+    /** Records the latency from startTicks to now for a stage of a capture */
+    void recordLatency (CaptureLatencyStats::Stage stage, int64 startTicks) const;
+
+    /** Counts a request whose trial was added to the average and records its latency */
+    void noteCaptured (const CaptureRequest& request);
+
+    /** Returns the buffers of a request, creating or resizing them to nSamples if needed.
+        The lock of the request's source must be held. */
+    CaptureTarget getCaptureTarget (const CaptureRequest& request,
+                                    int nSamples,
+                                    int nStreamChannels);
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DataCollector)
     JUCE_DECLARE_NON_MOVEABLE (DataCollector)
 };
 
+/**
+ * @brief Running sums of the trials of an average, in the layout of an accumulator type
+ *
+ * Held by a MultiChannelAverageBuffer, which adds trials to them, and copied into the
+ * snapshots it publishes, from which readers compute the average of their channels.
+ */
+struct AverageSums
+{
+    AccumulatorType accumulatorType = AccumulatorType::Float;
+
+    // Only the buffers of the accumulator type are allocated
+    juce::AudioBuffer<float> sums;
+    juce::AudioBuffer<float> sumSquares;
+    juce::AudioBuffer<double> doubleSums;
+    juce::AudioBuffer<double> doubleSumSquares;
+    juce::AudioBuffer<double> sumCompensations;
+    juce::AudioBuffer<double> sumSquareCompensations;
+    juce::AudioBuffer<double> means;
+    juce::AudioBuffer<double> squaredDeviations;
+
+    // Total weight of the trials of each channel, updated as they are added: their number,
+    // unless the older ones decay
+    std::vector<double> channelWeights;
+
+    // Per sample, the trials being written whose sample is in the sums already and counts on
+    // top of the channel weight. Empty while no trial is being written.
+    std::vector<int> openTrials;
+    int numTrials = 0;
+    int numChannels = 0;
+    int numSamples = 0;
+
+    /** Sizes the buffers of the accumulator type to numChannels and numSamples and frees
+        the others */
+    void allocate();
+
+    /** Zeroes the sums of all channels */
+    void clear();
+
+    /** Takes on the sums of another, reusing the memory of these where it is large enough.
+        Only the sums of the channels set in channels are copied; the others keep whatever
+        they held. */
+    void copyFrom (const AverageSums& other, const std::vector<bool>& channels);
+
+    /** Computes the average of one channel, and its variance unless variance is nullptr,
+        into numSamples values each. The variance is never negative. */
+    void computeChannelVariance (int channel, float* average, float* variance) const;
+
+    /** Sum of a channel's trials and of their squares at each sample, in double */
+    void getSums (int channel, double* sums, double* sumSquares) const;
+
+    /** Sets the state of a channel from the sums of its trials and their squares */
+    void setSums (int channel, const double* sums, const double* sumSquares);
+};
+
+/**
+ * @brief State of an average buffer and its order statistic at one change, for the UI
+ *
+ * Published by the buffer under the lock of its source and read without it, so a plot
+ * never waits for a capture. Immutable while read.
+ */
+struct AverageSnapshot
+{
+    // Only the channels that had a reader when it was published hold their sums
+    AverageSums sums;
+    std::vector<bool> channels;
+
+    // The median or trimmed mean of the stored trials, if selected, and the number of
+    // trials of each channel it was taken over. Empty for the mean.
+    juce::AudioBuffer<float> orderStatistic;
+    std::vector<int> orderStatisticNumTrials;
+
+    // Increases with every change of the buffer or its order statistic
+    uint64_t version = 0;
+
+    // Time::getHighResolutionTicks() of the trigger of the oldest trial added by the last
+    // change and of the change itself, 0 if the change did not add trials
+    int64 triggerArrivalTicks = 0;
+    int64 accumulatedTicks = 0;
+
+    // Set by the first reader to show the snapshot, which records its display latency
+    mutable std::atomic<bool> displayed = false;
+
+    /** True if the sums of the channel were published, see
+        MultiChannelAverageBuffer::addChannelReader() */
+    bool hasChannel (int channel) const
+    {
+        return channel >= 0 && static_cast<size_t> (channel) < channels.size()
+               && channels[static_cast<size_t> (channel)];
+    }
+
+    /** True if a median or trimmed mean of the channel is held rather than the sums' mean */
+    bool hasOrderStatistic (int channel) const
+    {
+        return hasChannel (channel)
+               && static_cast<size_t> (channel) < orderStatisticNumTrials.size()
+               && orderStatistic.getNumSamples() == sums.numSamples;
+    }
+};
+
 class MultiChannelAverageBuffer
 {
 public:
@@ -186,33 +607,197 @@ public:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultiChannelAverageBuffer)
 
     void addDataToAverageFromBuffer (const juce::AudioBuffer<float>& buffer);
+    void addDataToAverage (const float* const* channelData, int nChannels, int nSamples);
+
+    /** Adds one channel of a trial to the sums. Lets several trials be added channel by
+        channel; they count once addedTrials() is called. */
+    void addChannelToSums (int channel, const float* channelData);
+
+    /** Adds channels of trials to the sums like addChannelToSums(), from several threads at
+        once as long as each channel is added by one thread only. Obtained on one thread;
+        valid until the buffer is resized or its accumulator type changes. */
+    class SumWriter
+    {
+    public:
+        void addChannel (int channel, const float* channelData) const;
+
+        /** Takes a channel of a trial that was added before back out of the sums */
+        void removeChannel (int channel, const float* channelData) const;
+
+        /** Adds samples [firstSample, firstSample + numSamples) of a channel of a trial that
+            is being written, without counting the trial. Only if canAddOpenTrials(). */
+        void addChannelSamples (int channel,
+                                const float* channelData,
+                                int firstSample,
+                                int numSamples) const;
+
+        /** Takes samples added with addChannelSamples() back out of the sums */
+        void removeChannelSamples (int channel,
+                                   const float* channelData,
+                                   int firstSample,
+                                   int numSamples) const;
+
+    private:
+        friend class MultiChannelAverageBuffer;
+        AccumulatorType m_type = AccumulatorType::Float;
+        double m_decay = 1.0;
+        float* const* m_sums = nullptr;
+        float* const* m_sumSquares = nullptr;
+        double* const* m_doubleSums = nullptr;
+        double* const* m_doubleSumSquares = nullptr;
+        double* const* m_sumCompensations = nullptr;
+        double* const* m_sumSquareCompensations = nullptr;
+        double* const* m_means = nullptr;
+        double* const* m_squaredDeviations = nullptr;
+        double* m_channelWeights = nullptr;
+        int m_numChannels = 0;
+        int m_numSamples = 0;
+    };
+
+    SumWriter getSumWriter();
+
+    /** Completes numTrials trials whose channels were added with addChannelToSums().
+        triggerArrivalTicks is the arrival of the oldest of their triggers, if stamped.
+        Only the sums are updated; averages are computed when they are read. */
+    void addedTrials (int numTrials, int64 triggerArrivalTicks = 0);
+
+    /** Completes the removal of numTrials trials taken out with SumWriter::removeChannel() */
+    void removedTrials (int numTrials);
+
+    /** True if trials can be added sample by sample while they are written into the trial
+        buffer, which plain and compensated sums of trials that do not decay allow. The
+        samples then count in the average as soon as they arrive. */
+    bool canAddOpenTrials() const;
+
+    /** Samples of the trial written trialOffset slots after the next trial of the trial
+        buffer that are in the sums, from its first sample on */
+    int getOpenTrialSamples (int trialOffset) const;
+
+    /** Completes adding samples [getOpenTrialSamples (trialOffset), endSample) of a trial
+        being written with SumWriter::addChannelSamples(), once they were added to every
+        channel. The trial counts once completeOpenTrial() is called. */
+    void addedOpenTrialSamples (int trialOffset, int endSample);
+
+    /** Counts the first trial being written, all of whose samples are in the sums, as a
+        trial of the average. The other trials being written move one slot closer. */
+    void completeOpenTrial (int64 triggerArrivalTicks);
+
+    /** Takes the samples of the trials being written from firstTrialOffset on back out of
+        the sums, reading them from their slots in trials, e.g. before the slots move */
+    void withdrawOpenTrials (SingleTrialBuffer& trials, int firstTrialOffset);
+
+    /** Trials removed since the sums were last reset. Removing leaves rounding errors in
+        the sums, so they are rebuilt from the stored trials from time to time. */
+    int getNumRemovedTrials() const { return m_numRemovedTrials; }
+
+    /** Sets which trials the average covers. In Exponential mode, the weight of each trial
+        decays by a factor of e over timeConstant newer trials. Applies to the trials added
+        from now on; DataStore::setAverageMode() also rebuilds the sums. */
+    void setAverageMode (AverageMode mode, double timeConstant);
+    AverageMode getAverageMode() const { return m_averageMode; }
+
+    /** Replaces the sums by those of the trials stored in a trial buffer, oldest first, or
+        clears them if the trials have another size */
+    void rebuildFromTrials (const SingleTrialBuffer& trials);
+
+    /** Switches how trials are accumulated. The trials accumulated so far are converted,
+        so the average carries on. Trials being written that the new type cannot hold must
+        have been withdrawn, unless the sums are reset next. The lock of the buffer's source
+        must be held. */
+    void setAccumulatorType (AccumulatorType type);
+    AccumulatorType getAccumulatorType() const { return m_sums.accumulatorType; }
+
+    /** Average and standard deviation of all channels, computed from the sums */
     AudioBuffer<float> getAverage() const;
     AudioBuffer<float> getStandardDeviation() const;
 
+    /** Computes the average of one channel, and its standard deviation unless
+        standardDeviation is nullptr, from the sums into numSamples values each. Readers only
+        pay for the channels they draw, however often trials are added. Returns the version
+        of the values. The lock of the buffer's source must be held; readers on other threads
+        compute from getSnapshot() instead. */
+    uint64_t computeChannel (int channel, float* average, float* standardDeviation) const;
+
+    /** Like computeChannel(), but with the variance, for readers that take its square root
+        themselves, e.g. to draw error bands. The variance is never negative. */
+    uint64_t computeChannelVariance (int channel, float* average, float* variance) const;
+
+    /** The number of trials averaged in a channel, or their total weight if the older ones
+        decay. The lock of the buffer's source must be held. */
+    double getChannelWeight (int channel) const
+    {
+        return m_sums.channelWeights[static_cast<size_t> (channel)];
+    }
+
+    /** Increases with every change of the buffer, e.g. added trials. Lock-free. */
+    uint64_t getVersion() const { return m_version.load (std::memory_order_acquire); }
+
+    /** Publishes the sums, and the median or trimmed mean of orderStatistics if one is
+        selected, for readers on other threads, unless neither changed since the last time.
+        Copies, and computes the order statistic of, only the channels that have a reader,
+        so the collector publishes once per wake-up rather than per trial. The lock of the
+        buffer's source must be held. */
+    void publishSnapshot (const TrialOrderStatistics* orderStatistics);
+
+    /** Adds a reader of a channel, e.g. a plot in view. Snapshots only hold the channels
+        with a reader, so publishing costs as much as the channels shown, not as the channels
+        captured; the next snapshot holds the new channel. The lock of the buffer's source
+        must be held. */
+    void addChannelReader (int channel) const;
+
+    /** Removes a reader added with addChannelReader(). The lock of the buffer's source must
+        be held. */
+    void removeChannelReader (int channel) const;
+
+    /** Removes the readers of all channels, e.g. before the plots are set up again. The
+        lock of the buffer's source must be held. */
+    void removeChannelReaders();
+
+    /** The snapshot published last, or none before the first. Lock-free; the snapshot does
+        not change while it is held. */
+    SnapshotPublisher<AverageSnapshot>::Reader getSnapshot() const { return m_snapshots.read(); }
+
+    /** Time::getHighResolutionTicks() of the trigger of the oldest trial added by the last
+        change and of the change itself, 0 if the change did not add trials. The lock of the
+        buffer's source must be held. */
+    int64 getTriggerArrivalTicks() const { return m_triggerArrivalTicks; }
+    int64 getAccumulatedTicks() const { return m_accumulatedTicks; }
+
     void resetTrials();
     int getNumTrials() const;
     int getNumChannels() const;
     int getNumSamples() const;
-    void setSize (int nChannels, int nSamples, bool clearTrials = true)
-    {
-        m_numChannels = nChannels;
-        m_numSamples = nSamples;
-        m_sumBuffer.setSize (nChannels, nSamples);
-        m_sumSquaresBuffer.setSize (nChannels, nSamples);
-        m_averageBuffer.setSize (nChannels, nSamples);
-        if (clearTrials)
-            resetTrials();
-    }
+    void setSize (int nChannels, int nSamples, bool clearTrials = true);
 
 private:
-    juce::AudioBuffer<float> m_sumBuffer;
-    juce::AudioBuffer<float> m_sumSquaresBuffer;
-    juce::AudioBuffer<float> m_averageBuffer;
-    int m_numTrials = 0;
-    int m_numChannels;
-    int m_numSamples;
-
-    void updateRunningAverage();
+    AverageSums m_sums;
+
+    AverageMode m_averageMode = AverageMode::AllTrials;
+    double m_decay = 1.0; // of the weight of the older trials per new one
+    int m_numRemovedTrials = 0;
+
+    // By trial offset, see getOpenTrialSamples()
+    std::vector<int> m_openTrialSamples;
+
+    std::atomic<uint64_t> m_version = 0;
+    int64 m_triggerArrivalTicks = 0;
+    int64 m_accumulatedTicks = 0;
+
+    SnapshotPublisher<AverageSnapshot> m_snapshots;
+    uint64_t m_publishedVersion = 0;
+
+    // Readers of each channel, by channel, and how often they changed. Readers do not
+    // change the average, so they are registered through a const buffer.
+    mutable std::vector<int> m_channelReaders;
+    mutable uint64_t m_readersVersion = 0;
+    std::vector<bool> m_publishedChannels;
+
+    /** Increases the version after a change that added trials of triggerArrivalTicks, if
+        stamped */
+    void noteChange (int64 triggerArrivalTicks);
+
+    /** Forgets the trials being written, whose samples no longer count in the sums */
+    void forgetOpenTrials();
 };
 
 } // namespace TriggeredAverage
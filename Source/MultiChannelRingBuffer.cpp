@@ -23,102 +23,638 @@
 */
 #include "MultiChannelRingBuffer.h"
 #include <algorithm>
+#include <bit>
+#include <cmath>
 #include <juce_audio_basics/juce_audio_basics.h> // for AudioBuffer
+#include <thread>
+
+#if JUCE_INTEL
+#include <emmintrin.h>
+#endif
 
 using namespace TriggeredAverage;
 using namespace juce;
 
-MultiChannelRingBuffer::MultiChannelRingBuffer (int numChannels_, int bufferSize_)
-    : m_buffer (numChannels_, bufferSize_),
+namespace
+{
+/** Converts floats to 16-bit integers: round ((value - offset) * inverseScale), saturating.
+    Returns the number of samples outside the int16 range. */
+int quantize (const float* source,
+              std::int16_t* destination,
+              int numSamples,
+              float inverseScale,
+              float offset)
+{
+    int i = 0;
+    int numClipped = 0;
+
+#if JUCE_INTEL
+    const __m128 offsets = _mm_set1_ps (offset);
+    const __m128 inverseScales = _mm_set1_ps (inverseScale);
+    const __m128 lowest = _mm_set1_ps (-32768.0f);
+    const __m128 highest = _mm_set1_ps (32767.0f);
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m128 low =
+            _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (source + i), offsets), inverseScales);
+        const __m128 high =
+            _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (source + i + 4), offsets), inverseScales);
+
+        const int clippedLow = _mm_movemask_ps (
+            _mm_or_ps (_mm_cmplt_ps (low, lowest), _mm_cmpgt_ps (low, highest)));
+        const int clippedHigh = _mm_movemask_ps (
+            _mm_or_ps (_mm_cmplt_ps (high, lowest), _mm_cmpgt_ps (high, highest)));
+        numClipped += std::popcount (static_cast<unsigned> (clippedLow | (clippedHigh << 4)));
+
+        // rounds to nearest; the pack saturates to the int16 range
+        const __m128i packed = _mm_packs_epi32 (_mm_cvtps_epi32 (low), _mm_cvtps_epi32 (high));
+        _mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + i), packed);
+    }
+#endif
+
+    for (; i < numSamples; ++i)
+    {
+        const float scaled = (source[i] - offset) * inverseScale;
+        numClipped += scaled < -32768.0f || scaled > 32767.0f;
+        destination[i] =
+            static_cast<std::int16_t> (std::lrint (std::clamp (scaled, -32768.0f, 32767.0f)));
+    }
+
+    return numClipped;
+}
+
+/** Converts 16-bit integers back to floats: value * scale + offset */
+void dequantize (const std::int16_t* source,
+                 float* destination,
+                 int numSamples,
+                 float scale,
+                 float offset)
+{
+    int i = 0;
+
+#if JUCE_INTEL
+    const __m128 offsets = _mm_set1_ps (offset);
+    const __m128 scales = _mm_set1_ps (scale);
+    for (; i + 8 <= numSamples; i += 8)
+    {
+        const __m128i packed = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + i));
+
+        // sign-extend to 32 bit by moving each value to the upper half and shifting back
+        const __m128i low = _mm_srai_epi32 (_mm_unpacklo_epi16 (packed, packed), 16);
+        const __m128i high = _mm_srai_epi32 (_mm_unpackhi_epi16 (packed, packed), 16);
+
+        _mm_storeu_ps (destination + i,
+                       _mm_add_ps (_mm_mul_ps (_mm_cvtepi32_ps (low), scales), offsets));
+        _mm_storeu_ps (destination + i + 4,
+                       _mm_add_ps (_mm_mul_ps (_mm_cvtepi32_ps (high), scales), offsets));
+    }
+#endif
+
+    for (; i < numSamples; ++i)
+        destination[i] = static_cast<float> (source[i]) * scale + offset;
+}
+} // namespace
+
+MultiChannelRingBuffer::Storage::Storage (int numChannels_,
+                                          int size_,
+                                          std::uint64_t generation_,
+                                          RingBufferSampleFormat sampleFormat,
+                                          RingBufferMemoryPool* memoryPool)
+    : numChannels (numChannels_),
+      size (size_),
+      generation (generation_)
+{
+    const bool isCompact = sampleFormat == RingBufferSampleFormat::Int16;
+    const size_t numBytes = static_cast<size_t> (numChannels_) * static_cast<size_t> (size_)
+                            * (isCompact ? sizeof (std::int16_t) : sizeof (float));
+
+    memory = memoryPool != nullptr ? memoryPool->acquire (numBytes)
+                                   : RingBufferMemory::allocate (numBytes);
+
+    if (isCompact)
+        compactSamples = static_cast<std::int16_t*> (memory.getData());
+    else
+        samples = static_cast<float*> (memory.getData());
+}
+
+MultiChannelRingBuffer::MultiChannelRingBuffer (int numChannels_,
+                                                int bufferSize_,
+                                                RingBufferSampleFormat sampleFormat_,
+                                                RingBufferMemoryPool* memoryPool_)
+    : m_blockRecords (maximumNumberOfBlockRecords),
       m_nChannels (numChannels_),
-      m_bufferSize (bufferSize_)
+      m_sampleFormat (sampleFormat_),
+      m_memoryPool (memoryPool_),
+      m_scales (static_cast<size_t> (numChannels_), 1.0f),
+      m_inverseScales (static_cast<size_t> (numChannels_), 1.0f),
+      m_offsets (static_cast<size_t> (numChannels_), 0.0f)
 {
-    m_sampleNumbers.resize (m_bufferSize);
-    m_buffer.clear();
+    m_ownedStorages.push_back (
+        std::make_unique<Storage> (numChannels_, bufferSize_, 0, sampleFormat_, memoryPool_));
+    m_storage.store (m_ownedStorages.back().get());
+}
+
+void MultiChannelRingBuffer::setChannelScaling (int channel, float scale, float offset)
+{
+    jassert (channel >= 0 && channel < m_nChannels);
+    jassert (scale > 0.0f);
+
+    m_scales[channel] = scale;
+    m_inverseScales[channel] = 1.0f / scale;
+    m_offsets[channel] = offset;
 }
 
 void MultiChannelRingBuffer::addData (const AudioBuffer<float>& inputBuffer,
                                       SampleNumber firstSampleNumber,
                                       uint32 numberOfSamplesInBLock)
 {
-    const std::scoped_lock lock (writeLock);
+    addData (inputBuffer.getArrayOfReadPointers(),
+             inputBuffer.getNumChannels(),
+             firstSampleNumber,
+             numberOfSamplesInBLock);
+}
 
+void MultiChannelRingBuffer::addData (const float* const* channelData,
+                                      int numChannels,
+                                      SampleNumber firstSampleNumber,
+                                      uint32 numberOfSamplesInBLock)
+{
     const int numSamplesIn = static_cast<int> (numberOfSamplesInBLock);
     if (numSamplesIn <= 0)
         return;
 
-    jassert (inputBuffer.getNumChannels() <= m_nChannels);
+    if (m_pendingStorage.load (std::memory_order_relaxed) != nullptr)
+        adoptPendingStorage();
+
+    jassert (numChannels <= m_nChannels);
+    const int nChannelsIn = std::min (m_nChannels, numChannels);
+
+    Storage& storage = *m_storage.load (std::memory_order_relaxed);
+    const int bufferSize = storage.size;
+
+    // only the most recent bufferSize samples of an oversized block can be kept
+    const int inputOffset = std::max (0, numSamplesIn - bufferSize);
+    const int numSamplesToWrite = numSamplesIn - inputOffset;
+
+    const SampleNumber writePosition = m_writePosition.load (std::memory_order_relaxed);
+    const auto sequence = m_writeSequence.load (std::memory_order_relaxed);
+    const bool jumpedBackwards =
+        firstSampleNumber < m_nextSampleNumber.load (std::memory_order_relaxed);
 
-    // first segment (until end of ring)
-    const int spaceToEnd = m_bufferSize - m_writeIndex.load();
-    const int blockSize1 = std::min (numSamplesIn, spaceToEnd);
+    // announce the write before touching any sample memory
+    m_writeHorizon.store (writePosition + numSamplesToWrite, std::memory_order_relaxed);
+    m_writeSequence.store (sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
 
-    if (blockSize1 > 0)
+    const int writeIndex = static_cast<int> (writePosition % bufferSize);
+    const int blockSize1 = std::min (numSamplesToWrite, bufferSize - writeIndex);
+    const int blockSize2 = numSamplesToWrite - blockSize1;
+    int numClipped = 0;
+
+    for (int ch = 0; ch < m_nChannels; ++ch)
     {
-        for (int ch = 0; ch < std::min (m_nChannels, inputBuffer.getNumChannels()); ++ch)
+        // The ring memory is not cleared up front, so channels without input are zeroed here
+        if (ch >= nChannelsIn)
         {
-            m_buffer.copyFrom (ch, m_writeIndex.load(), inputBuffer, ch, 0, blockSize1);
+            if (m_sampleFormat == RingBufferSampleFormat::Int16)
+            {
+                std::fill_n (storage.getCompactPointer (ch, writeIndex), blockSize1, 0);
+                std::fill_n (storage.getCompactPointer (ch, 0), blockSize2, 0);
+            }
+            else
+            {
+                FloatVectorOperations::clear (storage.getSamplePointer (ch, writeIndex),
+                                              blockSize1);
+                FloatVectorOperations::clear (storage.getSamplePointer (ch, 0), blockSize2);
+            }
+            continue;
         }
 
-        for (int i = 0; i < blockSize1; ++i)
+        const float* source = channelData[ch] + inputOffset;
+
+        if (m_sampleFormat == RingBufferSampleFormat::Int16)
         {
-            m_sampleNumbers.at (m_writeIndex + i) = firstSampleNumber + i;
+            numClipped += quantize (source,
+                                    storage.getCompactPointer (ch, writeIndex),
+                                    blockSize1,
+                                    m_inverseScales[ch],
+                                    m_offsets[ch]);
+            numClipped += quantize (source + blockSize1,
+                                    storage.getCompactPointer (ch, 0),
+                                    blockSize2,
+                                    m_inverseScales[ch],
+                                    m_offsets[ch]);
+            continue;
         }
+
+        // first segment (until end of ring)
+        FloatVectorOperations::copy (storage.getSamplePointer (ch, writeIndex), source, blockSize1);
+
+        // second segment (from start of ring)
+        if (blockSize2 > 0)
+            FloatVectorOperations::copy (
+                storage.getSamplePointer (ch, 0), source + blockSize1, blockSize2);
     }
 
-    // second segment (from start of ring)
-    if (const int blockSize2 = numSamplesIn - blockSize1; blockSize2 > 0)
+    // only the producer writes the count, so no read-modify-write is needed
+    if (numClipped > 0)
+        m_numClippedSamples.store (m_numClippedSamples.load (std::memory_order_relaxed)
+                                       + static_cast<std::uint64_t> (numClipped),
+                                   std::memory_order_relaxed);
+
+    recordBlock (writePosition, firstSampleNumber + inputOffset, numSamplesToWrite);
+
+    m_writePosition.store (writePosition + numSamplesToWrite, std::memory_order_relaxed);
+    m_nextSampleNumber.store (firstSampleNumber + numSamplesIn, std::memory_order_release);
+
+    m_writeSequence.store (sequence + 2, std::memory_order_release);
+
+    signalWakeupIfDue (firstSampleNumber + numSamplesIn, jumpedBackwards);
+}
+
+void MultiChannelRingBuffer::requestWakeup (SampleNumber sampleNumber)
+{
+    m_wakeupSampleNumber.store (sampleNumber, std::memory_order_release);
+}
+
+void MultiChannelRingBuffer::signalWakeupIfDue (SampleNumber nextSampleNumber,
+                                                bool jumpedBackwards)
+{
+    auto wakeupSampleNumber = m_wakeupSampleNumber.load (std::memory_order_acquire);
+    if (wakeupSampleNumber == noWakeupRequested
+        || (nextSampleNumber < wakeupSampleNumber && ! jumpedBackwards))
+        return;
+
+    // The consumer may have replaced the request meanwhile, which then stays armed
+    if (! m_wakeupSampleNumber.compare_exchange_strong (
+            wakeupSampleNumber, noWakeupRequested, std::memory_order_acq_rel))
+        return;
+
+    if (auto* event = m_wakeupEvent.load (std::memory_order_acquire))
+        event->signal();
+}
+
+void MultiChannelRingBuffer::recordBlock (SampleNumber position,
+                                          SampleNumber firstSampleNumber,
+                                          int numSamples)
+{
+    const SampleNumber endPosition = position + numSamples;
+    const int bufferSize = m_storage.load (std::memory_order_relaxed)->size;
+    int nValidSamples = std::min (
+        m_nValidSamplesInBuffer.load (std::memory_order_relaxed) + numSamples, bufferSize);
+
+    auto oldest = m_oldestBlockRecord.load (std::memory_order_relaxed);
+    auto runStart = m_runStartBlockRecord.load (std::memory_order_relaxed);
+    auto end = m_endBlockRecord.load (std::memory_order_relaxed);
+
+    BlockRecord* newest = end > oldest ? &m_blockRecords[(end - 1) % maximumNumberOfBlockRecords]
+                                       : nullptr;
+    const SampleNumber expectedSampleNumber =
+        newest != nullptr ? newest->firstSampleNumber + newest->length : firstSampleNumber;
+
+    if (newest != nullptr && firstSampleNumber == expectedSampleNumber
+        && newest->position + newest->length == position)
     {
-        for (int ch = 0; ch < std::min (m_nChannels, inputBuffer.getNumChannels()); ++ch)
-        {
-            m_buffer.copyFrom (ch, 0, inputBuffer, ch, blockSize1, blockSize2);
-        }
+        newest->length += numSamples;
+    }
+    else
+    {
+        if (end - oldest == maximumNumberOfBlockRecords)
+            ++oldest;
 
-        for (int i = 0; i < blockSize2; ++i)
-        {
-            m_sampleNumbers.at (i) = firstSampleNumber + blockSize1 + i;
-        }
+        m_blockRecords[end % maximumNumberOfBlockRecords] = {
+            .position = position, .firstSampleNumber = firstSampleNumber, .length = numSamples
+        };
+
+        // a jump backwards in time starts a new run of increasing sample numbers
+        if (newest == nullptr || firstSampleNumber < expectedSampleNumber)
+            runStart = end;
+        ++end;
     }
 
-    m_writeIndex.store ((m_writeIndex.load() + numSamplesIn) % m_bufferSize);
-    m_nValidSamplesInBuffer.store (
-        std::min (m_nValidSamplesInBuffer.load() + numSamplesIn, m_bufferSize));
-    m_nextSampleNumber.store (firstSampleNumber + numSamplesIn);
+    // Drop records whose samples were all overwritten. Samples older than the oldest
+    // remaining record have no sample numbers anymore and are dropped, too.
+    while (end - oldest > 1
+           && getBlockRecord (oldest + 1).position <= endPosition - nValidSamples)
+        ++oldest;
+    nValidSamples = static_cast<int> (
+        std::min<SampleNumber> (nValidSamples, endPosition - getBlockRecord (oldest).position));
+
+    m_oldestBlockRecord.store (oldest, std::memory_order_relaxed);
+    m_runStartBlockRecord.store (std::max (runStart, oldest), std::memory_order_relaxed);
+    m_endBlockRecord.store (end, std::memory_order_relaxed);
+    m_nValidSamplesInBuffer.store (nValidSamples, std::memory_order_relaxed);
 }
 
 RingBufferReadResult
     MultiChannelRingBuffer::readAroundSample (SampleNumber centerSample,
                                               int preSamples,
                                               int postSamples,
-                                              AudioBuffer<float>& outputBuffer) const
+                                              AudioBuffer<float>& outputBuffer,
+                                              std::span<const int> channels) const
 {
-    auto [result, startSample] =
-        getStartSampleForTriggeredRead (centerSample, preSamples, postSamples);
-    if (result != RingBufferReadResult::Success || ! startSample.has_value())
-        return result;
+    // A window that gets overwritten during the copy fails validation, and the next
+    // attempt then reports it as too old, so more than two attempts are rarely needed
+    constexpr int maximumNumberOfAttempts = 3;
 
-    // Lock-free implementation: We're reading data that's already been written
-    // and won't be modified since we're staying behind the write index.
-    auto bufferStartPos = startSample.value();
-    const int totalSamples = preSamples + postSamples;
+    for (int attempt = 0; attempt < maximumNumberOfAttempts; ++attempt)
+    {
+        RingBufferView view;
+        auto result = getViewAroundSample (centerSample, preSamples, postSamples, view);
+        if (result != RingBufferReadResult::Success)
+            return result;
+
+        const int nOutputChannels =
+            channels.empty() ? m_nChannels : static_cast<int> (channels.size());
+        outputBuffer.setSize (nOutputChannels, view.getNumSamples());
+
+        for (int outCh = 0; outCh < nOutputChannels; ++outCh)
+        {
+            const int channel = channels.empty() ? outCh : channels[outCh];
+            jassert (channel >= 0 && channel < m_nChannels);
+            view.copyTo (channel, outputBuffer.getWritePointer (outCh));
+        }
+
+        if (isViewIntact (view))
+            return RingBufferReadResult::Success;
+    }
+
+    return RingBufferReadResult::DataInRingBufferTooOld;
+}
 
-    outputBuffer.setSize (m_nChannels, totalSamples);
+RingBufferReadResult MultiChannelRingBuffer::getViewAroundSample (SampleNumber centerSample,
+                                                                  int preSamples,
+                                                                  int postSamples,
+                                                                  RingBufferView& view) const
+{
+    // The view counts as a read in flight until it is released, so the storage it points
+    // into is kept
+    view.release();
+    beginRead();
+    view.m_numReaders = &m_numReaders;
 
-    for (int outCh = 0; outCh < m_nChannels; ++outCh)
+    const int totalSamples = preSamples + postSamples;
+    WriteState state;
+    SampleNumber startPosition = 0;
+    const auto result =
+        locateWindow (centerSample - preSamples, totalSamples, state, startPosition);
+    if (result != RingBufferReadResult::Success)
     {
-        // We can copy in up to 2 blocks due to wraparound
-        const int firstBlock = std::min (totalSamples, m_bufferSize - bufferStartPos);
-        if (firstBlock > 0)
-            outputBuffer.copyFrom (outCh, 0, m_buffer, outCh, bufferStartPos, firstBlock);
+        view.release();
+        return result;
+    }
+
+    const int bufferSize = state.storage->size;
 
-        const int secondBlock = totalSamples - firstBlock;
-        if (secondBlock > 0)
-            outputBuffer.copyFrom (outCh, firstBlock, m_buffer, outCh, 0, secondBlock);
+    if (m_sampleFormat == RingBufferSampleFormat::Int16)
+    {
+        view.m_samples = nullptr;
+        view.m_compactSamples = state.storage->compactSamples;
+        view.m_scales = m_scales.data();
+        view.m_offsets = m_offsets.data();
     }
+    else
+    {
+        view.m_samples = state.storage->samples;
+        view.m_compactSamples = nullptr;
+    }
+    view.m_numChannels = m_nChannels;
+    view.m_startIndex = static_cast<int> (startPosition % bufferSize);
+    view.m_firstSegmentLength = std::min (totalSamples, bufferSize - view.m_startIndex);
+    view.m_numSamples = totalSamples;
+    view.m_sequence = state.sequence;
+    view.m_startPosition = startPosition;
+    view.m_bufferSize = bufferSize;
 
     return RingBufferReadResult::Success;
 }
 
+bool MultiChannelRingBuffer::isViewIntact (const RingBufferView& view) const
+{
+    return isIntactSince (view.m_sequence, view.m_bufferSize, view.m_startPosition);
+}
+
+void RingBufferView::copyTo (int channel, float* destination) const
+{
+    if (m_compactSamples != nullptr)
+    {
+        const std::int16_t* samples =
+            m_compactSamples + static_cast<size_t> (channel) * m_bufferSize;
+        const float scale = m_scales[channel];
+        const float offset = m_offsets[channel];
+
+        dequantize (samples + m_startIndex, destination, m_firstSegmentLength, scale, offset);
+        dequantize (samples,
+                    destination + m_firstSegmentLength,
+                    m_numSamples - m_firstSegmentLength,
+                    scale,
+                    offset);
+        return;
+    }
+
+    const auto firstSegment = getFirstSegment (channel);
+    const auto secondSegment = getSecondSegment (channel);
+
+    FloatVectorOperations::copy (
+        destination, firstSegment.data(), static_cast<int> (firstSegment.size()));
+    if (! secondSegment.empty())
+        FloatVectorOperations::copy (destination + firstSegment.size(),
+                                     secondSegment.data(),
+                                     static_cast<int> (secondSegment.size()));
+}
+
+int MultiChannelRingBuffer::getBufferSize() const
+{
+    beginRead();
+    const int size = m_storage.load (std::memory_order_acquire)->size;
+    endRead();
+    return size;
+}
+
+void MultiChannelRingBuffer::beginRead() const
+{
+    // Pairs with the fence in freeRetiredStorages(): either that sees this read, or this
+    // read sees the storage the producer switched to before it checked
+    m_numReaders.fetch_add (1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+}
+
+MultiChannelRingBuffer::WriteState MultiChannelRingBuffer::loadWriteState() const
+{
+    for (;;)
+    {
+        const auto sequence = m_writeSequence.load (std::memory_order_acquire);
+        if ((sequence & 1u) == 0)
+        {
+            const WriteState state {
+                .storage = m_storage.load (std::memory_order_relaxed),
+                .writePosition = m_writePosition.load (std::memory_order_relaxed),
+                .nValidSamples = m_nValidSamplesInBuffer.load (std::memory_order_relaxed),
+                .oldestBlockRecord = m_oldestBlockRecord.load (std::memory_order_relaxed),
+                .runStartBlockRecord = m_runStartBlockRecord.load (std::memory_order_relaxed),
+                .endBlockRecord = m_endBlockRecord.load (std::memory_order_relaxed),
+                .sequence = sequence
+            };
+
+            std::atomic_thread_fence (std::memory_order_acquire);
+            if (m_writeSequence.load (std::memory_order_relaxed) == sequence)
+                return state;
+        }
+
+        // the producer is in the middle of a block, which takes microseconds
+        std::this_thread::yield();
+    }
+}
+
+bool MultiChannelRingBuffer::isIntactSince (std::uint64_t sequence,
+                                            int bufferSize,
+                                            SampleNumber firstPosition) const
+{
+    std::atomic_thread_fence (std::memory_order_acquire);
+    if (m_writeSequence.load (std::memory_order_relaxed) == sequence)
+        return true;
+
+    // The producer was active while copying. The samples are still intact as long as
+    // the producer has not reached the ring slots that held them.
+    return firstPosition >= m_writeHorizon.load (std::memory_order_relaxed) - bufferSize;
+}
+
+void MultiChannelRingBuffer::copyPositions (const Storage& source,
+                                            Storage& destination,
+                                            SampleNumber begin,
+                                            SampleNumber end)
+{
+    // Both storages belong to the same ring, so they have the same format and channel count
+    const bool isCompact = source.compactSamples != nullptr;
+
+    // Both rings may wrap at different positions, so copy in runs that are contiguous in both
+    for (SampleNumber position = begin; position < end;)
+    {
+        const int sourceIndex = static_cast<int> (position % source.size);
+        const int destinationIndex = static_cast<int> (position % destination.size);
+        const int runLength = static_cast<int> (std::min<SampleNumber> (
+            { end - position, source.size - sourceIndex, destination.size - destinationIndex }));
+
+        for (int ch = 0; ch < source.numChannels; ++ch)
+        {
+            if (isCompact)
+            {
+                std::copy_n (source.getCompactPointer (ch, sourceIndex),
+                             runLength,
+                             destination.getCompactPointer (ch, destinationIndex));
+            }
+            else
+            {
+                FloatVectorOperations::copy (destination.getSamplePointer (ch, destinationIndex),
+                                             source.getSamplePointer (ch, sourceIndex),
+                                             runLength);
+            }
+        }
+
+        position += runLength;
+    }
+}
+
+void MultiChannelRingBuffer::setCapacity (int newBufferSize)
+{
+    jassert (newBufferSize > 0);
+
+    // Take back a storage the producer has not started switching to; it never touched it.
+    // If the producer took it already, it may be copying into it right now, so it is only
+    // freed once the producer has acknowledged a newer one.
+    if (Storage* pendingStorage = m_pendingStorage.exchange (nullptr, std::memory_order_acq_rel))
+    {
+        std::erase_if (m_ownedStorages,
+                       [pendingStorage] (const auto& storage)
+                       { return storage.get() == pendingStorage; });
+    }
+
+    freeRetiredStorages();
+
+    // The newest storage left is the one the producer uses or is switching to
+    if (newBufferSize == m_ownedStorages.back()->size)
+        return;
+
+    auto storage = std::make_unique<Storage> (
+        m_nChannels, newBufferSize, m_nextGeneration++, m_sampleFormat, m_memoryPool);
+
+    // Prefill with the most recent samples while the producer keeps writing, validated
+    // like a regular read. If that keeps failing the producer copies everything itself.
+    constexpr int maximumNumberOfAttempts = 3;
+    for (int attempt = 0; attempt < maximumNumberOfAttempts; ++attempt)
+    {
+        const WriteState state = loadWriteState();
+        const int numSamplesToKeep = std::min (state.nValidSamples, newBufferSize);
+        const SampleNumber firstPosition = state.writePosition - numSamplesToKeep;
+
+        copyPositions (*state.storage, *storage, firstPosition, state.writePosition);
+        if (isIntactSince (state.sequence, state.storage->size, firstPosition))
+        {
+            storage->prefilledFrom = firstPosition;
+            storage->prefilledUpTo = state.writePosition;
+            break;
+        }
+    }
+
+    m_pendingStorage.store (storage.get(), std::memory_order_release);
+    m_ownedStorages.push_back (std::move (storage));
+}
+
+void MultiChannelRingBuffer::freeRetiredStorages()
+{
+    // The producer no longer touches storages older than the one it acknowledged. Reads
+    // that start after the check below load that one or a newer storage, so older ones
+    // are free once no read is in flight; otherwise a later call frees them.
+    const auto adoptedGeneration = m_adoptedGeneration.load (std::memory_order_acquire);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (m_numReaders.load (std::memory_order_acquire) != 0)
+        return;
+
+    std::erase_if (m_ownedStorages,
+                   [adoptedGeneration] (const auto& storage)
+                   { return storage->generation < adoptedGeneration; });
+}
+
+void MultiChannelRingBuffer::adoptPendingStorage()
+{
+    Storage* newStorage = m_pendingStorage.exchange (nullptr, std::memory_order_acquire);
+    if (newStorage == nullptr)
+        return;
+
+    Storage* oldStorage = m_storage.load (std::memory_order_relaxed);
+    const SampleNumber writePosition = m_writePosition.load (std::memory_order_relaxed);
+    const SampleNumber oldestPosition =
+        writePosition - m_nValidSamplesInBuffer.load (std::memory_order_relaxed);
+
+    // Samples written since the prefill are still in the old storage. If the producer
+    // has lapped the prefill (or the buffer was reset), start over from what is valid.
+    SampleNumber validFrom = newStorage->prefilledFrom;
+    SampleNumber copyFrom = newStorage->prefilledUpTo;
+    if (copyFrom < oldestPosition)
+    {
+        validFrom = std::max (oldestPosition, writePosition - newStorage->size);
+        copyFrom = validFrom;
+    }
+    copyFrom = std::max (copyFrom, writePosition - newStorage->size);
+    copyPositions (*oldStorage, *newStorage, copyFrom, writePosition);
+
+    // The old storage is not written anymore, so only the switch itself needs bracketing
+    const auto sequence = m_writeSequence.load (std::memory_order_relaxed);
+    m_writeSequence.store (sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    m_storage.store (newStorage, std::memory_order_relaxed);
+    m_nValidSamplesInBuffer.store (
+        static_cast<int> (std::min<SampleNumber> (writePosition - validFrom, newStorage->size)),
+        std::memory_order_relaxed);
+
+    m_writeSequence.store (sequence + 2, std::memory_order_release);
+
+    // From now on the old storage is only read, and setCapacity() may free it once no
+    // read is in flight
+    m_adoptedGeneration.store (newStorage->generation, std::memory_order_release);
+}
+
 /**
  * Calculates the starting position in the ring buffer for a triggered read operation.
  *
@@ -141,51 +677,128 @@ RingBufferReadResult
  *   - RingBufferReadResult indicating success or failure reason
  *   - Optional buffer start position (valid only if result is Success)
  *
- * @note This method is lock-free as it only reads atomic variables
+ * @note This method is lock-free. It reads a consistent snapshot of the write state
+ *       using the producer's sequence counter.
  */
 std::pair<RingBufferReadResult, std::optional<int>>
     MultiChannelRingBuffer::getStartSampleForTriggeredRead (SampleNumber centerSample,
                                                             int preSamples,
                                                             int postSamples) const
 {
-    // this does not require locking as it only reads atomic variables
-    const int totalSamples = preSamples + postSamples;
-    if (totalSamples <= 0)
-        return { RingBufferReadResult::InvalidParameters, std::nullopt };
+    beginRead();
+    WriteState state;
+    SampleNumber startPosition = 0;
+    const auto result =
+        locateWindow (centerSample - preSamples, preSamples + postSamples, state, startPosition);
+    const int bufferSize = state.storage->size;
+    endRead();
+
+    if (result != RingBufferReadResult::Success)
+        return { result, std::nullopt };
+    return { result, static_cast<int> (startPosition % bufferSize) };
+}
+
+RingBufferReadResult MultiChannelRingBuffer::locateWindow (SampleNumber startSample,
+                                                           int numSamples,
+                                                           WriteState& state,
+                                                           SampleNumber& startPosition) const
+{
+    // The block records are read without a lock, so the lookup only counts if the
+    // producer did not touch them in the meantime
+    for (;;)
+    {
+        state = loadWriteState();
+        const auto result = findWindowPosition (state, startSample, numSamples, startPosition);
 
-    const SampleNumber requestedStartSample = centerSample - preSamples;
-    const SampleNumber requestedEndSampleExclusive = requestedStartSample + totalSamples;
+        std::atomic_thread_fence (std::memory_order_acquire);
+        if (m_writeSequence.load (std::memory_order_relaxed) == state.sequence)
+            return result;
+    }
+}
 
-    const SampleNumber nextSampleNumber = m_nextSampleNumber.load();
-    const int nValidSamplesInBuffer = m_nValidSamplesInBuffer.load();
+RingBufferReadResult
+    MultiChannelRingBuffer::findWindowPosition (const WriteState& state,
+                                                SampleNumber startSample,
+                                                int numSamples,
+                                                SampleNumber& startPosition) const
+{
+    if (numSamples <= 0)
+        return RingBufferReadResult::InvalidParameters;
 
-    // TODO: this is nonesense. Fix it.
-    const SampleNumber oldestSample = nextSampleNumber - nValidSamplesInBuffer;
+    if (state.oldestBlockRecord == state.endBlockRecord)
+        return RingBufferReadResult::NotEnoughNewData;
 
-    // window must be inside [oldest, current)
-    if (requestedStartSample < oldestSample)
-        return { RingBufferReadResult::DataInRingBufferTooOld, std::nullopt };
+    // Sample numbers increase across the records of the current run, so find the last
+    // record starting at or before the window
+    auto first = state.runStartBlockRecord;
+    auto count = state.endBlockRecord - first;
+    while (count > 0)
+    {
+        const auto step = count / 2;
+        if (getBlockRecord (first + step).firstSampleNumber <= startSample)
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+        {
+            count = step;
+        }
+    }
 
-    // TODO: There is a bug here somewher
-    if (requestedEndSampleExclusive > nextSampleNumber)
-        return { RingBufferReadResult::NotEnoughNewData, std::nullopt };
+    if (first == state.runStartBlockRecord)
+    {
+        // The window starts before the current run. If the run began with a jump back in
+        // time, the window belongs to the samples before the jump.
+        return state.runStartBlockRecord > state.oldestBlockRecord
+                   ? RingBufferReadResult::Aborted
+                   : RingBufferReadResult::DataInRingBufferTooOld;
+    }
 
-    // Calculate ring buffer position
-    const int writeIndex = m_writeIndex.load();
-    const int oldestIndex = (writeIndex - nValidSamplesInBuffer + m_bufferSize) % m_bufferSize;
-    const int startBufferIndex =
-        (oldestIndex
-         + (requestedStartSample - oldestSample)) // NOLINT(bugprone-narrowing-conversions)
-        % m_bufferSize; // NOLINT(bugprone-narrowing-conversions)
+    const bool isNewestRecord = first == state.endBlockRecord;
+    const BlockRecord& record = getBlockRecord (first - 1);
+    const SampleNumber recordEndSample = record.firstSampleNumber + record.length;
 
-    return { RingBufferReadResult::Success, startBufferIndex };
+    // Records only split at discontinuities, so a window reaching beyond its record either
+    // waits for data that is not written yet or spans a gap in the sample numbers
+    if (startSample + numSamples > recordEndSample)
+    {
+        return isNewestRecord ? RingBufferReadResult::NotEnoughNewData
+                              : RingBufferReadResult::Aborted;
+    }
+
+    startPosition = record.position + (startSample - record.firstSampleNumber);
+    if (startPosition < state.writePosition - state.nValidSamples)
+        return RingBufferReadResult::DataInRingBufferTooOld;
+
+    return RingBufferReadResult::Success;
 }
 
 void MultiChannelRingBuffer::reset()
 {
-    const std::scoped_lock lock (writeLock);
-    m_buffer.clear();
-    m_nextSampleNumber.store (0);
-    m_writeIndex.store (0);
-    m_nValidSamplesInBuffer.store (0);
+    if (m_pendingStorage.load (std::memory_order_relaxed) != nullptr)
+        adoptPendingStorage();
+
+    Storage& storage = *m_storage.load (std::memory_order_relaxed);
+    const SampleNumber writePosition = m_writePosition.load (std::memory_order_relaxed);
+    const auto sequence = m_writeSequence.load (std::memory_order_relaxed);
+
+    // Skipping a full ring keeps the index mapping intact and makes every read that is
+    // still in flight fail its horizon check. The samples themselves are left in place:
+    // with no valid samples, none of them can be read before they are overwritten.
+    m_writeHorizon.store (writePosition + storage.size, std::memory_order_relaxed);
+    m_writeSequence.store (sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    m_writePosition.store (writePosition + storage.size, std::memory_order_relaxed);
+    m_nValidSamplesInBuffer.store (0, std::memory_order_relaxed);
+
+    const auto endBlockRecord = m_endBlockRecord.load (std::memory_order_relaxed);
+    m_oldestBlockRecord.store (endBlockRecord, std::memory_order_relaxed);
+    m_runStartBlockRecord.store (endBlockRecord, std::memory_order_relaxed);
+    m_nextSampleNumber.store (0, std::memory_order_release);
+
+    m_writeSequence.store (sequence + 2, std::memory_order_release);
+
+    signalWakeupIfDue (0, true);
 }
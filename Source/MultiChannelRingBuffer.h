@@ -22,15 +22,20 @@
 
 */
 #pragma once
+#include "RingBufferMemory.h"
 #include <JuceHeader.h>
 #include <atomic>
-#include <mutex>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
 #include <stdint.h>
 
 namespace TriggeredAverage
 {
 
 using SampleNumber = std::int64_t;
+using StreamId = std::uint16_t;
 
 enum class RingBufferReadResult : std::int_fast8_t
 {
@@ -42,42 +47,385 @@ enum class RingBufferReadResult : std::int_fast8_t
     Aborted = 4
 };
 
+/** How a MultiChannelRingBuffer stores its samples */
+enum class RingBufferSampleFormat : std::int_fast8_t
+{
+    Float32 = 0,
+
+    /** 16-bit integers with a per-channel scale and offset, e.g. the bit-volts of the ADC.
+        Halves memory and bandwidth; values outside the representable range saturate
+        and are counted, see MultiChannelRingBuffer::getNumClippedSamples(). */
+    Int16 = 1
+};
+
+/**
+ * Read-only view of a window inside a MultiChannelRingBuffer.
+ *
+ * Per channel, the window consists of up to two contiguous segments in ring memory; the
+ * second one is empty unless the window wraps around the end of the ring. Reading through
+ * a view does not block the producer, so after consuming the data the reader must call
+ * MultiChannelRingBuffer::isViewIntact() to make sure it was not overwritten meanwhile.
+ *
+ * The segments point to float samples and are only available if the ring stores
+ * RingBufferSampleFormat::Float32. copyTo() works for every format.
+ *
+ * A view keeps the ring from freeing the memory it points into, even if the capacity of
+ * the ring changes meanwhile, until it is destroyed or taken again.
+ */
+class RingBufferView
+{
+public:
+    RingBufferView() = default;
+    ~RingBufferView() { release(); }
+
+    int getNumChannels() const { return m_numChannels; }
+    int getNumSamples() const { return m_numSamples; }
+
+    std::span<const float> getFirstSegment (int channel) const
+    {
+        jassert (m_samples != nullptr);
+        return { getChannelStart (channel) + m_startIndex,
+                 static_cast<size_t> (m_firstSegmentLength) };
+    }
+
+    std::span<const float> getSecondSegment (int channel) const
+    {
+        jassert (m_samples != nullptr);
+        return { getChannelStart (channel),
+                 static_cast<size_t> (m_numSamples - m_firstSegmentLength) };
+    }
+
+    /** Copies the window of one channel to destination (getNumSamples() floats), converting
+        compactly stored samples back to float */
+    void copyTo (int channel, float* destination) const;
+
+private:
+    friend class MultiChannelRingBuffer;
+
+    /** Lets the ring free the memory of the view again */
+    void release()
+    {
+        if (m_numReaders != nullptr)
+            m_numReaders->fetch_sub (1, std::memory_order_release);
+        m_numReaders = nullptr;
+    }
+
+    const float* getChannelStart (int channel) const
+    {
+        return m_samples + static_cast<size_t> (channel) * m_bufferSize;
+    }
+
+    // Channel c starts at m_samples + c * m_bufferSize (or m_compactSamples for Int16 storage)
+    const float* m_samples = nullptr;
+    const std::int16_t* m_compactSamples = nullptr;
+    const float* m_scales = nullptr;
+    const float* m_offsets = nullptr;
+
+    int m_numChannels = 0;
+    int m_startIndex = 0;
+    int m_firstSegmentLength = 0;
+    int m_numSamples = 0;
+
+    // write state the view was taken at, for validation
+    std::uint64_t m_sequence = 0;
+    SampleNumber m_startPosition = 0;
+    int m_bufferSize = 0;
+
+    // Reads in flight of the ring the view was taken from, counting this one
+    std::atomic<int>* m_numReaders = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE (RingBufferView)
+};
+
+/**
+ * Multi-channel circular buffer holding the most recent samples of one data stream.
+ *
+ * Threading model: single producer, multiple readers, no locks.
+ * - addData() and reset() must only be called from one thread at a time (the
+ *   processing thread). They never block and never allocate.
+ * - readAroundSample() and getStartSampleForTriggeredRead() may be called from any
+ *   number of reader threads concurrently with the producer.
+ * - setCapacity() may be called from one other thread (e.g. the message thread)
+ *   concurrently with the producer and readers.
+ *
+ * The producer brackets every update with a sequence counter (seqlock style): the
+ * counter is odd while a block is being written and even otherwise. Readers take a
+ * consistent snapshot of the write position by re-checking the counter, copy their
+ * window without holding a lock and then check the counter again. If the producer
+ * was active during the copy, the reader compares its window against the write
+ * horizon published before the producer started overwriting old samples and retries
+ * if the window may have been overwritten.
+ *
+ * Sample numbers are not stored per sample. Each run of consecutive sample numbers is
+ * described by one block record (write position, first sample number, length), so a
+ * discontinuity such as a FileReader loop or an acquisition restart starts a new record.
+ * Reads locate their window by binary search over the records and are rejected if the
+ * window spans a discontinuity.
+ */
 class MultiChannelRingBuffer
 {
 public:
     MultiChannelRingBuffer() = delete;
-    MultiChannelRingBuffer (int numChannels, int bufferSize);
+    /** If memoryPool is given, the sample memory is taken from and returned to it. The pool
+        must outlive the ring buffer. */
+    MultiChannelRingBuffer (int numChannels,
+                            int bufferSize,
+                            RingBufferSampleFormat sampleFormat = RingBufferSampleFormat::Float32,
+                            RingBufferMemoryPool* memoryPool = nullptr);
     ~MultiChannelRingBuffer() = default;
 
+    /** Sets how a channel's Int16 samples map to float: value = sample * scale + offset.
+        Must be called before adding data. Has no effect on Float32 storage. */
+    void setChannelScaling (int channel, float scale, float offset = 0.0f);
+
+    RingBufferSampleFormat getSampleFormat() const { return m_sampleFormat; }
+
+    /** Number of samples that did not fit the Int16 range of their channel and were stored
+        saturated, since construction. Safe to call from any thread. */
+    std::uint64_t getNumClippedSamples() const
+    {
+        return m_numClippedSamples.load (std::memory_order_relaxed);
+    }
+
+    /** Appends a block of samples. Producer thread only, wait-free. */
     void addData (const juce::AudioBuffer<float>& inputBuffer,
                   SampleNumber firstSampleNumber,
                   uint32 numberOfSamplesInBLock);
+
+    /** Appends a block of samples from numChannels channel pointers, e.g. the channels of one
+        data stream inside the processor's buffer. Producer thread only, wait-free. */
+    void addData (const float* const* channelData,
+                  int numChannels,
+                  SampleNumber firstSampleNumber,
+                  uint32 numberOfSamplesInBLock);
+
+    /** Copies the window [centerSample - preSamples, centerSample + postSamples) into
+        outputBuffer. If channels is not empty, only those channels are copied, with
+        channels[i] ending up in channel i of outputBuffer. Safe to call concurrently with
+        addData(). */
     RingBufferReadResult readAroundSample (SampleNumber centerSample,
                                            int preSamples,
                                            int postSamples,
-                                           juce::AudioBuffer<float>& outputBuffer) const;
+                                           juce::AudioBuffer<float>& outputBuffer,
+                                           std::span<const int> channels = {}) const;
+
+    /** Points view at the window [centerSample - preSamples, centerSample + postSamples)
+        without copying. The view stays readable until it is destroyed or taken again. */
+    RingBufferReadResult getViewAroundSample (SampleNumber centerSample,
+                                              int preSamples,
+                                              int postSamples,
+                                              RingBufferView& view) const;
 
-    SampleNumber getCurrentSampleNumber() const { return m_nextSampleNumber.load(); }
-    int getBufferSize() const { return m_bufferSize; }
+    /** True if the data behind view was not overwritten since the view was taken. Call
+        after reading through the view; if false, the data read must be discarded. */
+    bool isViewIntact (const RingBufferView& view) const;
+
+    SampleNumber getCurrentSampleNumber() const
+    {
+        return m_nextSampleNumber.load (std::memory_order_acquire);
+    }
+    int getNumChannels() const { return m_nChannels; }
+    int getBufferSize() const;
     std::pair<RingBufferReadResult, std::optional<int>>
         getStartSampleForTriggeredRead (SampleNumber centerSample,
                                         int preSamples,
                                         int postSamples) const;
+
+    /** Changes the number of samples per channel the buffer can hold, keeping the most
+        recent valid samples.
+
+        The new storage is allocated and filled on the calling thread; the producer only
+        copies the samples written in the meantime and switches over at its next addData().
+        Storages are freed by later calls once the producer has acknowledged switching away
+        from them and no read or view is in flight. Must not be called from the producer
+        thread. */
+    void setCapacity (int newBufferSize);
+
+    /** Sets the event the producer signals when a wakeup requested with requestWakeup() is
+        due, or nullptr for none */
+    void setWakeupEvent (juce::WaitableEvent* event) { m_wakeupEvent.store (event); }
+
+    /** Makes the producer signal the wakeup event as soon as the samples before sampleNumber
+        were added, or when the sample numbers jump backwards or the buffer is reset. Fires
+        once and replaces an earlier request. Safe to call from any thread. */
+    void requestWakeup (SampleNumber sampleNumber);
+
+    /** Discards all samples. Producer thread only (or while no producer is running).
+        Only marks them invalid; the sample memory itself is left as it is. */
     void reset();
 
 private:
-    juce::AudioBuffer<float> m_buffer;
-    std::vector<SampleNumber> m_sampleNumbers;
+    /** Sample memory of the ring. Replaced as a whole when the capacity changes.
+        The memory is not cleared: only positions that were written are ever read. */
+    struct Storage
+    {
+        Storage (int numChannels,
+                 int size,
+                 std::uint64_t generation,
+                 RingBufferSampleFormat sampleFormat,
+                 RingBufferMemoryPool* memoryPool);
+
+        float* getSamplePointer (int channel, int index)
+        {
+            return samples + static_cast<size_t> (channel) * size + index;
+        }
+        const float* getSamplePointer (int channel, int index) const
+        {
+            return samples + static_cast<size_t> (channel) * size + index;
+        }
+        std::int16_t* getCompactPointer (int channel, int index)
+        {
+            return compactSamples + static_cast<size_t> (channel) * size + index;
+        }
+        const std::int16_t* getCompactPointer (int channel, int index) const
+        {
+            return compactSamples + static_cast<size_t> (channel) * size + index;
+        }
+
+        RingBufferMemory memory;
+
+        // Point into memory, channel after channel. Only one of them is set, depending on
+        // the sample format.
+        float* samples = nullptr;
+        std::int16_t* compactSamples = nullptr;
+
+        const int numChannels;
+        const int size;
+
+        // Counts up with every storage setCapacity() hands to the producer
+        const std::uint64_t generation;
+
+        // Write positions [prefilledFrom, prefilledUpTo) copied in by setCapacity()
+        SampleNumber prefilledFrom = 0;
+        SampleNumber prefilledUpTo = 0;
+    };
+
+    /** Write positions [position, position + length) hold the consecutive sample numbers
+        starting at firstSampleNumber */
+    struct BlockRecord
+    {
+        SampleNumber position = 0;
+        SampleNumber firstSampleNumber = 0;
+        SampleNumber length = 0;
+    };
+
+    /** Maximum number of discontinuities that can be tracked within the ring. When more
+        occur, the samples before the oldest remaining record are dropped. */
+    static constexpr int maximumNumberOfBlockRecords = 256;
+
+    /** Consistent view of the write state, taken between two producer updates */
+    struct WriteState
+    {
+        const Storage* storage;
+        SampleNumber writePosition;
+        int nValidSamples;
+
+        // Block records are identified by a running number, [oldest, end) are in use
+        std::uint64_t oldestBlockRecord;
+        std::uint64_t runStartBlockRecord;
+        std::uint64_t endBlockRecord;
+
+        std::uint64_t sequence;
+    };
+
+    WriteState loadWriteState() const;
+
+    /** Counts a read in flight until release, so setCapacity() keeps the storages it may
+        copy from. Must be called before the write state is loaded. */
+    void beginRead() const;
+    void endRead() const { m_numReaders.fetch_sub (1, std::memory_order_release); }
+
+    /** Frees the storages older than the one the producer switched to last, unless a read
+        is in flight. setCapacity() only. */
+    void freeRetiredStorages();
+
+    /** Finds the write position of the window [startSample, startSample + numSamples).
+        Loads the write state it belongs to into state. */
+    RingBufferReadResult locateWindow (SampleNumber startSample,
+                                       int numSamples,
+                                       WriteState& state,
+                                       SampleNumber& startPosition) const;
+    RingBufferReadResult findWindowPosition (const WriteState& state,
+                                             SampleNumber startSample,
+                                             int numSamples,
+                                             SampleNumber& startPosition) const;
+
+    const BlockRecord& getBlockRecord (std::uint64_t id) const
+    {
+        return m_blockRecords[static_cast<size_t> (id % maximumNumberOfBlockRecords)];
+    }
+
+    /** Adds the written samples to the block records. Producer thread only. */
+    void recordBlock (SampleNumber position, SampleNumber firstSampleNumber, int numSamples);
+
+    /** True if the samples from firstPosition onwards were not overwritten since the
+        write state with the given sequence was loaded. Call after copying them. */
+    bool isIntactSince (std::uint64_t sequence, int bufferSize, SampleNumber firstPosition) const;
+
+    /** Copies the samples at write positions [begin, end) between two storages */
+    static void copyPositions (const Storage& source,
+                               Storage& destination,
+                               SampleNumber begin,
+                               SampleNumber end);
+
+    /** Switches to the storage prepared by setCapacity(). Producer thread only. */
+    void adoptPendingStorage();
+
+    /** Signals the wakeup event if the requested wakeup is due. Producer thread only. */
+    void signalWakeupIfDue (SampleNumber nextSampleNumber, bool jumpedBackwards);
+
+    std::atomic<Storage*> m_storage = nullptr;
+    std::atomic<Storage*> m_pendingStorage = nullptr;
+
+    // Generation of the storage the producer switched to last. It stores it only once it
+    // no longer touches the older ones.
+    std::atomic<std::uint64_t> m_adoptedGeneration = 0;
+
+    // Reads and views in flight, which may still copy from a storage the producer left
+    mutable std::atomic<int> m_numReaders = 0;
+
+    // Owner of all storages, oldest first, only touched by the constructor and setCapacity()
+    std::vector<std::unique_ptr<Storage>> m_ownedStorages;
+    std::uint64_t m_nextGeneration = 1;
+
+    // Seqlock counter: odd while the producer is writing a block
+    std::atomic<std::uint64_t> m_writeSequence = 0;
+
+    // Total number of samples ever written (monotonic, never reset). The ring index of a
+    // sample is its write position modulo the buffer size.
+    std::atomic<SampleNumber> m_writePosition = 0;
+
+    // Write position up to which the producer may currently be overwriting samples.
+    // Published before the block data is written so readers can tell if their window
+    // was clobbered while they were copying it.
+    std::atomic<SampleNumber> m_writeHorizon = 0;
 
     std::atomic<SampleNumber> m_nextSampleNumber = 0;
-    std::atomic<int> m_writeIndex = 0;
+
+    // Sample number whose arrival signals m_wakeupEvent, see requestWakeup()
+    static constexpr SampleNumber noWakeupRequested = std::numeric_limits<SampleNumber>::max();
+    std::atomic<SampleNumber> m_wakeupSampleNumber = noWakeupRequested;
+    std::atomic<juce::WaitableEvent*> m_wakeupEvent = nullptr;
     std::atomic<int> m_nValidSamplesInBuffer =
         0; // number of valid samples currently stored (<= bufferSize)
 
+    // Circular array of block records, preallocated so the producer never allocates.
+    // Records [m_oldestBlockRecord, m_endBlockRecord) are in use; sample numbers increase
+    // monotonically from m_runStartBlockRecord on, i.e. since the last backward jump.
+    std::vector<BlockRecord> m_blockRecords;
+    std::atomic<std::uint64_t> m_oldestBlockRecord = 0;
+    std::atomic<std::uint64_t> m_runStartBlockRecord = 0;
+    std::atomic<std::uint64_t> m_endBlockRecord = 0;
+
     const int m_nChannels;
-    int m_bufferSize;
+    const RingBufferSampleFormat m_sampleFormat;
+    RingBufferMemoryPool* const m_memoryPool;
 
-    mutable std::recursive_mutex writeLock;
+    // Per-channel Int16 conversion, see setChannelScaling()
+    std::vector<float> m_scales;
+    std::vector<float> m_inverseScales;
+    std::vector<float> m_offsets;
+    std::atomic<std::uint64_t> m_numClippedSamples = 0;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultiChannelRingBuffer)
     JUCE_DECLARE_NON_MOVEABLE (MultiChannelRingBuffer)
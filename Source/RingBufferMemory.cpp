@@ -0,0 +1,190 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "RingBufferMemory.h"
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#if JUCE_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace TriggeredAverage;
+
+namespace
+{
+constexpr size_t pageSize = 4096;
+constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+size_t roundUp (size_t numBytes, size_t alignment)
+{
+    return (numBytes + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+RingBufferMemory::RingBufferMemory (RingBufferMemory&& other) noexcept
+    : m_data (std::exchange (other.m_data, nullptr)),
+      m_size (std::exchange (other.m_size, 0)),
+      m_pool (std::exchange (other.m_pool, nullptr))
+{
+}
+
+RingBufferMemory& RingBufferMemory::operator= (RingBufferMemory&& other) noexcept
+{
+    if (this != &other)
+    {
+        RingBufferMemory released (std::move (*this));
+        m_data = std::exchange (other.m_data, nullptr);
+        m_size = std::exchange (other.m_size, 0);
+        m_pool = std::exchange (other.m_pool, nullptr);
+    }
+    return *this;
+}
+
+RingBufferMemory::~RingBufferMemory()
+{
+    if (m_data == nullptr)
+        return;
+
+    if (m_pool != nullptr)
+        m_pool->release (m_data, m_size);
+    else
+        RingBufferMemoryPool::unmap (m_data, m_size);
+}
+
+RingBufferMemory RingBufferMemory::allocate (size_t numBytes, bool useHugePages)
+{
+    RingBufferMemory memory;
+    if (numBytes == 0)
+        return memory;
+
+    // Only blocks of at least one huge page can be backed by huge pages
+    useHugePages = useHugePages && numBytes >= hugePageSize;
+    memory.m_size = roundUp (numBytes, useHugePages ? hugePageSize : pageSize);
+
+#if JUCE_WINDOWS
+    memory.m_data =
+        VirtualAlloc (nullptr, memory.m_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* data = mmap (
+        nullptr, memory.m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED)
+    {
+        memory.m_data = data;
+#ifdef MADV_HUGEPAGE
+        if (useHugePages)
+            madvise (data, memory.m_size, MADV_HUGEPAGE);
+#endif
+    }
+#endif
+
+    if (memory.m_data == nullptr)
+    {
+        memory.m_size = 0;
+        throw std::bad_alloc();
+    }
+
+    // Fault every page in now instead of on the processing thread's first write
+    auto* bytes = static_cast<volatile char*> (memory.m_data);
+    for (size_t offset = 0; offset < memory.m_size; offset += pageSize)
+        bytes[offset] = 0;
+
+    return memory;
+}
+
+RingBufferMemoryPool::RingBufferMemoryPool (bool useHugePages) : m_useHugePages (useHugePages) {}
+
+RingBufferMemoryPool::~RingBufferMemoryPool() { releaseUnusedMemory(); }
+
+RingBufferMemory RingBufferMemoryPool::acquire (size_t numBytes)
+{
+    {
+        std::scoped_lock lock (m_mutex);
+
+        // Reuse the smallest block that fits, unless it would waste more than it holds
+        const size_t requiredSize = roundUp (numBytes, pageSize);
+        auto best = m_freeBlocks.end();
+        for (auto it = m_freeBlocks.begin(); it != m_freeBlocks.end(); ++it)
+        {
+            if (it->size >= requiredSize && it->size <= 2 * requiredSize
+                && (best == m_freeBlocks.end() || it->size < best->size))
+                best = it;
+        }
+
+        if (best != m_freeBlocks.end())
+        {
+            RingBufferMemory memory;
+            memory.m_data = best->data;
+            memory.m_size = best->size;
+            memory.m_pool = this;
+            m_freeBlocks.erase (best);
+            return memory;
+        }
+    }
+
+    RingBufferMemory memory = RingBufferMemory::allocate (numBytes, m_useHugePages);
+    memory.m_pool = this;
+    return memory;
+}
+
+void RingBufferMemoryPool::release (void* data, size_t size)
+{
+    std::scoped_lock lock (m_mutex);
+    m_freeBlocks.push_back ({ data, size });
+
+    if (m_freeBlocks.size() > maximumNumberOfFreeBlocks)
+    {
+        unmap (m_freeBlocks.front().data, m_freeBlocks.front().size);
+        m_freeBlocks.erase (m_freeBlocks.begin());
+    }
+}
+
+void RingBufferMemoryPool::releaseUnusedMemory()
+{
+    std::scoped_lock lock (m_mutex);
+    for (const auto& block : m_freeBlocks)
+        unmap (block.data, block.size);
+    m_freeBlocks.clear();
+}
+
+size_t RingBufferMemoryPool::getNumFreeBlocks() const
+{
+    std::scoped_lock lock (m_mutex);
+    return m_freeBlocks.size();
+}
+
+void RingBufferMemoryPool::unmap (void* data, size_t size)
+{
+#if JUCE_WINDOWS
+    juce::ignoreUnused (size);
+    VirtualFree (data, 0, MEM_RELEASE);
+#else
+    munmap (data, size);
+#endif
+}
@@ -0,0 +1,112 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#pragma once
+#include <JuceHeader.h>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace TriggeredAverage
+{
+class RingBufferMemoryPool;
+
+/**
+ * Block of page-aligned memory for ring buffer samples, mapped directly from the OS.
+ *
+ * The memory is pre-faulted when it is allocated so the processing thread does not take
+ * page faults when it first writes to it. Its contents are undefined: ring buffers only
+ * read samples they have written, so the memory is never cleared.
+ *
+ * If the block came from a RingBufferMemoryPool, it is returned there on destruction.
+ */
+class RingBufferMemory
+{
+public:
+    RingBufferMemory() = default;
+    RingBufferMemory (RingBufferMemory&& other) noexcept;
+    RingBufferMemory& operator= (RingBufferMemory&& other) noexcept;
+    ~RingBufferMemory();
+
+    /** Maps at least numBytes of memory, backed by transparent huge pages if requested and
+        supported by the OS */
+    static RingBufferMemory allocate (size_t numBytes, bool useHugePages = false);
+
+    void* getData() const { return m_data; }
+    size_t getSize() const { return m_size; }
+
+private:
+    friend class RingBufferMemoryPool;
+
+    void* m_data = nullptr;
+    size_t m_size = 0;
+    RingBufferMemoryPool* m_pool = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE (RingBufferMemory)
+};
+
+/**
+ * Recycles ring buffer memory across acquisition start/stop cycles and capacity changes, so
+ * starting acquisition neither maps nor faults in hundreds of MB again.
+ *
+ * Thread-safe. The pool must outlive all memory acquired from it.
+ */
+class RingBufferMemoryPool
+{
+public:
+    explicit RingBufferMemoryPool (bool useHugePages = true);
+    ~RingBufferMemoryPool();
+
+    /** Returns a block of at least numBytes, reusing the smallest released block that fits */
+    RingBufferMemory acquire (size_t numBytes);
+
+    /** Unmaps all released blocks */
+    void releaseUnusedMemory();
+
+    size_t getNumFreeBlocks() const;
+
+private:
+    friend class RingBufferMemory;
+
+    struct Block
+    {
+        void* data;
+        size_t size;
+    };
+
+    /** Takes back a block; called by RingBufferMemory */
+    void release (void* data, size_t size);
+
+    static void unmap (void* data, size_t size);
+
+    // Released blocks beyond this count are unmapped, oldest first
+    static constexpr size_t maximumNumberOfFreeBlocks = 8;
+
+    const bool m_useHugePages;
+    mutable std::mutex m_mutex;
+    std::vector<Block> m_freeBlocks;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RingBufferMemoryPool)
+};
+
+} // namespace TriggeredAverage
@@ -78,6 +78,32 @@ void SingleTrialBuffer::addTrial (const float* const* trialData, int nChannels,
     addTrial (std::span (channelSpans));
 }
 
+float* SingleTrialBuffer::getNextTrialWritePointer (int channelIndex, int trialOffset)
+{
+    assert (channelIndex >= 0 && channelIndex < m_size.numChannels && "Channel index out of range");
+    assert (trialOffset >= 0 && trialOffset < m_size.maxTrials && "Trial offset out of range");
+    return &data[getIndex (channelIndex, (writeIndex + trialOffset) % m_size.maxTrials, 0)];
+}
+
+void SingleTrialBuffer::commitTrials (int numTrials)
+{
+    assert (numTrials >= 0 && numTrials <= m_size.maxTrials && "Too many trials to commit");
+    writeIndex = (writeIndex + numTrials) % m_size.maxTrials;
+    numberOfStoredTrials = std::min (numberOfStoredTrials + numTrials, m_size.maxTrials);
+}
+
+void SingleTrialBuffer::reserveNextTrials (int numTrials)
+{
+    assert (numTrials >= 0 && numTrials <= m_size.maxTrials && "Too many trials to reserve");
+    numberOfStoredTrials = std::min (numberOfStoredTrials, m_size.maxTrials - numTrials);
+}
+
+void SingleTrialBuffer::discardTrials (int numTrials)
+{
+    assert (numTrials >= 0 && numTrials <= m_size.maxTrials && "Too many trials to discard");
+    numberOfStoredTrials = std::min (numberOfStoredTrials, m_size.maxTrials - numTrials);
+}
+
 std::span<const float> SingleTrialBuffer::getChannelTrials (int channelIndex) const
 {
     assert (channelIndex >= 0 && channelIndex < m_size.numChannels && "Channel index out of range");
@@ -167,6 +193,7 @@ void SingleTrialBuffer::setMaxTrials (int n)
 
     writeIndex = trialsToKeep % m_size.maxTrials;
     numberOfStoredTrials = trialsToKeep;
+    ++layoutGeneration;
 }
 
 void SingleTrialBuffer::clear()
@@ -174,6 +201,7 @@ void SingleTrialBuffer::clear()
     writeIndex = 0;
     numberOfStoredTrials = 0;
     std::fill (data.begin(), data.end(), 0.0f);
+    ++layoutGeneration;
 }
 
 void SingleTrialBuffer::setSize (SingleTrialBufferSize size)
@@ -184,6 +212,8 @@ void SingleTrialBuffer::setSize (SingleTrialBufferSize size)
     data.resize (static_cast<int> (m_size.numChannels) * m_size.maxTrials * m_size.numSamples,
                  0.0f);
     writeIndex = 0;
+    numberOfStoredTrials = 0;
+    ++layoutGeneration;
 }
 
 bool SingleTrialBuffer::getChannelMinMax (int channelIndex,
@@ -23,6 +23,7 @@
 */
 #pragma once
 
+#include <cstdint>
 #include <span>
 #include <vector>
 
@@ -75,6 +76,41 @@ public:
      */
     void addTrial (const float* const* trialData, int nChannels, int nSamples);
 
+    /** Get a pointer to the storage of the next trial for in-place writing
+     * @param channelIndex Channel to write (0-based)
+     * @param trialOffset Writes the trial that many slots after the next one, so several
+     *                    trials can be written before they are committed (< maxTrials)
+     * @return Pointer to numSamples floats. The trial only becomes visible after commitTrial().
+     * @note If the buffer is full, the slot still holds the oldest trial until it is written.
+     */
+    float* getNextTrialWritePointer (int channelIndex, int trialOffset = 0);
+
+    /** Store the trial written through getNextTrialWritePointer() as the newest trial */
+    void commitTrial() { commitTrials (1); }
+
+    /** Store the numTrials trials written through getNextTrialWritePointer() with trial
+        offsets 0 to numTrials - 1, in that order */
+    void commitTrials (int numTrials);
+
+    /** Give up the trial written through getNextTrialWritePointer()
+     * @note If the buffer is full, the slot held the oldest trial, which is dropped as it
+     *       may have been partially overwritten.
+     */
+    void discardTrial() { discardTrials (1); }
+
+    /** Give up the numTrials trials written through getNextTrialWritePointer(), dropping the
+        stored trials whose slots they may have overwritten */
+    void discardTrials (int numTrials);
+
+    /** Stop counting the stored trials in the slots of the next numTrials trials, so they
+        are not read while those trials are written over a longer time. The stored trials
+        are gone from then on, even if the new trials are never committed. Idempotent. */
+    void reserveNextTrials (int numTrials);
+
+    /** Changes whenever the slots of unwritten trials move or are cleared (resize, clear,
+        setMaxTrials), which invalidates trials that are being written */
+    uint64_t getLayoutGeneration() const { return layoutGeneration; }
+
     /** Get a span view of all trials for a specific channel
      * @param channelIndex Channel to access (0-based)
      * @return Span of float data containing all stored trials for this channel
@@ -161,6 +197,7 @@ private:
 
     int numberOfStoredTrials = 0; // current number of stored trials (<= maxTrials)
     int writeIndex = 0; // circular buffer write position
+    uint64_t layoutGeneration = 0;
 
     /** Get flat array index for a given channel, trial, and sample */
     inline int getIndex (int channel, int trial, int sample) const
@@ -0,0 +1,172 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace TriggeredAverage
+{
+/**
+ * Publishes immutable snapshots of a value for readers on other threads.
+ *
+ * The writer fills in a snapshot with beginUpdate() and makes it the current one with
+ * publish(). Readers obtain the current snapshot with read() without locking or copying;
+ * the snapshot stays unchanged for as long as they hold it.
+ *
+ * Snapshots count their readers. The writer recycles snapshots that are neither current
+ * nor read anymore, so once the pool has grown to the number of snapshots held at the same
+ * time, publishing does not allocate. A reader only counts itself on a snapshot that is
+ * still current after it did so; with both steps sequentially consistent, the writer either
+ * sees the count or the reader sees that the snapshot was replaced.
+ *
+ * beginUpdate() and publish() must not be called from several threads at once.
+ */
+template <typename T>
+class SnapshotPublisher
+{
+    struct Node
+    {
+        T value {};
+        std::atomic<int> numReaders = 0;
+    };
+
+public:
+    /** Read access to the snapshot that was current when it was obtained */
+    class Reader
+    {
+    public:
+        Reader() = default;
+        Reader (Reader&& other) noexcept : m_node (std::exchange (other.m_node, nullptr)) {}
+        Reader& operator= (Reader&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                m_node = std::exchange (other.m_node, nullptr);
+            }
+            return *this;
+        }
+        ~Reader() { release(); }
+
+        /** False if nothing was published yet */
+        explicit operator bool() const { return m_node != nullptr; }
+        const T& operator*() const { return m_node->value; }
+        const T* operator->() const { return &m_node->value; }
+
+    private:
+        friend class SnapshotPublisher;
+        explicit Reader (Node* node) : m_node (node) {}
+
+        void release()
+        {
+            if (m_node != nullptr)
+                m_node->numReaders.fetch_sub (1, std::memory_order_release);
+            m_node = nullptr;
+        }
+
+        Node* m_node = nullptr;
+
+        JUCE_DECLARE_NON_COPYABLE (Reader)
+    };
+
+    SnapshotPublisher() = default;
+
+    /** Takes over the snapshots of another publisher, which no reader may hold */
+    SnapshotPublisher (SnapshotPublisher&& other) noexcept
+        : m_pool (std::move (other.m_pool)),
+          m_published (other.m_published.exchange (nullptr)),
+          m_updated (std::exchange (other.m_updated, nullptr))
+    {
+    }
+
+    SnapshotPublisher& operator= (SnapshotPublisher&& other) noexcept
+    {
+        if (this != &other)
+        {
+            m_pool = std::move (other.m_pool);
+            m_published.store (other.m_published.exchange (nullptr));
+            m_updated = std::exchange (other.m_updated, nullptr);
+        }
+        return *this;
+    }
+
+    /** Returns a snapshot to fill in, which may hold the values of an older one. Readers
+        see it once publish() is called. Writer thread only. */
+    T& beginUpdate()
+    {
+        const Node* published = m_published.load (std::memory_order_relaxed);
+        for (auto& node : m_pool)
+        {
+            if (node.get() != published && node->numReaders.load() == 0)
+            {
+                m_updated = node.get();
+                return m_updated->value;
+            }
+        }
+
+        m_pool.push_back (std::make_unique<Node>());
+        m_updated = m_pool.back().get();
+        return m_updated->value;
+    }
+
+    /** Makes the snapshot of the last beginUpdate() the current one. Writer thread only. */
+    void publish()
+    {
+        jassert (m_updated != nullptr);
+        m_published.store (std::exchange (m_updated, nullptr));
+    }
+
+    /** Returns the current snapshot. Lock-free; safe to call from any thread. */
+    Reader read() const
+    {
+        for (;;)
+        {
+            Node* node = m_published.load();
+            if (node == nullptr)
+                return {};
+
+            node->numReaders.fetch_add (1);
+            if (m_published.load() == node)
+                return Reader (node);
+
+            // replaced meanwhile, so it may be being recycled: try the new one
+            node->numReaders.fetch_sub (1, std::memory_order_relaxed);
+        }
+    }
+
+    /** Number of snapshots allocated so far */
+    int getPoolSize() const { return static_cast<int> (m_pool.size()); }
+
+private:
+    std::vector<std::unique_ptr<Node>> m_pool;
+    std::atomic<Node*> m_published = nullptr;
+    Node* m_updated = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE (SnapshotPublisher)
+};
+
+} // namespace TriggeredAverage
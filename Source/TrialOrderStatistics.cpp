@@ -0,0 +1,193 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "TrialOrderStatistics.h"
+#include "SingleTrialBuffer.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace TriggeredAverage
+{
+
+void TrialOrderStatistics::setStatistic (AverageStatistic statistic, float trimFraction)
+{
+    const bool wasActive = isActive();
+    m_statistic = statistic;
+    m_trimFraction = std::clamp (trimFraction, 0.0f, 0.5f);
+
+    if (isActive() != wasActive)
+        allocate();
+    m_version.fetch_add (1, std::memory_order_release);
+}
+
+void TrialOrderStatistics::setSize (int numChannels, int numSamples, int maxTrials)
+{
+    m_numChannels = std::max (0, numChannels);
+    m_numSamples = std::max (0, numSamples);
+    m_maxTrials = std::max (0, maxTrials);
+    allocate();
+    m_version.fetch_add (1, std::memory_order_release);
+}
+
+void TrialOrderStatistics::allocate()
+{
+    // Assigning a new vector frees the memory when the statistics are not needed
+    const size_t size =
+        isActive() ? static_cast<size_t> (m_numChannels) * m_maxTrials * m_numSamples : 0;
+    m_values = std::vector<float> (size);
+    m_channelNumTrials.assign (static_cast<size_t> (m_numChannels), 0);
+}
+
+void TrialOrderStatistics::clear()
+{
+    std::fill (m_channelNumTrials.begin(), m_channelNumTrials.end(), 0);
+    m_version.fetch_add (1, std::memory_order_release);
+}
+
+void TrialOrderStatistics::rebuildFromTrials (const SingleTrialBuffer& trials)
+{
+    if (trials.getNumChannels() != m_numChannels || trials.getNumSamples() != m_numSamples
+        || trials.getMaxTrials() != m_maxTrials)
+        setSize (trials.getNumChannels(), trials.getNumSamples(), trials.getMaxTrials());
+    else
+        clear();
+
+    if (! isActive())
+        return;
+
+    for (int ch = 0; ch < m_numChannels; ++ch)
+    {
+        for (int t = 0; t < trials.getNumStoredTrials(); ++t)
+            insertChannel (ch, trials.getTrialDataPointer (ch, t));
+    }
+}
+
+void TrialOrderStatistics::insertChannel (int channel, const float* channelData)
+{
+    assert (isActive() && "No sorted values without a statistic other than the mean");
+    assert (channel >= 0 && channel < m_numChannels && "Channel index out of range");
+    int& numTrials = m_channelNumTrials[static_cast<size_t> (channel)];
+    assert (numTrials < m_maxTrials && "Remove a trial before inserting into a full channel");
+
+    // From the new top row down, each row takes the row below it while that is larger than
+    // the new value, and the smaller of its own and the new value otherwise. As the rows
+    // are sorted, that is the new value clamped between the two rows.
+    const float* x = channelData;
+    if (numTrials == 0)
+    {
+        std::memcpy (getRow (channel, 0), x, static_cast<size_t> (m_numSamples) * sizeof (float));
+        numTrials = 1;
+        return;
+    }
+
+    float* row = getRow (channel, numTrials);
+    const float* below = getRow (channel, numTrials - 1);
+    for (int s = 0; s < m_numSamples; ++s)
+        row[s] = std::max (below[s], x[s]);
+
+    for (int rank = numTrials - 1; rank > 0; --rank)
+    {
+        row = getRow (channel, rank);
+        below = getRow (channel, rank - 1);
+        for (int s = 0; s < m_numSamples; ++s)
+            row[s] = std::max (below[s], std::min (row[s], x[s]));
+    }
+
+    row = getRow (channel, 0);
+    for (int s = 0; s < m_numSamples; ++s)
+        row[s] = std::min (row[s], x[s]);
+
+    ++numTrials;
+}
+
+void TrialOrderStatistics::removeChannel (int channel, const float* channelData)
+{
+    assert (isActive() && "No sorted values without a statistic other than the mean");
+    assert (channel >= 0 && channel < m_numChannels && "Channel index out of range");
+    int& numTrials = m_channelNumTrials[static_cast<size_t> (channel)];
+    assert (numTrials > 0 && "No trial to remove");
+
+    // The rows from the removed value up take the row above them. The value is one of the
+    // stored ones, so the first row not below it holds it.
+    const float* x = channelData;
+    for (int rank = 0; rank < numTrials - 1; ++rank)
+    {
+        float* row = getRow (channel, rank);
+        const float* above = getRow (channel, rank + 1);
+        for (int s = 0; s < m_numSamples; ++s)
+        {
+            const float value = row[s];
+            const float next = above[s];
+            row[s] = value < x[s] ? value : next;
+        }
+    }
+
+    --numTrials;
+}
+
+void TrialOrderStatistics::computeChannel (int channel, float* destination) const
+{
+    assert (channel >= 0 && channel < m_numChannels && "Channel index out of range");
+    const int numTrials = isActive() ? getNumTrials (channel) : 0;
+    if (numTrials == 0)
+    {
+        std::fill (destination, destination + m_numSamples, 0.0f);
+        return;
+    }
+
+    // The median is the middle row, or the mean of the two middle rows
+    int firstRank = (numTrials - 1) / 2;
+    int endRank = numTrials / 2 + 1;
+    if (m_statistic == AverageStatistic::TrimmedMean)
+    {
+        // At least one trial is left
+        const int numTrimmed =
+            std::min (static_cast<int> (numTrials * m_trimFraction), (numTrials - 1) / 2);
+        firstRank = numTrimmed;
+        endRank = numTrials - numTrimmed;
+    }
+
+    std::memcpy (destination,
+                 getRow (channel, firstRank),
+                 static_cast<size_t> (m_numSamples) * sizeof (float));
+    for (int rank = firstRank + 1; rank < endRank; ++rank)
+    {
+        const float* row = getRow (channel, rank);
+        for (int s = 0; s < m_numSamples; ++s)
+            destination[s] += row[s];
+    }
+
+    const float scale = 1.0f / static_cast<float> (endRank - firstRank);
+    for (int s = 0; s < m_numSamples; ++s)
+        destination[s] *= scale;
+}
+
+const float* TrialOrderStatistics::getRank (int channel, int rank) const
+{
+    assert (channel >= 0 && channel < m_numChannels && "Channel index out of range");
+    assert (rank >= 0 && rank < getNumTrials (channel) && "Rank out of range");
+    return getRow (channel, rank);
+}
+
+} // namespace TriggeredAverage
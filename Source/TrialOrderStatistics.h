@@ -0,0 +1,138 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI Plugin Triggered Average
+    Copyright (C) 2022 Open Ephys
+    Copyright (C) 2025-2026 Joscha Schmiedt, Universität Bremen
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace TriggeredAverage
+{
+class SingleTrialBuffer;
+
+/** Which value of the trials at each sample a plot shows as the average */
+enum class AverageStatistic
+{
+    Mean, // of the trials covered by the average mode
+    Median, // of the stored trials
+    TrimmedMean // of the stored trials without the largest and smallest values
+};
+
+/**
+ * @brief Sorted values of the stored trials at each sample, for robust averages
+ *
+ * Kept in step with a SingleTrialBuffer: each trial is inserted when stored and removed
+ * again when its slot is overwritten, so reading a median or trimmed mean never sorts.
+ * The values are stored rank-major per channel, i.e. a row of numSamples floats holds the
+ * k-th smallest value of every sample:
+ * [Ch0_Rank0][Ch0_Rank1]...[Ch0_RankN][Ch1_Rank0]...
+ *
+ * Inserting or removing a trial is one branch-free pass over the rows of a channel that
+ * compilers vectorize across samples, and a median is a single row.
+ *
+ * Memory is only allocated while a statistic other than the mean is selected. Both the
+ * memory and the cost of inserting or removing a trial grow with maxTrials, which follows
+ * the max_trials parameter through the trial buffer.
+ *
+ * Thread Safety: This class is NOT thread-safe. External synchronization required, except
+ * that different channels may be inserted and removed from several threads at once. The
+ * collector updates it under the lock of its trigger source; plots never read it directly
+ * but the copy in the average buffer's published snapshot, so they do not wait for it.
+ */
+class TrialOrderStatistics
+{
+public:
+    TrialOrderStatistics() = default;
+
+    /** Selects the statistic computeChannel() returns. trimFraction is the share of trials
+        left out at each end for the trimmed mean. Switching between the mean and the
+        others allocates or frees the sorted values, which are then empty. */
+    void setStatistic (AverageStatistic statistic, float trimFraction);
+    AverageStatistic getStatistic() const { return m_statistic; }
+    float getTrimFraction() const { return m_trimFraction; }
+
+    /** True if trials have to be inserted and removed, i.e. a statistic other than the
+        mean is selected */
+    bool isActive() const { return m_statistic != AverageStatistic::Mean; }
+
+    /** Sets the size of the trials and their maximum number. Clears the sorted values. */
+    void setSize (int numChannels, int numSamples, int maxTrials);
+
+    /** Removes all trials */
+    void clear();
+
+    /** Replaces the sorted values by those of the trials stored in a trial buffer, taking
+        on its size */
+    void rebuildFromTrials (const SingleTrialBuffer& trials);
+
+    /** Inserts one channel of a trial into the sorted values of its samples */
+    void insertChannel (int channel, const float* channelData);
+
+    /** Removes one channel of a trial inserted before from the sorted values */
+    void removeChannel (int channel, const float* channelData);
+
+    /** Computes the selected statistic of one channel into numSamples values. The mean is
+        computed by the average buffer instead; without an active statistic, this gives 0. */
+    void computeChannel (int channel, float* destination) const;
+
+    /** k-th smallest value of every sample of a channel, for rank < getNumTrials (channel) */
+    const float* getRank (int channel, int rank) const;
+
+    int getNumTrials (int channel) const { return m_channelNumTrials[channel]; }
+    int getNumChannels() const { return m_numChannels; }
+    int getNumSamples() const { return m_numSamples; }
+    int getMaxTrials() const { return m_maxTrials; }
+
+    /** Increases when the statistic or the trials changed other than by inserting and
+        removing single trials, which the average buffer's version already tracks */
+    uint64_t getVersion() const { return m_version.load (std::memory_order_acquire); }
+
+private:
+    AverageStatistic m_statistic = AverageStatistic::Mean;
+    float m_trimFraction = 0.1f;
+
+    int m_numChannels = 0;
+    int m_numSamples = 0;
+    int m_maxTrials = 0;
+
+    // Rank-major per channel: row k of a channel holds the k-th smallest value per sample
+    std::vector<float> m_values;
+    std::vector<int> m_channelNumTrials;
+
+    std::atomic<uint64_t> m_version = 0;
+
+    float* getRow (int channel, int rank)
+    {
+        return &m_values[(static_cast<size_t> (channel) * m_maxTrials + rank) * m_numSamples];
+    }
+    const float* getRow (int channel, int rank) const
+    {
+        return &m_values[(static_cast<size_t> (channel) * m_maxTrials + rank) * m_numSamples];
+    }
+
+    /** Allocates the sorted values if active, and empties them */
+    void allocate();
+};
+
+} // namespace TriggeredAverage
@@ -21,6 +21,34 @@ TriggeredAverage::TriggerSource::TriggerSource (TriggeredAvgNode* processor_,
     colour = getColourForLine (line);
 }
 
+juce::String TriggeredAverage::TriggerSource::getStreamKey (const DataStream* stream)
+{
+    return String (stream->getSourceNodeId()) + "|" + stream->getName();
+}
+
+void TriggeredAverage::TriggerSource::saveChannelMasks (XmlElement* xml) const
+{
+    for (const auto& [streamKey, mask] : channelMasks)
+    {
+        XmlElement* channelsXml = xml->createNewChildElement ("CHANNELS");
+        channelsXml->setAttribute ("stream", streamKey);
+        channelsXml->setAttribute ("mask", mask.toString (16));
+    }
+}
+
+void TriggeredAverage::TriggerSource::loadChannelMasks (const XmlElement* xml)
+{
+    // streams without a saved mask capture all channels
+    channelMasks.clear();
+    for (auto* channelsXml : xml->getChildWithTagNameIterator ("CHANNELS"))
+    {
+        BigInteger mask;
+        mask.parseString (channelsXml->getStringAttribute ("mask"), 16);
+        if (! mask.isZero())
+            channelMasks[channelsXml->getStringAttribute ("stream")] = mask;
+    }
+}
+
 juce::Colour TriggeredAverage::TriggerSource::getColourForLine (int line)
 {
     Array<Colour> eventColours = { Colour (224, 185, 36),  Colour (243, 119, 33),
@@ -144,3 +172,17 @@ void TriggerSources::setTriggerSourceTriggerType (TriggerSource* source,
         m_parentProcessor->getParameter (ParameterNames::trigger_type)
             ->setNextValue ((int) type, false);
 }
+
+void TriggerSources::setTriggerSourceChannelMasks (TriggerSource* source,
+                                                   const ChannelMasks& channelMasks,
+                                                   bool updateEditor)
+{
+    source->channelMasks = channelMasks;
+
+    // the buffers of the source change size, which the editor sets up
+    if (auto* editor = dynamic_cast<TriggeredAvgEditor*> (m_parentProcessor->getEditor());
+        updateEditor && editor)
+    {
+        editor->updateSettings();
+    }
+}
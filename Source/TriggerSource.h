@@ -1,6 +1,12 @@
 #pragma once
 #include <JuceHeader.h>
+#include <atomic>
 #include <cstdint>
+#include <map>
+#include <vector>
+
+class DataStream;
+
 namespace TriggeredAverage
 {
 enum class TriggerType : std::int_fast8_t
@@ -24,6 +30,26 @@ constexpr auto TriggerTypeToString (TriggerType type)
             return "Unknown Trigger Type";
     }
 }
+/** What became of the capture requests of a trigger source. Written by the audio and
+    collector threads, readable from any thread. */
+struct CaptureCounters
+{
+    std::atomic<uint64_t> accepted = 0; // taken into the collector's backlog
+    std::atomic<uint64_t> captured = 0; // added to the average
+    std::atomic<uint64_t> dropped = 0; // rejected or evicted because the backlog was full
+    std::atomic<uint64_t> tooOld = 0; // window overwritten in the ring before it was read
+    std::atomic<uint64_t> aborted = 0; // window spans a time jump or changed size, or no ring
+
+    void reset()
+    {
+        for (auto* counter : { &accepted, &captured, &dropped, &tooOld, &aborted })
+            counter->store (0, std::memory_order_relaxed);
+    }
+};
+
+/** Channels to capture per stream key (see TriggerSource::getStreamKey()) as local indices */
+using ChannelMasks = std::map<juce::String, juce::BigInteger>;
+
 class TriggeredAvgNode;
 class TriggerSource
 {
@@ -35,12 +61,38 @@ public:
 
     static juce::Colour getColourForLine (int line);
 
+    /** Identifies a stream across signal chain updates and sessions, unlike its stream id */
+    static juce::String getStreamKey (const DataStream* stream);
+
+    /** Returns the local indices of the channels captured for this source from the stream with
+        the given key and numChannels channels. Channel i of the source's average and trial
+        buffers holds the channel at position i. */
+    std::vector<int> getCapturedChannels (const juce::String& streamKey, int numChannels) const
+    {
+        const auto it = channelMasks.find (streamKey);
+        const bool captureAll = it == channelMasks.end() || it->second.isZero();
+
+        std::vector<int> channels;
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            if (captureAll || it->second[ch])
+                channels.push_back (ch);
+        }
+        return channels;
+    }
+
+    /** Writes the channel masks as CHANNELS children of xml, and reads them back */
+    void saveChannelMasks (juce::XmlElement* xml) const;
+    void loadChannelMasks (const juce::XmlElement* xml);
+
     juce::String name;
     int line;
     TriggerType type;
     bool canTrigger;
     juce::Colour colour;
+    ChannelMasks channelMasks; // all channels are captured of streams without a mask
     TriggeredAvgNode* processor;
+    CaptureCounters captureCounters;
 };
 
 // Container class for managing multiple TriggerSource objects
@@ -84,6 +136,9 @@ public:
     void setTriggerSourceTriggerType (TriggerSource* source,
                                       TriggerType type,
                                       bool updateEditor = true);
+    void setTriggerSourceChannelMasks (TriggerSource* source,
+                                       const ChannelMasks& channelMasks,
+                                       bool updateEditor = true);
     String ensureUniqueTriggerSourceName (String name);
     int getNextConditionIndex() const { return m_nextConditionIndex; }
     void clear() { m_triggerSources.clear(); }
@@ -116,6 +116,7 @@ RemoveTriggerConditions::RemoveTriggerConditions (TriggeredAvgNode* processor_,
         sourceXml->setAttribute ("line", source->line);
         sourceXml->setAttribute ("type", static_cast<int> (source->type));
         sourceXml->setAttribute ("colour", source->colour.toString());
+        source->saveChannelMasks (sourceXml);
         sourceXml->setAttribute ("index", allSources.indexOf (source));
     }
 }
@@ -169,6 +170,8 @@ bool RemoveTriggerConditions::undo()
         if (savedColour.length() > 0)
             source->colour = Colour::fromString (savedColour);
 
+        source->loadChannelMasks (sourceXml);
+
         triggerSourcesToRemove.add (source);
     }
 
@@ -314,3 +317,45 @@ bool ChangeTriggerType::undo()
 
     return true;
 }
+
+ChangeTriggerChannels::ChangeTriggerChannels (TriggeredAvgNode* processor_,
+                                              TriggerSource* source_,
+                                              const ChannelMasks& newChannelMasks_)
+    : ProcessorAction ("ChangeTriggerChannels"),
+      processorNode (processor_),
+      triggerSource (source_),
+      newChannelMasks (newChannelMasks_)
+{
+    triggerIndex = processorNode->getTriggerSources().getIndexOf (triggerSource);
+    oldChannelMasks = triggerSource->channelMasks;
+}
+
+void ChangeTriggerChannels::restoreOwner (GenericProcessor* processor)
+{
+    processorNode = (TriggeredAvgNode*) processor;
+}
+
+bool ChangeTriggerChannels::perform()
+{
+    auto source = processorNode->getTriggerSources().getByIndex (triggerIndex);
+    if (source != nullptr)
+    {
+        processorNode->getTriggerSources().setTriggerSourceChannelMasks (source, newChannelMasks);
+        processorNode->registerUndoableAction (processorNode->getNodeId(), this);
+        CoreServices::sendStatusMessage ("Changed channels of trigger condition " + source->name);
+    }
+
+    return true;
+}
+
+bool ChangeTriggerChannels::undo()
+{
+    auto source = processorNode->getTriggerSources().getByIndex (triggerIndex);
+    if (source != nullptr)
+    {
+        processorNode->getTriggerSources().setTriggerSourceChannelMasks (source, oldChannelMasks);
+        CoreServices::sendStatusMessage ("Changed channels of trigger condition " + source->name);
+    }
+
+    return true;
+}
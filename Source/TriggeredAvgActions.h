@@ -138,5 +138,30 @@ private:
     TriggerType oldType;
     int triggerIndex = -1;
 };
+
+/**
+    Changes the channels captured for a trigger condition
+
+    Undo: restores the previous channel selection.
+*/
+class ChangeTriggerChannels : public ProcessorAction
+{
+public:
+    ChangeTriggerChannels (TriggeredAvgNode* processor,
+                           TriggerSource* triggerSource,
+                           const ChannelMasks& newChannelMasks);
+    ~ChangeTriggerChannels() override = default;
+
+    void restoreOwner (GenericProcessor* processor) override;
+    bool perform() override;
+    bool undo() override;
+
+private:
+    TriggeredAvgNode* processorNode;
+    TriggerSource* triggerSource;
+    ChannelMasks newChannelMasks;
+    ChannelMasks oldChannelMasks;
+    int triggerIndex = -1;
+};
 } // namespace TriggeredAverage
 #endif /* TriggeredAvgNodeActions_h */
@@ -34,11 +34,8 @@ using namespace TriggeredAverage;
 TriggeredAvgNode::TriggeredAvgNode()
     : GenericProcessor ("Triggered Avg"),
       m_dataStore (std::make_unique<DataStore>()),
-      // TODO: check if 10 seconds buffer is sufficient (lock-free?) and how to handle more than one stream
       m_canvas (nullptr),
-      m_triggerSources (this), // 10 seconds buffer
-      m_ringBufferSize (
-          static_cast<int> (GenericProcessor::getSampleRate (m_dataStreamIndex) * 10.0f)),
+      m_triggerSources (this),
       m_threadsInitialized (false)
 {
     addFloatParameter (Parameter::PROCESSOR_SCOPE,
@@ -63,6 +60,107 @@ TriggeredAvgNode::TriggeredAvgNode()
                        10.0f,
                        true);
 
+    addFloatParameter (Parameter::PROCESSOR_SCOPE,
+                       ParameterNames::latency_margin_ms,
+                       "Latency Margin",
+                       "Data kept in the ring buffer beyond the trigger window, covering the "
+                       "delay until a trigger is collected",
+                       "ms",
+                       1000.0f,
+                       100.0f,
+                       10000.0f,
+                       100.0f,
+                       false);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE,
+                         ParameterNames::compact_ring_buffer,
+                         "Compact Ring Buffer",
+                         "Store the ring buffer as 16-bit integers in units of each channel's "
+                         "bit-volts, halving its memory",
+                         false,
+                         true);
+
+    addIntParameter (Parameter::PROCESSOR_SCOPE,
+                     ParameterNames::capture_threads,
+                     "Capture Threads",
+                     "Number of threads copying and averaging captured trials; large captures "
+                     "are split by channel across them",
+                     1,
+                     1,
+                     16,
+                     true);
+
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE,
+                         ParameterNames::streaming_capture,
+                         "Streaming Capture",
+                         "Copy each trigger window into its trial block by block as the data "
+                         "arrives, instead of reading it back once complete",
+                         false,
+                         true);
+
+    addIntParameter (Parameter::PROCESSOR_SCOPE,
+                     ParameterNames::capture_backlog,
+                     "Capture Backlog",
+                     "Maximum number of triggers per stream waiting for their data; further "
+                     "triggers are dropped according to the backlog policy",
+                     4096,
+                     16,
+                     16384,
+                     true);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE,
+                             ParameterNames::backlog_policy,
+                             "Backlog Policy",
+                             "Which trigger to drop when the capture backlog is full: the oldest, "
+                             "the newest, or the newest pending one of the same source",
+                             { "Drop Oldest", "Drop Newest", "Coalesce" },
+                             0,
+                             true);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE,
+                             ParameterNames::accumulator,
+                             "Accumulator",
+                             "How trials are summed: float sums are fastest, while the double "
+                             "precision ones keep mean and standard deviation exact over long "
+                             "sessions with DC offsets",
+                             { "Float", "Kahan (Double)", "Welford (Double)" },
+                             0);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE,
+                             ParameterNames::average_mode,
+                             "Average Mode",
+                             "Which trials the average covers: all of them, the stored last "
+                             "Max Trials, or all with exponentially decaying weights",
+                             { "All Trials", "Last Trials", "Exponential" },
+                             0);
+
+    addIntParameter (Parameter::PROCESSOR_SCOPE,
+                     ParameterNames::average_time_constant,
+                     "Time Constant",
+                     "Number of newer trials after which a trial weighs 1/e in the exponential "
+                     "average",
+                     20,
+                     1,
+                     1000);
+
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE,
+                             ParameterNames::average_statistic,
+                             "Average Statistic",
+                             "What the average trace shows at each sample: the mean, or the "
+                             "median or trimmed mean of the stored trials, which artifacts in "
+                             "single trials do not pull away",
+                             { "Mean", "Median", "Trimmed Mean" },
+                             0);
+
+    addIntParameter (Parameter::PROCESSOR_SCOPE,
+                     ParameterNames::trim_percent,
+                     "Trim Percent",
+                     "Percentage of the stored trials left out at each end of the sorted "
+                     "values for the trimmed mean",
+                     10,
+                     0,
+                     45);
+
     addIntParameter (Parameter::PROCESSOR_SCOPE,
                      ParameterNames::max_trials,
                      "Max Trials",
@@ -72,6 +170,14 @@ TriggeredAvgNode::TriggeredAvgNode()
                      50,
                      true);
 
+    addIntParameter (Parameter::PROCESSOR_SCOPE,
+                     ParameterNames::max_refresh_rate,
+                     "Max Refresh Rate",
+                     "Maximum number of times per second the plots are redrawn for new trials",
+                     30,
+                     1,
+                     60);
+
     addIntParameter (Parameter::PROCESSOR_SCOPE,
                      ParameterNames::trigger_line,
                      "Trigger Line",
@@ -140,6 +246,9 @@ TriggeredAvgNode::TriggeredAvgNode()
                        10000.0f,
                        1.0f);
 
+    // The trial buffers keep as many trials as the parameter from the start
+    m_dataStore->setMaxTrialsToStore (getMaxTrials());
+
     // Create a default trigger source for any line
     m_triggerSources.addTriggerSource (-1, TriggerType::TTL_TRIGGER);
 }
@@ -158,9 +267,7 @@ void TriggeredAvgNode::parameterValueChanged (Parameter* param)
     // Update trial buffers when max trials changes
     if (param->getName().equalsIgnoreCase (max_trials))
     {
-        const int maxTrials = (int) param->getValue();
-        const int totalSamples = getNumberOfSamples();
-        m_dataStore->ResizeAllAverageBuffers (getTotalNumInputChannels(), totalSamples, maxTrials);
+        m_dataStore->setMaxTrialsToStore ((int) param->getValue());
 
         if (m_canvas)
         {
@@ -188,8 +295,8 @@ void TriggeredAvgNode::parameterValueChanged (Parameter* param)
     }
     else if (param->getName().equalsIgnoreCase (ParameterNames::pre_ms))
     {
-        const int totalSamples = getNumberOfSamples();
-        m_dataStore->ResizeAllAverageBuffers (getTotalNumInputChannels(), totalSamples, false);
+        resizeAverageBuffers (false);
+        resizeRingBuffers();
 
         if (m_canvas)
         {
@@ -199,8 +306,8 @@ void TriggeredAvgNode::parameterValueChanged (Parameter* param)
     }
     else if (param->getName().equalsIgnoreCase (ParameterNames::post_ms))
     {
-        const int totalSamples = getNumberOfSamples();
-        m_dataStore->ResizeAllAverageBuffers (getTotalNumInputChannels(), totalSamples, false);
+        resizeAverageBuffers (false);
+        resizeRingBuffers();
 
         if (m_canvas)
         {
@@ -208,6 +315,40 @@ void TriggeredAvgNode::parameterValueChanged (Parameter* param)
             triggerAsyncUpdate();
         }
     }
+    else if (param->getName().equalsIgnoreCase (latency_margin_ms))
+    {
+        resizeRingBuffers();
+    }
+    else if (param->getName().equalsIgnoreCase (accumulator))
+    {
+        // The trials so far are converted, so this works during acquisition too
+        m_dataStore->setAccumulatorType (static_cast<AccumulatorType> ((int) param->getValue()));
+
+        if (m_canvas)
+            triggerAsyncUpdate();
+    }
+    else if (param->getName().equalsIgnoreCase (average_mode)
+             || param->getName().equalsIgnoreCase (average_time_constant))
+    {
+        // The averages start over from the stored trials
+        m_dataStore->setAverageMode (
+            static_cast<AverageMode> ((int) getParameter (average_mode)->getValue()),
+            (int) getParameter (average_time_constant)->getValue());
+
+        if (m_canvas)
+            triggerAsyncUpdate();
+    }
+    else if (param->getName().equalsIgnoreCase (average_statistic)
+             || param->getName().equalsIgnoreCase (trim_percent))
+    {
+        // The stored trials are sorted from now on
+        m_dataStore->setAverageStatistic (
+            static_cast<AverageStatistic> ((int) getParameter (average_statistic)->getValue()),
+            (int) getParameter (trim_percent)->getValue() / 100.0f);
+
+        if (m_canvas)
+            triggerAsyncUpdate();
+    }
     else if (param->getName().equalsIgnoreCase (use_custom_y_limits))
     {
         if (m_canvas)
@@ -231,29 +372,29 @@ void TriggeredAvgNode::parameterValueChanged (Parameter* param)
 
 void TriggeredAvgNode::process (AudioBuffer<float>& buffer)
 {
-    // For now: first stream only
-    static SampleNumber lastSampleNumber = 0;
-    // TODO: Add handling of multiple streams (ring buffer per stream?)
-    StreamId streamId = getDataStreams()[m_dataStreamIndex]->getStreamId();
-    auto timestamp = getFirstTimestampForBlock (streamId);
-
-    SampleNumber firstSampleNumber = getFirstSampleNumberForBlock (streamId);
-    auto diff = firstSampleNumber - lastSampleNumber;
-    if (diff < 0)
+    if (! m_threadsInitialized.load())
+        return;
+
+    for (auto& stream : m_streamRingBuffers)
     {
-        lastSampleNumber += 0;
+        const SampleNumber firstSampleNumber = getFirstSampleNumberForBlock (stream.streamId);
+        const uint32 nSamplesInBlock = getNumSamplesInBlock (stream.streamId);
+
+        stream.ringBuffer->addData (buffer.getArrayOfReadPointers() + stream.firstChannel,
+                                    stream.numChannels,
+                                    firstSampleNumber,
+                                    nSamplesInBlock);
     }
-    lastSampleNumber = firstSampleNumber;
-    if (! m_ringBuffer)
-        return;
 
-    auto nSamplesInBlock = getNumSamplesInBlock (streamId);
-    m_ringBuffer->addData (buffer, firstSampleNumber, nSamplesInBlock);
     checkForEvents (false);
 }
 
 bool TriggeredAvgNode::startAcquisition()
 {
+    for (auto source : m_triggerSources.getAll())
+        source->captureCounters.reset();
+    m_latencyStats.reset();
+
     initializeThreads();
     return m_threadsInitialized;
 }
@@ -262,27 +403,31 @@ float TriggeredAvgNode::getPreWindowSizeMs() const
 {
     return getParameter (ParameterNames::pre_ms)->getValue();
 }
-int TriggeredAvgNode::getNumberOfPreSamples() const
+int TriggeredAvgNode::getNumberOfPreSamples (StreamId streamId) const
 {
-    const float sampleRate = getDataStreams()[m_dataStreamIndex]->getSampleRate();
+    const float sampleRate = getDataStream (streamId)->getSampleRate();
     const int preSamples = static_cast<int> (sampleRate * (getPreWindowSizeMs() / 1000.0f));
     return preSamples;
 }
-int TriggeredAvgNode::getNumberOfPostSamplesIncludingTrigger() const
+int TriggeredAvgNode::getNumberOfPostSamplesIncludingTrigger (StreamId streamId) const
 {
-    const float sampleRate = getDataStreams()[m_dataStreamIndex]->getSampleRate();
+    const float sampleRate = getDataStream (streamId)->getSampleRate();
     const int postSamples = static_cast<int> (sampleRate * (getPostWindowSizeMs() / 1000.0f));
     return postSamples;
 }
-int TriggeredAvgNode::getNumberOfSamples() const
+int TriggeredAvgNode::getNumberOfSamples (StreamId streamId) const
 {
-    if (getNumDataStreams() == 0)
+    if (getDataStream (streamId) == nullptr)
         return 0;
-    const float sampleRate = getDataStreams()[m_dataStreamIndex]->getSampleRate();
-    const int preSamples = static_cast<int> (sampleRate * (getPreWindowSizeMs() / 1000.0f));
-    const int postSamples = static_cast<int> (sampleRate * (getPostWindowSizeMs() / 1000.0f));
-    const int totalSamples = preSamples + postSamples;
-    return totalSamples;
+    return getNumberOfPreSamples (streamId) + getNumberOfPostSamplesIncludingTrigger (streamId);
+}
+
+int TriggeredAvgNode::getRingBufferSize (StreamId streamId) const
+{
+    const float sampleRate = getDataStream (streamId)->getSampleRate();
+    const float lengthMs = getPreWindowSizeMs() + getPostWindowSizeMs()
+                           + getParameter (ParameterNames::latency_margin_ms)->getValue();
+    return static_cast<int> (std::ceil (sampleRate * (lengthMs / 1000.0f)));
 }
 
 float TriggeredAvgNode::getPostWindowSizeMs() const
@@ -299,6 +444,7 @@ void TriggeredAvgNode::saveCustomParametersToXml (XmlElement* xml)
         sourceXml->setAttribute ("line", source->line);
         sourceXml->setAttribute ("type", static_cast<int> (source->type));
         sourceXml->setAttribute ("colour", source->colour.toString());
+        source->saveChannelMasks (sourceXml);
     }
 }
 
@@ -325,6 +471,8 @@ void TriggeredAvgNode::loadCustomParametersFromXml (XmlElement* xml)
 
             if (savedColour.length() > 0)
                 source->colour = Colour::fromString (savedColour);
+
+            source->loadChannelMasks (sourceXml);
         }
     }
 }
@@ -355,7 +503,41 @@ void TriggeredAvgNode::handleBroadcastMessage (const String& message, const int6
     }
 }
 
-String TriggeredAvgNode::handleConfigMessage (const String& message) { return ""; }
+String TriggeredAvgNode::handleConfigMessage (const String& message)
+{
+    if (message.trim().equalsIgnoreCase ("capture_stats"))
+        return JSON::toString (getCaptureStats(), true);
+    if (message.trim().equalsIgnoreCase ("latency_stats"))
+        return JSON::toString (m_latencyStats.toVar(), true);
+
+    return "";
+}
+
+var TriggeredAvgNode::getCaptureStats()
+{
+    DynamicObject::Ptr stats = new DynamicObject();
+    for (auto source : m_triggerSources.getAll())
+    {
+        const auto& counters = source->captureCounters;
+        DynamicObject::Ptr sourceStats = new DynamicObject();
+        sourceStats->setProperty ("accepted", (int64) counters.accepted.load());
+        sourceStats->setProperty ("captured", (int64) counters.captured.load());
+        sourceStats->setProperty ("dropped", (int64) counters.dropped.load());
+        sourceStats->setProperty ("too_old", (int64) counters.tooOld.load());
+        sourceStats->setProperty ("aborted", (int64) counters.aborted.load());
+        stats->setProperty (source->name, sourceStats.get());
+    }
+    stats->setProperty ("clipped_samples", (int64) getNumClippedSamples());
+    return stats.get();
+}
+
+uint64_t TriggeredAvgNode::getNumClippedSamples() const
+{
+    uint64_t numClipped = 0;
+    for (const auto& stream : m_streamRingBuffers)
+        numClipped += stream.ringBuffer->getNumClippedSamples();
+    return numClipped;
+}
 
 bool TriggeredAvgNode::getIntField (DynamicObject::Ptr payload,
                                     String name,
@@ -376,20 +558,37 @@ void TriggeredAvgNode::handleTTLEvent (TTLEventPtr event)
 {
     if (m_dataCollector && m_threadsInitialized.load())
     {
+        const int64 arrivalTicks = Time::getHighResolutionTicks();
+
+        // Time of the event relative to the start of the current block. All streams are
+        // processed in the same block, so this converts the event into every stream's
+        // sample numbers.
+        const StreamId eventStreamId = event->getStreamId();
+        const double secondsIntoBlock =
+            static_cast<double> (
+                event->getSampleNumber()
+                - static_cast<SampleNumber> (getFirstSampleNumberForBlock (eventStreamId)))
+            / getDataStream (eventStreamId)->getSampleRate();
+
         for (auto source : m_triggerSources.getAll())
         {
             if (event->getLine() == source->line && event->getState() && source->canTrigger)
             {
-                const float sampleRate = getDataStreams()[m_dataStreamIndex]->getSampleRate();
-                int preSamples = static_cast<int> (sampleRate * (getPreWindowSizeMs() / 1000.0f));
-                int postSamples = static_cast<int> (sampleRate * (getPostWindowSizeMs() / 1000.0f));
-
-                auto triggerSample = event->getSampleNumber();
-                m_dataCollector->registerCaptureRequest (
-                    CaptureRequest { .triggerSource = source,
-                                     .triggerSample = event->getSampleNumber(),
-                                     .preSamples = preSamples,
-                                     .postSamples = postSamples });
+                for (const auto& stream : m_streamRingBuffers)
+                {
+                    const double sampleRate = getDataStream (stream.streamId)->getSampleRate();
+                    const SampleNumber triggerSample =
+                        static_cast<SampleNumber> (getFirstSampleNumberForBlock (stream.streamId))
+                        + static_cast<SampleNumber> (std::round (secondsIntoBlock * sampleRate));
+
+                    m_dataCollector->registerCaptureRequest (CaptureRequest {
+                        .triggerSource = source,
+                        .triggerSample = triggerSample,
+                        .preSamples = getNumberOfPreSamples (stream.streamId),
+                        .postSamples = getNumberOfPostSamplesIncludingTrigger (stream.streamId),
+                        .streamId = stream.streamId,
+                        .timestamps = { .triggerArrival = arrivalTicks } });
+                }
 
                 if (source->type == TriggerType::TTL_AND_MSG_TRIGGER)
                     source->canTrigger = false;
@@ -409,9 +608,64 @@ void TriggeredAvgNode::initializeThreads()
     if (m_threadsInitialized.load())
         shutdownThreads();
 
-    m_ringBuffer = std::make_unique<MultiChannelRingBuffer> (getNumInputs(), m_ringBufferSize);
-    m_dataCollector = std::make_unique<DataCollector> (this, m_ringBuffer.get(), m_dataStore.get());
-    if (getNumInputs() > 0 && m_ringBufferSize > 0)
+    m_dataCollector = std::make_unique<DataCollector> (this, nullptr, m_dataStore.get());
+    m_dataCollector->setNumCaptureThreads (
+        (int) getParameter (ParameterNames::capture_threads)->getValue());
+    m_dataCollector->setStreamingCapture (
+        (bool) getParameter (ParameterNames::streaming_capture)->getValue());
+    m_dataCollector->setCaptureBacklog (
+        (int) getParameter (ParameterNames::capture_backlog)->getValue(),
+        static_cast<BacklogPolicy> (
+            (int) getParameter (ParameterNames::backlog_policy)->getValue()));
+    m_dataCollector->setLatencyStats (&m_latencyStats);
+
+    const bool useCompactRingBuffer =
+        (bool) getParameter (ParameterNames::compact_ring_buffer)->getValue();
+
+    for (auto stream : getDataStreams())
+    {
+        const int numChannels = stream->getChannelCount();
+        const int ringBufferSize = getRingBufferSize (stream->getStreamId());
+        if (numChannels == 0 || ringBufferSize <= 0)
+            continue;
+
+        // One integer step per ADC step keeps the data exact. Without the bit-volts of every
+        // channel there is no step to store, so such streams keep float samples.
+        const auto& channels = stream->getContinuousChannels();
+        bool allChannelsHaveBitVolts = true;
+        for (auto channel : channels)
+            allChannelsHaveBitVolts = allChannelsHaveBitVolts && channel->getBitVolts() > 0.0f;
+        if (useCompactRingBuffer && ! allChannelsHaveBitVolts)
+        {
+            LOGC ("[TriggeredAvg] Stream ",
+                  stream->getName(),
+                  " has channels without bit-volts, its ring buffer stores floats.");
+        }
+        const auto sampleFormat = useCompactRingBuffer && allChannelsHaveBitVolts
+                                      ? RingBufferSampleFormat::Int16
+                                      : RingBufferSampleFormat::Float32;
+
+        StreamRingBuffer streamRingBuffer {
+            .streamId = stream->getStreamId(),
+            .firstChannel = channels.getFirst()->getGlobalIndex(),
+            .numChannels = numChannels,
+            .ringBuffer = std::make_unique<MultiChannelRingBuffer> (
+                numChannels, ringBufferSize, sampleFormat, &m_ringBufferMemoryPool)
+        };
+
+        if (sampleFormat == RingBufferSampleFormat::Int16)
+        {
+            for (auto channel : channels)
+                streamRingBuffer.ringBuffer->setChannelScaling (channel->getLocalIndex(),
+                                                               channel->getBitVolts());
+        }
+
+        m_dataCollector->setRingBufferForStream (streamRingBuffer.streamId,
+                                                 streamRingBuffer.ringBuffer.get());
+        m_streamRingBuffers.push_back (std::move (streamRingBuffer));
+    }
+
+    if (! m_streamRingBuffers.empty())
     {
         m_dataCollector->startThread (Thread::Priority::high);
         m_threadsInitialized.store (true);
@@ -420,10 +674,23 @@ void TriggeredAvgNode::initializeThreads()
 
 void TriggeredAvgNode::shutdownThreads()
 {
-    if (m_threadsInitialized.load())
+    m_threadsInitialized.store (false);
+    m_dataCollector.reset();
+    m_streamRingBuffers.clear();
+}
+
+void TriggeredAvgNode::resizeAverageBuffers (bool clearTrials)
+{
+    for (auto stream : getDataStreams())
     {
-        m_dataCollector.reset();
-        m_ringBuffer.reset();
-        m_threadsInitialized.store (false);
+        const StreamId streamId = stream->getStreamId();
+        m_dataStore->ResizeAverageBuffersForStream (
+            streamId, getNumberOfSamples (streamId), clearTrials);
     }
 }
+
+void TriggeredAvgNode::resizeRingBuffers()
+{
+    for (auto& stream : m_streamRingBuffers)
+        stream.ringBuffer->setCapacity (getRingBufferSize (stream.streamId));
+}
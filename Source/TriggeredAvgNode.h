@@ -23,16 +23,18 @@
 */
 #pragma once
 
+#include "MultiChannelRingBuffer.h"
 #include "TriggerSource.h"
+#include "Ui/PerformanceTimer.h"
 
 #include <ProcessorHeaders.h>
 #include <atomic>
 #include <memory>
+#include <vector>
 
 namespace TriggeredAverage
 {
 
-using StreamId = std::uint16_t;
 class TriggeredAvgNode;
 class DataCollector;
 class MultiChannelRingBuffer;
@@ -45,7 +47,19 @@ namespace ParameterNames
 {
     constexpr auto pre_ms = "pre_ms";
     constexpr auto post_ms = "post_ms";
+    constexpr auto latency_margin_ms = "latency_margin_ms";
+    constexpr auto compact_ring_buffer = "compact_ring_buffer";
+    constexpr auto capture_threads = "capture_threads";
+    constexpr auto streaming_capture = "streaming_capture";
+    constexpr auto capture_backlog = "capture_backlog";
+    constexpr auto backlog_policy = "backlog_policy";
+    constexpr auto accumulator = "accumulator";
+    constexpr auto average_mode = "average_mode";
+    constexpr auto average_time_constant = "average_time_constant";
+    constexpr auto average_statistic = "average_statistic";
+    constexpr auto trim_percent = "trim_percent";
     constexpr auto max_trials = "max_trials";
+    constexpr auto max_refresh_rate = "max_refresh_rate";
     constexpr auto trigger_line = "trigger_line";
     constexpr auto trigger_type = "trigger_type";
     constexpr auto use_custom_x_limits = "use_custom_x_limits";
@@ -73,18 +87,39 @@ public:
 
     // parameters
     int getMaxTrials() const { return (int) getParameter (ParameterNames::max_trials)->getValue(); }
+    int getMaxRefreshRate() const
+    {
+        return (int) getParameter (ParameterNames::max_refresh_rate)->getValue();
+    }
     float getPreWindowSizeMs() const;
     float getPostWindowSizeMs() const;
 
-    int getNumberOfPreSamples() const;
-    int getNumberOfPostSamplesIncludingTrigger() const;
-    int getNumberOfSamples() const;
+    /** Window sizes in samples of the given data stream */
+    int getNumberOfPreSamples (StreamId streamId) const;
+    int getNumberOfPostSamplesIncludingTrigger (StreamId streamId) const;
+    int getNumberOfSamples (StreamId streamId) const;
+
+    /** Ring buffer capacity of a stream: the trigger window plus the latency margin */
+    int getRingBufferSize (StreamId streamId) const;
 
     // trigger sources
     TriggerSources& getTriggerSources() { return m_triggerSources; }
 
     TriggeredAverage::DataStore* getDataStore() { return m_dataStore.get(); }
 
+    /** Capture counters of every trigger source since acquisition started, keyed by source
+        name, and the clipped samples under "clipped_samples". Also returned as JSON for the
+        config message "capture_stats". */
+    var getCaptureStats();
+
+    /** Samples of the current acquisition that did not fit a compact ring buffer */
+    uint64_t getNumClippedSamples() const;
+
+    /** Latencies of the capture stages since acquisition started, from the TTL event to the
+        first paint of the average including it. Returned as JSON for the config message
+        "latency_stats". */
+    CaptureLatencyStats& getLatencyStats() { return m_latencyStats; }
+
     void setCanvas (TriggeredAvgCanvas* canvas) { m_canvas = canvas; }
 
     int getNextConditionIndex() const { return m_triggerSources.getNextConditionIndex(); }
@@ -95,10 +130,16 @@ public:
     /** Saves trigger source parameters */
     void loadCustomParametersFromXml (XmlElement* xml) override;
 
-    // TODO: should we use this?
-    StreamId m_dataStreamIndex = 0;
-
 private:
+    /** Ring buffer holding the continuous data of one input stream */
+    struct StreamRingBuffer
+    {
+        StreamId streamId;
+        int firstChannel; // index of the stream's first channel in the process() buffer
+        int numChannels;
+        std::unique_ptr<MultiChannelRingBuffer> ringBuffer;
+    };
+
     void handleBroadcastMessage (const String& message, const int64 sysTimeMs) override;
     String handleConfigMessage (const String& message) override;
 
@@ -115,15 +156,24 @@ private:
     void initializeThreads();
     void shutdownThreads();
 
+    /** Resizes the average buffers of every stream to the current window size */
+    void resizeAverageBuffers (bool clearTrials);
+
+    /** Adapts the ring buffer capacities to the current window size and latency margin */
+    void resizeRingBuffers();
+
     std::unique_ptr<DataStore> m_dataStore;
-    std::unique_ptr<MultiChannelRingBuffer> m_ringBuffer;
+
+    // Keeps the ring buffer memory mapped and faulted in between acquisition runs. Declared
+    // before the ring buffers so it outlives them.
+    RingBufferMemoryPool m_ringBufferMemoryPool;
+    std::vector<StreamRingBuffer> m_streamRingBuffers;
     std::unique_ptr<DataCollector> m_dataCollector;
+    CaptureLatencyStats m_latencyStats;
     TriggeredAvgCanvas* m_canvas;
 
     TriggerSources m_triggerSources;
 
-    // Buffer parameters
-    int m_ringBufferSize;
     std::atomic<bool> m_threadsInitialized;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TriggeredAvgNode)
@@ -63,4 +63,40 @@ static const auto DisplayModeStrings = {
     DisplayModeModeToString (DisplayMode::AVERAGE_TRAGE),
     DisplayModeModeToString (DisplayMode::ALL_AND_AVERAGE),
 };
+
+/** Band drawn around the average trace */
+enum class ErrorBand : std::uint8_t
+{
+    INVALID = 0,
+    NONE = 1,
+    STANDARD_DEVIATION = 2,
+    STANDARD_ERROR = 3,
+    CONFIDENCE_INTERVAL = 4, // 95%, from the normal distribution
+};
+
+constexpr auto ErrorBandToString (ErrorBand band) -> const char*
+{
+    switch (band)
+    {
+        case ErrorBand::INVALID:
+            return "Invalid";
+        case ErrorBand::NONE:
+            return "None";
+        case ErrorBand::STANDARD_DEVIATION:
+            return "+/- SD";
+        case ErrorBand::STANDARD_ERROR:
+            return "+/- SEM";
+        case ErrorBand::CONFIDENCE_INTERVAL:
+            return "95% CI";
+        default:
+            return "Unknown";
+    }
+}
+
+static const auto ErrorBandStrings = {
+    ErrorBandToString (ErrorBand::NONE),
+    ErrorBandToString (ErrorBand::STANDARD_DEVIATION),
+    ErrorBandToString (ErrorBand::STANDARD_ERROR),
+    ErrorBandToString (ErrorBand::CONFIDENCE_INTERVAL),
+};
 } // namespace TriggeredAverage
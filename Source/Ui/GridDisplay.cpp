@@ -31,18 +31,42 @@ TriggeredAverage::GridDisplay::GridDisplay() = default;
 
 TriggeredAverage::GridDisplay::~GridDisplay() = default;
 
-void TriggeredAverage::GridDisplay::refresh()
+bool TriggeredAverage::GridDisplay::refresh()
 {
-    // Update paths if data has changed (update functions check internally)
+    // A new trial changes the panels of one condition only. Panels out of view keep their
+    // new data and are updated when scrolled into view.
+    const auto viewArea = getViewArea();
+
+    // Only the channels of the panels in view are published. Those that just came into view
+    // are published here, in case the collector has nothing to capture.
+    bool channelsPending = false;
     for (auto panel : panels)
     {
-        panel->invalidateCache();
+        if (panel->setInView (panel->getBounds().intersects (viewArea)))
+            channelsPending = true;
     }
+    if (channelsPending && dataStore != nullptr)
+        dataStore->tryPublishSnapshots();
 
+    bool panelsPending = false;
     for (auto panel : panels)
     {
-        panel->repaint();
+        if (panel->getBounds().intersects (viewArea) && panel->hasNewData())
+        {
+            panel->invalidateCache();
+            panelsPending = panelsPending || panel->hasNewData();
+        }
     }
+    return panelsPending;
+}
+
+void TriggeredAverage::GridDisplay::moved() { refresh(); }
+
+Rectangle<int> TriggeredAverage::GridDisplay::getViewArea() const
+{
+    if (auto* viewport = findParentComponentOfClass<Viewport>())
+        return viewport->getViewArea();
+    return getLocalBounds();
 }
 
 void TriggeredAverage::GridDisplay::resized()
@@ -103,10 +127,13 @@ void TriggeredAverage::GridDisplay::resized()
 void TriggeredAverage::GridDisplay::addContChannel (const ContinuousChannel* channel,
                                                     const TriggerSource* source,
                                                     int channelIndexInAverageBuffer,
-                                                    const MultiChannelAverageBuffer* avgBuffer)
+                                                    const MultiChannelAverageBuffer* avgBuffer,
+                                                    std::recursive_mutex* bufferMutex)
 {
-    auto* h = new SinglePlotPanel (this, channel, source, channelIndexInAverageBuffer, avgBuffer);
+    auto* h = new SinglePlotPanel (
+        this, channel, source, channelIndexInAverageBuffer, avgBuffer, bufferMutex);
     h->setPlotType (plotType);
+    h->setErrorBand (errorBand);
 
     panels.add (h);
     triggerSourceToPanelMap[source].add (h);
@@ -185,6 +212,18 @@ void TriggeredAverage::GridDisplay::setPlotType (TriggeredAverage::DisplayMode p
     }
 }
 
+void TriggeredAverage::GridDisplay::setErrorBand (ErrorBand band)
+{
+    errorBand = band;
+
+    for (auto panel : panels)
+    {
+        panel->setErrorBand (errorBand);
+    }
+
+    refresh();
+}
+
 int TriggeredAverage::GridDisplay::getDesiredHeight() const { return totalHeight; }
 
 void TriggeredAverage::GridDisplay::clearPanels()
@@ -306,6 +345,7 @@ void TriggeredAverage::GridDisplay::setTrialOpacity (float opacity)
 }
 
 void TriggeredAverage::GridDisplay::setTrialBuffersForSource (const TriggerSource* source,
+                                                              uint16 streamId,
                                                               const SingleTrialBuffer* trialBuffer)
 {
     if (triggerSourceToPanelMap.find (source) != triggerSourceToPanelMap.end())
@@ -314,7 +354,8 @@ void TriggeredAverage::GridDisplay::setTrialBuffersForSource (const TriggerSourc
 
         for (auto panel : plotPanels)
         {
-            panel->setTrialBuffer (trialBuffer);
+            if (panel->streamId == streamId)
+                panel->setTrialBuffer (trialBuffer);
         }
     }
 }
@@ -23,11 +23,13 @@
 */
 #pragma once
 #include "DisplayMode.h"
+#include "PerformanceTimer.h"
 #include "SinglePlotPanel.h"
 #include <VisualizerWindowHeaders.h>
 
 namespace TriggeredAverage
 {
+class DataStore;
 class MultiChannelAverageBuffer;
 class TriggerSource;
 
@@ -40,17 +42,27 @@ public:
 
     /** Renders the Visualizer on each animation callback cycle
         Called instead of Juce's "repaint()" to avoid redrawing underlying components
-        if not necessary.*/
-    void refresh();
+        if not necessary. Only updates the panels in view whose data changed. Returns true if
+        a panel could not read its trials while the collector held them, or its channel was
+        not published yet, so the next refresh has to try again. */
+    bool refresh();
 
     void resized() override;
+
+    /** Called when the viewport scrolls: updates panels that got data while out of view */
+    void moved() override;
     void setWindowSizeMs (float pre_ms, float post_ms);
     void setPlotType (TriggeredAverage::DisplayMode plotType);
 
+    /** Sets the band drawn around the average traces. The panels in view compute it right
+        away, the others once scrolled into view. */
+    void setErrorBand (ErrorBand band);
+
     void addContChannel (const ContinuousChannel*,
                          const TriggerSource*,
                          int channelIndexInAverageBuffer,
-                         const MultiChannelAverageBuffer*);
+                         const MultiChannelAverageBuffer*,
+                         std::recursive_mutex* bufferMutex);
 
     void updateColourForSource (const TriggerSource* source);
     void updateConditionName (const TriggerSource* source);
@@ -91,11 +103,23 @@ public:
     /** Sets the opacity for individual trial traces for all panels */
     void setTrialOpacity (float opacity);
 
-    /** Connects trial buffers to panels for a given trigger source */
+    /** Connects trial buffers to the panels of a given trigger source and data stream */
     void setTrialBuffersForSource (const TriggerSource* source,
+                                   uint16 streamId,
                                    const class SingleTrialBuffer* trialBuffer);
 
+    /** Where the panels record how long new trials take to be painted, or nullptr */
+    void setLatencyStats (CaptureLatencyStats* stats) { latencyStats = stats; }
+    CaptureLatencyStats* getLatencyStats() const { return latencyStats; }
+
+    /** Where the channels that come into view are published from if no capture does it,
+        or nullptr */
+    void setDataStore (DataStore* store) { dataStore = store; }
+
 private:
+    /** Area of the grid shown by its viewport */
+    Rectangle<int> getViewArea() const;
+
     OwnedArray<SinglePlotPanel> panels;
 
     std::unordered_map<const TriggerSource*, Array<SinglePlotPanel*>> triggerSourceToPanelMap;
@@ -107,9 +131,12 @@ private:
     int numColumns = 1;
 
     bool overlayConditions = false;
+    CaptureLatencyStats* latencyStats = nullptr;
+    DataStore* dataStore = nullptr;
 
     float post_ms;
     DisplayMode plotType = DisplayMode::INDIVIDUAL_TRACES;
+    ErrorBand errorBand = ErrorBand::NONE;
 };
 
 } // namespace TriggeredAverage
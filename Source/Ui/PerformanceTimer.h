@@ -24,6 +24,12 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
 namespace TriggeredAverage
 {
@@ -126,4 +132,173 @@ private:
     double m_maxMs;
 };
 
+/**
+ * Lock-free histogram of latencies, filled on one thread and read on others.
+ *
+ * Buckets grow by a factor of 2^(1/4) from 1 us to about a minute, so percentiles are
+ * accurate to within 19 %. The maximum is kept exactly.
+ */
+class LatencyHistogram
+{
+public:
+    void addSample (double latencyMs)
+    {
+        const double micros = std::max (latencyMs * 1000.0, 0.0);
+        m_buckets[getBucketIndex (micros)].fetch_add (1, std::memory_order_relaxed);
+
+        const auto sampleMicros = static_cast<int64_t> (micros);
+        int64_t maxMicros = m_maxMicros.load (std::memory_order_relaxed);
+        while (sampleMicros > maxMicros
+               && ! m_maxMicros.compare_exchange_weak (
+                   maxMicros, sampleMicros, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t getCount() const
+    {
+        uint64_t count = 0;
+        for (const auto& bucket : m_buckets)
+            count += bucket.load (std::memory_order_relaxed);
+        return count;
+    }
+
+    double getMaxMs() const
+    {
+        return static_cast<double> (m_maxMicros.load (std::memory_order_relaxed)) / 1000.0;
+    }
+
+    /** Latency below which the given fraction of the samples lies, e.g. 0.99 for the 99th
+        percentile. 0 if there are no samples. */
+    double getPercentileMs (double fraction) const
+    {
+        std::array<uint64_t, numBuckets> counts;
+        uint64_t total = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            counts[i] = m_buckets[i].load (std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0)
+            return 0.0;
+
+        const auto rank = std::max<uint64_t> (
+            1, static_cast<uint64_t> (std::ceil (fraction * static_cast<double> (total))));
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            cumulative += counts[i];
+            if (cumulative >= rank)
+                return std::min (getBucketUpperEdgeMicros (static_cast<int> (i)) / 1000.0,
+                                 getMaxMs());
+        }
+        return getMaxMs();
+    }
+
+    void reset()
+    {
+        for (auto& bucket : m_buckets)
+            bucket.store (0, std::memory_order_relaxed);
+        m_maxMicros.store (0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int bucketsPerOctave = 4;
+    static constexpr int numOctaves = 26; // 2^26 us is about 67 s
+    // plus one bucket below 1 us and one for everything beyond the last octave
+    static constexpr int numBuckets = numOctaves * bucketsPerOctave + 2;
+
+    static int getBucketIndex (double micros)
+    {
+        if (micros < 1.0)
+            return 0;
+        const int index = 1 + static_cast<int> (std::log2 (micros) * bucketsPerOctave);
+        return std::min (index, numBuckets - 1);
+    }
+
+    static double getBucketUpperEdgeMicros (int index)
+    {
+        return std::exp2 (static_cast<double> (index) / bucketsPerOctave);
+    }
+
+    std::array<std::atomic<uint64_t>, numBuckets> m_buckets {};
+    std::atomic<int64_t> m_maxMicros = 0;
+};
+
+/**
+ * Latencies of captures, from the trigger to the first paint of an average that includes
+ * it, split into stages. The data collector records the stages up to the accumulation of a
+ * trial; the plot panels record the rest.
+ */
+class CaptureLatencyStats
+{
+public:
+    enum Stage
+    {
+        TriggerToDequeue, // TTL event handled until the collector took the request
+        DequeueToWindowComplete, // until the end of the trigger window was in the ring
+        WindowCompleteToAccumulated, // until the trial was added to the average
+        AccumulatedToPaint, // until the first panel showing the new average was painted
+        TriggerToPaint, // the whole way
+        numStages
+    };
+
+    /** Adds the time between two Time::getHighResolutionTicks() values. Ignored if the
+        start was not stamped. */
+    void addSample (Stage stage, int64 startTicks, int64 endTicks)
+    {
+        if (startTicks == 0)
+            return;
+        m_histograms[stage].addSample (
+            Time::highResolutionTicksToSeconds (endTicks - startTicks) * 1000.0);
+    }
+
+    const LatencyHistogram& getHistogram (Stage stage) const { return m_histograms[stage]; }
+
+    static String getStageName (Stage stage)
+    {
+        switch (stage)
+        {
+            case TriggerToDequeue:
+                return "trigger_to_dequeue";
+            case DequeueToWindowComplete:
+                return "dequeue_to_window_complete";
+            case WindowCompleteToAccumulated:
+                return "window_complete_to_accumulated";
+            case AccumulatedToPaint:
+                return "accumulated_to_paint";
+            case TriggerToPaint:
+                return "trigger_to_paint";
+            default:
+                return "unknown";
+        }
+    }
+
+    /** Count, p50, p99 and maximum of every stage, keyed by stage name */
+    var toVar() const
+    {
+        DynamicObject::Ptr stats = new DynamicObject();
+        for (int stage = 0; stage < numStages; ++stage)
+        {
+            const auto& histogram = m_histograms[stage];
+            DynamicObject::Ptr stageStats = new DynamicObject();
+            stageStats->setProperty ("count", (int64) histogram.getCount());
+            stageStats->setProperty ("p50_ms", histogram.getPercentileMs (0.5));
+            stageStats->setProperty ("p99_ms", histogram.getPercentileMs (0.99));
+            stageStats->setProperty ("max_ms", histogram.getMaxMs());
+            stats->setProperty (getStageName (static_cast<Stage> (stage)), stageStats.get());
+        }
+        return stats.get();
+    }
+
+    void reset()
+    {
+        for (auto& histogram : m_histograms)
+            histogram.reset();
+    }
+
+private:
+    std::array<LatencyHistogram, numStages> m_histograms;
+};
+
 } // namespace TriggeredAverage
@@ -112,6 +112,93 @@ void LineSelectorCustomComponent::selectedLineChanged (int selectedLine)
     CoreServices::getUndoManager()->perform ((UndoableAction*) action);
 }
 
+void ChannelSelectorCustomComponent::mouseDown (const juce::MouseEvent& event)
+{
+    if (source == nullptr || acquisitionIsActive)
+        return;
+
+    // The selector lists the channels of all input streams one stream after the other
+    std::vector<bool> channelStates;
+    for (auto stream : source->processor->getDataStreams())
+    {
+        const int nChannels = stream->getChannelCount();
+        std::vector<bool> streamStates (nChannels, false);
+        for (int ch : source->getCapturedChannels (TriggerSource::getStreamKey (stream), nChannels))
+            streamStates[ch] = true;
+        channelStates.insert (channelStates.end(), streamStates.begin(), streamStates.end());
+    }
+
+    auto* channelSelector =
+        new PopupChannelSelector (this->getParentComponent(), this, channelStates);
+
+    CoreServices::getPopupManager()->showPopup (std::unique_ptr<Component> (channelSelector), this);
+}
+
+void ChannelSelectorCustomComponent::channelStateChanged (Array<int> selectedChannels)
+{
+    // Selecting every channel (or none) of a stream captures all of its channels
+    ChannelMasks channelMasks;
+    int firstChannel = 0;
+    for (auto stream : source->processor->getDataStreams())
+    {
+        const int nChannels = stream->getChannelCount();
+        BigInteger mask;
+        for (int channel : selectedChannels)
+        {
+            if (channel >= firstChannel && channel < firstChannel + nChannels)
+                mask.setBit (channel - firstChannel);
+        }
+
+        if (! mask.isZero() && mask.countNumberOfSetBits() < nChannels)
+            channelMasks[TriggerSource::getStreamKey (stream)] = mask;
+        firstChannel += nChannels;
+    }
+
+    ChangeTriggerChannels* action =
+        new ChangeTriggerChannels (source->processor, source, channelMasks);
+    CoreServices::getUndoManager()->beginNewTransaction();
+    CoreServices::getUndoManager()->perform ((UndoableAction*) action);
+
+    setRowAndColumn (row, columnId);
+}
+
+Array<int> ChannelSelectorCustomComponent::getSelectedChannels()
+{
+    Array<int> selectedChannels;
+    int firstChannel = 0;
+    for (auto stream : source->processor->getDataStreams())
+    {
+        const int nChannels = stream->getChannelCount();
+        for (int ch : source->getCapturedChannels (TriggerSource::getStreamKey (stream), nChannels))
+            selectedChannels.add (firstChannel + ch);
+        firstChannel += nChannels;
+    }
+    return selectedChannels;
+}
+
+int ChannelSelectorCustomComponent::getChannelCount()
+{
+    int channelCount = 0;
+    for (auto stream : source->processor->getDataStreams())
+        channelCount += stream->getChannelCount();
+    return channelCount;
+}
+
+void ChannelSelectorCustomComponent::setRowAndColumn (const int newRow, const int newColumn)
+{
+    row = newRow;
+    columnId = newColumn;
+
+    if (source == nullptr)
+        return;
+
+    const int nSelected = getSelectedChannels().size();
+    if (nSelected == getChannelCount())
+        setText ("ALL", dontSendNotification);
+    else
+        setText (String (nSelected), dontSendNotification);
+}
+
 void TriggerTypeSelectorCustomComponent::mouseDown (const juce::MouseEvent& event)
 {
     if (source == nullptr)
@@ -369,6 +456,22 @@ Component* TableModel::refreshComponentForCell (int rowNumber,
 
         return selectorButton;
     }
+    else if (columnId == TableModel::Columns::CHANNELS)
+    {
+        auto* channelsLabel =
+            static_cast<ChannelSelectorCustomComponent*> (existingComponentToUpdate);
+
+        if (channelsLabel == nullptr)
+        {
+            channelsLabel = new ChannelSelectorCustomComponent (triggerSources[rowNumber],
+                                                                acquisitionIsActive);
+        }
+
+        channelsLabel->setColour (Label::textColourId, Colours::white);
+        channelsLabel->setRowAndColumn (rowNumber, columnId);
+
+        return channelsLabel;
+    }
     else if (columnId == TableModel::Columns::COLOUR)
     {
         auto* colourComponent =
@@ -449,6 +552,17 @@ void TableModel::update (Array<TriggerSource*> triggerSources_)
 
         tts->repaint();
 
+        c = table->getCellComponent (TableModel::Columns::CHANNELS, i);
+
+        if (c == nullptr)
+            continue;
+
+        ChannelSelectorCustomComponent* cscc = (ChannelSelectorCustomComponent*) c;
+
+        cscc->source = triggerSources[i];
+
+        cscc->setRowAndColumn (i, TableModel::Columns::CHANNELS);
+
         c = table->getCellComponent (TableModel::Columns::COLOUR, i);
 
         if (c == nullptr)
@@ -704,6 +818,12 @@ PopupConfigurationWindow::PopupConfigurationWindow (TriggeredAvgEditor* editor_,
                                   90,
                                   90,
                                   TableHeaderComponent::notResizableOrSortable);
+    table->getHeader().addColumn ("Channels",
+                                  TableModel::Columns::CHANNELS,
+                                  80,
+                                  80,
+                                  80,
+                                  TableHeaderComponent::notResizableOrSortable);
     table->getHeader().addColumn (
         " ", TableModel::Columns::COLOUR, 30, 30, 30, TableHeaderComponent::notResizableOrSortable);
     table->getHeader().addColumn (
@@ -762,9 +882,9 @@ void PopupConfigurationWindow::update (Array<TriggerSource*> triggerSources)
             viewport->getVerticalScrollBar().setVisible (false);
         }
 
-        setSize (480 + scrollBarWidth, (numRowsVisible + 1) * 30 + 10 + 40);
-        viewport->setBounds (5, 5, 460 + scrollBarWidth, (numRowsVisible + 1) * 30);
-        table->setBounds (0, 0, 460 + scrollBarWidth, (triggerSources.size() + 1) * 30);
+        setSize (560 + scrollBarWidth, (numRowsVisible + 1) * 30 + 10 + 40);
+        viewport->setBounds (5, 5, 540 + scrollBarWidth, (numRowsVisible + 1) * 30);
+        table->setBounds (0, 0, 540 + scrollBarWidth, (triggerSources.size() + 1) * 30);
 
         viewport->setViewPosition (0, scrollDistance);
 
@@ -778,8 +898,8 @@ void PopupConfigurationWindow::update (Array<TriggerSource*> triggerSources)
     {
         tableModel->update (triggerSources);
         table->setVisible (false);
-        setSize (480, 45);
-        triggerSourceGenerator->setBounds (10, 8, 460, 30);
+        setSize (560, 45);
+        triggerSourceGenerator->setBounds (10, 8, 540, 30);
     }
 }
 
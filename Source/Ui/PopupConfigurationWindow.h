@@ -102,6 +102,41 @@ private:
     bool acquisitionIsActive;
 };
 
+/**
+*   Table component used to select the channels captured for a condition
+*/
+class ChannelSelectorCustomComponent : public juce::Label, public PopupChannelSelector::Listener
+{
+public:
+    ChannelSelectorCustomComponent (TriggerSource* source_, bool acquisitionIsActive_)
+        : source (source_),
+          acquisitionIsActive (acquisitionIsActive_)
+    {
+        setEditable (false, false, false);
+    }
+
+    /** Opens the channel selector */
+    void mouseDown (const juce::MouseEvent& event) override;
+
+    /** Called when the channel selection changes */
+    void channelStateChanged (Array<int> selectedChannels) override;
+
+    Array<int> getSelectedChannels() override;
+
+    /** Number of channels of all input streams, which the selector lists in stream order */
+    int getChannelCount() override;
+
+    /** Sets row and column */
+    void setRowAndColumn (const int newRow, const int newColumn);
+
+    int row;
+    TriggerSource* source;
+
+private:
+    int columnId;
+    bool acquisitionIsActive;
+};
+
 /**
 *   Table component used to select the trigger type
 *   (TTL, MSG, or TTL + MSG) for a Spike Channel.
@@ -227,6 +262,7 @@ public:
         NAME,
         LINE,
         TYPE,
+        CHANNELS,
         COLOUR,
         DELETE
     };
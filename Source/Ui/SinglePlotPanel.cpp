@@ -34,13 +34,15 @@ SinglePlotPanel::SinglePlotPanel (const GridDisplay* display_,
                                   const ContinuousChannel* channel,
                                   const TriggerSource* source_,
                                   int channelIndexInAverageBuffer_,
-                                  const MultiChannelAverageBuffer* avgBuffer)
+                                  const MultiChannelAverageBuffer* avgBuffer,
+                                  std::recursive_mutex* bufferMutex)
     : streamId (channel->getStreamId()),
       contChannel (channel),
       baseColour (source_->colour),
       m_triggerSource (source_),
       m_parentGrid (display_),
       m_averageBuffer (avgBuffer),
+      m_bufferMutex (bufferMutex),
       waitingForWindowToClose (false),
       m_sampleRate (channel->getSampleRate()),
       channelIndexInAverageBuffer (channelIndexInAverageBuffer_)
@@ -128,6 +130,7 @@ void SinglePlotPanel::clear()
     numTrials = 0;
     cachedNumTrials = -1;
     cachedAveragePath.clear();
+    cachedErrorBandPath.clear();
     cachedTrialPaths.clear();
     cachedTrialCount = -1;
     String conditionText = m_triggerSource->name + " (N=0)";
@@ -248,6 +251,16 @@ void SinglePlotPanel::setPlotType (TriggeredAverage::DisplayMode plotType)
     repaint();
 }
 
+void SinglePlotPanel::setErrorBand (ErrorBand band)
+{
+    if (band == errorBand)
+        return;
+
+    // Rebuilt like new data: by the grid once the panel is in view
+    errorBand = band;
+    cachedAverageVersion = 0;
+}
+
 void SinglePlotPanel::setSourceColour (Colour colour)
 {
     baseColour = colour;
@@ -284,8 +297,49 @@ void SinglePlotPanel::update()
     repaint();
 }
 
+bool SinglePlotPanel::hasNewData() const
+{
+    if (! m_averageBuffer)
+        return false;
+
+    const auto snapshot = m_averageBuffer->getSnapshot();
+    return (snapshot
+            && (snapshot->version != cachedAverageVersion
+                || ! snapshot->hasChannel (channelIndexInAverageBuffer)))
+           || trialPathsPending;
+}
+
+bool SinglePlotPanel::setInView (bool isInView)
+{
+    if (! m_averageBuffer)
+        return false;
+
+    if (readsChannel != isInView)
+    {
+        std::unique_lock lock (*m_bufferMutex, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            if (isInView)
+                m_averageBuffer->addChannelReader (channelIndexInAverageBuffer);
+            else
+                m_averageBuffer->removeChannelReader (channelIndexInAverageBuffer);
+            readsChannel = isInView;
+        }
+    }
+
+    if (! isInView)
+        return false;
+    const auto snapshot = m_averageBuffer->getSnapshot();
+    return ! snapshot || ! snapshot->hasChannel (channelIndexInAverageBuffer);
+}
+
 void SinglePlotPanel::invalidateCache()
 {
+    // Trials are stored together with the average, so its new version also means new
+    // trials, even once the trial buffer is full and its trial count stays the same
+    if (hasNewData())
+        cachedTrialCount = -1;
+
     updateCachedAveragPath();
     updateCachedTrialPaths();
     repaint();
@@ -719,9 +773,18 @@ void SinglePlotPanel::plotTrialToPath (Path& path,
 
 bool SinglePlotPanel::updateCachedTrialPaths()
 {
+    trialPathsPending = false;
     if (! m_trialBuffer || ! plotAllTraces)
         return false;
 
+    // The paths are built straight from the trial buffer memory, which the collector must
+    // not write to meanwhile. Rather than wait for a capture to finish, the panel keeps its
+    // paths and tries again on the next refresh.
+    std::unique_lock lock (*m_bufferMutex, std::try_to_lock);
+    trialPathsPending = ! lock.owns_lock();
+    if (trialPathsPending)
+        return false;
+
     int currentTrialCount = m_trialBuffer->getNumStoredTrials();
 
     // Check if we need to update
@@ -808,33 +871,100 @@ bool SinglePlotPanel::updateCachedAveragPath()
     if (! m_averageBuffer)
         return false;
 
-    int currentNumTrials = m_averageBuffer->getNumTrials();
+    // Only this panel's channel of the average is computed, from the sums last published by
+    // the collector, so drawing never waits for a capture. The snapshot does not change
+    // while it is held.
+    const auto snapshot = m_averageBuffer->getSnapshot();
+    if (! snapshot || ! snapshot->hasChannel (channelIndexInAverageBuffer))
+        return false;
 
-    if (currentNumTrials == cachedNumTrials && ! cachedAveragePath.isEmpty())
+    const AverageSums& sums = snapshot->sums;
+
+    // A median or trimmed mean of the stored trials is published ready to draw
+    const bool fromOrderStatistic = snapshot->hasOrderStatistic (channelIndexInAverageBuffer);
+    const int currentNumTrials =
+        fromOrderStatistic
+            ? snapshot->orderStatisticNumTrials[static_cast<size_t> (channelIndexInAverageBuffer)]
+            : sums.numTrials;
+    const uint64_t version = snapshot->version;
+    if (currentNumTrials == cachedNumTrials && version == cachedAverageVersion
+        && ! cachedAveragePath.isEmpty())
         return false;
 
     PerformanceTimer updateTimer ("update cached path", 5.0);
 
-    AudioBuffer<float> avgBuffer;
+    auto trialCounterString = m_triggerSource->name + " (N=" + String (currentNumTrials) + ")";
+    conditionLabel->setText (trialCounterString, dontSendNotification);
+    cachedAverageVersion = version;
+    cachedAveragePath.clear();
+    cachedErrorBandPath.clear();
+
+    // The first panel to show new trials measures how long they took to reach the screen
+    if (snapshot->accumulatedTicks != 0 && ! snapshot->displayed.exchange (true))
     {
-        PerformanceTimer avgTimer ("getAverage()", 5.0);
-        avgBuffer = m_averageBuffer->getAverage();
+        undisplayedTriggerArrivalTicks = snapshot->triggerArrivalTicks;
+        undisplayedAccumulatedTicks = snapshot->accumulatedTicks;
     }
 
-    auto trialCounterString =
-        m_triggerSource->name + " (N=" + String (m_averageBuffer->getNumTrials()) + ")";
-    conditionLabel->setText (trialCounterString, dontSendNotification);
-
-    if (avgBuffer.getNumSamples() == 0 || avgBuffer.getNumChannels() == 0)
+    const int numSamples = sums.numSamples;
+    if (currentNumTrials == 0 || numSamples == 0
+        || channelIndexInAverageBuffer >= sums.numChannels)
         return false;
 
-    const int numSamples = avgBuffer.getNumSamples();
-    const float* channelData = avgBuffer.getReadPointer (channelIndexInAverageBuffer);
+    const bool showsErrorBand = errorBand != ErrorBand::NONE && ! fromOrderStatistic;
+    const float* channelData = nullptr;
+
+    if (fromOrderStatistic)
+    {
+        channelData = snapshot->orderStatistic.getReadPointer (channelIndexInAverageBuffer);
+    }
+    else
+    {
+        channelAverage.resize (static_cast<size_t> (numSamples));
+        channelVariance.resize (showsErrorBand ? static_cast<size_t> (numSamples) : 0);
+        sums.computeChannelVariance (channelIndexInAverageBuffer,
+                                     channelAverage.data(),
+                                     showsErrorBand ? channelVariance.data() : nullptr);
+        channelData = channelAverage.data();
+    }
 
     auto dataRange = calculateDataRange (channelData, numSamples);
     auto timeRange = calculateTimeRange (numSamples);
 
-    cachedAveragePath.clear();
+    if (showsErrorBand)
+    {
+        // The standard error shrinks with the number of trials, or their total weight if
+        // the older ones decay
+        const double weight = std::max (
+            1.0, sums.channelWeights[static_cast<size_t> (channelIndexInAverageBuffer)]);
+        float scale = 1.0f;
+        if (errorBand == ErrorBand::STANDARD_ERROR)
+            scale = static_cast<float> (1.0 / std::sqrt (weight));
+        else if (errorBand == ErrorBand::CONFIDENCE_INTERVAL)
+            scale = static_cast<float> (1.96 / std::sqrt (weight));
+
+        errorBandLower.resize (static_cast<size_t> (numSamples));
+        errorBandUpper.resize (static_cast<size_t> (numSamples));
+        computeErrorBand (errorBandLower.data(),
+                          errorBandUpper.data(),
+                          channelData,
+                          channelVariance.data(),
+                          scale,
+                          numSamples);
+
+        // Auto-scaling fits the whole band, not just the trace
+        if (! useCustomYLimits)
+        {
+            dataRange.minVal = calculateDataRange (errorBandLower.data(), numSamples).minVal;
+            dataRange.maxVal = calculateDataRange (errorBandUpper.data(), numSamples).maxVal;
+            dataRange.range = dataRange.maxVal - dataRange.minVal;
+            if (dataRange.range < 1e-6f)
+                dataRange.range = 1.0f;
+        }
+
+        plotErrorBand (
+            errorBandLower.data(), errorBandUpper.data(), numSamples, dataRange, timeRange);
+    }
 
     if (! useCustomXLimits)
     {
@@ -850,6 +980,94 @@ bool SinglePlotPanel::updateCachedAveragPath()
     return true;
 }
 
+void SinglePlotPanel::plotErrorBand (const float* lower,
+                                     const float* upper,
+                                     int numSamples,
+                                     const DataRange& dataRange,
+                                     const TimeRange& timeRange)
+{
+    int firstVisibleSample = 0;
+    int lastVisibleSample = numSamples - 1;
+
+    if (useCustomXLimits)
+    {
+        firstVisibleSample = std::max (
+            0,
+            static_cast<int> (
+                std::ceil ((timeRange.displayXMin + pre_ms) / timeRange.timePerSample)));
+        lastVisibleSample = std::min (
+            numSamples - 1,
+            static_cast<int> (
+                std::floor ((timeRange.displayXMax + pre_ms) / timeRange.timePerSample)));
+
+        if (lastVisibleSample < firstVisibleSample)
+            return;
+    }
+
+    // Same columns as the average trace: a sample each, or the extent of the band over the
+    // samples of a pixel
+    const int numVisibleSamples = lastVisibleSample - firstVisibleSample + 1;
+    const int samplesPerPixel = std::max (1, numVisibleSamples / panelWidthPx);
+    const int numColumns = samplesPerPixel <= 1 ? numVisibleSamples : panelWidthPx;
+
+    auto toY = [this, &dataRange] (float value)
+    {
+        if (useCustomYLimits)
+            value = jlimit (dataRange.minVal, dataRange.maxVal, value);
+        return static_cast<float> (panelHeightPx)
+               * (1.0f - (value - dataRange.minVal) / dataRange.range);
+    };
+
+    // The upper edge is traced left to right, then the lower edge back
+    std::vector<Point<float>> lowerEdge;
+    lowerEdge.reserve (static_cast<size_t> (numColumns));
+
+    for (int column = 0; column < numColumns; ++column)
+    {
+        const int sampleStart = firstVisibleSample + column * samplesPerPixel;
+        if (sampleStart > lastVisibleSample)
+            break;
+        const int sampleEnd = std::min (sampleStart + samplesPerPixel, lastVisibleSample + 1);
+
+        float bandMin = lower[sampleStart];
+        float bandMax = upper[sampleStart];
+        for (int i = sampleStart + 1; i < sampleEnd; ++i)
+        {
+            bandMin = std::min (bandMin, lower[i]);
+            bandMax = std::max (bandMax, upper[i]);
+        }
+
+        float x;
+        if (useCustomXLimits)
+        {
+            const float sampleTimeMs = -pre_ms + (sampleStart * timeRange.timePerSample);
+            x = ((sampleTimeMs - timeRange.displayXMin) / timeRange.displayXRange)
+                * static_cast<float> (panelWidthPx);
+        }
+        else if (samplesPerPixel <= 1)
+        {
+            x = (static_cast<float> (sampleStart) / static_cast<float> (numSamples - 1))
+                * static_cast<float> (panelWidthPx);
+        }
+        else
+        {
+            x = static_cast<float> (column);
+        }
+
+        if (column == 0)
+            cachedErrorBandPath.startNewSubPath (x, toY (bandMax));
+        else
+            cachedErrorBandPath.lineTo (x, toY (bandMax));
+
+        lowerEdge.emplace_back (x, toY (bandMin));
+    }
+
+    for (auto point = lowerEdge.rbegin(); point != lowerEdge.rend(); ++point)
+        cachedErrorBandPath.lineTo (*point);
+
+    cachedErrorBandPath.closeSubPath();
+}
+
 void SinglePlotPanel::drawZeroLine (Graphics& g) const
 {
     float zeroLoc;
@@ -906,6 +1124,13 @@ void SinglePlotPanel::paint (Graphics& g)
         g.setOpacity (1.0f);
     }
 
+    // Error band between the trials and the average trace
+    if (plotAverage && ! cachedErrorBandPath.isEmpty())
+    {
+        g.setColour (baseColour.withAlpha (0.3f));
+        g.fillPath (cachedErrorBandPath);
+    }
+
     // Draw average trace on top with antialiasing for better quality
     if (plotAverage && ! cachedAveragePath.isEmpty())
     {
@@ -916,6 +1141,22 @@ void SinglePlotPanel::paint (Graphics& g)
     // Draw zero line
     g.setColour (Colours::white);
     drawZeroLine (g);
+
+    if (undisplayedAccumulatedTicks != 0)
+    {
+        if (auto* latencyStats = m_parentGrid->getLatencyStats())
+        {
+            const int64 paintedTicks = Time::getHighResolutionTicks();
+            latencyStats->addSample (CaptureLatencyStats::AccumulatedToPaint,
+                                     undisplayedAccumulatedTicks,
+                                     paintedTicks);
+            latencyStats->addSample (CaptureLatencyStats::TriggerToPaint,
+                                     undisplayedTriggerArrivalTicks,
+                                     paintedTicks);
+        }
+        undisplayedTriggerArrivalTicks = 0;
+        undisplayedAccumulatedTicks = 0;
+    }
 }
 
 void SinglePlotPanel::mouseMove (const MouseEvent& event)
@@ -25,6 +25,8 @@
 
 #include "DisplayMode.h"
 #include <VisualizerWindowHeaders.h>
+#include <mutex>
+#include <vector>
 
 namespace TriggeredAverage
 {
@@ -36,11 +38,13 @@ class TriggerSource;
 class SinglePlotPanel : public Component, public ComboBox::Listener
 {
 public:
+    /** bufferMutex guards the trial and average buffers of the panel's source */
     SinglePlotPanel (const GridDisplay*,
                      const ContinuousChannel*,
                      const TriggerSource*,
                      int channelIndexInAverageBuffer,
-                     const MultiChannelAverageBuffer*);
+                     const MultiChannelAverageBuffer*,
+                     std::recursive_mutex* bufferMutex);
 
     void paint (Graphics& g) override;
     void resized() override;
@@ -48,6 +52,10 @@ public:
     void clear();
     void setWindowSizeMs (float pre_ms, float post_ms);
     void setPlotType (TriggeredAverage::DisplayMode plotType);
+
+    /** Sets the band drawn around the average trace. It is not drawn while a median or
+        trimmed mean is selected, which the standard deviation does not describe. */
+    void setErrorBand (ErrorBand band);
     void setSourceColour (Colour colour);
 
     void setSourceName (const String& name) const;
@@ -58,8 +66,18 @@ public:
     void mouseExit (const MouseEvent& event) override;
     void comboBoxChanged (ComboBox* comboBox) override;
     void update();
+
+    /** Rebuilds the cached paths if the data changed and repaints */
     void invalidateCache();
 
+    /** True if the average was changed, e.g. by a new trial, since the paths were built, or
+        its channel was not published yet */
+    bool hasNewData() const;
+
+    /** Reads the panel's channel of the average while it is in view, so that it is
+        published. Returns true while in view and the channel is not published yet. */
+    bool setInView (bool isInView);
+
     /** Sets custom y-axis limits for the plot */
     void setYLimits (float minY, float maxY);
 
@@ -134,6 +152,11 @@ private:
                           int numSamples,
                           const DataRange& dataRange,
                           const TimeRange& timeRange);
+    void plotErrorBand (const float* lower,
+                        const float* upper,
+                        int numSamples,
+                        const DataRange& dataRange,
+                        const TimeRange& timeRange);
     void drawZeroLine (Graphics& g) const;
     bool updateCachedAveragPath();
     bool updateCachedTrialPaths();
@@ -143,6 +166,7 @@ private:
 
     bool plotAllTraces = true;
     bool plotAverage = true;
+    ErrorBand errorBand = ErrorBand::NONE;
     int maxSortedId = 0;
 
     Colour baseColour;
@@ -151,6 +175,7 @@ private:
     const GridDisplay* m_parentGrid;
     const MultiChannelAverageBuffer* m_averageBuffer;
     const SingleTrialBuffer* m_trialBuffer = nullptr;
+    std::recursive_mutex* m_bufferMutex;
 
     float pre_ms;
     float post_ms;
@@ -167,12 +192,35 @@ private:
     // Cache for downsampled path
     Path cachedAveragePath;
     int cachedNumTrials = -1;
+    uint64_t cachedAverageVersion = 0;
+
+    // Filled outline of the error band, built together with the average path
+    Path cachedErrorBandPath;
+
+    // The panel's channel of the average, computed from the published sums when they changed
+    std::vector<float> channelAverage;
+    std::vector<float> channelVariance;
+    std::vector<float> errorBandLower;
+    std::vector<float> errorBandUpper;
+
+    // Ticks of the change whose display latency this panel records at its next paint,
+    // 0 if none
+    int64 undisplayedTriggerArrivalTicks = 0;
+    int64 undisplayedAccumulatedTicks = 0;
     int cachedPanelWidth = -1;
     int numTrials = 0;
 
     // Individual trial rendering
     Array<Path> cachedTrialPaths;
     int cachedTrialCount = -1;
+
+    // The trial paths are read from the trial buffer only if its lock is free; set while
+    // the collector held it, so the grid tries again on its next refresh
+    bool trialPathsPending = false;
+
+    // Whether the panel is a reader of its channel of the average. Changed only while the
+    // buffers' lock is free, like the trial paths are read.
+    bool readsChannel = false;
     int maxTrialsToDisplay = 10;
     float trialOpacity = 0.3f;
 
@@ -47,6 +47,11 @@ OptionsBar::OptionsBar (TriggeredAvgCanvas* canvas_, GridDisplay* display_, Time
     saveButton->setClickingTogglesState (false);
     addAndMakeVisible (saveButton.get());
 
+    latencyLabel = std::make_unique<Label> ("Latency Label");
+    latencyLabel->setFont (FontOptions (14.0f));
+    latencyLabel->setJustificationType (Justification::centredRight);
+    addAndMakeVisible (latencyLabel.get());
+
     // Row height controls
     rowHeightLabel = std::make_unique<Label> ("Row Height Label", "Row Height");
     rowHeightLabel->setFont (FontOptions (20.0f));
@@ -98,6 +103,20 @@ OptionsBar::OptionsBar (TriggeredAvgCanvas* canvas_, GridDisplay* display_, Time
     plotTypeSelector->addListener (this);
     addAndMakeVisible (plotTypeSelector.get());
 
+    // Error band controls
+    errorBandLabel = std::make_unique<Label> ("Error Band Label", "Band");
+    errorBandLabel->setFont (FontOptions (20.0f));
+    errorBandLabel->setJustificationType (Justification::centredRight);
+    addAndMakeVisible (errorBandLabel.get());
+
+    errorBandSelector = std::make_unique<ComboBox> ("Error Band Selector");
+    errorBandSelector->addItemList (ErrorBandStrings, 1);
+    errorBandSelector->setSelectedId (1, dontSendNotification);
+    errorBandSelector->setTooltip ("Band around the average trace: standard deviation, "
+                                   "standard error of the mean or 95% confidence interval");
+    errorBandSelector->addListener (this);
+    addAndMakeVisible (errorBandSelector.get());
+
     // X-axis limit controls
     xLimitsLabel = std::make_unique<Label> ("X Limits Label", "X-Axis (ms)");
     xLimitsLabel->setFont (FontOptions (20.0f));
@@ -328,6 +347,10 @@ void OptionsBar::comboBoxChanged (ComboBox* comboBox)
         auto id = comboBox->getSelectedId();
         display->setPlotType (static_cast<DisplayMode> (comboBox->getSelectedId()));
     }
+    else if (comboBox == errorBandSelector.get())
+    {
+        display->setErrorBand (static_cast<ErrorBand> (comboBox->getSelectedId()));
+    }
     else if (comboBox == columnNumberSelector.get())
     {
         const int numColumns = comboBox->getSelectedId();
@@ -388,6 +411,11 @@ void OptionsBar::resized()
     addControl (*plotTypeLabel, 80);
     addSpacer (spacing);
     addControl (*plotTypeSelector, 150);
+    addSpacer (spacing * 3);
+
+    addControl (*errorBandLabel, 50);
+    addSpacer (spacing);
+    addControl (*errorBandSelector, 85);
     addSpacer (spacing * 5);
 
     // X-axis controls group
@@ -409,8 +437,10 @@ void OptionsBar::resized()
     addSpacer (spacing);
     addControl (*yMaxEditor, 60);
 
-    // Flexible spacer to push buttons to the right
-    mainLayout.items.add (FlexItem().withFlex (1).withHeight (controlHeight));
+    // Latency fills the space that pushes the buttons to the right
+    addSpacer (spacing * 5);
+    mainLayout.items.add (FlexItem (*latencyLabel).withFlex (1).withHeight (controlHeight));
+    addSpacer (spacing * 3);
 
     // Right section: Action buttons
     addControl (*saveButton, 70);
@@ -422,6 +452,31 @@ void OptionsBar::resized()
         getLocalBounds().withTrimmedTop (verticalOffset).withTrimmedLeft (5).withTrimmedRight (5));
 }
 
+void OptionsBar::updateLatency (const CaptureLatencyStats& stats)
+{
+    const auto formatMs = [] (double ms) { return String (ms, ms < 10.0 ? 1 : 0) + " ms"; };
+
+    const auto& total = stats.getHistogram (CaptureLatencyStats::TriggerToPaint);
+    latencyLabel->setText (total.getCount() == 0
+                               ? String()
+                               : "Trigger to display: " + formatMs (total.getPercentileMs (0.5))
+                                     + " (p99 " + formatMs (total.getPercentileMs (0.99)) + ")",
+                           dontSendNotification);
+
+    String details;
+    for (int i = 0; i < CaptureLatencyStats::numStages; ++i)
+    {
+        const auto stage = static_cast<CaptureLatencyStats::Stage> (i);
+        const auto& histogram = stats.getHistogram (stage);
+        details << CaptureLatencyStats::getStageName (stage) << ": p50 "
+                << formatMs (histogram.getPercentileMs (0.5)) << ", p99 "
+                << formatMs (histogram.getPercentileMs (0.99)) << ", max "
+                << formatMs (histogram.getMaxMs()) << " (n=" << (int64) histogram.getCount()
+                << ")\n";
+    }
+    latencyLabel->setTooltip (details.trimEnd());
+}
+
 void OptionsBar::paint (Graphics& g)
 {
     g.setColour (findColour (ThemeColours::defaultText));
@@ -521,6 +576,7 @@ void OptionsBar::updateXLimits()
 void OptionsBar::saveCustomParametersToXml (XmlElement* xml) const
 {
     xml->setAttribute ("plot_type", plotTypeSelector->getSelectedId());
+    xml->setAttribute ("error_band", errorBandSelector->getSelectedId());
     xml->setAttribute ("num_cols", columnNumberSelector->getSelectedId());
     xml->setAttribute ("row_height", rowHeightSelector->getSelectedId());
     xml->setAttribute ("overlay", overlayButton->getToggleState());
@@ -553,6 +609,7 @@ void OptionsBar::loadCustomParametersFromXml (XmlElement* xml)
     rowHeightSelector->setSelectedId (xml->getIntAttribute ("row_height", 150), sendNotification);
     overlayButton->setToggleState (xml->getBoolAttribute ("overlay", false), sendNotification);
     plotTypeSelector->setSelectedId (xml->getIntAttribute ("plot_type", 1), sendNotification);
+    errorBandSelector->setSelectedId (xml->getIntAttribute ("error_band", 1), sendNotification);
 
     // Load X-axis limit parameters
     bool customXLimits = xml->getBoolAttribute ("use_custom_x_limits", false);
@@ -603,6 +660,7 @@ void OptionsBar::loadCustomParametersFromXml (XmlElement* xml)
 
 TriggeredAvgCanvas::TriggeredAvgCanvas (TriggeredAvgNode* processor_)
     : Visualizer (processor_),
+      m_processor (processor_),
       m_dataStore (processor_->getDataStore())
 {
     m_timeAxis = std::make_unique<TimeAxis>();
@@ -612,6 +670,8 @@ TriggeredAvgCanvas::TriggeredAvgCanvas (TriggeredAvgNode* processor_)
     m_mainViewport->setScrollBarsShown (true, true);
 
     m_grid = std::make_unique<GridDisplay>();
+    m_grid->setLatencyStats (&processor_->getLatencyStats());
+    m_grid->setDataStore (m_dataStore);
     m_mainViewport->setViewedComponent (m_grid.get(), false);
     m_mainViewport->setScrollBarThickness (15);
     addAndMakeVisible (m_mainViewport.get());
@@ -625,11 +685,43 @@ TriggeredAvgCanvas::TriggeredAvgCanvas (TriggeredAvgNode* processor_)
     m_optionsBarHolder->setViewedComponent (m_optionsBar.get(), false);
     addAndMakeVisible (m_optionsBarHolder.get());
 
-    // Start timer for regular display updates (60 Hz)
+    // Start timer for refreshes held back by the maximum refresh rate (60 Hz)
     // Note: Visualizer already inherits from Timer, so we use the inherited startTimer
     startTimer (16); // ~60 FPS
 }
 
+void TriggeredAvgCanvas::refresh()
+{
+    m_refreshPending = true;
+    refreshGridIfDue();
+}
+
+void TriggeredAvgCanvas::timerCallback()
+{
+    refreshGridIfDue();
+
+    const double nowMs = Time::getMillisecondCounterHiRes();
+    if (nowMs - m_lastLatencyUpdateMs >= 500.0)
+    {
+        m_lastLatencyUpdateMs = nowMs;
+        m_optionsBar->updateLatency (m_processor->getLatencyStats());
+    }
+}
+
+void TriggeredAvgCanvas::refreshGridIfDue()
+{
+    if (! m_refreshPending || ! m_grid)
+        return;
+
+    const double minimumIntervalMs = 1000.0 / std::max (1, m_processor->getMaxRefreshRate());
+    const double nowMs = Time::getMillisecondCounterHiRes();
+    if (nowMs - m_lastRefreshMs < minimumIntervalMs)
+        return;
+
+    m_lastRefreshMs = nowMs;
+    m_refreshPending = m_grid->refresh();
+}
+
 void TriggeredAvgCanvas::refreshState() { resized(); }
 
 void TriggeredAvgCanvas::resized()
@@ -680,9 +772,10 @@ void TriggeredAvgCanvas::setWindowSizeMs (float pre_ms_, float post_ms_)
 void TriggeredAvgCanvas::addContChannel (const ContinuousChannel* channel,
                                          const TriggerSource* source,
                                          int channelIndexInAverageBuffer,
-                                         const MultiChannelAverageBuffer* avgBuffer)
+                                         const MultiChannelAverageBuffer* avgBuffer,
+                                         std::recursive_mutex* bufferMutex)
 {
-    m_grid->addContChannel (channel, source, channelIndexInAverageBuffer, avgBuffer);
+    m_grid->addContChannel (channel, source, channelIndexInAverageBuffer, avgBuffer, bufferMutex);
 }
 
 void TriggeredAvgCanvas::updateColourForSource (const TriggerSource* source)
@@ -696,9 +789,10 @@ void TriggeredAvgCanvas::updateConditionName (const TriggerSource* source)
 }
 
 void TriggeredAvgCanvas::setTrialBuffersForSource (const TriggerSource* source,
+                                                   uint16 streamId,
                                                    const SingleTrialBuffer* trialBuffer)
 {
-    m_grid->setTrialBuffersForSource (source, trialBuffer);
+    m_grid->setTrialBuffersForSource (source, streamId, trialBuffer);
 }
 
 void TriggeredAvgCanvas::prepareToUpdate() { m_grid->prepareToUpdate(); }
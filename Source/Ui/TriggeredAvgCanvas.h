@@ -49,6 +49,9 @@ public:
     void updateYLimits();
     void updateXLimits();
 
+    /** Shows the trigger-to-paint latency, with all stages in the tooltip */
+    void updateLatency (const CaptureLatencyStats& stats);
+
 private:
     GridDisplay* display;
     TriggeredAvgCanvas* canvas;
@@ -57,9 +60,14 @@ private:
     std::unique_ptr<UtilityButton> clearButton;
     std::unique_ptr<UtilityButton> saveButton;
 
+    std::unique_ptr<Label> latencyLabel;
+
     std::unique_ptr<Label> plotTypeLabel;
     std::unique_ptr<ComboBox> plotTypeSelector;
 
+    std::unique_ptr<Label> errorBandLabel;
+    std::unique_ptr<ComboBox> errorBandSelector;
+
     std::unique_ptr<Label> columnNumberLabel;
     std::unique_ptr<ComboBox> columnNumberSelector;
 
@@ -108,19 +116,14 @@ public:
     TriggeredAvgCanvas (TriggeredAvgNode* processor);
     ~TriggeredAvgCanvas() override = default;
 
-    void refresh() override
-    {
-        // Directly refresh when called (from async update when data changes)
-        if (m_grid)
-            m_grid->refresh();
-    }
+    /** Called from handleAsyncUpdate() when data changes. Refreshes the grid right away,
+        unless that would exceed the maximum refresh rate; then the timer does it once the
+        interval has passed. */
+    void refresh() override;
 
-    /** Timer callback - not needed since refresh is called directly on data updates */
-    void timerCallback() override
-    {
-        // No-op: refresh is now called directly from handleAsyncUpdate() when data arrives
-        // This eliminates 50 FPS polling
-    }
+    /** Refreshes the grid if a refresh was held back by the maximum refresh rate, and
+        updates the latency shown in the options bar */
+    void timerCallback() override;
 
     /** Called when the Visualizer's tab becomes visible after being hidden .*/
     void refreshState() override;
@@ -143,7 +146,8 @@ public:
     void addContChannel (const ContinuousChannel*,
                          const TriggerSource*,
                          int channelIndexInAverageBuffer,
-                         const MultiChannelAverageBuffer*);
+                         const MultiChannelAverageBuffer*,
+                         std::recursive_mutex* bufferMutex);
 
     /** Changes source colour */
     void updateColourForSource (const TriggerSource* source);
@@ -151,8 +155,9 @@ public:
     /** Changes source name */
     void updateConditionName (const TriggerSource* source);
 
-    /** Sets trial buffer for panels associated with a trigger source */
+    /** Sets trial buffer for panels associated with a trigger source and data stream */
     void setTrialBuffersForSource (const TriggerSource* source,
+                                   uint16 streamId,
                                    const SingleTrialBuffer* trialBuffer);
 
     /** Prepare for update*/
@@ -165,9 +170,17 @@ public:
     void loadCustomParametersFromXml (XmlElement* xml) override;
 
 private:
+    /** Refreshes the grid if a refresh is pending and the maximum refresh rate allows it */
+    void refreshGridIfDue();
+
     // dependencies
+    TriggeredAvgNode* m_processor;
     DataStore* m_dataStore;
 
+    bool m_refreshPending = false;
+    double m_lastRefreshMs = 0.0;
+    double m_lastLatencyUpdateMs = 0.0;
+
     // data
     float pre_ms;
     float post_ms;
@@ -30,6 +30,54 @@
 #include "TriggeredAvgNode.h"
 using namespace TriggeredAverage;
 
+class TriggeredAvgEditor::CaptureStatusLabel : public Label, private Timer
+{
+public:
+    explicit CaptureStatusLabel (TriggeredAvgNode* processor) : m_processor (processor)
+    {
+        setFont (FontOptions (12.0f));
+        setJustificationType (Justification::centredLeft);
+        update();
+        startTimer (500);
+    }
+
+private:
+    void timerCallback() override { update(); }
+
+    void update()
+    {
+        uint64_t numDropped = 0;
+        uint64_t numTooOld = 0;
+        String details;
+        for (auto source : m_processor->getTriggerSources().getAll())
+        {
+            const auto& counters = source->captureCounters;
+            numDropped += counters.dropped.load (std::memory_order_relaxed);
+            numTooOld += counters.tooOld.load (std::memory_order_relaxed);
+            details << source->name << ": " << (int64) counters.captured.load() << " of "
+                    << (int64) counters.accepted.load() << " captured, "
+                    << (int64) counters.dropped.load() << " dropped, "
+                    << (int64) counters.tooOld.load() << " too old, "
+                    << (int64) counters.aborted.load() << " aborted\n";
+        }
+
+        String text = "Dropped: " + String ((int64) numDropped)
+                      + "  Too old: " + String ((int64) numTooOld);
+        const uint64_t numClipped = m_processor->getNumClippedSamples();
+        if (numClipped > 0)
+            text << "  Clipped: " << (int64) numClipped;
+
+        setText (text, dontSendNotification);
+        if (numDropped + numTooOld + numClipped > 0)
+            setColour (textColourId, Colours::orange);
+        else
+            removeColour (textColourId);
+        setTooltip (details.trimEnd());
+    }
+
+    TriggeredAvgNode* m_processor;
+};
+
 TriggeredAvgEditor::TriggeredAvgEditor (GenericProcessor* parentNode)
     : VisualizerEditor (parentNode, "TRIG AVG", 210),
       canvas (nullptr),
@@ -60,8 +108,16 @@ TriggeredAvgEditor::TriggeredAvgEditor (GenericProcessor* parentNode)
     auto* trialsEd = getParameterEditor (ParameterNames::max_trials);
     trialsEd->setLayout (ParameterEditor::Layout::nameOnLeft);
     trialsEd->setBounds (trialsEd->getX(), trialsEd->getY(), 170, 20);
+
+    // Captures lost since acquisition started, e.g. because triggers arrive too fast
+    captureStatusLabel =
+        std::make_unique<CaptureStatusLabel> (dynamic_cast<TriggeredAvgNode*> (parentNode));
+    captureStatusLabel->setBounds (20, 122, 170, 14);
+    addAndMakeVisible (captureStatusLabel.get());
 }
 
+TriggeredAvgEditor::~TriggeredAvgEditor() = default;
+
 Visualizer* TriggeredAvgEditor::createNewCanvas()
 {
     auto* p = dynamic_cast<TriggeredAvgNode*> (getProcessor());
@@ -88,32 +144,55 @@ void TriggeredAvgEditor::updateSettings()
     assert (store);
 
     store->Clear();
-    const int nChannels = proc->getTotalContinuousChannels();
-    const int nSamples = proc->getNumberOfSamples();
 
-    // First, initialize buffers for all sources
-    for (auto source : proc->getTriggerSources().getAll())
+    // First, initialize buffers for the captured channels of all sources on every stream
+    for (auto stream : proc->getDataStreams())
     {
-        store->ResetAndResizeBuffersForTriggerSource (source, nChannels, nSamples);
+        const StreamId streamId = stream->getStreamId();
+        const int nChannels = stream->getChannelCount();
+        const int nSamples = proc->getNumberOfSamples (streamId);
+        const String streamKey = TriggerSource::getStreamKey (stream);
+
+        for (auto source : proc->getTriggerSources().getAll())
+        {
+            store->ResetAndResizeBuffersForTriggerSource (
+                source, source->getCapturedChannels (streamKey, nChannels), nSamples, streamId);
+        }
     }
 
-    // Then add panels grouped by channel (for overlay feature to work correctly)
+    // Then add panels grouped by channel (for overlay feature to work correctly). The buffers
+    // only hold the captured channels, so each panel reads its channel's compacted index.
     for (int i = 0; i < proc->getTotalContinuousChannels(); i++)
     {
         const ContinuousChannel* channel = proc->getContinuousChannel (i);
+        const StreamId streamId = channel->getStreamId();
 
         for (auto source : proc->getTriggerSources().getAll())
         {
-            canvas->addContChannel (
-                channel, source, i, store->getRefToAverageBufferForTriggerSource (source));
+            const auto* channelMap = store->getChannelMapForTriggerSource (source, streamId);
+            const auto it = std::ranges::find (*channelMap, channel->getLocalIndex());
+            if (it == channelMap->end())
+                continue;
+
+            const int channelIndexInBuffer = static_cast<int> (it - channelMap->begin());
+            auto* avgBuffer = store->getRefToAverageBufferForTriggerSource (source, streamId);
+            canvas->addContChannel (channel,
+                                    source,
+                                    channelIndexInBuffer,
+                                    avgBuffer,
+                                    &store->getMutexForTriggerSource (source, streamId));
         }
     }
 
     // Set trial buffers for all sources
-    for (auto source : proc->getTriggerSources().getAll())
+    for (auto stream : proc->getDataStreams())
     {
-        canvas->setTrialBuffersForSource (source,
-                                          store->getRefToTrialBufferForTriggerSource (source));
+        const StreamId streamId = stream->getStreamId();
+        for (auto source : proc->getTriggerSources().getAll())
+        {
+            canvas->setTrialBuffersForSource (
+                source, streamId, store->getRefToTrialBufferForTriggerSource (source, streamId));
+        }
     }
     canvas->setWindowSizeMs (proc->getPreWindowSizeMs(), proc->getPostWindowSizeMs());
     canvas->resized();
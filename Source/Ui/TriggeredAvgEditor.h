@@ -43,7 +43,7 @@ class TriggeredAvgEditor : public VisualizerEditor, public Button::Listener
 {
 public:
     TriggeredAvgEditor (GenericProcessor* parentNode);
-    ~TriggeredAvgEditor() override = default;
+    ~TriggeredAvgEditor() override;
 
     /** Creates the visualizer */
     Visualizer* createNewCanvas() override;
@@ -70,7 +70,12 @@ public:
                                Array<TriggerSource*> triggerSourcesToRemove) const;
 
 private:
+    /** Shows the dropped and too-old captures of all sources, with the per-source counters
+        in its tooltip */
+    class CaptureStatusLabel;
+
     std::unique_ptr<UtilityButton> configureButton;
+    std::unique_ptr<CaptureStatusLabel> captureStatusLabel;
 
     TriggeredAvgCanvas* canvas;
 
@@ -0,0 +1,414 @@
+#include "../Source/AccumulateKernels.h"
+#include "../Source/DataCollector.h"
+#include <JuceHeader.h>
+#include <chrono>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace TriggeredAverage;
+using namespace juce;
+
+namespace
+{
+constexpr SimdLevel allSimdLevels[] = {
+    SimdLevel::Scalar, SimdLevel::Neon, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Avx512
+};
+} // namespace
+
+TEST (AccumulateKernelTests, EveryInstructionSetMatchesScalarSums)
+{
+    std::mt19937 random (1);
+    std::uniform_real_distribution<float> distribution (-100.0f, 100.0f);
+
+    for (SimdLevel level : allSimdLevels)
+    {
+        if (! isSimdLevelSupported (level))
+            continue;
+
+        // Lengths around the vector widths, to cover the tails
+        for (int numSamples : { 0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 1000 })
+        {
+            std::vector<float> data (static_cast<size_t> (numSamples));
+            for (auto& sample : data)
+                sample = distribution (random);
+
+            // One element more than written, which must stay untouched
+            std::vector<float> sums (data.size() + 1, 1.0f);
+            std::vector<float> sumSquares (data.size() + 1, 2.0f);
+            accumulateSumAndSquares (
+                level, sums.data(), sumSquares.data(), data.data(), numSamples);
+
+            for (size_t i = 0; i < data.size(); ++i)
+            {
+                EXPECT_FLOAT_EQ (sums[i], 1.0f + data[i]) << getSimdLevelName (level);
+                // fused multiply-adds round once instead of twice
+                EXPECT_NEAR (sumSquares[i], 2.0f + data[i] * data[i], 1e-6f * sumSquares[i])
+                    << getSimdLevelName (level);
+            }
+            EXPECT_EQ (sums.back(), 1.0f);
+            EXPECT_EQ (sumSquares.back(), 2.0f);
+        }
+    }
+}
+
+TEST (AccumulateKernelTests, DISABLED_BenchmarkAgainstTwoPassAccumulation)
+{
+    // 1 s trials at 30 kHz
+    const int numSamples = 30000;
+    for (int numChannels : { 32, 384, 1024 })
+    {
+        AudioBuffer<float> trial (numChannels, numSamples);
+        AudioBuffer<float> sums (numChannels, numSamples);
+        AudioBuffer<float> sumSquares (numChannels, numSamples);
+        trial.clear();
+        sums.clear();
+        sumSquares.clear();
+
+        const int numTrials = std::max (1, 2000 / numChannels);
+        const auto measureMs = [&] (auto&& accumulateChannel)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            for (int t = 0; t < numTrials; ++t)
+            {
+                for (int ch = 0; ch < numChannels; ++ch)
+                {
+                    accumulateChannel (sums.getWritePointer (ch),
+                                       sumSquares.getWritePointer (ch),
+                                       trial.getReadPointer (ch));
+                }
+            }
+            return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now()
+                                                              - start)
+                       .count()
+                   / numTrials;
+        };
+
+        // The accumulation before the fused kernel: a vectorized add, then a scalar loop
+        std::cout << numChannels << " channels: two passes "
+                  << measureMs (
+                         [&] (float* sumData, float* sumSquaresData, const float* data)
+                         {
+                             FloatVectorOperations::add (sumData, data, numSamples);
+                             for (int i = 0; i < numSamples; ++i)
+                                 sumSquaresData[i] += data[i] * data[i];
+                         })
+                  << " ms/trial";
+
+        for (SimdLevel level : allSimdLevels)
+        {
+            if (! isSimdLevelSupported (level))
+                continue;
+
+            std::cout << ", " << getSimdLevelName (level) << " "
+                      << measureMs (
+                             [&] (float* sumData, float* sumSquaresData, const float* data)
+                             {
+                                 accumulateSumAndSquares (
+                                     level, sumData, sumSquaresData, data, numSamples);
+                             })
+                      << " ms/trial";
+        }
+        std::cout << std::endl;
+    }
+}
+
+TEST (AccumulateKernelTests, DoubleKernelsMatchScalarOnEveryInstructionSet)
+{
+    std::mt19937 random (2);
+    std::uniform_real_distribution<float> distribution (-100.0f, 100.0f);
+
+    for (SimdLevel level : allSimdLevels)
+    {
+        if (! isSimdLevelSupported (level))
+            continue;
+
+        for (int numSamples : { 0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 1000 })
+        {
+            const size_t size = static_cast<size_t> (numSamples);
+            std::vector<double> sums (size), sumCompensations (size), sumSquares (size),
+                sumSquareCompensations (size), means (size), squaredDeviations (size);
+            std::vector<double> expected (size), expectedCompensations (size),
+                expectedSquares (size), expectedSquareCompensations (size), expectedMeans (size),
+                expectedDeviations (size);
+
+            for (int trialNumber = 1; trialNumber <= 5; ++trialNumber)
+            {
+                std::vector<float> data (size);
+                for (auto& sample : data)
+                    sample = distribution (random);
+
+                accumulateCompensatedSums (level,
+                                           sums.data(),
+                                           sumCompensations.data(),
+                                           sumSquares.data(),
+                                           sumSquareCompensations.data(),
+                                           data.data(),
+                                           numSamples);
+                accumulateCompensatedSums (SimdLevel::Scalar,
+                                           expected.data(),
+                                           expectedCompensations.data(),
+                                           expectedSquares.data(),
+                                           expectedSquareCompensations.data(),
+                                           data.data(),
+                                           numSamples);
+                accumulateWelford (level,
+                                   means.data(),
+                                   squaredDeviations.data(),
+                                   data.data(),
+                                   trialNumber,
+                                   numSamples);
+                accumulateWelford (SimdLevel::Scalar,
+                                   expectedMeans.data(),
+                                   expectedDeviations.data(),
+                                   data.data(),
+                                   trialNumber,
+                                   numSamples);
+            }
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                // squares of floats are exact in double, so only fused multiply-adds differ
+                EXPECT_EQ (sums[i] - sumCompensations[i], expected[i] - expectedCompensations[i])
+                    << getSimdLevelName (level);
+                EXPECT_EQ (sumSquares[i] - sumSquareCompensations[i],
+                           expectedSquares[i] - expectedSquareCompensations[i])
+                    << getSimdLevelName (level);
+                EXPECT_NEAR (means[i], expectedMeans[i], 1e-12) << getSimdLevelName (level);
+                EXPECT_NEAR (squaredDeviations[i], expectedDeviations[i], 1e-9)
+                    << getSimdLevelName (level);
+            }
+        }
+    }
+}
+
+TEST (AccumulateKernelTests, FloatSumsLosePrecisionThatDoubleAccumulatorsKeep)
+{
+    // A large DC offset with a small signal on top: mean 1000, standard deviation 1
+    const int numTrials = 20000;
+    AudioBuffer<float> trial (2, 8);
+
+    for (auto type :
+         { AccumulatorType::Float, AccumulatorType::KahanDouble, AccumulatorType::Welford })
+    {
+        MultiChannelAverageBuffer buffer (2, 8);
+        buffer.setAccumulatorType (type);
+        for (int t = 0; t < numTrials; ++t)
+        {
+            for (int ch = 0; ch < 2; ++ch)
+                FloatVectorOperations::fill (
+                    trial.getWritePointer (ch), t % 2 == 0 ? 999.0f : 1001.0f, 8);
+            buffer.addDataToAverageFromBuffer (trial);
+        }
+
+        float average[8] {};
+        float standardDeviation[8] {};
+        buffer.computeChannel (1, average, standardDeviation);
+
+        if (type == AccumulatorType::Float)
+        {
+            // the float sum of squares is rounded to thousands, which swamps the variance
+            EXPECT_GT (std::abs (standardDeviation[0] - 1.0f), 1.0f);
+        }
+        else
+        {
+            EXPECT_FLOAT_EQ (average[0], 1000.0f) << getAccumulatorTypeName (type);
+            EXPECT_NEAR (standardDeviation[0], 1.0f, 1e-5f) << getAccumulatorTypeName (type);
+        }
+    }
+}
+
+TEST (AccumulateKernelTests, SwitchingAccumulatorKeepsTrials)
+{
+    MultiChannelAverageBuffer buffer (1, 4);
+    AudioBuffer<float> trial (1, 4);
+
+    // One trial per accumulator type, each converting the trials before it
+    const AccumulatorType types[] = { AccumulatorType::Float,
+                                      AccumulatorType::Welford,
+                                      AccumulatorType::KahanDouble,
+                                      AccumulatorType::Float };
+    for (int t = 0; t < 4; ++t)
+    {
+        buffer.setAccumulatorType (types[t]);
+        for (int i = 0; i < 4; ++i)
+            trial.setSample (0, i, (2.0f * t + 1.0f) * (i + 1)); // 1, 3, 5, 7 times i + 1
+        buffer.addDataToAverageFromBuffer (trial);
+    }
+    buffer.setAccumulatorType (AccumulatorType::Welford);
+
+    float average[4] {};
+    float standardDeviation[4] {};
+    buffer.computeChannel (0, average, standardDeviation);
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_FLOAT_EQ (average[i], 4.0f * (i + 1));
+        EXPECT_FLOAT_EQ (standardDeviation[i], std::sqrt (5.0f) * (i + 1));
+    }
+}
+
+TEST (AccumulateKernelTests, RemovingTrialsLeavesAverageOfTheRest)
+{
+    for (auto type :
+         { AccumulatorType::Float, AccumulatorType::KahanDouble, AccumulatorType::Welford })
+    {
+        MultiChannelAverageBuffer buffer (1, 4);
+        buffer.setAccumulatorType (type);
+        AudioBuffer<float> trials (5, 4);
+        for (int t = 0; t < 5; ++t)
+        {
+            for (int i = 0; i < 4; ++i)
+                trials.setSample (t, i, static_cast<float> ((t * t + 1) * (i + 1)));
+            buffer.addDataToAverage (trials.getArrayOfReadPointers() + t, 1, 4);
+        }
+
+        // Take the first two out again: 5, 10 and 17 times i + 1 are left
+        const auto sums = buffer.getSumWriter();
+        sums.removeChannel (0, trials.getReadPointer (0));
+        sums.removeChannel (0, trials.getReadPointer (1));
+        buffer.removedTrials (2);
+        EXPECT_EQ (buffer.getNumTrials(), 3);
+        EXPECT_EQ (buffer.getNumRemovedTrials(), 2);
+
+        float average[4] {};
+        float standardDeviation[4] {};
+        buffer.computeChannel (0, average, standardDeviation);
+        for (int i = 0; i < 4; ++i)
+        {
+            EXPECT_NEAR (average[i], 32.0f / 3.0f * (i + 1), 1e-4f * (i + 1))
+                << getAccumulatorTypeName (type);
+            EXPECT_NEAR (standardDeviation[i], std::sqrt (218.0f / 9.0f) * (i + 1), 1e-3f * (i + 1))
+                << getAccumulatorTypeName (type);
+        }
+    }
+}
+
+TEST (AccumulateKernelTests, ExponentialAverageWeighsRecentTrialsMost)
+{
+    const double timeConstant = 10.0;
+    const double decay = std::exp (-1.0 / timeConstant);
+
+    // A step from 1 to 3 after 100 trials, followed for 10 trials
+    std::vector<float> values (100, 1.0f);
+    values.resize (110, 3.0f);
+
+    double weight = 0.0;
+    double weightedSum = 0.0;
+    double weightedSquares = 0.0;
+    for (float value : values)
+    {
+        weight = weight * decay + 1.0;
+        weightedSum = weightedSum * decay + value;
+        weightedSquares = weightedSquares * decay + value * value;
+    }
+    const double expectedMean = weightedSum / weight;
+    const double expectedSd = std::sqrt (weightedSquares / weight - expectedMean * expectedMean);
+    ASSERT_GT (expectedMean, 2.0); // a plain average would still be near 1
+
+    for (auto type :
+         { AccumulatorType::Float, AccumulatorType::KahanDouble, AccumulatorType::Welford })
+    {
+        MultiChannelAverageBuffer buffer (1, 2);
+        buffer.setAccumulatorType (type);
+        buffer.setAverageMode (AverageMode::Exponential, timeConstant);
+        for (float value : values)
+        {
+            const float trial[2] = { value, -value };
+            const float* channels[1] = { trial };
+            buffer.addDataToAverage (channels, 1, 2);
+        }
+
+        float average[2] {};
+        float standardDeviation[2] {};
+        buffer.computeChannel (0, average, standardDeviation);
+        EXPECT_NEAR (average[0], expectedMean, 1e-4) << getAccumulatorTypeName (type);
+        EXPECT_NEAR (average[1], -expectedMean, 1e-4) << getAccumulatorTypeName (type);
+        EXPECT_NEAR (standardDeviation[0], expectedSd, 1e-3) << getAccumulatorTypeName (type);
+    }
+}
+
+TEST (AccumulateKernelTests, ErrorBandMatchesSquareRootOnEveryInstructionSet)
+{
+    std::mt19937 random (3);
+    std::uniform_real_distribution<float> averageDistribution (-100.0f, 100.0f);
+    std::uniform_real_distribution<float> varianceDistribution (0.0f, 1.0e4f);
+    const float scale = 1.96f;
+
+    for (SimdLevel level : allSimdLevels)
+    {
+        if (! isSimdLevelSupported (level))
+            continue;
+
+        for (int numSamples : { 0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 1000 })
+        {
+            std::vector<float> average (static_cast<size_t> (numSamples));
+            std::vector<float> variance (average.size());
+            for (size_t i = 0; i < average.size(); ++i)
+            {
+                average[i] = averageDistribution (random);
+                // Flat stretches of a channel have no variance, which rsqrt turns into inf
+                variance[i] = i % 5 == 0 ? 0.0f : varianceDistribution (random);
+            }
+
+            // One element more than written, which must stay untouched
+            std::vector<float> lower (average.size() + 1, -1.0f);
+            std::vector<float> upper (average.size() + 1, -1.0f);
+            computeErrorBand (level,
+                              lower.data(),
+                              upper.data(),
+                              average.data(),
+                              variance.data(),
+                              scale,
+                              numSamples);
+
+            for (size_t i = 0; i < average.size(); ++i)
+            {
+                const float halfWidth = scale * std::sqrt (variance[i]);
+                const float tolerance = 1e-6f * (std::abs (average[i]) + halfWidth);
+                EXPECT_NEAR (lower[i], average[i] - halfWidth, tolerance)
+                    << getSimdLevelName (level);
+                EXPECT_NEAR (upper[i], average[i] + halfWidth, tolerance)
+                    << getSimdLevelName (level);
+                if (variance[i] == 0.0f)
+                {
+                    EXPECT_EQ (lower[i], upper[i]) << getSimdLevelName (level);
+                }
+            }
+            EXPECT_EQ (lower.back(), -1.0f);
+            EXPECT_EQ (upper.back(), -1.0f);
+        }
+    }
+}
+
+TEST (AccumulateKernelTests, DISABLED_BenchmarkAccumulatorTypes)
+{
+    // 1 s trials at 30 kHz
+    const int numSamples = 30000;
+    for (int numChannels : { 32, 384, 1024 })
+    {
+        AudioBuffer<float> trial (numChannels, numSamples);
+        trial.clear();
+        const int numTrials = std::max (1, 2000 / numChannels);
+
+        std::cout << numChannels << " channels:";
+        for (auto type :
+             { AccumulatorType::Float, AccumulatorType::KahanDouble, AccumulatorType::Welford })
+        {
+            MultiChannelAverageBuffer buffer (numChannels, numSamples);
+            buffer.setAccumulatorType (type);
+
+            const auto start = std::chrono::steady_clock::now();
+            for (int t = 0; t < numTrials; ++t)
+                buffer.addDataToAverageFromBuffer (trial);
+            const double msPerTrial =
+                std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - start)
+                    .count()
+                / numTrials;
+
+            std::cout << " " << getAccumulatorTypeName (type) << " " << msPerTrial << " ms/trial";
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,52 @@
+#include "../Source/BoundedMpscQueue.h"
+#include <JuceHeader.h>
+#include <gtest/gtest.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace TriggeredAverage;
+
+TEST (BoundedMpscQueueTests, KeepsOrderOfEachProducer)
+{
+    BoundedMpscQueue<std::pair<int, int>> queue (100);
+    EXPECT_EQ (queue.getCapacity(), 128u);
+
+    constexpr int numProducers = 4;
+    constexpr int itemsPerProducer = 10000;
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < numProducers; ++producer)
+    {
+        producers.emplace_back (
+            [&queue, producer]
+            {
+                for (int i = 0; i < itemsPerProducer; ++i)
+                {
+                    while (! queue.tryPush ({ producer, i }))
+                        std::this_thread::yield();
+                }
+            });
+    }
+
+    std::vector<int> nextItem (numProducers, 0);
+    int numReceived = 0;
+    while (numReceived < numProducers * itemsPerProducer)
+    {
+        std::pair<int, int> item;
+        if (! queue.tryPop (item))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        EXPECT_EQ (item.second, nextItem[item.first]);
+        nextItem[item.first] = item.second + 1;
+        ++numReceived;
+    }
+
+    for (auto& producer : producers)
+        producer.join();
+
+    std::pair<int, int> item;
+    EXPECT_FALSE (queue.tryPop (item));
+}
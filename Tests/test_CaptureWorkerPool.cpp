@@ -0,0 +1,32 @@
+#include "../Source/CaptureWorkerPool.h"
+#include <JuceHeader.h>
+#include <atomic>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace TriggeredAverage;
+
+TEST (CaptureWorkerPoolTests, HandsOutEveryItemOnce)
+{
+    CaptureWorkerPool pool (4);
+    EXPECT_EQ (pool.getNumThreads(), 4);
+
+    std::vector<std::atomic<int>> timesProcessed (1000);
+    std::atomic<bool> threadIndexInRange = true;
+    for (int job = 0; job < 10; ++job)
+    {
+        pool.parallelFor (1000,
+                          7,
+                          [&] (int begin, int end, int threadIndex)
+                          {
+                              if (threadIndex < 0 || threadIndex >= 4)
+                                  threadIndexInRange = false;
+                              for (int i = begin; i < end; ++i)
+                                  ++timesProcessed[i];
+                          });
+    }
+
+    EXPECT_TRUE (threadIndexInRange);
+    for (const auto& count : timesProcessed)
+        EXPECT_EQ (count.load(), 10);
+}
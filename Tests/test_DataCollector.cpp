@@ -6,6 +6,7 @@
 #include <gtest/gtest.h>
 #include <thread>
 #include <chrono>
+#include <iostream>
 
 using namespace TriggeredAverage;
 using namespace juce;
@@ -217,6 +218,53 @@ TEST_F (DataCollectorTests, HandlesMultipleTriggerSources)
     EXPECT_EQ (avgBuffer2->getNumTrials(), 1);
 }
 
+TEST_F (DataCollectorTests, HandlesMultipleStreams)
+{
+    // Second stream with fewer channels at a quarter of the sample rate
+    const StreamId lfpStreamId = 7;
+    auto lfpRingBuffer = std::make_unique<MultiChannelRingBuffer> (2, 2500);
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setRingBufferForStream (lfpStreamId, lfpRingBuffer.get());
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 2000);
+    AudioBuffer<float> lfpData (2, 500);
+    lfpData.clear();
+    lfpRingBuffer->addData (lfpData, 0, 500);
+
+    // One trigger, fanned out to both streams with stream-specific windows
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                        .triggerSample = 1000,
+                                                        .preSamples = 100,
+                                                        .postSamples = 100 });
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                        .triggerSample = 250,
+                                                        .preSamples = 25,
+                                                        .postSamples = 25,
+                                                        .streamId = lfpStreamId });
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (300));
+
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    auto lfpAvgBuffer =
+        dataStore->getRefToAverageBufferForTriggerSource (source.get(), lfpStreamId);
+
+    ASSERT_NE (avgBuffer, nullptr);
+    ASSERT_NE (lfpAvgBuffer, nullptr);
+    EXPECT_NE (avgBuffer, lfpAvgBuffer);
+
+    EXPECT_EQ (avgBuffer->getNumChannels(), 4);
+    EXPECT_EQ (avgBuffer->getNumSamples(), 200);
+    EXPECT_EQ (lfpAvgBuffer->getNumChannels(), 2);
+    EXPECT_EQ (lfpAvgBuffer->getNumSamples(), 50);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 1);
+    EXPECT_EQ (lfpAvgBuffer->getNumTrials(), 1);
+
+    // The ring buffers must outlive the collector, which detaches from them when destroyed
+    collector.reset();
+}
+
 TEST_F (DataCollectorTests, AutomaticallyCreatesBuffersOnFirstRequest)
 {
     collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
@@ -318,6 +366,45 @@ TEST_F (DataCollectorTests, CapturedDataMatchesExpectedValues)
     }
 }
 
+TEST_F (DataCollectorTests, CapturesOnlySelectedChannels)
+{
+    const std::vector<int> channels { 1, 3 };
+    dataStore->ResetAndResizeBuffersForTriggerSource (source.get(), channels, 20);
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 1000);
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                        .triggerSample = 500,
+                                                        .preSamples = 10,
+                                                        .postSamples = 10 });
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (200));
+
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumChannels(), 2);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 1);
+
+    auto trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source.get());
+    ASSERT_NE (trialBuffer, nullptr);
+    ASSERT_EQ (trialBuffer->getNumStoredTrials(), 1);
+
+    AudioBuffer<float> retrievedTrial (2, 20);
+    trialBuffer->getTrial (0, retrievedTrial);
+
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        for (int s = 0; s < 20; ++s)
+        {
+            const float expectedValue = static_cast<float> (490 + s) * 0.1f + channels[ch];
+            EXPECT_FLOAT_EQ (retrievedTrial.getSample (ch, s), expectedValue)
+                << "Mismatch at channel " << ch << ", sample " << s;
+        }
+    }
+}
+
 TEST_F (DataCollectorTests, AveragesMultipleTrialsCorrectly)
 {
     collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
@@ -360,6 +447,172 @@ TEST_F (DataCollectorTests, AveragesMultipleTrialsCorrectly)
     }
 }
 
+TEST_F (DataCollectorTests, AveragesOnlyTheStoredTrialsInLastTrialsMode)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source.get(), 4, 20);
+    dataStore->setMaxTrialsToStore (3);
+    dataStore->setAverageMode (AverageMode::LastTrials, 20.0);
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 2000);
+
+    // Trials 5 to 7 are left in the window, centred on sample 1100
+    for (int i = 0; i < 8; ++i)
+    {
+        CaptureRequest request;
+        request.triggerSource = source.get();
+        request.triggerSample = 500 + i * 100;
+        request.preSamples = 10;
+        request.postSamples = 10;
+        collector->registerCaptureRequest (request);
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (400));
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 3);
+
+    std::vector<float> average (20);
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        avgBuffer->computeChannel (ch, average.data(), nullptr);
+        for (int s = 0; s < 20; ++s)
+            EXPECT_NEAR (average[s], (1090 + s) * 0.1f + ch, 1e-3f);
+    }
+}
+
+TEST_F (DataCollectorTests, SortsStoredTrialsForMedian)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source.get(), 4, 20);
+    dataStore->setMaxTrialsToStore (4);
+    dataStore->setAverageStatistic (AverageStatistic::Median, 0.1f);
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 2000);
+
+    // Six trials, of which the last four are stored; the one at sample 1500 stands out
+    for (int triggerSample : { 300, 400, 500, 600, 700, 1500 })
+    {
+        CaptureRequest request;
+        request.triggerSource = source.get();
+        request.triggerSample = triggerSample;
+        request.preSamples = 10;
+        request.postSamples = 10;
+        collector->registerCaptureRequest (request);
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (400));
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto* orderStatistics = dataStore->getRefToOrderStatisticsForTriggerSource (source.get());
+    ASSERT_NE (orderStatistics, nullptr);
+
+    // The median of the trials at 500, 600, 700 and 1500 lies halfway between 600 and 700
+    std::vector<float> median (20);
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        EXPECT_EQ (orderStatistics->getNumTrials (ch), 4);
+        orderStatistics->computeChannel (ch, median.data());
+        for (int s = 0; s < 20; ++s)
+            EXPECT_NEAR (median[s], (640 + s) * 0.1f + ch, 1e-3f);
+    }
+}
+
+TEST_F (DataCollectorTests, WindowResizeStartsLastTrialsOver)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source.get(), 4, 20);
+    dataStore->setMaxTrialsToStore (3);
+    dataStore->setAverageMode (AverageMode::LastTrials, 20.0);
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 2000);
+
+    auto captureTrials = [this] (std::initializer_list<int> triggerSamples, int halfWindow)
+    {
+        for (int triggerSample : triggerSamples)
+        {
+            CaptureRequest request;
+            request.triggerSource = source.get();
+            request.triggerSample = triggerSample;
+            request.preSamples = halfWindow;
+            request.postSamples = halfWindow;
+            collector->registerCaptureRequest (request);
+        }
+        std::this_thread::sleep_for (std::chrono::milliseconds (400));
+    };
+
+    // A longer window resizes the buffers, so only the two trials after it are left and the
+    // ones before are not evicted a second time
+    captureTrials ({ 500, 600, 700, 800 }, 10);
+    captureTrials ({ 1100, 1200 }, 15);
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (trialBuffer->getNumStoredTrials(), 2);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 2);
+
+    std::vector<float> average (30);
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        avgBuffer->computeChannel (ch, average.data(), nullptr);
+        for (int s = 0; s < 30; ++s)
+            EXPECT_NEAR (average[s], (1135 + s) * 0.1f + ch, 1e-3f);
+    }
+}
+
+TEST_F (DataCollectorTests, WindowResizeLeavesNoZeroTrialsInMedian)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source.get(), 4, 20);
+    dataStore->setMaxTrialsToStore (4);
+    dataStore->setAverageStatistic (AverageStatistic::Median, 0.1f);
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 2000);
+
+    auto captureTrials = [this] (std::initializer_list<int> triggerSamples, int halfWindow)
+    {
+        for (int triggerSample : triggerSamples)
+        {
+            CaptureRequest request;
+            request.triggerSource = source.get();
+            request.triggerSample = triggerSample;
+            request.preSamples = halfWindow;
+            request.postSamples = halfWindow;
+            collector->registerCaptureRequest (request);
+        }
+        std::this_thread::sleep_for (std::chrono::milliseconds (400));
+    };
+
+    captureTrials ({ 500, 600, 700 }, 10);
+    captureTrials ({ 1100, 1200 }, 15);
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto* orderStatistics = dataStore->getRefToOrderStatisticsForTriggerSource (source.get());
+    ASSERT_NE (orderStatistics, nullptr);
+
+    // Zero-filled slots counted as trials would pull the median towards 0
+    std::vector<float> median (30);
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        EXPECT_EQ (orderStatistics->getNumTrials (ch), 2);
+        orderStatistics->computeChannel (ch, median.data());
+        for (int s = 0; s < 30; ++s)
+            EXPECT_NEAR (median[s], (1135 + s) * 0.1f + ch, 1e-3f);
+    }
+}
+
 TEST_F (DataCollectorTests, QueueingMultipleRequestsBeforeThreadStarts)
 {
     collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
@@ -387,6 +640,608 @@ TEST_F (DataCollectorTests, QueueingMultipleRequestsBeforeThreadStarts)
     EXPECT_EQ (avgBuffer->getNumTrials(), 3);
 }
 
+TEST_F (DataCollectorTests, CountsRequestsDroppedWhenQueueIsFull)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+
+    fillRingBufferWithTestData (0, 2000);
+
+    // Nothing takes requests from the queue while the thread is not running
+    int numAccepted = 0;
+    for (int i = 0; i < 5000; ++i)
+    {
+        if (collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                                .triggerSample = 1000,
+                                                                .preSamples = 10,
+                                                                .postSamples = 10 }))
+            ++numAccepted;
+    }
+
+    EXPECT_EQ (numAccepted, 4096);
+    EXPECT_EQ (collector->getNumDroppedCaptureRequests(), 5000u - 4096u);
+
+    collector->startThread();
+    std::this_thread::sleep_for (std::chrono::milliseconds (500));
+
+    // The queue accepts requests again once it was drained
+    EXPECT_TRUE (collector->registerCaptureRequest (CaptureRequest {
+        .triggerSource = source.get(), .triggerSample = 1000, .preSamples = 10, .postSamples = 10 }));
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumTrials(), numAccepted + 1);
+}
+
+TEST_F (DataCollectorTests, BacklogPolicyChoosesWhichRequestsToDrop)
+{
+    // Two of three requests fit into the backlog; the policy decides which two are kept.
+    // Channel 0 holds sample * 0.1, so the average at the trigger tells them apart.
+    const std::pair<BacklogPolicy, float> expectedAverages[] = {
+        { BacklogPolicy::DropOldest, (160.0f + 170.0f) / 2.0f },
+        { BacklogPolicy::DropNewest, (150.0f + 160.0f) / 2.0f },
+        { BacklogPolicy::Coalesce, (150.0f + 170.0f) / 2.0f },
+    };
+
+    for (const auto& [policy, expectedAverage] : expectedAverages)
+    {
+        source->captureCounters.reset();
+        collector.reset();
+        dataStore = std::make_unique<DataStore>();
+        ringBuffer = std::make_unique<MultiChannelRingBuffer> (4, 10000);
+        collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+        collector->setCaptureBacklog (2, policy);
+
+        // Queued before the thread starts, so all three reach the backlog at once
+        fillRingBufferWithTestData (0, 1000);
+        for (SampleNumber triggerSample : { 1500, 1600, 1700 })
+        {
+            collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                                .triggerSample = triggerSample,
+                                                                .preSamples = 10,
+                                                                .postSamples = 10 });
+        }
+        collector->startThread();
+        std::this_thread::sleep_for (std::chrono::milliseconds (100));
+        fillRingBufferWithTestData (1000, 1000);
+        std::this_thread::sleep_for (std::chrono::milliseconds (100));
+        collector->stopThread (1000);
+
+        auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+        ASSERT_NE (avgBuffer, nullptr);
+        ASSERT_EQ (avgBuffer->getNumTrials(), 2);
+        EXPECT_NEAR (avgBuffer->getAverage().getSample (0, 10), expectedAverage, 1e-3f);
+
+        const auto& counters = source->captureCounters;
+        EXPECT_EQ (counters.accepted.load(), policy == BacklogPolicy::DropNewest ? 2u : 3u);
+        EXPECT_EQ (counters.dropped.load(), 1u);
+        EXPECT_EQ (counters.captured.load(), 2u);
+    }
+}
+
+TEST_F (DataCollectorTests, CoalescingDropsRequestsOfSourcesWithoutPendingOnes)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setCaptureBacklog (2, BacklogPolicy::Coalesce);
+
+    auto otherSource = std::make_unique<MockTriggerSource> (2);
+    fillRingBufferWithTestData (0, 1000);
+    for (SampleNumber triggerSample : { 1500, 1600 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 10,
+                                                            .postSamples = 10 });
+    }
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = otherSource.get(),
+                                                        .triggerSample = 1700,
+                                                        .preSamples = 10,
+                                                        .postSamples = 10 });
+    collector->startThread();
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    EXPECT_EQ (source->captureCounters.accepted.load(), 2u);
+    EXPECT_EQ (source->captureCounters.dropped.load(), 0u);
+    EXPECT_EQ (otherSource->captureCounters.accepted.load(), 0u);
+    EXPECT_EQ (otherSource->captureCounters.dropped.load(), 1u);
+
+    collector->stopThread (1000);
+}
+
+TEST_F (DataCollectorTests, CountsWhatBecameOfEachRequest)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+
+    // The ring holds the last 10000 samples
+    for (SampleNumber startSample = 0; startSample < 20000; startSample += 5000)
+        fillRingBufferWithTestData (startSample, 5000);
+    for (SampleNumber triggerSample : { 100, 19000 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 10,
+                                                            .postSamples = 10 });
+    }
+    // No ring buffer serves this stream
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                        .triggerSample = 19000,
+                                                        .preSamples = 10,
+                                                        .postSamples = 10,
+                                                        .streamId = 7 });
+    collector->startThread();
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+    collector->stopThread (1000);
+
+    const auto& counters = source->captureCounters;
+    EXPECT_EQ (counters.accepted.load(), 2u);
+    EXPECT_EQ (counters.captured.load(), 1u);
+    EXPECT_EQ (counters.tooOld.load(), 1u);
+    EXPECT_EQ (counters.aborted.load(), 1u);
+    EXPECT_EQ (counters.dropped.load(), 0u);
+}
+
+TEST_F (DataCollectorTests, RecordsLatencyOfEachCaptureStage)
+{
+    CaptureLatencyStats latencyStats;
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setLatencyStats (&latencyStats);
+    collector->startThread();
+
+    fillRingBufferWithTestData (0, 1000);
+    const int64 triggerArrival = Time::getHighResolutionTicks();
+    collector->registerCaptureRequest (
+        CaptureRequest { .triggerSource = source.get(),
+                         .triggerSample = 500,
+                         .preSamples = 10,
+                         .postSamples = 10,
+                         .timestamps = { .triggerArrival = triggerArrival } });
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    for (auto stage : { CaptureLatencyStats::TriggerToDequeue,
+                        CaptureLatencyStats::DequeueToWindowComplete,
+                        CaptureLatencyStats::WindowCompleteToAccumulated })
+        EXPECT_EQ (latencyStats.getHistogram (stage).getCount(), 1u);
+
+    // The display stages are recorded by the panel that paints the new average
+    EXPECT_EQ (latencyStats.getHistogram (CaptureLatencyStats::TriggerToPaint).getCount(), 0u);
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    const auto snapshot = avgBuffer->getSnapshot();
+    ASSERT_TRUE (snapshot);
+    EXPECT_EQ (snapshot->triggerArrivalTicks, triggerArrival);
+    EXPECT_GE (snapshot->accumulatedTicks, triggerArrival);
+    EXPECT_FALSE (snapshot->displayed.exchange (true));
+    EXPECT_TRUE (snapshot->displayed.load());
+}
+
+TEST_F (DataCollectorTests, SplitsLargeCapturesAcrossThreads)
+{
+    // Large enough for several channel blocks per capture
+    const int numChannels = 64;
+    ringBuffer = std::make_unique<MultiChannelRingBuffer> (numChannels, 20000);
+    AudioBuffer<float> data (numChannels, 10000);
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        for (int s = 0; s < data.getNumSamples(); ++s)
+            data.setSample (ch, s, static_cast<float> (s) * 0.1f + ch);
+    }
+    ringBuffer->addData (data, 0, data.getNumSamples());
+
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setNumCaptureThreads (4);
+    EXPECT_EQ (collector->getNumCaptureThreads(), 4);
+    collector->startThread();
+
+    // A batch of overlapping windows and a single one
+    for (SampleNumber triggerSample : { 2000, 2500, 6000 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 1000,
+                                                            .postSamples = 1000 });
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (300));
+
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source.get());
+        auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+        ASSERT_NE (avgBuffer, nullptr);
+        ASSERT_EQ (avgBuffer->getNumTrials(), 3);
+
+        const auto average = avgBuffer->getAverage();
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            for (int s = 0; s < 2000; s += 100)
+            {
+                const float expectedValue =
+                    static_cast<float> ((1000 + s) + (1500 + s) + (5000 + s)) * 0.1f / 3.0f + ch;
+                EXPECT_NEAR (average.getSample (ch, s), expectedValue, 1e-2f)
+                    << "Mismatch at channel " << ch << ", sample " << s;
+            }
+        }
+    }
+}
+
+// Not run by default: --gtest_also_run_disabled_tests --gtest_filter=*BenchmarkCapture*
+TEST_F (DataCollectorTests, DISABLED_BenchmarkCaptureThroughput)
+{
+    // 384 channels with 200 ms windows at 30 kHz. The windows are a window length apart, so
+    // none overlap and each is captured on its own rather than together in one batch.
+    const int numChannels = 384;
+    const int windowSamples = 6000;
+    const int windowSpacing = 2 * windowSamples;
+    const int numRequests = 16;
+    const int numRounds = 10;
+    const int ringSamples = numRequests * windowSpacing;
+    ringBuffer = std::make_unique<MultiChannelRingBuffer> (numChannels, ringSamples);
+    AudioBuffer<float> data (numChannels, ringSamples);
+    data.clear();
+    ringBuffer->addData (data, 0, data.getNumSamples());
+
+    double singleThreadSeconds = 0.0;
+    for (int numThreads : { 1, 2, 4 })
+    {
+        auto benchmarkSource = std::make_unique<MockTriggerSource> (numThreads);
+        collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+        collector->setNumCaptureThreads (numThreads);
+        collector->startThread();
+
+        // The first round sets up the buffers of the source
+        const auto captureRound = [&] (int expectedTrials)
+        {
+            for (int i = 0; i < numRequests; ++i)
+            {
+                collector->registerCaptureRequest (
+                    CaptureRequest { .triggerSource = benchmarkSource.get(),
+                                     .triggerSample = i * windowSpacing + windowSamples / 2,
+                                     .preSamples = windowSamples / 2,
+                                     .postSamples = windowSamples / 2 });
+            }
+
+            int numTrials = 0;
+            while (numTrials < expectedTrials)
+            {
+                std::this_thread::sleep_for (std::chrono::microseconds (100));
+                if (auto buffer = dataStore->getRefToAverageBufferForTriggerSource (
+                        benchmarkSource.get()))
+                {
+                    if (const auto snapshot = buffer->getSnapshot())
+                        numTrials = snapshot->sums.numTrials;
+                }
+            }
+        };
+        captureRound (numRequests);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int round = 1; round <= numRounds; ++round)
+            captureRound ((round + 1) * numRequests);
+        const double seconds =
+            std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+        if (numThreads == 1)
+            singleThreadSeconds = seconds;
+
+        std::cout << numThreads << " capture thread(s): " << numRounds * numRequests / seconds
+                  << " trials/s, speedup " << singleThreadSeconds / seconds << std::endl;
+
+        collector.reset();
+        dataStore->Clear();
+    }
+}
+
+TEST_F (DataCollectorTests, CapturesOverlappingRequestsInOneBatch)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    fillRingBufferWithTestData (0, 2000);
+
+    // The second source only captures channel 2
+    auto otherSource = std::make_unique<MockTriggerSource> (2);
+    dataStore->ResetAndResizeBuffersForTriggerSource (
+        otherSource.get(), std::vector<int> { 2 }, 200);
+
+    // Overlapping windows of both sources, queued out of order so they are taken together
+    const std::vector<SampleNumber> triggerSamples { 700, 500, 550, 600, 650 };
+    for (size_t i = 0; i < triggerSamples.size(); ++i)
+    {
+        collector->registerCaptureRequest (
+            CaptureRequest { .triggerSource = i % 2 == 0 ? source.get() : otherSource.get(),
+                             .triggerSample = triggerSamples[i],
+                             .preSamples = 100,
+                             .postSamples = 100 });
+    }
+
+    collector->startThread();
+    std::this_thread::sleep_for (std::chrono::milliseconds (300));
+
+    // Trials are stored in the order of their trigger samples
+    const auto verifyTrials = [&] (MockTriggerSource* triggerSource,
+                                   const std::vector<SampleNumber>& expectedTriggers,
+                                   const std::vector<int>& channels)
+    {
+        auto trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (triggerSource);
+        auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (triggerSource);
+        ASSERT_NE (trialBuffer, nullptr);
+        ASSERT_NE (avgBuffer, nullptr);
+        ASSERT_EQ (trialBuffer->getNumStoredTrials(), static_cast<int> (expectedTriggers.size()));
+        ASSERT_EQ (avgBuffer->getNumTrials(), static_cast<int> (expectedTriggers.size()));
+
+        const auto average = avgBuffer->getAverage();
+        for (size_t ch = 0; ch < channels.size(); ++ch)
+        {
+            for (int s = 0; s < 200; ++s)
+            {
+                float sum = 0.0f;
+                for (size_t t = 0; t < expectedTriggers.size(); ++t)
+                {
+                    const float expected =
+                        static_cast<float> (expectedTriggers[t] - 100 + s) * 0.1f + channels[ch];
+                    EXPECT_FLOAT_EQ (trialBuffer->getSample (static_cast<int> (ch),
+                                                             static_cast<int> (t),
+                                                             s),
+                                     expected);
+                    sum += expected;
+                }
+                EXPECT_NEAR (average.getSample (static_cast<int> (ch), s),
+                             sum / static_cast<float> (expectedTriggers.size()),
+                             1e-3f);
+            }
+        }
+    };
+
+    verifyTrials (source.get(), { 550, 650, 700 }, { 0, 1, 2, 3 });
+    verifyTrials (otherSource.get(), { 500, 600 }, { 2 });
+}
+
+TEST_F (DataCollectorTests, CapturesRequestsOnceTheirDataArrives)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    // The long window is still incomplete; it must not hold up the short ones behind it
+    auto longWindowSource = std::make_unique<MockTriggerSource> (2);
+    fillRingBufferWithTestData (0, 600);
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = longWindowSource.get(),
+                                                        .triggerSample = 550,
+                                                        .preSamples = 10,
+                                                        .postSamples = 100 });
+    for (SampleNumber triggerSample : { 500, 560 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 10,
+                                                            .postSamples = 10 });
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 2);
+    EXPECT_EQ (dataStore->getRefToAverageBufferForTriggerSource (longWindowSource.get()), nullptr);
+
+    // The ring wakes the collector up as soon as the rest of the long window arrives, well
+    // before the collector's 100 ms timeout
+    fillRingBufferWithTestData (600, 100);
+    int numLongWindowTrials = 0;
+    for (int i = 0; i < 50 && numLongWindowTrials == 0; ++i)
+    {
+        std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        auto lock = dataStore->GetLockForTriggerSource (longWindowSource.get());
+        if (auto buffer = dataStore->getRefToAverageBufferForTriggerSource (longWindowSource.get()))
+            numLongWindowTrials = buffer->getNumTrials();
+    }
+
+    EXPECT_EQ (numLongWindowTrials, 1);
+    EXPECT_EQ (
+        dataStore->getRefToAverageBufferForTriggerSource (longWindowSource.get())->getNumSamples(),
+        110);
+}
+
+TEST_F (DataCollectorTests, DropsPendingRequestsWhenSampleNumbersJumpBack)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->startThread();
+
+    // The window of this request is never written before the jump
+    auto stalledSource = std::make_unique<MockTriggerSource> (2);
+    fillRingBufferWithTestData (0, 1000);
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = stalledSource.get(),
+                                                        .triggerSample = 1500,
+                                                        .preSamples = 10,
+                                                        .postSamples = 10 });
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                        .triggerSample = 500,
+                                                        .preSamples = 10,
+                                                        .postSamples = 10 });
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    // e.g. a FileReader looping back to its start
+    fillRingBufferWithTestData (0, 100);
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+    fillRingBufferWithTestData (100, 1500);
+    collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                        .triggerSample = 1000,
+                                                        .preSamples = 10,
+                                                        .postSamples = 10 });
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 2);
+    EXPECT_EQ (dataStore->getRefToAverageBufferForTriggerSource (stalledSource.get()), nullptr);
+}
+
+TEST_F (DataCollectorTests, StreamsOpenWindowsIntoTheirSlots)
+{
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setStreamingCapture (true);
+    collector->startThread();
+
+    // Two overlapping windows of the same source are open at the same time
+    fillRingBufferWithTestData (0, 520);
+    for (SampleNumber triggerSample : { 510, 530 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 20,
+                                                            .postSamples = 20 });
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (50));
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source.get());
+        auto trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source.get());
+        ASSERT_NE (trialBuffer, nullptr);
+        EXPECT_EQ (trialBuffer->getNumStoredTrials(), 0);
+        EXPECT_EQ (dataStore->getRefToAverageBufferForTriggerSource (source.get())->getNumTrials(),
+                   0);
+    }
+
+    // The rest arrives in small blocks, as from the audio thread
+    for (SampleNumber blockStart = 520; blockStart < 600; blockStart += 10)
+    {
+        fillRingBufferWithTestData (blockStart, 10);
+        std::this_thread::sleep_for (std::chrono::milliseconds (5));
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    auto trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    ASSERT_NE (trialBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumTrials(), 2);
+    ASSERT_EQ (trialBuffer->getNumStoredTrials(), 2);
+
+    // Trials are stored in trigger order and hold the samples of their window
+    for (int trial = 0; trial < 2; ++trial)
+    {
+        const SampleNumber windowStart = (trial == 0 ? 510 : 530) - 20;
+        for (int ch = 0; ch < 4; ++ch)
+        {
+            for (int s = 0; s < 40; s += 13)
+            {
+                EXPECT_FLOAT_EQ (trialBuffer->getSample (ch, trial, s),
+                                 static_cast<float> (windowStart + s) * 0.1f + ch);
+            }
+        }
+    }
+}
+
+TEST_F (DataCollectorTests, AddsStreamedSamplesToTheAverageAsTheyArrive)
+{
+    dataStore->setAccumulatorType (AccumulatorType::KahanDouble);
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setStreamingCapture (true);
+    collector->startThread();
+
+    // The first window has 30 of its 40 samples, the second the first 10
+    fillRingBufferWithTestData (0, 520);
+    for (SampleNumber triggerSample : { 510, 530 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 20,
+                                                            .postSamples = 20 });
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (50));
+
+    std::vector<float> average (40);
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source.get());
+        auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+        ASSERT_NE (avgBuffer, nullptr);
+        EXPECT_EQ (avgBuffer->getNumTrials(), 0);
+
+        // Each sample averages the windows that reached it
+        for (int ch = 0; ch < 4; ++ch)
+        {
+            avgBuffer->computeChannel (ch, average.data(), nullptr);
+            for (int s = 0; s < 40; ++s)
+            {
+                const float expected = s < 10   ? static_cast<float> (500 + s) * 0.1f + ch
+                                       : s < 30 ? static_cast<float> (490 + s) * 0.1f + ch
+                                                : 0.0f;
+                EXPECT_NEAR (average[static_cast<size_t> (s)], expected, 1e-4f) << s;
+            }
+        }
+    }
+
+    for (SampleNumber blockStart = 520; blockStart < 600; blockStart += 10)
+    {
+        fillRingBufferWithTestData (blockStart, 10);
+        std::this_thread::sleep_for (std::chrono::milliseconds (5));
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    // Once stored, the trials count like captured ones
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    EXPECT_EQ (avgBuffer->getNumTrials(), 2);
+    EXPECT_EQ (avgBuffer->getOpenTrialSamples (0), 0);
+
+    std::vector<float> standardDeviation (40);
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        avgBuffer->computeChannel (ch, average.data(), standardDeviation.data());
+        for (int s = 0; s < 40; ++s)
+        {
+            EXPECT_NEAR (average[static_cast<size_t> (s)],
+                         static_cast<float> (500 + s) * 0.1f + ch,
+                         1e-4f);
+            EXPECT_NEAR (standardDeviation[static_cast<size_t> (s)], 1.0f, 1e-3f);
+        }
+    }
+}
+
+TEST_F (DataCollectorTests, OpeningAWindowEvictsTheOldestTrialInLastTrialsMode)
+{
+    dataStore->setMaxTrialsToStore (2);
+    dataStore->setAverageMode (AverageMode::LastTrials, 20.0);
+    dataStore->setAverageStatistic (AverageStatistic::Median, 0.0f);
+    collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
+    collector->setStreamingCapture (true);
+    collector->startThread();
+
+    // Two complete trials fill the trial buffer, then a third window opens
+    fillRingBufferWithTestData (0, 490);
+    for (SampleNumber triggerSample : { 100, 200, 500 })
+    {
+        collector->registerCaptureRequest (CaptureRequest { .triggerSource = source.get(),
+                                                            .triggerSample = triggerSample,
+                                                            .preSamples = 20,
+                                                            .postSamples = 20 });
+        std::this_thread::sleep_for (std::chrono::milliseconds (50));
+    }
+
+    // The open window's slot is the oldest trial's, so that trial already left the average
+    // and the sorted values, although the window has not completed
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source.get());
+        auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+        auto trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source.get());
+        auto orderStatistics = dataStore->getRefToOrderStatisticsForTriggerSource (source.get());
+        ASSERT_NE (avgBuffer, nullptr);
+        EXPECT_EQ (avgBuffer->getNumTrials(), 1);
+        EXPECT_EQ (trialBuffer->getNumStoredTrials(), 1);
+        EXPECT_EQ (orderStatistics->getNumTrials (0), 1);
+    }
+
+    fillRingBufferWithTestData (490, 110);
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+
+    auto lock = dataStore->GetLockForTriggerSource (source.get());
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source.get());
+    EXPECT_EQ (avgBuffer->getNumTrials(), 2);
+
+    std::vector<float> average (40);
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        avgBuffer->computeChannel (ch, average.data(), nullptr);
+        for (int s = 0; s < 40; ++s)
+            EXPECT_NEAR (average[static_cast<size_t> (s)], (330 + s) * 0.1f + ch, 1e-3f);
+    }
+}
+
 TEST_F (DataCollectorTests, HandlesContinuousStreamOfRequests)
 {
     collector = std::make_unique<DataCollector> (nullptr, ringBuffer.get(), dataStore.get());
@@ -1,6 +1,7 @@
 #include "../Source/DataCollector.h"
 #include "../Source/TriggerSource.h"
 #include <JuceHeader.h>
+#include <chrono>
 #include <gtest/gtest.h>
 #include <thread>
 
@@ -68,6 +69,29 @@ TEST_F (DataStoreTests, ResetAndResizeCreatesBuffers)
     EXPECT_EQ (trialBuffer->getNumSamples(), nSamples);
 }
 
+TEST_F (DataStoreTests, ResetAndResizeWithChannelSubset)
+{
+    const std::vector<int> channels { 2, 5, 7 };
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), channels, 100);
+
+    auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+    ASSERT_NE (avgBuffer, nullptr);
+    EXPECT_EQ (avgBuffer->getNumChannels(), 3);
+
+    auto trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source1.get());
+    ASSERT_NE (trialBuffer, nullptr);
+    EXPECT_EQ (trialBuffer->getNumChannels(), 3);
+
+    auto channelMap = dataStore->getChannelMapForTriggerSource (source1.get());
+    ASSERT_NE (channelMap, nullptr);
+    EXPECT_EQ (*channelMap, channels);
+
+    // Without a selection, buffer channels are the stream channels
+    dataStore->ResetAndResizeBuffersForTriggerSource (source2.get(), 4, 100);
+    EXPECT_EQ (*dataStore->getChannelMapForTriggerSource (source2.get()),
+               (std::vector<int> { 0, 1, 2, 3 }));
+}
+
 TEST_F (DataStoreTests, ResetAndResizeUpdatesExistingBuffers)
 {
     dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 50);
@@ -193,6 +217,11 @@ TEST_F (DataStoreTests, SetMaxTrialsToStore)
 
     EXPECT_EQ (trialBuffer1->getMaxTrials(), maxTrials);
     EXPECT_EQ (trialBuffer2->getMaxTrials(), maxTrials);
+
+    // Buffers set up or reset afterwards keep as many trials
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 4, 20);
+    EXPECT_EQ (dataStore->getRefToTrialBufferForTriggerSource (source1.get())->getMaxTrials(),
+               maxTrials);
 }
 
 TEST_F (DataStoreTests, ThreadSafety_ConcurrentReads)
@@ -240,7 +269,7 @@ TEST_F (DataStoreTests, ThreadSafety_ConcurrentWrites)
 
         for (int i = 0; i < writesPerThread; ++i)
         {
-            auto lock = dataStore->GetLock();
+            auto lock = dataStore->GetLockForTriggerSource (source1.get());
             auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
             if (avgBuffer != nullptr)
                 avgBuffer->addDataToAverageFromBuffer (testData);
@@ -287,7 +316,7 @@ TEST_F (DataStoreTests, ThreadSafety_ConcurrentReadWrite)
 
         for (int i = 0; i < 50; ++i)
         {
-            auto lock = dataStore->GetLock();
+            auto lock = dataStore->GetLockForTriggerSource (source1.get());
             auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
             if (avgBuffer != nullptr)
                 avgBuffer->addDataToAverageFromBuffer (testData);
@@ -309,12 +338,12 @@ TEST_F (DataStoreTests, ThreadSafety_ConcurrentReadWrite)
     EXPECT_GT (successfulReads.load(), 0);
 }
 
-TEST_F (DataStoreTests, GetLockProvidesExclusiveAccess)
+TEST_F (DataStoreTests, GetLockForTriggerSourceProvidesExclusiveAccess)
 {
     dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 50);
 
     {
-        auto lock = dataStore->GetLock();
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
         auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
         ASSERT_NE (avgBuffer, nullptr);
 
@@ -328,3 +357,354 @@ TEST_F (DataStoreTests, GetLockProvidesExclusiveAccess)
     auto avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
     EXPECT_EQ (avgBuffer->getNumTrials(), 1);
 }
+
+TEST_F (DataStoreTests, LocksOfDifferentSourcesAreIndependent)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 50);
+    dataStore->ResetAndResizeBuffersForTriggerSource (source2.get(), 2, 50);
+
+    // While source 1 is being written, source 2 can still be read and resized
+    auto lock = dataStore->GetLockForTriggerSource (source1.get());
+    std::atomic<bool> done { false };
+    std::thread other (
+        [&]
+        {
+            {
+                auto otherLock = dataStore->GetLockForTriggerSource (source2.get());
+                dataStore->getRefToAverageBufferForTriggerSource (source2.get())->getAverage();
+            }
+            dataStore->ResetAndResizeBuffersForTriggerSource (source2.get(), 4, 100);
+            done = true;
+        });
+
+    for (int i = 0; i < 1000 && ! done; ++i)
+        std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    EXPECT_TRUE (done);
+
+    lock.unlock();
+    other.join();
+    EXPECT_EQ (dataStore->getRefToAverageBufferForTriggerSource (source2.get())->getNumChannels(),
+               4);
+}
+
+TEST_F (DataStoreTests, ClearKeepsBufferAddresses)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 50);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+    auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source1.get());
+    auto* mutex = &dataStore->getMutexForTriggerSource (source1.get());
+
+    dataStore->Clear();
+    EXPECT_EQ (dataStore->getRefToAverageBufferForTriggerSource (source1.get()), nullptr);
+    EXPECT_EQ (avgBuffer->getNumSamples(), 0);
+
+    // Pointers handed out before Clear() stay valid and point to the buffers set up again
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 50);
+    EXPECT_EQ (dataStore->getRefToAverageBufferForTriggerSource (source1.get()), avgBuffer);
+    EXPECT_EQ (dataStore->getRefToTrialBufferForTriggerSource (source1.get()), trialBuffer);
+    EXPECT_EQ (&dataStore->getMutexForTriggerSource (source1.get()), mutex);
+    EXPECT_EQ (avgBuffer->getNumSamples(), 50);
+}
+
+TEST_F (DataStoreTests, ComputesAverageOfRequestedChannelOnDemand)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+    const uint64_t emptyVersion = avgBuffer->getVersion();
+
+    for (float value : { 1.0f, 3.0f })
+    {
+        AudioBuffer<float> trial (2, 4);
+        for (int ch = 0; ch < 2; ++ch)
+            FloatVectorOperations::fill (trial.getWritePointer (ch), value * (ch + 1), 4);
+        avgBuffer->addDataToAverageFromBuffer (trial);
+    }
+
+    // Every change counts, whether or not anyone read the average in between
+    EXPECT_EQ (avgBuffer->getVersion(), emptyVersion + 2);
+
+    float average[4] {};
+    float standardDeviation[4] {};
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        EXPECT_EQ (avgBuffer->computeChannel (ch, average, standardDeviation),
+                   avgBuffer->getVersion());
+        EXPECT_FLOAT_EQ (average[3], 2.0f * (ch + 1));
+        EXPECT_FLOAT_EQ (standardDeviation[3], 1.0f * (ch + 1));
+    }
+    EXPECT_FLOAT_EQ (avgBuffer->getAverage().getSample (1, 0), 4.0f);
+    EXPECT_FLOAT_EQ (avgBuffer->getStandardDeviation().getSample (1, 0), 2.0f);
+
+    float variance[4] {};
+    avgBuffer->computeChannelVariance (1, average, variance);
+    EXPECT_FLOAT_EQ (average[3], 4.0f);
+    EXPECT_FLOAT_EQ (variance[3], 4.0f);
+
+    avgBuffer->resetTrials();
+    EXPECT_EQ (avgBuffer->getVersion(), emptyVersion + 3);
+    avgBuffer->computeChannel (0, average, nullptr);
+    EXPECT_FLOAT_EQ (average[0], 0.0f);
+}
+
+TEST_F (DataStoreTests, AverageSnapshotHoldsSumsOfPublishedTrials)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        for (int ch = 0; ch < 2; ++ch)
+            avgBuffer->addChannelReader (ch);
+    }
+
+    auto empty = avgBuffer->getSnapshot();
+    ASSERT_TRUE (empty);
+    EXPECT_EQ (empty->sums.numTrials, 0);
+
+    for (float value : { 1.0f, 3.0f })
+    {
+        AudioBuffer<float> trial (2, 4);
+        for (int ch = 0; ch < 2; ++ch)
+            FloatVectorOperations::fill (trial.getWritePointer (ch), value * (ch + 1), 4);
+        avgBuffer->addDataToAverageFromBuffer (trial);
+    }
+
+    // Trials are only seen by readers once published
+    EXPECT_EQ (avgBuffer->getSnapshot()->sums.numTrials, 0);
+    dataStore->publishSnapshots();
+
+    const auto snapshot = avgBuffer->getSnapshot();
+    ASSERT_TRUE (snapshot);
+    EXPECT_EQ (snapshot->sums.numTrials, 2);
+    EXPECT_GT (snapshot->version, empty->version);
+    EXPECT_FALSE (snapshot->hasOrderStatistic (0));
+
+    float average[4] {};
+    float variance[4] {};
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        snapshot->sums.computeChannelVariance (ch, average, variance);
+        EXPECT_FLOAT_EQ (average[3], 2.0f * (ch + 1));
+        EXPECT_FLOAT_EQ (variance[3], 1.0f * (ch + 1) * (ch + 1));
+    }
+
+    // Snapshots held by readers do not change when the buffer does
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        avgBuffer->resetTrials();
+        avgBuffer->publishSnapshot (nullptr);
+    }
+    EXPECT_EQ (snapshot->sums.numTrials, 2);
+    snapshot->sums.computeChannelVariance (0, average, nullptr);
+    EXPECT_FLOAT_EQ (average[0], 2.0f);
+    EXPECT_EQ (avgBuffer->getSnapshot()->sums.numTrials, 0);
+}
+
+TEST_F (DataStoreTests, AverageSnapshotHoldsOrderStatistic)
+{
+    dataStore->setAverageStatistic (AverageStatistic::Median, 0.1f);
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source1.get());
+        auto* orderStatistics = dataStore->getRefToOrderStatisticsForTriggerSource (source1.get());
+        for (float value : { 1.0f, 9.0f, 2.0f })
+        {
+            AudioBuffer<float> trial (2, 4);
+            for (int ch = 0; ch < 2; ++ch)
+                FloatVectorOperations::fill (trial.getWritePointer (ch), value * (ch + 1), 4);
+            trialBuffer->addTrial (trial);
+        }
+        orderStatistics->rebuildFromTrials (*trialBuffer);
+        for (int ch = 0; ch < 2; ++ch)
+            dataStore->getRefToAverageBufferForTriggerSource (source1.get())->addChannelReader (ch);
+    }
+    dataStore->publishSnapshots();
+
+    const auto snapshot =
+        dataStore->getRefToAverageBufferForTriggerSource (source1.get())->getSnapshot();
+    ASSERT_TRUE (snapshot);
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        ASSERT_TRUE (snapshot->hasOrderStatistic (ch));
+        EXPECT_EQ (snapshot->orderStatisticNumTrials[ch], 3);
+        EXPECT_FLOAT_EQ (snapshot->orderStatistic.getSample (ch, 2), 2.0f * (ch + 1));
+    }
+}
+
+TEST_F (DataStoreTests, AverageSnapshotHoldsOnlyChannelsWithAReader)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 3, 4);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        AudioBuffer<float> trial (3, 4);
+        for (int ch = 0; ch < 3; ++ch)
+            FloatVectorOperations::fill (trial.getWritePointer (ch), static_cast<float> (ch), 4);
+        avgBuffer->addDataToAverageFromBuffer (trial);
+        avgBuffer->addChannelReader (1);
+    }
+    dataStore->publishSnapshots();
+
+    // The trial count is published for every channel, the sums only for the one read
+    auto snapshot = avgBuffer->getSnapshot();
+    EXPECT_EQ (snapshot->sums.numTrials, 1);
+    EXPECT_FALSE (snapshot->hasChannel (0));
+    EXPECT_TRUE (snapshot->hasChannel (1));
+    EXPECT_FALSE (snapshot->hasChannel (2));
+    float average[4] {};
+    snapshot->sums.computeChannelVariance (1, average, nullptr);
+    EXPECT_FLOAT_EQ (average[0], 1.0f);
+
+    // A new reader is published even though the average did not change; a reader that
+    // leaves is not published anymore
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        avgBuffer->addChannelReader (2);
+        avgBuffer->removeChannelReader (1);
+    }
+    dataStore->tryPublishSnapshots();
+    snapshot = avgBuffer->getSnapshot();
+    EXPECT_FALSE (snapshot->hasChannel (1));
+    ASSERT_TRUE (snapshot->hasChannel (2));
+    snapshot->sums.computeChannelVariance (2, average, nullptr);
+    EXPECT_FLOAT_EQ (average[0], 2.0f);
+
+    // Setting the plots up again starts without readers
+    dataStore->Clear();
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 3, 4);
+    EXPECT_FALSE (avgBuffer->getSnapshot()->hasChannel (2));
+}
+
+TEST_F (DataStoreTests, SnapshotsArePublishedWithoutWaitingForABusySource)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+    const uint64_t version = avgBuffer->getSnapshot()->version;
+
+    std::atomic<bool> locked { false };
+    std::atomic<bool> release { false };
+    std::thread collector (
+        [&]
+        {
+            auto lock = dataStore->GetLockForTriggerSource (source1.get());
+            avgBuffer->addChannelReader (0);
+            locked = true;
+            while (! release)
+                std::this_thread::yield();
+        });
+    while (! locked)
+        std::this_thread::yield();
+
+    // A busy source is left to whoever holds its lock
+    dataStore->tryPublishSnapshots();
+    EXPECT_EQ (avgBuffer->getSnapshot()->version, version);
+
+    release = true;
+    collector.join();
+    dataStore->tryPublishSnapshots();
+    EXPECT_TRUE (avgBuffer->getSnapshot()->hasChannel (0));
+}
+
+TEST_F (DataStoreTests, AverageSnapshotHoldsOrderStatisticOfChannelsWithAReader)
+{
+    dataStore->setAverageStatistic (AverageStatistic::TrimmedMean, 0.2f);
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source1.get());
+        auto* orderStatistics = dataStore->getRefToOrderStatisticsForTriggerSource (source1.get());
+        for (float value : { 1.0f, 100.0f, 2.0f, 3.0f, -50.0f })
+        {
+            AudioBuffer<float> trial (2, 4);
+            for (int ch = 0; ch < 2; ++ch)
+                FloatVectorOperations::fill (trial.getWritePointer (ch), value * (ch + 1), 4);
+            trialBuffer->addTrial (trial);
+        }
+        orderStatistics->rebuildFromTrials (*trialBuffer);
+        avgBuffer->addChannelReader (1);
+    }
+    dataStore->publishSnapshots();
+
+    // The trial counts cover every channel, the trimmed mean only the one read
+    auto snapshot = avgBuffer->getSnapshot();
+    EXPECT_EQ (snapshot->orderStatisticNumTrials[0], 5);
+    EXPECT_FALSE (snapshot->hasOrderStatistic (0));
+    ASSERT_TRUE (snapshot->hasOrderStatistic (1));
+    EXPECT_FLOAT_EQ (snapshot->orderStatistic.getSample (1, 0), 4.0f);
+
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        avgBuffer->addChannelReader (0);
+    }
+    dataStore->publishSnapshots();
+    snapshot = avgBuffer->getSnapshot();
+    ASSERT_TRUE (snapshot->hasOrderStatistic (0));
+    EXPECT_FLOAT_EQ (snapshot->orderStatistic.getSample (0, 3), 2.0f);
+}
+
+TEST_F (DataStoreTests, OrderStatisticsFollowMaxTrials)
+{
+    dataStore->setAverageStatistic (AverageStatistic::Median, 0.1f);
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+    auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source1.get());
+    auto* orderStatistics = dataStore->getRefToOrderStatisticsForTriggerSource (source1.get());
+
+    // Each trial is inserted into as many rows as trials are kept, so max_trials bounds how
+    // long a capture holds the source's lock for them
+    dataStore->setMaxTrialsToStore (3);
+    EXPECT_EQ (orderStatistics->getMaxTrials(), 3);
+
+    {
+        auto lock = dataStore->GetLockForTriggerSource (source1.get());
+        for (int i = 0; i < 5; ++i)
+        {
+            AudioBuffer<float> trial (2, 4);
+            trial.clear();
+            trialBuffer->addTrial (trial);
+        }
+        orderStatistics->rebuildFromTrials (*trialBuffer);
+    }
+    EXPECT_EQ (orderStatistics->getMaxTrials(), 3);
+    EXPECT_EQ (orderStatistics->getNumTrials (0), 3);
+
+    dataStore->setMaxTrialsToStore (8);
+    EXPECT_EQ (orderStatistics->getMaxTrials(), 8);
+
+    const auto snapshot =
+        dataStore->getRefToAverageBufferForTriggerSource (source1.get())->getSnapshot();
+    ASSERT_TRUE (snapshot);
+    EXPECT_EQ (snapshot->orderStatisticNumTrials[0], trialBuffer->getNumStoredTrials());
+}
+
+TEST_F (DataStoreTests, SnapshotsAreReadWhileTheSourceIsLocked)
+{
+    dataStore->ResetAndResizeBuffersForTriggerSource (source1.get(), 2, 4);
+    auto* avgBuffer = dataStore->getRefToAverageBufferForTriggerSource (source1.get());
+
+    // The collector holds the lock of a source for whole captures; a plot reading the
+    // published snapshot meanwhile does not wait for it
+    std::atomic<bool> locked { false };
+    std::atomic<bool> release { false };
+    std::thread collector (
+        [&]
+        {
+            auto lock = dataStore->GetLockForTriggerSource (source1.get());
+            locked = true;
+            while (! release)
+                std::this_thread::yield();
+        });
+    while (! locked)
+        std::this_thread::yield();
+
+    const auto snapshot = avgBuffer->getSnapshot();
+    ASSERT_TRUE (snapshot);
+    float average[4] {};
+    snapshot->sums.computeChannelVariance (1, average, nullptr);
+    EXPECT_FLOAT_EQ (average[0], 0.0f);
+
+    release = true;
+    collector.join();
+}
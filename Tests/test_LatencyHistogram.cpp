@@ -0,0 +1,26 @@
+#include "../Source/Ui/PerformanceTimer.h"
+#include <JuceHeader.h>
+#include <cmath>
+#include <gtest/gtest.h>
+
+using namespace TriggeredAverage;
+
+TEST (LatencyHistogramTests, PercentilesAreAccurateToOneBucket)
+{
+    LatencyHistogram histogram;
+    EXPECT_EQ (histogram.getPercentileMs (0.5), 0.0);
+
+    for (int ms = 1; ms <= 100; ++ms)
+        histogram.addSample (ms);
+
+    EXPECT_EQ (histogram.getCount(), 100u);
+    EXPECT_GE (histogram.getPercentileMs (0.5), 50.0);
+    EXPECT_LE (histogram.getPercentileMs (0.5), 50.0 * std::exp2 (0.25));
+    EXPECT_GE (histogram.getPercentileMs (0.99), 99.0);
+    EXPECT_LE (histogram.getPercentileMs (0.99), 100.0);
+    EXPECT_DOUBLE_EQ (histogram.getMaxMs(), 100.0);
+
+    histogram.reset();
+    EXPECT_EQ (histogram.getCount(), 0u);
+    EXPECT_EQ (histogram.getMaxMs(), 0.0);
+}
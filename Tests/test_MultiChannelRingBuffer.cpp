@@ -1,7 +1,9 @@
 #include "MultiChannelRingBuffer.h"
 #include <JuceHeader.h>
 #include <gtest/gtest.h>
+#include <atomic>
 #include <memory>
+#include <thread>
 
 using namespace TriggeredAverage;
 using namespace testing;
@@ -130,6 +132,24 @@ TEST_F (MultiChannelRingBufferTest, ChannelSubsetRead)
         }
     }
 }
+TEST_F (MultiChannelRingBufferTest, ReadsOnlySelectedChannels)
+{
+    ringBuffer->addData (createTestBuffer (numChannels, 100, 1.0f), 0, 100);
+
+    const std::vector<int> channels { 1, 3 };
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (ringBuffer->readAroundSample (50, 10, 10, outputBuffer, channels),
+               RingBufferReadResult::Success);
+    ASSERT_EQ (outputBuffer.getNumChannels(), 2);
+    ASSERT_EQ (outputBuffer.getNumSamples(), 20);
+
+    for (int sample = 0; sample < 20; ++sample)
+    {
+        EXPECT_FLOAT_EQ (outputBuffer.getSample (0, sample), 1.0f + 1000.0f + (40 + sample));
+        EXPECT_FLOAT_EQ (outputBuffer.getSample (1, sample), 1.0f + 3000.0f + (40 + sample));
+    }
+}
+
 TEST_F (MultiChannelRingBufferTest, EdgeCaseReads)
 {
     auto testData = createTestBuffer (numChannels, 100, 1.0f);
@@ -154,6 +174,413 @@ TEST_F (MultiChannelRingBufferTest, EdgeCaseReads)
     success = ringBuffer->readAroundSample (999, 0, 1, outputBuffer);
     ASSERT_NE (success, RingBufferReadResult::Success);
 }
+
+TEST_F (MultiChannelRingBufferTest, ConcurrentReadsNeverReturnTornData)
+{
+    // The writer keeps wrapping the ring while the reader requests windows close to the
+    // oldest retained sample, which is where overwrites during a copy happen
+    constexpr int blockSize = 16;
+    constexpr int numberOfBlocks = 5000;
+    std::atomic<bool> writerDone { false };
+
+    std::thread writer (
+        [&]
+        {
+            AudioBuffer<float> block (numChannels, blockSize);
+            for (int b = 0; b < numberOfBlocks; ++b)
+            {
+                const SampleNumber firstSample = static_cast<SampleNumber> (b) * blockSize;
+                for (int ch = 0; ch < numChannels; ++ch)
+                    for (int i = 0; i < blockSize; ++i)
+                        block.setSample (ch, i, static_cast<float> (firstSample + i + ch * 1000));
+                ringBuffer->addData (block, firstSample, blockSize);
+                std::this_thread::yield();
+            }
+            writerDone = true;
+        });
+
+    AudioBuffer<float> outputBuffer;
+    int numberOfSuccessfulReads = 0;
+    for (int attempt = 0; ! writerDone; ++attempt)
+    {
+        // alternate between the oldest retained samples and the middle of the ring
+        const SampleNumber current = ringBuffer->getCurrentSampleNumber();
+        const SampleNumber center =
+            current - (attempt % 2 == 0 ? bufferSize - 12 : bufferSize / 2);
+        if (center < 10)
+            continue;
+
+        if (ringBuffer->readAroundSample (center, 10, 10, outputBuffer)
+            != RingBufferReadResult::Success)
+            continue;
+
+        ++numberOfSuccessfulReads;
+        for (int ch = 0; ch < numChannels; ++ch)
+            for (int i = 0; i < 20; ++i)
+                ASSERT_FLOAT_EQ (outputBuffer.getSample (ch, i),
+                                 static_cast<float> (center - 10 + i + ch * 1000))
+                    << "Channel " << ch << ", Sample " << i;
+    }
+    writer.join();
+
+    EXPECT_GT (numberOfSuccessfulReads, 0);
+}
+
+TEST_F (MultiChannelRingBufferTest, ViewSplitsWrappedWindowIntoTwoSegments)
+{
+    ringBuffer->addData (createTestBuffer (numChannels, 80, 1.0f), 0, 80);
+    ringBuffer->addData (createTestBuffer (numChannels, 40, 81.0f), 80, 40);
+
+    // Samples 70-99 end exactly at the end of the ring
+    RingBufferView view;
+    ASSERT_EQ (ringBuffer->getViewAroundSample (80, 10, 20, view), RingBufferReadResult::Success);
+    EXPECT_EQ (view.getNumChannels(), numChannels);
+    EXPECT_EQ (view.getNumSamples(), 30);
+    ASSERT_EQ (view.getFirstSegment (1).size(), 30u);
+    EXPECT_EQ (view.getSecondSegment (1).size(), 0u);
+
+    // Samples 90-109 wrap around
+    ASSERT_EQ (ringBuffer->getViewAroundSample (100, 10, 10, view), RingBufferReadResult::Success);
+    ASSERT_EQ (view.getFirstSegment (1).size(), 10u);
+    ASSERT_EQ (view.getSecondSegment (1).size(), 10u);
+    EXPECT_FLOAT_EQ (view.getFirstSegment (1)[0], 1.0f + 1000.0f + 90.0f);
+    EXPECT_FLOAT_EQ (view.getSecondSegment (1)[0], 1.0f + 1000.0f + 100.0f);
+    EXPECT_TRUE (ringBuffer->isViewIntact (view));
+
+    // Overwriting the slots behind the view invalidates it
+    ringBuffer->addData (createTestBuffer (numChannels, 80, 121.0f), 120, 80);
+    EXPECT_FALSE (ringBuffer->isViewIntact (view));
+}
+
+TEST_F (MultiChannelRingBufferTest, GrowingKeepsMostRecentSamples)
+{
+    ringBuffer->addData (createTestBuffer (numChannels, 100, 1.0f), 0, 100);
+
+    // The new capacity takes effect with the next block
+    ringBuffer->setCapacity (200);
+    EXPECT_EQ (ringBuffer->getBufferSize(), 100);
+    ringBuffer->addData (createTestBuffer (numChannels, 50, 101.0f), 100, 50);
+    EXPECT_EQ (ringBuffer->getBufferSize(), 200);
+
+    // Samples 0-149 are all still available
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (ringBuffer->readAroundSample (75, 75, 75, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 150, 1.0f);
+}
+
+TEST_F (MultiChannelRingBufferTest, ShrinkingKeepsMostRecentSamples)
+{
+    ringBuffer->addData (createTestBuffer (numChannels, 100, 1.0f), 0, 100);
+
+    ringBuffer->setCapacity (40);
+    ringBuffer->addData (createTestBuffer (numChannels, 10, 101.0f), 100, 10);
+    EXPECT_EQ (ringBuffer->getBufferSize(), 40);
+
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (ringBuffer->readAroundSample (70, 0, 40, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 40, 71.0f);
+
+    EXPECT_EQ (ringBuffer->readAroundSample (69, 0, 40, outputBuffer),
+               RingBufferReadResult::DataInRingBufferTooOld);
+}
+
+TEST_F (MultiChannelRingBufferTest, WindowsSpanningSampleNumberGapAreRejected)
+{
+    // Samples 1000-1039, then a jump forward to 5000-5039
+    ringBuffer->addData (createTestBuffer (numChannels, 40, 1.0f), 1000, 40);
+    ringBuffer->addData (createTestBuffer (numChannels, 40, 41.0f), 5000, 40);
+
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (ringBuffer->readAroundSample (1020, 10, 10, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 20, 11.0f);
+
+    ASSERT_EQ (ringBuffer->readAroundSample (5010, 10, 10, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 20, 41.0f);
+
+    EXPECT_EQ (ringBuffer->readAroundSample (1035, 5, 10, outputBuffer),
+               RingBufferReadResult::Aborted);
+    EXPECT_EQ (ringBuffer->readAroundSample (3000, 5, 10, outputBuffer),
+               RingBufferReadResult::Aborted);
+    EXPECT_EQ (ringBuffer->readAroundSample (5035, 5, 10, outputBuffer),
+               RingBufferReadResult::NotEnoughNewData);
+    EXPECT_EQ (ringBuffer->readAroundSample (990, 5, 10, outputBuffer),
+               RingBufferReadResult::DataInRingBufferTooOld);
+}
+
+TEST_F (MultiChannelRingBufferTest, WindowsAfterJumpBackInTimeUseNewestSamples)
+{
+    // A FileReader loop: samples 0-59 are followed by 0-29 again
+    ringBuffer->addData (createTestBuffer (numChannels, 60, 1.0f), 0, 60);
+    ringBuffer->addData (createTestBuffer (numChannels, 30, 101.0f), 0, 30);
+
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (ringBuffer->readAroundSample (10, 10, 10, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 20, 101.0f);
+
+    EXPECT_EQ (ringBuffer->readAroundSample (20, 0, 20, outputBuffer),
+               RingBufferReadResult::NotEnoughNewData);
+
+    // Continuing the new run extends it in place
+    ringBuffer->addData (createTestBuffer (numChannels, 20, 131.0f), 30, 20);
+    ASSERT_EQ (ringBuffer->readAroundSample (20, 0, 20, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 20, 121.0f);
+
+    // After a reset, nothing from before is found
+    ringBuffer->reset();
+    ringBuffer->addData (createTestBuffer (numChannels, 10, 1.0f), 100, 10);
+    EXPECT_EQ (ringBuffer->readAroundSample (20, 0, 20, outputBuffer),
+               RingBufferReadResult::DataInRingBufferTooOld);
+}
+
+TEST_F (MultiChannelRingBufferTest, Int16StorageRestoresScaledSamples)
+{
+    MultiChannelRingBuffer compactBuffer (2, 100, RingBufferSampleFormat::Int16);
+    compactBuffer.setChannelScaling (0, 0.195f);
+    compactBuffer.setChannelScaling (1, 0.5f, 10.0f);
+
+    // Samples on the ADC grid of each channel, wrapping around the end of the ring
+    AudioBuffer<float> block (2, 70);
+    for (int b = 0; b < 2; ++b)
+    {
+        for (int i = 0; i < 70; ++i)
+        {
+            const int step = b * 70 + i - 60;
+            block.setSample (0, i, step * 0.195f);
+            block.setSample (1, i, step * 0.5f + 10.0f);
+        }
+        compactBuffer.addData (block, b * 70, 70);
+    }
+
+    // Samples 60-139, i.e. steps 0-79
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (compactBuffer.readAroundSample (100, 40, 40, outputBuffer),
+               RingBufferReadResult::Success);
+    ASSERT_EQ (outputBuffer.getNumChannels(), 2);
+    for (int i = 0; i < 80; ++i)
+    {
+        EXPECT_NEAR (outputBuffer.getSample (0, i), i * 0.195f, 1e-4f) << "Sample " << i;
+        EXPECT_NEAR (outputBuffer.getSample (1, i), i * 0.5f + 10.0f, 1e-4f) << "Sample " << i;
+    }
+
+    // Shrinking keeps the compact samples
+    compactBuffer.setCapacity (50);
+    compactBuffer.addData (block, 140, 10);
+    ASSERT_EQ (compactBuffer.readAroundSample (120, 10, 10, outputBuffer),
+               RingBufferReadResult::Success);
+    EXPECT_NEAR (outputBuffer.getSample (0, 0), 50 * 0.195f, 1e-4f);
+}
+
+TEST_F (MultiChannelRingBufferTest, Int16StorageSaturates)
+{
+    MultiChannelRingBuffer compactBuffer (1, 16, RingBufferSampleFormat::Int16);
+    compactBuffer.setChannelScaling (0, 1.0f);
+
+    AudioBuffer<float> block (1, 16);
+    for (int i = 0; i < 16; ++i)
+        block.setSample (0, i, (i % 2 == 0 ? 1.0f : -1.0f) * 1.0e6f);
+    compactBuffer.addData (block, 0, 16);
+
+    AudioBuffer<float> outputBuffer;
+    ASSERT_EQ (compactBuffer.readAroundSample (0, 0, 16, outputBuffer),
+               RingBufferReadResult::Success);
+    for (int i = 0; i < 16; ++i)
+        EXPECT_FLOAT_EQ (outputBuffer.getSample (0, i), i % 2 == 0 ? 32767.0f : -32768.0f);
+    EXPECT_EQ (compactBuffer.getNumClippedSamples(), 16u);
+
+    // Samples in range are not counted, also in the tail after the last full vector
+    for (int i = 0; i < 11; ++i)
+        block.setSample (0, i, i == 2 || i == 9 || i == 10 ? 40000.0f : 100.0f);
+    compactBuffer.addData (block, 16, 11);
+    EXPECT_EQ (compactBuffer.getNumClippedSamples(), 19u);
+}
+
+TEST_F (MultiChannelRingBufferTest, CapacityChangesDuringConcurrentWrites)
+{
+    constexpr int blockSize = 16;
+    constexpr int numberOfBlocks = 2000;
+    std::atomic<bool> writerDone { false };
+
+    std::thread writer (
+        [&]
+        {
+            AudioBuffer<float> block (numChannels, blockSize);
+            for (int b = 0; b < numberOfBlocks; ++b)
+            {
+                const SampleNumber firstSample = static_cast<SampleNumber> (b) * blockSize;
+                for (int ch = 0; ch < numChannels; ++ch)
+                    for (int i = 0; i < blockSize; ++i)
+                        block.setSample (ch, i, static_cast<float> (firstSample + i + ch * 1000));
+                ringBuffer->addData (block, firstSample, blockSize);
+                std::this_thread::yield();
+            }
+            writerDone = true;
+        });
+
+    AudioBuffer<float> outputBuffer;
+    for (int attempt = 0; ! writerDone; ++attempt)
+    {
+        if (attempt % 8 == 0)
+            ringBuffer->setCapacity (attempt % 16 == 0 ? 300 : 60);
+
+        const SampleNumber center = ringBuffer->getCurrentSampleNumber() - 30;
+        if (center < 10
+            || ringBuffer->readAroundSample (center, 10, 10, outputBuffer)
+                   != RingBufferReadResult::Success)
+            continue;
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            for (int i = 0; i < 20; ++i)
+                ASSERT_FLOAT_EQ (outputBuffer.getSample (ch, i),
+                                 static_cast<float> (center - 10 + i + ch * 1000))
+                    << "Channel " << ch << ", Sample " << i;
+    }
+    writer.join();
+}
+
+TEST_F (MultiChannelRingBufferTest, ResizingInALoopWhileWritingAndReading)
+{
+    // Resizes back to back, so the producer is often still switching to one storage when
+    // the next is handed out. No storage may be freed while it is written or read.
+    constexpr int blockSize = 16;
+    std::atomic<bool> done { false };
+
+    std::thread writer (
+        [&]
+        {
+            AudioBuffer<float> block (numChannels, blockSize);
+            for (SampleNumber firstSample = 0; ! done; firstSample += blockSize)
+            {
+                for (int ch = 0; ch < numChannels; ++ch)
+                    for (int i = 0; i < blockSize; ++i)
+                        block.setSample (ch, i, static_cast<float> (firstSample + i + ch * 1000));
+                ringBuffer->addData (block, firstSample, blockSize);
+            }
+        });
+
+    std::thread reader (
+        [&]
+        {
+            while (! done)
+            {
+                const SampleNumber center = ringBuffer->getCurrentSampleNumber() - 30;
+                RingBufferView view;
+                if (center < 10
+                    || ringBuffer->getViewAroundSample (center, 10, 10, view)
+                           != RingBufferReadResult::Success)
+                    continue;
+
+                float samples[20];
+                view.copyTo (numChannels - 1, samples);
+                if (! ringBuffer->isViewIntact (view))
+                    continue;
+                for (int i = 0; i < 20; ++i)
+                    ASSERT_FLOAT_EQ (samples[i],
+                                     static_cast<float> (center - 10 + i
+                                                         + (numChannels - 1) * 1000));
+            }
+        });
+
+    for (int resize = 0; resize < 20000; ++resize)
+        ringBuffer->setCapacity (resize % 3 == 0 ? 300 : (resize % 3 == 1 ? 50 : 120));
+
+    done = true;
+    writer.join();
+    reader.join();
+}
+
+TEST_F (MultiChannelRingBufferTest, ViewKeepsItsStorageAcrossResizes)
+{
+    ringBuffer->addData (createTestBuffer (numChannels, 50, 1.0f), 0, 50);
+
+    RingBufferView view;
+    ASSERT_EQ (ringBuffer->getViewAroundSample (20, 10, 10, view), RingBufferReadResult::Success);
+
+    // The producer switches storages twice; the first one stays readable through the view
+    SampleNumber nextSample = 50;
+    for (int size : { 200, 400 })
+    {
+        ringBuffer->setCapacity (size);
+        ringBuffer->addData (
+            createTestBuffer (numChannels, 10, 1.0f + nextSample), nextSample, 10);
+        nextSample += 10;
+    }
+    ASSERT_EQ (ringBuffer->getBufferSize(), 400);
+    ringBuffer->setCapacity (40);
+
+    float samples[20];
+    view.copyTo (1, samples);
+    for (int i = 0; i < 20; ++i)
+        EXPECT_FLOAT_EQ (samples[i], 1.0f + 1000.0f + 10.0f + i);
+}
+
+TEST_F (MultiChannelRingBufferTest, SignalsWakeupOnceRequestedSamplesArrive)
+{
+    WaitableEvent event;
+    ringBuffer->setWakeupEvent (&event);
+
+    ringBuffer->requestWakeup (150);
+    ringBuffer->addData (createTestBuffer (numChannels, 100, 1.0f), 0, 100);
+    EXPECT_FALSE (event.wait (0));
+    ringBuffer->addData (createTestBuffer (numChannels, 50, 101.0f), 100, 50);
+    EXPECT_TRUE (event.wait (0));
+
+    // A wakeup fires only once
+    ringBuffer->addData (createTestBuffer (numChannels, 50, 151.0f), 150, 50);
+    EXPECT_FALSE (event.wait (0));
+
+    // Samples that will not arrive anymore after a jump back in time also end the wait
+    ringBuffer->requestWakeup (1000);
+    ringBuffer->addData (createTestBuffer (numChannels, 50, 1.0f), 0, 50);
+    EXPECT_TRUE (event.wait (0));
+
+    ringBuffer->requestWakeup (1000);
+    ringBuffer->reset();
+    EXPECT_TRUE (event.wait (0));
+}
+
+TEST_F (MultiChannelRingBufferTest, PooledMemoryIsReusedWithoutClearing)
+{
+    RingBufferMemoryPool pool (false);
+    AudioBuffer<float> outputBuffer;
+
+    {
+        MultiChannelRingBuffer first (
+            numChannels, bufferSize, RingBufferSampleFormat::Float32, &pool);
+        first.addData (createTestBuffer (numChannels, 100, 1.0f), 0, 100);
+    }
+    ASSERT_EQ (pool.getNumFreeBlocks(), 1u);
+
+    // The second ring takes over the memory of the first one, including its old samples
+    MultiChannelRingBuffer second (
+        numChannels, bufferSize, RingBufferSampleFormat::Float32, &pool);
+    EXPECT_EQ (pool.getNumFreeBlocks(), 0u);
+    EXPECT_EQ (second.readAroundSample (50, 10, 10, outputBuffer),
+               RingBufferReadResult::NotEnoughNewData);
+
+    second.addData (createTestBuffer (numChannels, 30, 501.0f), 500, 30);
+    ASSERT_EQ (second.readAroundSample (510, 10, 20, outputBuffer),
+               RingBufferReadResult::Success);
+    verifyBufferData (outputBuffer, numChannels, 30, 501.0f);
+
+    // Channels without input read as zero, not as the previous owner's samples
+    second.addData (createTestBuffer (1, 10, 531.0f), 530, 10);
+    ASSERT_EQ (second.readAroundSample (530, 0, 10, outputBuffer),
+               RingBufferReadResult::Success);
+    for (int ch = 1; ch < numChannels; ++ch)
+        for (int i = 0; i < 10; ++i)
+            EXPECT_FLOAT_EQ (outputBuffer.getSample (ch, i), 0.0f);
+
+    // Resets discard the samples without touching the memory
+    second.reset();
+    EXPECT_EQ (second.readAroundSample (510, 10, 20, outputBuffer),
+               RingBufferReadResult::NotEnoughNewData);
+}
 //
 //TEST_F (MultiChannelRingBufferTest, BufferWrapAround)
 //{
@@ -69,6 +69,24 @@ TEST (SingleTrialBufferTests, CircularOverwrite)
     EXPECT_FLOAT_EQ (buf.getSample (0, 2, 0), t3.getSample (0, 0));
 }
 
+TEST (SingleTrialBufferTests, SetSizeDropsStoredTrials)
+{
+    SingleTrialBuffer buf { { .numChannels = 1, .numSamples = 3, .maxTrials = 3 } };
+
+    auto t0 = makeTrial (1, 3, 1.0f);
+    buf.addTrial (t0.getArrayOfReadPointers(), 1, 3);
+    buf.addTrial (t0.getArrayOfReadPointers(), 1, 3);
+
+    // The zeroed slots must not count as stored trials
+    buf.setSize ({ .numChannels = 1, .numSamples = 5, .maxTrials = 3 });
+    EXPECT_EQ (buf.getNumStoredTrials(), 0);
+
+    auto t1 = makeTrial (1, 5, 2.0f);
+    buf.addTrial (t1.getArrayOfReadPointers(), 1, 5);
+    EXPECT_EQ (buf.getNumStoredTrials(), 1);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 0, 0), t1.getSample (0, 0));
+}
+
 TEST (SingleTrialBufferTests, ShrinkMaxTrialsKeepsMostRecent)
 {
     SingleTrialBuffer buf;
@@ -325,3 +343,115 @@ TEST (SingleTrialBufferTests, SetMaxTrialsIncrease)
     EXPECT_EQ (buffer.getMaxTrials(), 10);
     EXPECT_EQ (buffer.getNumStoredTrials(), 3); // Stored count unchanged
 }
+
+TEST (SingleTrialBufferTests, InPlaceWriteAndCommit)
+{
+    SingleTrialBuffer buf { { .numChannels = 2, .numSamples = 4, .maxTrials = 3 } };
+
+    for (int ch = 0; ch < 2; ++ch)
+    {
+        float* dest = buf.getNextTrialWritePointer (ch);
+        std::iota (dest, dest + 4, ch * 10.0f);
+    }
+
+    // nothing is visible before the commit
+    EXPECT_EQ (buf.getNumStoredTrials(), 0);
+    buf.commitTrial();
+    ASSERT_EQ (buf.getNumStoredTrials(), 1);
+
+    EXPECT_FLOAT_EQ (buf.getSample (0, 0, 3), 3.0f);
+    EXPECT_FLOAT_EQ (buf.getSample (1, 0, 0), 10.0f);
+}
+
+TEST (SingleTrialBufferTests, DiscardDropsOverwrittenOldestTrial)
+{
+    SingleTrialBuffer buf { { .numChannels = 1, .numSamples = 2, .maxTrials = 2 } };
+
+    buf.getNextTrialWritePointer (0)[0] = 1.0f;
+    buf.discardTrial();
+    EXPECT_EQ (buf.getNumStoredTrials(), 0);
+
+    for (float value : { 1.0f, 2.0f })
+    {
+        std::fill_n (buf.getNextTrialWritePointer (0), 2, value);
+        buf.commitTrial();
+    }
+
+    // buffer is full, so the next slot holds the oldest trial (1.0)
+    std::fill_n (buf.getNextTrialWritePointer (0), 2, 3.0f);
+    buf.discardTrial();
+
+    ASSERT_EQ (buf.getNumStoredTrials(), 1);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 0, 0), 2.0f);
+}
+
+TEST (SingleTrialBufferTests, WritesSeveralTrialsBeforeCommitting)
+{
+    SingleTrialBuffer buf { { .numChannels = 1, .numSamples = 2, .maxTrials = 3 } };
+    std::fill_n (buf.getNextTrialWritePointer (0), 2, 1.0f);
+    buf.commitTrial();
+
+    for (int offset = 0; offset < 2; ++offset)
+        std::fill_n (buf.getNextTrialWritePointer (0, offset), 2, 2.0f + offset);
+    buf.commitTrials (2);
+
+    ASSERT_EQ (buf.getNumStoredTrials(), 3);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 0, 0), 1.0f);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 1, 0), 2.0f);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 2, 1), 3.0f);
+
+    // Two more trials overwrite the slots of the two oldest ones, so discarding them
+    // leaves only the newest stored trial
+    for (int offset = 0; offset < 2; ++offset)
+        std::fill_n (buf.getNextTrialWritePointer (0, offset), 2, 4.0f);
+    buf.discardTrials (2);
+
+    ASSERT_EQ (buf.getNumStoredTrials(), 1);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 0, 0), 3.0f);
+}
+
+TEST (SingleTrialBufferTests, ReservedSlotsAreNotReadWhileWritten)
+{
+    SingleTrialBuffer buf { { .numChannels = 1, .numSamples = 2, .maxTrials = 3 } };
+    for (float value : { 1.0f, 2.0f, 3.0f })
+    {
+        std::fill_n (buf.getNextTrialWritePointer (0), 2, value);
+        buf.commitTrial();
+    }
+
+    // The next two trials go to the slots of the two oldest ones
+    buf.reserveNextTrials (2);
+    buf.reserveNextTrials (2);
+    ASSERT_EQ (buf.getNumStoredTrials(), 1);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 0, 0), 3.0f);
+
+    std::fill_n (buf.getNextTrialWritePointer (0, 1), 2, 5.0f);
+    std::fill_n (buf.getNextTrialWritePointer (0, 0), 2, 4.0f);
+    buf.commitTrial();
+    ASSERT_EQ (buf.getNumStoredTrials(), 2);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 1, 0), 4.0f);
+
+    buf.commitTrial();
+    ASSERT_EQ (buf.getNumStoredTrials(), 3);
+    EXPECT_FLOAT_EQ (buf.getSample (0, 2, 0), 5.0f);
+}
+
+TEST (SingleTrialBufferTests, LayoutGenerationChangesWhenSlotsMove)
+{
+    SingleTrialBuffer buf { { .numChannels = 1, .numSamples = 2, .maxTrials = 3 } };
+    auto generation = buf.getLayoutGeneration();
+
+    buf.commitTrial();
+    EXPECT_EQ (buf.getLayoutGeneration(), generation);
+
+    buf.setMaxTrials (5);
+    EXPECT_NE (buf.getLayoutGeneration(), generation);
+    generation = buf.getLayoutGeneration();
+
+    buf.clear();
+    EXPECT_NE (buf.getLayoutGeneration(), generation);
+    generation = buf.getLayoutGeneration();
+
+    buf.setSize ({ .numChannels = 1, .numSamples = 4, .maxTrials = 5 });
+    EXPECT_NE (buf.getLayoutGeneration(), generation);
+}
@@ -0,0 +1,83 @@
+#include "../Source/SnapshotPublisher.h"
+#include <JuceHeader.h>
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace TriggeredAverage;
+
+TEST (SnapshotPublisherTests, ReadersAlwaysSeeCompleteSnapshots)
+{
+    SnapshotPublisher<std::vector<int>> publisher;
+    EXPECT_FALSE (publisher.read());
+
+    std::atomic<bool> keepReading { true };
+    std::atomic<int> numInconsistentReads { 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i)
+    {
+        readers.emplace_back (
+            [&]
+            {
+                while (keepReading)
+                {
+                    const auto snapshot = publisher.read();
+                    if (! snapshot)
+                        continue;
+
+                    // Every element of a snapshot holds the same value
+                    for (int value : *snapshot)
+                    {
+                        if (value != snapshot->front())
+                            ++numInconsistentReads;
+                    }
+                }
+            });
+    }
+
+    for (int version = 0; version < 20000; ++version)
+    {
+        auto& values = publisher.beginUpdate();
+        values.assign (64, version);
+        publisher.publish();
+    }
+
+    keepReading = false;
+    for (auto& reader : readers)
+        reader.join();
+
+    EXPECT_EQ (numInconsistentReads.load(), 0);
+    EXPECT_EQ (publisher.read()->front(), 19999);
+
+    // The pool only grows to the snapshots held at once: the current one, and at most two
+    // per reader (one read, one it is about to find replaced)
+    EXPECT_LE (publisher.getPoolSize(), 7);
+}
+
+TEST (SnapshotPublisherTests, RecyclesSnapshotsOnceReleased)
+{
+    SnapshotPublisher<int> publisher;
+    publisher.beginUpdate() = 1;
+    publisher.publish();
+
+    auto first = publisher.read();
+    publisher.beginUpdate() = 2;
+    publisher.publish();
+    publisher.beginUpdate() = 3;
+    publisher.publish();
+
+    // The first snapshot is still held, so it was not reused
+    EXPECT_EQ (*first, 1);
+    EXPECT_EQ (*publisher.read(), 3);
+    EXPECT_EQ (publisher.getPoolSize(), 3);
+
+    first = {};
+    for (int value = 4; value < 100; ++value)
+    {
+        publisher.beginUpdate() = value;
+        publisher.publish();
+    }
+    EXPECT_EQ (*publisher.read(), 99);
+    EXPECT_EQ (publisher.getPoolSize(), 3);
+}
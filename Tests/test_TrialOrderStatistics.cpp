@@ -0,0 +1,198 @@
+#include "../Source/SingleTrialBuffer.h"
+#include "../Source/TrialOrderStatistics.h"
+#include <algorithm>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace TriggeredAverage;
+
+namespace
+{
+/** Median and trimmed mean of the stored trials of a channel, sorting them at each sample */
+void computeBySorting (const SingleTrialBuffer& trials,
+                       int channel,
+                       float trimFraction,
+                       std::vector<float>& median,
+                       std::vector<float>& trimmedMean)
+{
+    const int numTrials = trials.getNumStoredTrials();
+    const int numTrimmed = std::min (static_cast<int> (numTrials * trimFraction),
+                                     (numTrials - 1) / 2);
+    std::vector<float> values (static_cast<size_t> (numTrials));
+    median.resize (static_cast<size_t> (trials.getNumSamples()));
+    trimmedMean.resize (static_cast<size_t> (trials.getNumSamples()));
+
+    for (int s = 0; s < trials.getNumSamples(); ++s)
+    {
+        for (int t = 0; t < numTrials; ++t)
+            values[t] = trials.getSample (channel, t, s);
+        std::sort (values.begin(), values.end());
+
+        median[s] = (values[(numTrials - 1) / 2] + values[numTrials / 2]) / 2.0f;
+        float sum = 0.0f;
+        for (int t = numTrimmed; t < numTrials - numTrimmed; ++t)
+            sum += values[t];
+        trimmedMean[s] = sum / (numTrials - 2 * numTrimmed);
+    }
+}
+} // namespace
+
+TEST (TrialOrderStatisticsTests, FollowsTrialsAsTheyAreStoredAndOverwritten)
+{
+    const int numChannels = 3;
+    const int numSamples = 37;
+    const int maxTrials = 7;
+    SingleTrialBuffer trials ({ .numChannels = numChannels,
+                              .numSamples = numSamples,
+                              .maxTrials = maxTrials });
+    TrialOrderStatistics median;
+    TrialOrderStatistics trimmedMean;
+    median.setStatistic (AverageStatistic::Median, 0.0f);
+    trimmedMean.setStatistic (AverageStatistic::TrimmedMean, 0.2f);
+    median.rebuildFromTrials (trials);
+    trimmedMean.rebuildFromTrials (trials);
+
+    // Few distinct values, so samples hold the same value in several trials
+    std::mt19937 random (7);
+    std::uniform_int_distribution<int> value (-4, 4);
+    std::vector<float> expectedMedian;
+    std::vector<float> expectedTrimmedMean;
+    std::vector<float> actual (numSamples);
+
+    for (int trial = 0; trial < 30; ++trial)
+    {
+        // Like the collector: the oldest trial leaves before the new one takes its slot
+        if (trials.getNumStoredTrials() == maxTrials)
+        {
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                median.removeChannel (ch, trials.getTrialDataPointer (ch, 0));
+                trimmedMean.removeChannel (ch, trials.getTrialDataPointer (ch, 0));
+            }
+        }
+        trials.reserveNextTrials (1);
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            float* slot = trials.getNextTrialWritePointer (ch);
+            for (int s = 0; s < numSamples; ++s)
+                slot[s] = static_cast<float> (value (random)) * 0.5f + ch;
+        }
+        trials.commitTrial();
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            const float* stored = trials.getTrialDataPointer (ch, trials.getNumStoredTrials() - 1);
+            median.insertChannel (ch, stored);
+            trimmedMean.insertChannel (ch, stored);
+        }
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            ASSERT_EQ (median.getNumTrials (ch), trials.getNumStoredTrials());
+            computeBySorting (trials, ch, 0.2f, expectedMedian, expectedTrimmedMean);
+
+            median.computeChannel (ch, actual.data());
+            for (int s = 0; s < numSamples; ++s)
+                ASSERT_FLOAT_EQ (actual[s], expectedMedian[s]) << "trial " << trial;
+
+            trimmedMean.computeChannel (ch, actual.data());
+            for (int s = 0; s < numSamples; ++s)
+                ASSERT_NEAR (actual[s], expectedTrimmedMean[s], 1e-5f) << "trial " << trial;
+        }
+    }
+}
+
+TEST (TrialOrderStatisticsTests, MedianIgnoresArtifactTrial)
+{
+    SingleTrialBuffer trials ({ .numChannels = 1, .numSamples = 4, .maxTrials = 10 });
+    for (float offset : { 1.0f, 2.0f, 1000.0f, 3.0f, 2.5f })
+    {
+        const float trial[4] = { offset, offset, offset, offset };
+        const float* channels[1] = { trial };
+        trials.addTrial (channels, 1, 4);
+    }
+
+    TrialOrderStatistics statistics;
+    statistics.setStatistic (AverageStatistic::Median, 0.0f);
+    statistics.rebuildFromTrials (trials);
+    EXPECT_EQ (statistics.getNumTrials (0), 5);
+
+    float median[4] {};
+    statistics.computeChannel (0, median);
+    for (float value : median)
+        EXPECT_FLOAT_EQ (value, 2.5f);
+
+    // The mean keeps no sorted values
+    statistics.setStatistic (AverageStatistic::Mean, 0.0f);
+    EXPECT_FALSE (statistics.isActive());
+    EXPECT_EQ (statistics.getNumTrials (0), 0);
+}
+
+TEST (TrialOrderStatisticsTests, DISABLED_BenchmarkAgainstSortingOnEveryRefresh)
+{
+    // 100 ms trials at 30 kHz, 384 channels, the largest trial buffer
+    const int numChannels = 384;
+    const int numSamples = 3000;
+    const int maxTrials = 50;
+    SingleTrialBuffer trials ({ .numChannels = numChannels,
+                              .numSamples = numSamples,
+                              .maxTrials = maxTrials });
+    TrialOrderStatistics statistics;
+    statistics.setStatistic (AverageStatistic::Median, 0.0f);
+    statistics.rebuildFromTrials (trials);
+
+    std::mt19937 random (1);
+    std::normal_distribution<float> noise;
+    std::vector<float> trial (static_cast<size_t> (numSamples));
+    for (int t = 0; t < maxTrials; ++t)
+    {
+        trials.reserveNextTrials (1);
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            float* slot = trials.getNextTrialWritePointer (ch);
+            for (int s = 0; s < numSamples; ++s)
+                slot[s] = noise (random);
+        }
+        trials.commitTrial();
+    }
+    statistics.rebuildFromTrials (trials);
+
+    using Clock = std::chrono::steady_clock;
+    const auto msSince = [] (Clock::time_point start)
+    { return std::chrono::duration<double, std::milli> (Clock::now() - start).count(); };
+
+    // One new trial replacing the oldest one
+    auto start = Clock::now();
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        statistics.removeChannel (ch, trials.getTrialDataPointer (ch, 0));
+        statistics.insertChannel (ch, trials.getTrialDataPointer (ch, 0));
+    }
+    const double updateMs = msSince (start);
+
+    // Reading the medians of all channels, as one refresh of the grid
+    std::vector<float> median (static_cast<size_t> (numSamples));
+    start = Clock::now();
+    for (int ch = 0; ch < numChannels; ++ch)
+        statistics.computeChannel (ch, median.data());
+    const double readMs = msSince (start);
+
+    // The same refresh with nth_element over the trials of every sample
+    std::vector<float> values (static_cast<size_t> (maxTrials));
+    start = Clock::now();
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        for (int s = 0; s < numSamples; ++s)
+        {
+            for (int t = 0; t < maxTrials; ++t)
+                values[t] = trials.getSample (ch, t, s);
+            std::nth_element (values.begin(), values.begin() + maxTrials / 2, values.end());
+            median[s] = values[maxTrials / 2];
+        }
+    }
+    const double sortingMs = msSince (start);
+
+    std::cout << "Per trial: " << updateMs << " ms, per refresh: " << readMs
+              << " ms, nth_element per refresh: " << sortingMs << " ms" << std::endl;
+}
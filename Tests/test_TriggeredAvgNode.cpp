@@ -0,0 +1,82 @@
+#include "../Source/DataCollector.h"
+#include "../Source/TriggerSource.h"
+#include "../Source/TriggeredAvgNode.h"
+#include <JuceHeader.h>
+#include <ModelApplication.h>
+#include <ModelProcessors.h>
+#include <TestFixtures.h>
+#include <gtest/gtest.h>
+
+using namespace TriggeredAverage;
+
+class TriggeredAvgNodeTests : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        tester = std::make_unique<ProcessorTester> (
+            TestSourceNodeBuilder (FakeSourceNodeParams { numChannels, sampleRate, bitVolts }));
+        node = tester->createProcessor<TriggeredAvgNode> (Plugin::Processor::SINK);
+        source = node->getTriggerSources().getLastAddedTriggerSource();
+        ASSERT_NE (source, nullptr);
+    }
+
+    /** Stores numTrials trials with the value of their index in the buffers of the source */
+    void storeTrials (int numTrials)
+    {
+        auto* trialBuffer = node->getDataStore()->getRefToTrialBufferForTriggerSource (source);
+        AudioBuffer<float> trial (numChannels, numSamples);
+        for (int t = 0; t < numTrials; ++t)
+        {
+            for (int ch = 0; ch < numChannels; ++ch)
+                FloatVectorOperations::fill (trial.getWritePointer (ch), float (t), numSamples);
+            trialBuffer->addTrial (trial);
+        }
+    }
+
+    static constexpr int numChannels = 4;
+    static constexpr int numSamples = 100;
+    static constexpr float sampleRate = 30000.0f;
+    static constexpr float bitVolts = 0.195f;
+
+    std::unique_ptr<ProcessorTester> tester;
+    TriggeredAvgNode* node = nullptr;
+    TriggerSource* source = nullptr;
+};
+
+TEST_F (TriggeredAvgNodeTests, TrialBuffersKeepMaxTrialsFromTheStart)
+{
+    auto* dataStore = node->getDataStore();
+    dataStore->ResetAndResizeBuffersForTriggerSource (source, numChannels, numSamples);
+
+    auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source);
+    ASSERT_NE (trialBuffer, nullptr);
+    EXPECT_EQ (trialBuffer->getMaxTrials(), node->getMaxTrials());
+}
+
+TEST_F (TriggeredAvgNodeTests, MaxTrialsSetsTheLastTrialsWindow)
+{
+    auto* dataStore = node->getDataStore();
+    dataStore->ResetAndResizeBuffersForTriggerSource (source, numChannels, numSamples);
+    node->getParameter (ParameterNames::average_mode)
+        ->setNextValue ((int) AverageMode::LastTrials, false);
+    storeTrials (8);
+
+    node->getParameter (ParameterNames::max_trials)->setNextValue (5, false);
+
+    // The buffers set up before keep the 5 most recent trials, and the average covers them
+    auto* trialBuffer = dataStore->getRefToTrialBufferForTriggerSource (source);
+    auto* averageBuffer = dataStore->getRefToAverageBufferForTriggerSource (source);
+    EXPECT_EQ (trialBuffer->getMaxTrials(), 5);
+    EXPECT_EQ (trialBuffer->getNumStoredTrials(), 5);
+    EXPECT_EQ (averageBuffer->getNumTrials(), 5);
+
+    std::vector<float> average (numSamples);
+    std::vector<float> standardDeviation (numSamples);
+    averageBuffer->computeChannel (0, average.data(), standardDeviation.data());
+    EXPECT_FLOAT_EQ (average[0], (3.0f + 4.0f + 5.0f + 6.0f + 7.0f) / 5.0f);
+
+    // Buffers set up afterwards get the new window too
+    dataStore->ResetAndResizeBuffersForTriggerSource (source, numChannels, numSamples);
+    EXPECT_EQ (dataStore->getRefToTrialBufferForTriggerSource (source)->getMaxTrials(), 5);
+}